@@ -0,0 +1,183 @@
+// Measure many processes reading the same bundle at once: each opens it and
+// reads the bindings of the dependency closure, as nutmeg-run does at startup.
+// Compares a plain sqlite3_open (locking, SQLite page cache) with
+// BundleReader's read-only, immutable, memory-mapped open, with the bundle's
+// pages evicted from the OS page cache first (cold) or left in it (warm).
+//
+// Usage: bench_bundle_open [PROCESSES] [BINDINGS]
+
+#include "bench_support.hpp"
+#include "../src/bundle_reader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <sqlite3.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nutmeg;
+
+// A chain of bindings f0 -> f1 -> ... each with a JSON value of realistic size.
+static std::string make_bundle(int num_bindings) {
+    bench::BundleWriter bundle("bench");
+    bundle.add_entry_point("f0");
+    std::string body = R"({"type": "push.int", "index": 1})";
+    for (int i = 0; i < 40; i++) {
+        body += R"(, {"type": "push.int", "index": 1})";
+    }
+    for (int i = 0; i < num_bindings; i++) {
+        if (i + 1 < num_bindings) {
+            bundle.add_dependency(fmt::format("f{}", i), fmt::format("f{}", i + 1));
+        }
+        bundle.add_binding(fmt::format("f{}", i), fmt::format(R"({{"nlocals": 0, "nparams": 0, "instructions": [{}]}})", body));
+    }
+    return bundle.close();
+}
+
+// The process's dirty private memory in KB: its heap, including SQLite's page
+// cache, but not the clean file pages of a mapping, which are shared.
+static long private_dirty_kb() {
+    FILE* file = std::fopen("/proc/self/smaps_rollup", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    char line[256];
+    long kb = 0;
+    while (std::fgets(line, sizeof(line), file)) {
+        std::sscanf(line, "Private_Dirty: %ld kB", &kb);
+    }
+    std::fclose(file);
+    return kb;
+}
+
+// The closure query as BundleReader runs it, copying out every row.
+static size_t read_closure(sqlite3* db, long& private_kb) {
+    sqlite3_stmt* stmt = nullptr;
+    sqlite3_prepare_v2(db,
+        "WITH RECURSIVE closure(id_name) AS (SELECT ?1 UNION "
+        "SELECT d.needs FROM depends_ons d JOIN closure c ON d.id_name = c.id_name) "
+        "SELECT c.id_name, b.lazy, b.value, b.file_name FROM closure c LEFT JOIN bindings b "
+        "ON b.id_name = c.id_name ORDER BY c.id_name", -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, "f0", -1, SQLITE_STATIC);
+    std::vector<Binding> bindings;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Binding binding;
+        binding.idname = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        binding.lazy = sqlite3_column_int(stmt, 1) != 0;
+        binding.value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        binding.filename = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        bindings.push_back(std::move(binding));
+    }
+    private_kb = private_dirty_kb();
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return bindings.size();
+}
+
+// The previous open: read-write, with locking, through SQLite's page cache.
+static size_t read_plain(const std::string& path, long& private_kb) {
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    return read_closure(db, private_kb);
+}
+
+// The open BundleReader now uses, with the same query.
+static size_t read_immutable(const std::string& path, long& private_kb) {
+    sqlite3* db = nullptr;
+    sqlite3_open_v2(BundleReader::make_uri(path).c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, nullptr);
+    sqlite3_exec(db, "PRAGMA mmap_size = 268435456", nullptr, nullptr, nullptr);
+    return read_closure(db, private_kb);
+}
+
+// BundleReader itself, end to end.
+static size_t read_bundle_reader(const std::string& path, long& private_kb) {
+    BundleReader reader(path);
+    std::vector<Binding> bindings = reader.get_dependency_bindings("f0");
+    private_kb = private_dirty_kb();
+    return bindings.size();
+}
+
+// Ask the kernel to drop the file's (clean) pages from the page cache.
+static void evict(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+struct Round {
+    double ms;
+    long private_kb;  // The most dirty private memory of any reader.
+};
+
+// Fork the readers, start them together and wait for all of them.
+static Round run_round(const std::string& path, int processes, bool cold, size_t (*read)(const std::string&, long&)) {
+    if (cold) {
+        evict(path);
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    for (int p = 0; p < processes; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            long kb = 0;
+            size_t rows = read(path, kb);
+            ssize_t written = write(fds[1], &kb, sizeof(kb));
+            _exit(rows > 0 && written == sizeof(kb) ? 0 : 1);
+        }
+        children.push_back(pid);
+    }
+    bool ok = true;
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    auto stop = std::chrono::steady_clock::now();
+    close(fds[1]);
+    Round round{std::chrono::duration<double, std::milli>(stop - start).count(), 0};
+    long kb;
+    while (::read(fds[0], &kb, sizeof(kb)) == sizeof(kb)) {
+        round.private_kb = std::max(round.private_kb, kb);
+    }
+    close(fds[0]);
+    if (!ok) {
+        throw std::runtime_error("A reader process failed");
+    }
+    return round;
+}
+
+int main(int argc, char* argv[]) {
+    int processes = argc > 1 ? std::atoi(argv[1]) : 16;
+    int num_bindings = argc > 2 ? std::atoi(argv[2]) : 5000;
+    std::string path = make_bundle(num_bindings);
+    fmt::print("Processes: {}, bindings: {}, bundle: {:.1f} KB\n", processes, num_bindings,
+               static_cast<double>(std::filesystem::file_size(path)) / 1024.0);
+
+    fmt::print("{:<18} {:>10} {:>10} {:>16}\n", "open", "cold ms", "warm ms", "private KB/proc");
+    for (const auto& [name, read] : {std::pair{"sqlite3_open", &read_plain}, std::pair{"immutable + mmap", &read_immutable},
+                                     std::pair{"BundleReader", &read_bundle_reader}}) {
+        double cold = 1e300;
+        double warm = 1e300;
+        long private_kb = 0;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            cold = std::min(cold, run_round(path, processes, true, read).ms);
+            Round round = run_round(path, processes, false, read);
+            warm = std::min(warm, round.ms);
+            private_kb = round.private_kb;
+        }
+        fmt::print("{:<18} {:>10.2f} {:>10.2f} {:>16}\n", name, cold, warm, private_kb);
+    }
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,149 @@
+// Measure the bundle-reading part of startup on a synthetic bundle of several
+// thousand bindings: the previous strategy (one prepared statement per visited
+// node and per fetched binding) against BundleReader's single recursive query
+// with a batched fetch of the bindings. Then load the bundle into a Machine.
+//
+// Usage: bench_bundle_startup [BINDINGS]
+
+#include "bench_support.hpp"
+#include "../src/bundle_reader.hpp"
+#include "../src/machine.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <fmt/core.h>
+#include <sqlite3.h>
+
+using namespace nutmeg;
+
+// Binding f{i} calls f{2i+1} and f{2i+2} (where they exist), and every tenth
+// binding also calls back to f{i/2}, so the graph has cycles.
+static std::string make_bundle(int num_bindings) {
+    bench::BundleWriter bundle("bench");
+    bundle.exec("CREATE INDEX idx_depends_ons_id_name ON depends_ons(id_name);");
+    bundle.add_entry_point("f0");
+    for (int i = 0; i < num_bindings; i++) {
+        std::vector<int> callees;
+        for (int callee : {2 * i + 1, 2 * i + 2}) {
+            if (callee < num_bindings) {
+                callees.push_back(callee);
+            }
+        }
+        if (i > 0 && i % 10 == 0) {
+            callees.push_back(i / 2);
+        }
+        std::string instructions = R"({"type": "stack.length", "index": 0})";
+        for (int callee : callees) {
+            bundle.add_dependency(fmt::format("f{}", i), fmt::format("f{}", callee));
+            instructions += fmt::format(R"(, {{"type": "call.global.counted", "index": 0, "name": "f{}"}})", callee);
+        }
+        instructions += R"(, {"type": "return"})";
+        bundle.add_binding(fmt::format("f{}", i),
+                           fmt::format(R"({{"nlocals": 1, "nparams": 0, "instructions": [{}]}})", instructions));
+    }
+    return bundle.close();
+}
+
+// The previous strategy: a depth-first walk that prepares a statement for every
+// node, then a prepared statement for every binding fetched.
+static std::vector<Binding> read_per_node(const std::string& path, int& prepares) {
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> order;
+    std::function<void(const std::string&)> visit = [&](const std::string& idname) {
+        if (!seen.insert(idname).second) {
+            return;
+        }
+        order.push_back(idname);
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT needs FROM depends_ons WHERE id_name = ?", -1, &stmt, nullptr);
+        prepares++;
+        sqlite3_bind_text(stmt, 1, idname.c_str(), -1, SQLITE_TRANSIENT);
+        std::vector<std::string> needs;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            needs.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        }
+        sqlite3_finalize(stmt);
+        for (const auto& need : needs) {
+            visit(need);
+        }
+    };
+    visit("f0");
+
+    std::vector<Binding> bindings;
+    for (const auto& idname : order) {
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT id_name, lazy, value, file_name FROM bindings WHERE id_name = ?", -1, &stmt, nullptr);
+        prepares++;
+        sqlite3_bind_text(stmt, 1, idname.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            Binding binding;
+            binding.idname = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            binding.lazy = sqlite3_column_int(stmt, 1) != 0;
+            binding.value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+            bindings.push_back(std::move(binding));
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return bindings;
+}
+
+template <typename F>
+static double best_ms(int repeats, F&& body) {
+    double best = 1e300;
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int num_bindings = argc > 1 ? std::atoi(argv[1]) : 5000;
+    std::string path = make_bundle(num_bindings);
+    fmt::print("Bindings: {}, bundle: {:.1f} KB\n", num_bindings,
+               static_cast<double>(std::filesystem::file_size(path)) / 1024.0);
+
+    int prepares = 0;
+    size_t per_node_count = 0;
+    double per_node = best_ms(5, [&] {
+        prepares = 0;
+        per_node_count = read_per_node(path, prepares).size();
+    });
+
+    size_t batched_count = 0;
+    double batched = best_ms(5, [&] {
+        BundleReader reader(path);
+        batched_count = reader.get_dependency_bindings("f0").size();
+    });
+
+    // Full startup with the batched reader: declare, compile and allocate.
+    double load = best_ms(5, [&] {
+        BundleReader reader(path);
+        Machine machine;
+        std::vector<Binding> bindings = reader.get_dependency_bindings("f0");
+        for (const auto& binding : bindings) {
+            machine.define_global(binding.idname, make_undef());
+        }
+        for (const auto& binding : bindings) {
+            Cell* func_obj = machine.allocate_function(machine.parse_function_object(binding.value));
+            machine.define_global(binding.idname, make_tagged_ptr(func_obj));
+        }
+    });
+
+    fmt::print("{:<28} {:>10} {:>10} {:>10}\n", "strategy", "ms", "bindings", "prepares");
+    fmt::print("{:<28} {:>10.2f} {:>10} {:>10}\n", "per-node statements", per_node, per_node_count, prepares);
+    fmt::print("{:<28} {:>10.2f} {:>10} {:>10}\n", "recursive CTE + batch", batched, batched_count, 1);
+    fmt::print("{:<28} {:>10.2f}\n", "full load (batched)", load);
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Compare loading function objects from the binary bytecode format with the
+// streaming JSON parser on a large synthetic bundle: encoded size and time per
+// function. Both plant the same threaded code.
+//
+// Usage: bench_bytecode [FUNCTIONS] [INSTRUCTIONS_PER_FUNCTION]
+
+#include "../src/bytecode.hpp"
+#include "../src/machine.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+// A function body in the shape the Nutmeg compiler emits: mostly locals, small
+// literals and counted calls, with the occasional string.
+static std::string make_function_json(int num_instructions, int seed) {
+    std::string json = R"({"nlocals": 4, "nparams": 1, "instructions": [)";
+    for (int i = 0; i < num_instructions; i++) {
+        if (i > 0) {
+            json += ", ";
+        }
+        switch ((i + seed) % 8) {
+        case 0: json += fmt::format(R"({{"type": "push.int", "index": {}}})", i * 7 - 100); break;
+        case 1: json += fmt::format(R"({{"type": "push.local", "index": {}}})", i % 4); break;
+        case 2: json += fmt::format(R"({{"type": "pop.local", "index": {}}})", i % 4); break;
+        case 3: json += R"({"type": "stack.length", "index": 3})"; break;
+        case 4: json += R"({"type": "syscall.counted", "index": 3, "name": "+"})"; break;
+        case 5: json += fmt::format(R"({{"type": "call.global.counted", "index": 3, "name": "f{}"}})", i % 50); break;
+        case 6: json += fmt::format(R"({{"type": "push.global", "value": "g{}"}})", i % 20); break;
+        default:
+            if (i % 64 == 7) {
+                json += fmt::format(R"({{"type": "push.string", "value": "line {}\n"}})", i);
+            } else {
+                json += R"({"type": "push.int", "index": 1})";
+            }
+            break;
+        }
+    }
+    json += R"(, {"type": "return"}]})";
+    return json;
+}
+
+template <typename Load>
+static double measure(const std::vector<std::string>& bundle, Load&& load) {
+    double best = 1e300;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        // A fresh machine each time, so that the (fixed-size) heap never fills up.
+        Machine machine;
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string& encoded : bundle) {
+            FunctionObject func = load(machine, encoded);
+            asm volatile("" : : "g"(func.code.data()) : "memory");
+        }
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int num_functions = argc > 1 ? std::atoi(argv[1]) : 200;
+    int num_instructions = argc > 2 ? std::atoi(argv[2]) : 500;
+
+    std::vector<std::string> json_bundle;
+    std::vector<std::string> bytecode_bundle;
+    size_t json_bytes = 0;
+    size_t bytecode_bytes = 0;
+    for (int i = 0; i < num_functions; i++) {
+        json_bundle.push_back(make_function_json(num_instructions, i));
+        bytecode_bundle.push_back(encode_bytecode(json_bundle.back()));
+        json_bytes += json_bundle.back().size();
+        bytecode_bytes += bytecode_bundle.back().size();
+    }
+    fmt::print("Functions: {}, instructions per function: {}\n", num_functions, num_instructions);
+
+    double json = measure(json_bundle, [](Machine& m, const std::string& s) { return m.parse_function_object(s); });
+    double bytecode = measure(bytecode_bundle, [](Machine& m, const std::string& s) {
+        return m.decode_function_object(s);
+    });
+
+    fmt::print("{:<10} {:>12} {:>14}\n", "format", "KB", "us/function");
+    fmt::print("{:<10} {:>12.1f} {:>14.2f}\n", "json", static_cast<double>(json_bytes) / 1024, json * 1e6 / num_functions);
+    fmt::print("{:<10} {:>12.1f} {:>14.2f}\n", "bytecode", static_cast<double>(bytecode_bytes) / 1024,
+               bytecode * 1e6 / num_functions);
+    fmt::print("Size: {:.1f}x smaller, decode: {:.2f}x faster\n",
+               static_cast<double>(json_bytes) / static_cast<double>(bytecode_bytes), json / bytecode);
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Compare a heap of plain 64-bit fields with one of compressed references on
+// pointer-heavy data: a balanced binary tree of records, and a random graph of
+// vectors with several edges each. For each, report the live size, the time to
+// walk every object through get_field, and the pause of a full collection.
+//
+// Usage: bench_compressed_refs [OBJECTS]
+
+#include "../src/heap.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nutmeg;
+
+// The roots of a heap: the cells of a vector outside it.
+static void root_cells(Heap& heap, std::vector<Cell>& roots) {
+    heap.set_root_enumerator([&roots](const Heap::RootVisitor& visit) {
+        for (Cell& cell : roots) {
+            visit(cell);
+        }
+    });
+}
+
+static Cell* object(Cell cell) {
+    return static_cast<Cell*>(as_detagged_ptr(cell));
+}
+
+// A complete binary tree of num_nodes records of two children and a value.
+static void build_tree(Heap& heap, std::vector<Cell>& roots, size_t num_nodes) {
+    Cell* node_datakey = heap.allocate_record_datakey(3);
+    // Every node is rooted until it is linked, since allocation may move them.
+    std::vector<Cell> nodes;
+    roots.clear();
+    root_cells(heap, nodes);
+    for (size_t i = 0; i < num_nodes; i++) {
+        nodes.push_back(make_tagged_ptr(heap.allocate_record(node_datakey)));
+        heap.set_field(object(nodes.back()), 2, make_tagged_int(static_cast<int64_t>(i % 1000)));
+    }
+    for (size_t i = 0; 2 * i + 1 < num_nodes; i++) {
+        heap.set_field(object(nodes[i]), 0, nodes[2 * i + 1]);
+        if (2 * i + 2 < num_nodes) {
+            heap.set_field(object(nodes[i]), 1, nodes[2 * i + 2]);
+        }
+    }
+    roots.push_back(nodes[0]);
+    root_cells(heap, roots);
+}
+
+// The sum of the values in a tree, found depth first.
+static int64_t walk_tree(const Heap& heap, Cell root) {
+    int64_t sum = 0;
+    std::vector<Cell> pending{root};
+    while (!pending.empty()) {
+        Cell* node = object(pending.back());
+        pending.pop_back();
+        sum += as_detagged_int(heap.get_field(node, 2));
+        for (size_t child = 0; child < 2; child++) {
+            Cell next = heap.get_field(node, child);
+            if (!is_nil(next)) {
+                pending.push_back(next);
+            }
+        }
+    }
+    return sum;
+}
+
+// num_nodes vectors of degree elements, each referring to a random vector.
+static void build_graph(Heap& heap, std::vector<Cell>& roots, size_t num_nodes, size_t degree) {
+    std::vector<Cell> nodes;
+    roots.clear();
+    root_cells(heap, nodes);
+    for (size_t i = 0; i < num_nodes; i++) {
+        nodes.push_back(make_tagged_ptr(heap.allocate_vector(degree)));
+    }
+    std::mt19937_64 random(42);
+    for (size_t i = 0; i < num_nodes; i++) {
+        for (size_t j = 0; j < degree; j++) {
+            heap.set_field(object(nodes[i]), j, nodes[random() % num_nodes]);
+        }
+    }
+    roots.push_back(nodes[0]);
+    root_cells(heap, roots);
+}
+
+// A walk of num_steps steps through a graph, taking an edge chosen by the step
+// number each time, returning the number of distinct-looking hops (so that the
+// walk cannot be optimised away).
+static int64_t walk_graph(const Heap& heap, Cell start, size_t num_steps) {
+    int64_t hops = 0;
+    Cell node = start;
+    for (size_t step = 0; step < num_steps; step++) {
+        Cell* node_ptr = object(node);
+        Cell next = heap.get_field(node_ptr, step % heap.get_num_fields(node_ptr));
+        hops += next.u64 != node.u64;
+        node = next;
+    }
+    return hops;
+}
+
+// The best time of run, in milliseconds, over a few runs.
+static double best_of(int repeats, const std::function<void()>& run) {
+    double best = 1e300;
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t num_objects = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    fmt::print("Objects: {}\n", num_objects);
+
+    fmt::print("{:<14} {:<12} {:>12} {:>10} {:>10}\n", "heap", "fields", "live MB", "walk ms", "pause ms");
+    for (const char* shape : {"record tree", "vector graph"}) {
+        for (bool compressed : {false, true}) {
+            HeapOptions options;
+            options.max_bytes = size_t{3} << 30;
+            options.compressed_references = compressed;
+            Heap heap(options);
+            std::vector<Cell> roots;
+            int64_t checksum = 0;
+            std::function<void()> walk;
+            if (std::string(shape) == "record tree") {
+                build_tree(heap, roots, num_objects);
+                walk = [&]() { checksum += walk_tree(heap, roots[0]); };
+            } else {
+                build_graph(heap, roots, num_objects, 4);
+                walk = [&]() { checksum += walk_graph(heap, roots[0], num_objects); };
+            }
+            heap.collect();
+            double walk_ms = best_of(5, walk);
+            double pause_ms = best_of(5, [&]() { heap.collect(); });
+            fmt::print("{:<14} {:<12} {:>12.1f} {:>10.2f} {:>10.2f}{}\n", shape, compressed ? "compressed" : "cells",
+                       static_cast<double>(heap.get_collected_bytes()) / (1 << 20), walk_ms, pause_ms,
+                       checksum == 0 ? " (empty)" : "");
+        }
+    }
+    return 0;
+}
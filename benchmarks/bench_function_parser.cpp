@@ -0,0 +1,114 @@
+// Compare the streaming FunctionParser with the nlohmann::json DOM loader on a
+// large synthetic bundle: time per function and C++ heap allocations made
+// while parsing (counted by replacing the global operator new).
+//
+// Usage: bench_function_parser [FUNCTIONS] [INSTRUCTIONS_PER_FUNCTION]
+
+#include "../src/machine.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+static size_t allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count++;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// A function body in the shape the Nutmeg compiler emits: mostly locals, small
+// literals and counted calls, with the occasional string.
+static std::string make_function_json(int num_instructions, int seed) {
+    std::string json = R"({"nlocals": 4, "nparams": 1, "instructions": [)";
+    for (int i = 0; i < num_instructions; i++) {
+        if (i > 0) {
+            json += ", ";
+        }
+        switch ((i + seed) % 8) {
+        case 0: json += fmt::format(R"({{"type": "push.int", "index": {}}})", i * 7 - 100); break;
+        case 1: json += fmt::format(R"({{"type": "push.local", "index": {}}})", i % 4); break;
+        case 2: json += fmt::format(R"({{"type": "pop.local", "index": {}}})", i % 4); break;
+        case 3: json += R"({"type": "stack.length", "index": 3})"; break;
+        case 4: json += R"({"type": "syscall.counted", "index": 3, "name": "+"})"; break;
+        case 5: json += fmt::format(R"({{"type": "call.global.counted", "index": 3, "name": "f{}"}})", i % 50); break;
+        case 6: json += fmt::format(R"({{"type": "push.global", "value": "g{}"}})", i % 20); break;
+        default:
+            if (i % 64 == 7) {
+                json += fmt::format(R"({{"type": "push.string", "value": "line {}\n"}})", i);
+            } else {
+                json += R"({"type": "push.int", "index": 1})";
+            }
+            break;
+        }
+    }
+    json += R"(, {"type": "return"}]})";
+    return json;
+}
+
+struct Result {
+    double seconds;
+    size_t allocations;
+};
+
+template <typename Parse>
+static Result measure(const std::vector<std::string>& bundle, Parse&& parse) {
+    Result best{1e300, 0};
+    for (int repeat = 0; repeat < 5; repeat++) {
+        // A fresh machine each time, so that the (fixed-size) heap never fills up.
+        Machine machine;
+        size_t before = allocation_count;
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string& json : bundle) {
+            FunctionObject func = parse(machine, json);
+            asm volatile("" : : "g"(func.code.data()) : "memory");
+        }
+        auto stop = std::chrono::steady_clock::now();
+        best.seconds = std::min(best.seconds, std::chrono::duration<double>(stop - start).count());
+        best.allocations = allocation_count - before;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int num_functions = argc > 1 ? std::atoi(argv[1]) : 200;
+    int num_instructions = argc > 2 ? std::atoi(argv[2]) : 500;
+
+    std::vector<std::string> bundle;
+    size_t bytes = 0;
+    for (int i = 0; i < num_functions; i++) {
+        bundle.push_back(make_function_json(num_instructions, i));
+        bytes += bundle.back().size();
+    }
+    fmt::print("Functions: {}, instructions per function: {}, JSON: {:.1f} MB\n", num_functions,
+               num_instructions, static_cast<double>(bytes) / 1e6);
+
+    Result dom = measure(bundle, [](Machine& m, const std::string& json) { return m.parse_function_object_dom(json); });
+    Result streaming = measure(bundle, [](Machine& m, const std::string& json) { return m.parse_function_object(json); });
+
+    fmt::print("{:<10} {:>14} {:>14} {:>18}\n", "parser", "us/function", "MB/s", "allocs/function");
+    for (const auto& [name, result] : {std::pair{"dom", dom}, std::pair{"streaming", streaming}}) {
+        fmt::print("{:<10} {:>14.2f} {:>14.1f} {:>18.1f}\n", name,
+                   result.seconds * 1e6 / num_functions,
+                   static_cast<double>(bytes) / 1e6 / result.seconds,
+                   static_cast<double>(result.allocations) / num_functions);
+    }
+    fmt::print("Speed-up: {:.2f}x\n", dom.seconds / streaming.seconds);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Measure the pause of a full garbage collection as the number of collector
+// threads grows, for two heaps of records and vectors: a balanced binary tree
+// of records, and a random graph of vectors with several edges each (so that
+// threads race to copy the same objects).
+//
+// Usage: bench_gc [OBJECTS] [MAX_THREADS]
+
+#include "../src/heap.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nutmeg;
+
+// The roots of a heap: the cells of a vector outside it.
+static void root_cells(Heap& heap, std::vector<Cell>& roots) {
+    heap.set_root_enumerator([&roots](const Heap::RootVisitor& visit) {
+        for (Cell& cell : roots) {
+            visit(cell);
+        }
+    });
+}
+
+static Cell* object(Cell cell) {
+    return static_cast<Cell*>(as_detagged_ptr(cell));
+}
+
+// A complete binary tree of num_nodes records of two children and a value.
+static void build_tree(Heap& heap, std::vector<Cell>& roots, size_t num_nodes) {
+    Cell* node_datakey = heap.allocate_record_datakey(3);
+    // Every node is rooted until it is linked, since allocation may move them.
+    std::vector<Cell> nodes;
+    roots.clear();
+    root_cells(heap, nodes);
+    for (size_t i = 0; i < num_nodes; i++) {
+        nodes.push_back(make_tagged_ptr(heap.allocate_record(node_datakey)));
+        heap.set_field(object(nodes.back()), 2, make_tagged_int(static_cast<int64_t>(i)));
+    }
+    for (size_t i = 0; 2 * i + 1 < num_nodes; i++) {
+        heap.set_field(object(nodes[i]), 0, nodes[2 * i + 1]);
+        if (2 * i + 2 < num_nodes) {
+            heap.set_field(object(nodes[i]), 1, nodes[2 * i + 2]);
+        }
+    }
+    roots.push_back(nodes[0]);
+    root_cells(heap, roots);
+}
+
+// num_nodes vectors of degree elements, each referring to a random vector.
+static void build_graph(Heap& heap, std::vector<Cell>& roots, size_t num_nodes, size_t degree) {
+    std::vector<Cell> nodes;
+    roots.clear();
+    root_cells(heap, nodes);
+    for (size_t i = 0; i < num_nodes; i++) {
+        nodes.push_back(make_tagged_ptr(heap.allocate_vector(degree)));
+    }
+    std::mt19937_64 random(42);
+    for (size_t i = 0; i < num_nodes; i++) {
+        for (size_t j = 0; j < degree; j++) {
+            heap.set_field(object(nodes[i]), j, nodes[random() % num_nodes]);
+        }
+    }
+    // A few entry points, from which (almost) everything is reachable.
+    for (size_t i = 0; i < 16; i++) {
+        roots.push_back(nodes[i]);
+    }
+    root_cells(heap, roots);
+}
+
+// The best full-collection pause, in milliseconds, over a few collections.
+static double best_of(Heap& heap, int repeats) {
+    double best = 1e300;
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        heap.collect();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t num_objects = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    unsigned max_threads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 8;
+    fmt::print("Objects: {}, hardware threads: {}\n", num_objects, std::thread::hardware_concurrency());
+
+    fmt::print("{:<14} {:>8} {:>12} {:>10} {:>8}\n", "heap", "threads", "live MB", "pause ms", "speedup");
+    for (const char* shape : {"record tree", "vector graph"}) {
+        double single = 0;
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            HeapOptions options;
+            options.max_bytes = size_t{4} << 30;
+            options.gc_threads = threads;
+            Heap heap(options);
+            std::vector<Cell> roots;
+            if (std::string(shape) == "record tree") {
+                build_tree(heap, roots, num_objects);
+            } else {
+                build_graph(heap, roots, num_objects, 4);
+            }
+            heap.collect();
+            double pause = best_of(heap, 5);
+            if (threads == 1) {
+                single = pause;
+            }
+            fmt::print("{:<14} {:>8} {:>12.1f} {:>10.2f} {:>7.2f}x\n", shape, threads,
+                       static_cast<double>(heap.get_collected_bytes()) / (1 << 20), pause, single / pause);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Break startup down into its phases, as nutmeg-run --startup-stats does, on
+// synthetic bundles of increasing size: open the bundle, find the entry point,
+// compute the dependency closure, fetch, parse and compile the bindings, and
+// place them on the heap. Each size is loaded once to warm the page cache and
+// then measured. Run it with `cmake --build BUILD --target startup-benchmark`.
+//
+// Usage: bench_startup [BINDINGS...]
+
+#include "bench_support.hpp"
+#include "../src/bundle_reader.hpp"
+#include "../src/machine.hpp"
+#include "../src/program_loader.hpp"
+#include "../src/startup_stats.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+// Binding f{i} calls f{2i+1} and f{2i+2} where they exist, so every binding is
+// in the closure of the entry point f0. Bodies are kept small, since every
+// function object must fit in the machine's heap.
+static std::string make_bundle(int num_bindings) {
+    bench::BundleWriter bundle(fmt::format("bench-{}", num_bindings));
+    bundle.add_entry_point("f0");
+    for (int i = 0; i < num_bindings; i++) {
+        std::string instructions = R"({"type": "stack.length", "index": 0}, {"type": "push.int", "index": 7})";
+        for (int callee : {2 * i + 1, 2 * i + 2}) {
+            if (callee < num_bindings) {
+                bundle.add_dependency(fmt::format("f{}", i), fmt::format("f{}", callee));
+                instructions += fmt::format(R"(, {{"type": "call.global.counted", "index": 0, "name": "f{}"}})", callee);
+            }
+        }
+        instructions += R"(, {"type": "return"})";
+        bundle.add_binding(fmt::format("f{}", i),
+                           fmt::format(R"({{"nlocals": 1, "nparams": 0, "instructions": [{}]}})", instructions));
+    }
+    return bundle.close();
+}
+
+// Load the bundle through nutmeg-run's loader, sequentially (as --jobs=1 does),
+// timed by the same phases.
+static void load(const std::string& path, StartupStats& stats) {
+    PhaseTimer startup_timer(&stats, StartupPhase::FirstInstruction);
+    BundleReader reader = [&]() {
+        PhaseTimer timer(&stats, StartupPhase::BundleOpen);
+        return BundleReader(path);
+    }();
+    reader.set_startup_stats(&stats);
+    std::string entry_point;
+    {
+        PhaseTimer timer(&stats, StartupPhase::EntryPoint);
+        entry_point = reader.get_entry_points().at(0);
+    }
+    Machine machine;
+    machine.set_startup_stats(&stats);
+    ProgramLoader loader(reader, machine, path, LoadOptions(), &stats);
+    loader.load(entry_point);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back(std::atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {250, 1000, 4000};
+    }
+    set_allocation_counting(true);
+    for (int num_bindings : sizes) {
+        std::string path = make_bundle(num_bindings);
+        StartupStats warm_up;
+        load(path, warm_up);
+        StartupStats stats;
+        load(path, stats);
+        fmt::print("Bindings: {}, bundle: {:.1f} KB\n", num_bindings,
+                   static_cast<double>(std::filesystem::file_size(path)) / 1024.0);
+        stats.print(stdout);
+        fmt::print("\n");
+        std::filesystem::remove(path);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef BENCH_SUPPORT_HPP
+#define BENCH_SUPPORT_HPP
+
+// Scaffolding shared by the benchmarks, and by the tests that need a bundle.
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fmt/core.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+namespace nutmeg::bench {
+
+// BundleWriter creates a bundle with the tables the Nutmeg compiler writes, in
+// the temporary directory, keyed by the process and replacing any bundle left
+// there before. Rows are inserted in one transaction, committed by close.
+class BundleWriter {
+private:
+    std::string path_;
+    sqlite3* db_ = nullptr;
+
+public:
+    explicit BundleWriter(const std::string& name)
+        : path_((std::filesystem::temp_directory_path() / fmt::format("nutmeg-{}-{}.bundle", name, getpid())).string()) {
+        std::filesystem::remove(path_);
+        if (sqlite3_open(path_.c_str(), &db_) != SQLITE_OK) {
+            std::string message = db_ != nullptr ? sqlite3_errmsg(db_) : "out of memory";
+            sqlite3_close(db_);
+            db_ = nullptr;
+            throw std::runtime_error(fmt::format("Cannot create bundle {}: {}", path_, message));
+        }
+        exec(R"(
+            CREATE TABLE entry_points (id_name text, PRIMARY KEY (id_name));
+            CREATE TABLE depends_ons (id_name text, needs text, PRIMARY KEY (id_name, needs));
+            CREATE TABLE bindings (id_name text, lazy numeric, value text, file_name text, PRIMARY KEY (id_name));
+            BEGIN;
+        )");
+    }
+
+    ~BundleWriter() {
+        sqlite3_close(db_);
+    }
+
+    BundleWriter(const BundleWriter&) = delete;
+    BundleWriter& operator=(const BundleWriter&) = delete;
+
+    const std::string& path() const { return path_; }
+
+    // Run sql against the bundle, throwing on failure.
+    void exec(const std::string& sql) {
+        char* error = nullptr;
+        if (sqlite3_exec(db_, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+            std::string message = error ? error : "unknown error";
+            sqlite3_free(error);
+            throw std::runtime_error(message);
+        }
+    }
+
+    // Quote text as an SQL string literal.
+    static std::string quote(std::string_view text) {
+        std::string quoted = "'";
+        for (char c : text) {
+            quoted += c;
+            if (c == '\'') {
+                quoted += c;
+            }
+        }
+        return quoted + "'";
+    }
+
+    void add_entry_point(std::string_view idname) {
+        exec(fmt::format("INSERT INTO entry_points VALUES ({});", quote(idname)));
+    }
+
+    void add_dependency(std::string_view idname, std::string_view needs) {
+        exec(fmt::format("INSERT INTO depends_ons VALUES ({}, {});", quote(idname), quote(needs)));
+    }
+
+    void add_binding(std::string_view idname, std::string_view value, bool lazy = false) {
+        exec(fmt::format("INSERT INTO bindings VALUES ({}, {}, {}, 'bench.nutmeg');", quote(idname), lazy ? 1 : 0,
+                         quote(value)));
+    }
+
+    // Commit the rows and close the bundle, returning its path.
+    std::string close() {
+        exec("COMMIT;");
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return path_;
+    }
+};
+
+} // namespace nutmeg::bench
+
+#endif // BENCH_SUPPORT_HPP
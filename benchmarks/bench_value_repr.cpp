@@ -0,0 +1,100 @@
+// Compare the two value representations on integer-heavy and float-heavy
+// workloads. Both policies are instantiated directly, so a single build measures
+// both regardless of which one NUTMEG_VALUE_REPR selects for the runtime.
+//
+// Usage: bench_value_repr [ITERATIONS]
+
+#include "../src/value.hpp"
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
+#include <cstdlib>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+// Keep the optimiser from discarding a result.
+template <typename T>
+static void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <typename F>
+static double best_of(int repeats, F&& body) {
+    double best = 1e300;
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+    return best;
+}
+
+// Integer-heavy: a running sum and product of small tagged integers, through the
+// overflow-checked fast paths that the arithmetic sys-functions use.
+template <typename Repr>
+static Cell integer_workload(int64_t iterations) {
+    Cell sum = Repr::make_int(0);
+    Cell product = Repr::make_int(1);
+    for (int64_t i = 0; i < iterations; i++) {
+        Cell x = Repr::make_int(i & 1023);
+        if (!Repr::add_ints(sum, x, sum)) {
+            sum = Repr::make_int(0);
+        }
+        if (!Repr::multiply_ints(product, Repr::make_int(3), product)) {
+            product = Repr::make_int(1);
+        }
+    }
+    if (!Repr::add_ints(sum, product, sum)) {
+        sum = Repr::make_int(0);
+    }
+    return sum;
+}
+
+// Float-heavy: a damped recurrence that decodes and re-encodes on every step, as
+// an interpreter without unboxed float registers must.
+template <typename Repr>
+static Cell float_workload(int64_t iterations) {
+    Cell acc = Repr::make_float(0.0);
+    Cell step = Repr::make_float(0.5);
+    for (int64_t i = 0; i < iterations; i++) {
+        double value = Repr::as_float(acc) * 0.999999 + Repr::as_float(step);
+        acc = Repr::make_float(value);
+    }
+    return acc;
+}
+
+// Count the values (out of a sample) that do not survive an encode/decode round trip.
+template <typename Repr>
+static int lossy_roundtrips() {
+    int lossy = 0;
+    double value = 0.1;
+    for (int i = 0; i < 1000; i++) {
+        if (Repr::as_float(Repr::make_float(value)) != value) {
+            lossy++;
+        }
+        value = value * 1.37 + 0.013;
+    }
+    return lossy;
+}
+
+template <typename Repr>
+static void run(const char* name, int64_t iterations) {
+    double int_seconds = best_of(5, [&] { keep(integer_workload<Repr>(iterations)); });
+    double float_seconds = best_of(5, [&] { keep(float_workload<Repr>(iterations)); });
+    fmt::print("{:<8} {:>12.3f} {:>12.3f} {:>16}\n", name,
+               int_seconds * 1e9 / static_cast<double>(iterations),
+               float_seconds * 1e9 / static_cast<double>(iterations),
+               fmt::format("{}/1000", lossy_roundtrips<Repr>()));
+}
+
+int main(int argc, char* argv[]) {
+    int64_t iterations = argc > 1 ? std::atoll(argv[1]) : 50'000'000;
+    fmt::print("Iterations: {} (runtime built with {})\n", iterations,
+               std::is_same_v<ValueRepr, NanBoxRepr> ? "NANBOX" : "LOWTAG");
+    fmt::print("{:<8} {:>12} {:>12} {:>16}\n", "repr", "int ns/op", "float ns/op", "lossy floats");
+    run<LowTagRepr>("lowtag", iterations);
+    run<NanBoxRepr>("nanbox", iterations);
+    return 0;
+}
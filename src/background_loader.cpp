@@ -0,0 +1,77 @@
+#include "background_loader.hpp"
+#include <stdexcept>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+BackgroundLoader::BackgroundLoader(unsigned num_threads) : num_threads_(num_threads) {}
+
+BackgroundLoader::~BackgroundLoader() {
+    // The workers skip whatever is still queued, so the pool's destructor only
+    // waits for the bindings being compiled right now.
+    cancelled_ = true;
+    pool_.reset();
+}
+
+void BackgroundLoader::run(Slot& slot) {
+    // Errors are kept rather than thrown, so that the once_flag is set either way
+    // and the binding is never compiled twice.
+    std::call_once(slot.once, [&slot]() {
+        try {
+            slot.result = slot.compile();
+        } catch (...) {
+            slot.error = std::current_exception();
+        }
+    });
+}
+
+void BackgroundLoader::add(const std::string& name, Compile compile) {
+    // Defensive check: the workers must not see the slots change under them.
+    if (pool_) {
+        throw std::logic_error("BackgroundLoader::add called after start");
+    }
+    auto [it, inserted] = slots_.try_emplace(name, std::make_unique<Slot>());
+    if (!inserted) {
+        throw std::runtime_error(fmt::format("Binding queued twice for background loading: {}", name));
+    }
+    it->second->compile = std::move(compile);
+    order_.push_back(it->second.get());
+}
+
+void BackgroundLoader::start() {
+    if (pool_ || order_.empty()) {
+        return;
+    }
+    pool_.emplace(num_threads_);
+    for (Slot* slot : order_) {
+        pool_->submit([this, slot]() {
+            if (!cancelled_) {
+                run(*slot);
+            }
+        });
+    }
+}
+
+bool BackgroundLoader::has(std::string_view name) const {
+    auto it = slots_.find(name);
+    return it != slots_.end() && !it->second->taken;
+}
+
+FunctionObject BackgroundLoader::take(std::string_view name) {
+    auto it = slots_.find(name);
+    if (it == slots_.end() || it->second->taken) {
+        throw std::runtime_error(fmt::format("Binding not queued for background loading: {}", name));
+    }
+    Slot& slot = *it->second;
+    run(slot);
+    if (slot.error) {
+        std::rethrow_exception(slot.error);
+    }
+    // The slot itself stays in place, since a queued task still points to it.
+    slot.taken = true;
+    FunctionObject func = std::move(*slot.result);
+    slot.result.reset();
+    return func;
+}
+
+} // namespace nutmeg
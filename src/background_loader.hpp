@@ -0,0 +1,76 @@
+#ifndef BACKGROUND_LOADER_HPP
+#define BACKGROUND_LOADER_HPP
+
+#include "function_object.hpp"
+#include "string_hash.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nutmeg {
+
+// BackgroundLoader compiles bindings on worker threads while the program is
+// already running (see --pipeline in main). Each binding is compiled exactly
+// once: by a worker, in the order the bindings were added, or by the thread
+// that needs it first, if no worker has started on it yet. A thread that needs
+// a binding a worker is compiling waits for that binding alone.
+//
+// add, start, has and take are called from one thread (the interpreter's);
+// only the compile functions run on the workers.
+class BackgroundLoader {
+public:
+    using Compile = std::function<FunctionObject()>;
+
+private:
+    struct Slot {
+        std::once_flag once;
+        Compile compile;
+        std::optional<FunctionObject> result;
+        std::exception_ptr error;
+        bool taken = false;
+    };
+
+    std::unordered_map<std::string, std::unique_ptr<Slot>, StringHash, std::equal_to<>> slots_;
+    std::vector<Slot*> order_;
+    std::atomic<bool> cancelled_{false};
+    unsigned num_threads_;
+
+    // Declared last, so that the workers are joined before the slots go.
+    std::optional<ThreadPool> pool_;
+
+    static void run(Slot& slot);
+
+public:
+    explicit BackgroundLoader(unsigned num_threads);
+
+    // Bindings not yet compiled are abandoned, not compiled.
+    ~BackgroundLoader();
+
+    BackgroundLoader(const BackgroundLoader&) = delete;
+    BackgroundLoader& operator=(const BackgroundLoader&) = delete;
+
+    // Queue a binding. Nothing is compiled until start.
+    void add(const std::string& name, Compile compile);
+
+    // Start compiling the queued bindings on the workers.
+    void start();
+
+    // Whether name was added and has not been taken.
+    bool has(std::string_view name) const;
+
+    // Take the compiled function of name, compiling it on this thread or waiting
+    // for a worker as needed. A compile error is rethrown here.
+    FunctionObject take(std::string_view name);
+};
+
+} // namespace nutmeg
+
+#endif // BACKGROUND_LOADER_HPP
@@ -0,0 +1,208 @@
+#include "bignum.hpp"
+#include "heap.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+// Magnitude helpers. All operate on little-endian limb vectors without leading zeros.
+
+static void trim(std::vector<uint64_t>& limbs) {
+    while (!limbs.empty() && limbs.back() == 0) {
+        limbs.pop_back();
+    }
+}
+
+static int compare_magnitude(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0; ) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static std::vector<uint64_t> add_magnitude(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    const auto& longer = a.size() >= b.size() ? a : b;
+    const auto& shorter = a.size() >= b.size() ? b : a;
+    std::vector<uint64_t> result(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); i++) {
+        unsigned __int128 sum = static_cast<unsigned __int128>(longer[i]) + carry;
+        if (i < shorter.size()) {
+            sum += shorter[i];
+        }
+        result[i] = static_cast<uint64_t>(sum);
+        carry = static_cast<uint64_t>(sum >> 64);
+    }
+    result[longer.size()] = carry;
+    trim(result);
+    return result;
+}
+
+// Requires |a| >= |b|.
+static std::vector<uint64_t> sub_magnitude(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    std::vector<uint64_t> result(a.size());
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t rhs = i < b.size() ? b[i] : 0;
+        unsigned __int128 diff = static_cast<unsigned __int128>(a[i]) - rhs - borrow;
+        result[i] = static_cast<uint64_t>(diff);
+        borrow = (diff >> 64) != 0 ? 1 : 0;
+    }
+    trim(result);
+    return result;
+}
+
+static std::vector<uint64_t> mul_magnitude(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    if (a.empty() || b.empty()) {
+        return {};
+    }
+    std::vector<uint64_t> result(a.size() + b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            unsigned __int128 product =
+                static_cast<unsigned __int128>(a[i]) * b[j] + result[i + j] + carry;
+            result[i + j] = static_cast<uint64_t>(product);
+            carry = static_cast<uint64_t>(product >> 64);
+        }
+        result[i + b.size()] = carry;
+    }
+    trim(result);
+    return result;
+}
+
+// Divide in place by a single limb, returning the remainder.
+static uint64_t divmod_limb(std::vector<uint64_t>& limbs, uint64_t divisor) {
+    unsigned __int128 remainder = 0;
+    for (size_t i = limbs.size(); i-- > 0; ) {
+        unsigned __int128 current = (remainder << 64) | limbs[i];
+        limbs[i] = static_cast<uint64_t>(current / divisor);
+        remainder = current % divisor;
+    }
+    trim(limbs);
+    return static_cast<uint64_t>(remainder);
+}
+
+BigInt BigInt::from_int64(int64_t value) {
+    BigInt result;
+    result.negative = value < 0;
+    // Negate in unsigned arithmetic so that INT64_MIN is handled correctly.
+    uint64_t magnitude = result.negative ? ~static_cast<uint64_t>(value) + 1 : static_cast<uint64_t>(value);
+    if (magnitude != 0) {
+        result.limbs.push_back(magnitude);
+    }
+    return result;
+}
+
+BigInt BigInt::from_uint64(uint64_t value) {
+    BigInt result;
+    if (value != 0) {
+        result.limbs.push_back(value);
+    }
+    return result;
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+    BigInt result;
+    if (a.negative == b.negative) {
+        result.negative = a.negative;
+        result.limbs = add_magnitude(a.limbs, b.limbs);
+    } else if (compare_magnitude(a.limbs, b.limbs) >= 0) {
+        result.negative = a.negative;
+        result.limbs = sub_magnitude(a.limbs, b.limbs);
+    } else {
+        result.negative = b.negative;
+        result.limbs = sub_magnitude(b.limbs, a.limbs);
+    }
+    if (result.is_zero()) {
+        result.negative = false;
+    }
+    return result;
+}
+
+BigInt operator-(const BigInt& a) {
+    BigInt result = a;
+    result.negative = !a.negative && !a.is_zero();
+    return result;
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + (-b);
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    BigInt result;
+    result.limbs = mul_magnitude(a.limbs, b.limbs);
+    result.negative = !result.is_zero() && a.negative != b.negative;
+    return result;
+}
+
+std::string to_string(const BigInt& value) {
+    if (value.is_zero()) {
+        return "0";
+    }
+    // Peel off 19 decimal digits at a time, the largest power of ten in a limb.
+    constexpr uint64_t CHUNK = 10000000000000000000ULL;
+    std::vector<uint64_t> magnitude = value.limbs;
+    std::vector<uint64_t> chunks;
+    while (!magnitude.empty()) {
+        chunks.push_back(divmod_limb(magnitude, CHUNK));
+    }
+    std::string result = value.negative ? "-" : "";
+    result += fmt::format("{}", chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0; ) {
+        result += fmt::format("{:019}", chunks[i]);
+    }
+    return result;
+}
+
+bool is_bignum(const Heap& heap, Cell cell) {
+    return is_tagged_ptr(cell) && static_cast<Cell*>(as_detagged_ptr(cell))[0].ptr == heap.get_bignum_datakey();
+}
+
+bool is_integer(const Heap& heap, Cell cell) {
+    return is_tagged_int(cell) || is_bignum(heap, cell);
+}
+
+BigInt to_bigint(const Heap& heap, Cell cell) {
+    if (is_tagged_int(cell)) {
+        return BigInt::from_int64(as_detagged_int(cell));
+    }
+    if (!is_bignum(heap, cell)) {
+        throw std::runtime_error("Value is not an integer");
+    }
+    Cell* obj_ptr = static_cast<Cell*>(as_detagged_ptr(cell));
+    const uint64_t* limbs = heap.get_bignum_limbs(obj_ptr);
+    BigInt result;
+    result.negative = heap.is_bignum_negative(obj_ptr);
+    result.limbs.assign(limbs, limbs + heap.get_bignum_num_limbs(obj_ptr));
+    return result;
+}
+
+Cell make_integer(Heap& heap, const BigInt& value, HeapSpace space) {
+    // Demote to a tagged int whenever the value fits.
+    if (value.limbs.size() <= 1) {
+        uint64_t magnitude = value.is_zero() ? 0 : value.limbs[0];
+        if (!value.negative && magnitude <= static_cast<uint64_t>(TAGGED_INT_MAX)) {
+            return make_tagged_int(static_cast<int64_t>(magnitude));
+        }
+        if (value.negative && magnitude <= static_cast<uint64_t>(TAGGED_INT_MAX) + 1) {
+            return make_tagged_int(-static_cast<int64_t>(magnitude - 1) - 1);
+        }
+    }
+    Cell* obj_ptr = heap.allocate_bignum(value.limbs.size(), value.negative, space);
+    std::copy(value.limbs.begin(), value.limbs.end(), heap.get_bignum_limbs(obj_ptr));
+    return make_tagged_ptr(obj_ptr);
+}
+
+std::string bignum_to_string(const Heap& heap, Cell cell) {
+    return to_string(to_bigint(heap, cell));
+}
+
+} // namespace nutmeg
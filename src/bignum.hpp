@@ -0,0 +1,50 @@
+#ifndef BIGNUM_HPP
+#define BIGNUM_HPP
+
+#include "value.hpp"
+#include "heap.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nutmeg {
+
+// BigInt is a transient, C++-side arbitrary-precision integer used while
+// computing the slow path of integer arithmetic. Results are written back to the
+// heap by make_integer, which demotes them to tagged ints whenever they fit.
+struct BigInt {
+    bool negative = false;
+    std::vector<uint64_t> limbs;  // Magnitude, least significant first, no leading zeros.
+
+    static BigInt from_int64(int64_t value);
+    static BigInt from_uint64(uint64_t value);
+
+    bool is_zero() const { return limbs.empty(); }
+};
+
+BigInt operator+(const BigInt& a, const BigInt& b);
+BigInt operator-(const BigInt& a, const BigInt& b);
+BigInt operator*(const BigInt& a, const BigInt& b);
+BigInt operator-(const BigInt& a);
+
+// Render in decimal.
+std::string to_string(const BigInt& value);
+
+// Is the cell a pointer to a bignum object?
+bool is_bignum(const Heap& heap, Cell cell);
+
+// Is the cell an integer of either representation?
+bool is_integer(const Heap& heap, Cell cell);
+
+// Read a tagged int or bignum into a BigInt. Throws if the cell is not an integer.
+BigInt to_bigint(const Heap& heap, Cell cell);
+
+// Convert to a cell: a tagged int if the value fits, otherwise a new bignum.
+Cell make_integer(Heap& heap, const BigInt& value, HeapSpace space = HeapSpace::Collected);
+
+// Render a bignum cell in decimal.
+std::string bignum_to_string(const Heap& heap, Cell cell);
+
+} // namespace nutmeg
+
+#endif // BIGNUM_HPP
@@ -0,0 +1,49 @@
+#include "binary_file.hpp"
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <unistd.h>
+
+namespace nutmeg {
+
+uint64_t StringTable::add(std::string_view text) {
+    uint64_t ref = (static_cast<uint64_t>(data_.size()) << 32) | text.size();
+    data_.append(text);
+    return ref;
+}
+
+std::optional<std::string_view> read_string_ref(std::string_view data, uint64_t ref) {
+    uint64_t offset = ref >> 32, length = ref & 0xFFFFFFFF;
+    if (offset > data.size() || length > data.size() - offset) {
+        return std::nullopt;
+    }
+    return data.substr(offset, length);
+}
+
+BinaryFileWriter::BinaryFileWriter(const std::string& path, const std::string& description)
+    : path_(path), temp_path_(fmt::format("{}.{}.tmp", path, getpid())), description_(description),
+      out_(temp_path_, std::ios::binary | std::ios::trunc) {
+}
+
+BinaryFileWriter::~BinaryFileWriter() {
+    if (!committed_) {
+        out_.close();
+        std::error_code ignored;
+        std::filesystem::remove(temp_path_, ignored);
+    }
+}
+
+void BinaryFileWriter::write(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+}
+
+void BinaryFileWriter::commit() {
+    out_.close();
+    if (!out_) {
+        throw std::runtime_error(fmt::format("Cannot write {}: {}", description_, temp_path_));
+    }
+    std::filesystem::rename(temp_path_, path_);
+    committed_ = true;
+}
+
+} // namespace nutmeg
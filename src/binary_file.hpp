@@ -0,0 +1,65 @@
+#ifndef BINARY_FILE_HPP
+#define BINARY_FILE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nutmeg {
+
+// Helpers shared by the binary files the runtime writes: the code cache, heap
+// images and heap dumps.
+
+// StringTable accumulates the string data of a file. Each string added is
+// referred to by a single word, offset << 32 | length, into the data.
+class StringTable {
+private:
+    std::string data_;
+
+public:
+    uint64_t add(std::string_view text);
+    const std::string& data() const { return data_; }
+    size_t size() const { return data_.size(); }
+};
+
+// The string a reference refers to in data, or nullopt if it is out of range.
+std::optional<std::string_view> read_string_ref(std::string_view data, uint64_t ref);
+
+// BinaryFileWriter writes a file privately and renames it into place on
+// commit(), so that readers (possibly other processes) only ever see a complete
+// file. A writer destroyed without committing removes its private file.
+class BinaryFileWriter {
+private:
+    std::string path_;
+    std::string temp_path_;
+    std::string description_;
+    std::ofstream out_;
+    bool committed_ = false;
+
+public:
+    // Write to path; description names the kind of file in error messages.
+    BinaryFileWriter(const std::string& path, const std::string& description);
+    ~BinaryFileWriter();
+
+    BinaryFileWriter(const BinaryFileWriter&) = delete;
+    BinaryFileWriter& operator=(const BinaryFileWriter&) = delete;
+
+    void write(const void* data, size_t size);
+    void write(std::string_view bytes) { write(bytes.data(), bytes.size()); }
+
+    template <typename T>
+    void write(const std::vector<T>& items) {
+        write(items.data(), items.size() * sizeof(T));
+    }
+
+    // Finish the file and rename it into place, or throw if it could not be written.
+    void commit();
+};
+
+} // namespace nutmeg
+
+#endif // BINARY_FILE_HPP
@@ -6,17 +6,59 @@ using json = nlohmann::json;
 
 namespace nutmeg {
 
+// Bundles are read through a memory mapping of up to this many bytes (SQLite
+// clamps it to its compile-time limit), so pages come straight from the OS page
+// cache, shared by every process reading the bundle, instead of being copied
+// into SQLite's own page cache.
+static constexpr int64_t BUNDLE_MMAP_SIZE = 256 * 1024 * 1024;
+
+std::string BundleReader::make_uri(const std::string& bundle_path) {
+    // A URI filename must escape the characters that delimit the query string
+    // or fragment, and the escape character itself. An absolute path gets an
+    // explicit empty authority, so that one starting "//" is not taken for a host.
+    std::string uri = bundle_path.rfind('/', 0) == 0 ? "file://" : "file:";
+    for (char c : bundle_path) {
+        if (c == '?' || c == '#' || c == '%') {
+            uri += fmt::format("%{:02X}", static_cast<unsigned char>(c));
+        } else {
+            uri += c;
+        }
+    }
+    // immutable=1 tells SQLite the file cannot change while it is open, so it
+    // takes no locks and never looks for a hot journal or WAL file.
+    uri += "?immutable=1";
+    return uri;
+}
+
 BundleReader::BundleReader(const std::string& bundle_path)
     : db_(nullptr), bundle_path_(bundle_path) {
-    int result = sqlite3_open(bundle_path.c_str(), &db_);
+    // Bundles are never written by the runtime, so they are opened read-only.
+    int result = sqlite3_open_v2(make_uri(bundle_path).c_str(), &db_, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, nullptr);
     if (result != SQLITE_OK) {
-        std::string error = sqlite3_errmsg(db_);
+        std::string error = db_ ? sqlite3_errmsg(db_) : sqlite3_errstr(result);
         sqlite3_close(db_);
         throw BundleReaderError(fmt::format("Failed to open bundle file '{}': {}", bundle_path, error));
     }
+    // Failing to map only costs speed, so the result is not checked.
+    sqlite3_exec(db_, fmt::format("PRAGMA mmap_size = {}", BUNDLE_MMAP_SIZE).c_str(), nullptr, nullptr, nullptr);
+
+    sqlite3_stmt* stmt = nullptr;
+    result = sqlite3_prepare_v2(db_, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'bytecodes'",
+                                -1, &stmt, nullptr);
+    if (result == SQLITE_OK) {
+        has_bytecodes_ = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
 }
 
 BundleReader::~BundleReader() {
+    // Finalizing a null statement is a harmless no-op.
+    sqlite3_finalize(binding_stmt_);
+    sqlite3_finalize(dependencies_stmt_);
+    sqlite3_finalize(direct_dependencies_stmt_);
+    sqlite3_finalize(closure_bindings_stmt_);
+    sqlite3_finalize(closure_bytecodes_stmt_);
+    sqlite3_finalize(bytecode_stmt_);
     if (db_) {
         sqlite3_close(db_);
     }
@@ -29,6 +71,26 @@ void BundleReader::check_sqlite_result(int result, const std::string& operation)
     }
 }
 
+sqlite3_stmt* BundleReader::prepare_cached(sqlite3_stmt*& stmt, const char* sql) {
+    if (stmt == nullptr) {
+        int result = sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+        check_sqlite_result(result, "Failed to prepare query");
+    } else {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+    return stmt;
+}
+
+// The transitive closure of the depends_ons relation from ?1. UNION (rather
+// than UNION ALL) discards names already visited, which makes cycles terminate.
+#define DEPENDENCY_CLOSURE_CTE \
+    "WITH RECURSIVE closure(id_name) AS (" \
+    "    SELECT ?1" \
+    "    UNION" \
+    "    SELECT d.needs FROM depends_ons d JOIN closure c ON d.id_name = c.id_name" \
+    ") "
+
 std::vector<std::string> BundleReader::get_entry_points() {
     std::vector<std::string> entry_points;
     sqlite3_stmt* stmt = nullptr;
@@ -50,22 +112,15 @@ std::vector<std::string> BundleReader::get_entry_points() {
     return entry_points;
 }
 
-Binding BundleReader::get_binding(const std::string& idname) {
-    sqlite3_stmt* stmt = nullptr;
-
-    const char* sql = "SELECT id_name, lazy, value, file_name FROM bindings WHERE id_name = ?";
-    int result = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    check_sqlite_result(result, "Failed to prepare bindings query");
-
-    result = sqlite3_bind_text(stmt, 1, idname.c_str(), -1, SQLITE_TRANSIENT);
-    check_sqlite_result(result, "Failed to bind parameter");
-
-    result = sqlite3_step(stmt);
-    if (result != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        throw BundleReaderError(fmt::format("Binding not found: {}", idname));
-    }
+// Resets a cached statement when it goes out of scope, even if a visitor throws,
+// so that its read transaction does not outlive the call.
+struct ResetGuard {
+    sqlite3_stmt* stmt;
+    ~ResetGuard() { sqlite3_reset(stmt); }
+};
 
+// Read a row of (id_name, lazy, value, file_name).
+static Binding read_binding(sqlite3_stmt* stmt) {
     Binding binding;
     const unsigned char* text;
 
@@ -80,61 +135,163 @@ Binding BundleReader::get_binding(const std::string& idname) {
     text = sqlite3_column_text(stmt, 3);
     binding.filename = text ? reinterpret_cast<const char*>(text) : "";
 
-    sqlite3_finalize(stmt);
     return binding;
 }
 
-std::vector<std::string> BundleReader::get_dependencies(const std::string& idname) {
-    std::unordered_map<std::string, bool> seen;
-    std::vector<std::string> dependencies;
-    get_dependencies_recursive(idname, seen, dependencies);
-    return dependencies;
-}
+Binding BundleReader::get_binding(const std::string& idname) {
+    sqlite3_stmt* stmt = prepare_cached(binding_stmt_,
+        "SELECT id_name, lazy, value, file_name FROM bindings WHERE id_name = ?");
 
-void BundleReader::get_dependencies_recursive(
-    const std::string& idname,
-    std::unordered_map<std::string, bool>& seen,
-    std::vector<std::string>& dependencies) {
+    int result = sqlite3_bind_text(stmt, 1, idname.c_str(), static_cast<int>(idname.size()), SQLITE_STATIC);
+    check_sqlite_result(result, "Failed to bind parameter");
 
-    // If we've already processed this dependency, skip it (prevents cycles).
-    if (seen[idname]) {
-        return;
+    result = sqlite3_step(stmt);
+    if (result != SQLITE_ROW) {
+        check_sqlite_result(result, "Failed to execute bindings query");
+        throw BundleReaderError(fmt::format("Binding not found: {}", idname));
     }
-    seen[idname] = true;
+    Binding binding = read_binding(stmt);
+
+    // Release the read transaction now rather than at the next reuse.
+    sqlite3_reset(stmt);
+    return binding;
+}
 
-    // Add the current id to the dependencies list.
-    dependencies.push_back(idname);
+std::vector<std::string> BundleReader::get_dependencies(const std::string& idname) {
+    sqlite3_stmt* stmt = prepare_cached(dependencies_stmt_,
+        DEPENDENCY_CLOSURE_CTE "SELECT id_name FROM closure");
 
-    sqlite3_stmt* stmt = nullptr;
+    int result = sqlite3_bind_text(stmt, 1, idname.c_str(), static_cast<int>(idname.size()), SQLITE_STATIC);
+    check_sqlite_result(result, "Failed to bind parameter");
 
-    const char* sql = "SELECT needs FROM depends_ons WHERE id_name = ?";
-    int result = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    check_sqlite_result(result, "Failed to prepare depends_ons query");
+    std::vector<std::string> dependencies;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char* name = sqlite3_column_text(stmt, 0);
+        if (name) {
+            dependencies.emplace_back(reinterpret_cast<const char*>(name));
+        }
+    }
+    check_sqlite_result(result, "Failed to execute dependencies query");
+    sqlite3_reset(stmt);
+
+    return dependencies;
+}
+
+std::vector<std::string> BundleReader::get_direct_dependencies(const std::string& idname) {
+    sqlite3_stmt* stmt = prepare_cached(direct_dependencies_stmt_, "SELECT needs FROM depends_ons WHERE id_name = ?");
 
-    result = sqlite3_bind_text(stmt, 1, idname.c_str(), -1, SQLITE_TRANSIENT);
+    int result = sqlite3_bind_text(stmt, 1, idname.c_str(), static_cast<int>(idname.size()), SQLITE_STATIC);
     check_sqlite_result(result, "Failed to bind parameter");
 
-    std::vector<std::string> direct_deps;
+    std::vector<std::string> dependencies;
     while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
-        const unsigned char* needs = sqlite3_column_text(stmt, 0);
-        if (needs) {
-            direct_deps.emplace_back(reinterpret_cast<const char*>(needs));
+        const unsigned char* name = sqlite3_column_text(stmt, 0);
+        if (name) {
+            dependencies.emplace_back(reinterpret_cast<const char*>(name));
         }
     }
+    check_sqlite_result(result, "Failed to execute direct dependencies query");
+    sqlite3_reset(stmt);
 
-    check_sqlite_result(result, "Failed to execute DependsOn query");
-    sqlite3_finalize(stmt);
+    return dependencies;
+}
 
-    // Recursively process each direct dependency.
-    for (const auto& dep : direct_deps) {
-        // Add to result if not already seen.
-        if (!seen[dep]) {
-            dependencies.push_back(dep);
-            get_dependencies_recursive(dep, seen, dependencies);
+std::vector<Binding> BundleReader::get_dependency_bindings(const std::string& idname, bool with_lazy_values) {
+    std::vector<Binding> bindings;
+    run_closure_bindings_query(idname, with_lazy_values, false, [&](Binding& binding, std::string_view) {
+        bindings.push_back(std::move(binding));
+    });
+    return bindings;
+}
+
+void BundleReader::visit_dependency_bindings(const std::string& idname, const BindingVisitor& visitor,
+                                             bool with_lazy_values) {
+    run_closure_bindings_query(idname, with_lazy_values, has_bytecodes_, visitor);
+}
+
+void BundleReader::run_closure_bindings_query(const std::string& idname, bool with_lazy_values, bool with_bytecode,
+                                              const BindingVisitor& visitor) {
+    // The LEFT JOIN keeps dependencies that have no binding, so that they can be
+    // reported. The CASEs mean the (possibly large) values of lazy bindings are
+    // never read from the file, and that a binding is read in only one encoding.
+    // The query is prepared in two shapes, since the bytecodes table is optional.
+    sqlite3_stmt* stmt = with_bytecode
+        ? prepare_cached(closure_bytecodes_stmt_,
+            DEPENDENCY_CLOSURE_CTE
+            "SELECT c.id_name, b.lazy, "
+            "       CASE WHEN (b.lazy != 0 AND ?2 = 0) OR y.code IS NOT NULL THEN NULL ELSE b.value END, "
+            "       b.file_name, b.id_name IS NULL, "
+            "       CASE WHEN b.lazy != 0 AND ?2 = 0 THEN NULL ELSE y.code END "
+            "FROM closure c LEFT JOIN bindings b ON b.id_name = c.id_name "
+            "LEFT JOIN bytecodes y ON y.id_name = c.id_name "
+            "ORDER BY c.id_name")
+        : prepare_cached(closure_bindings_stmt_,
+            DEPENDENCY_CLOSURE_CTE
+            "SELECT c.id_name, b.lazy, CASE WHEN b.lazy != 0 AND ?2 = 0 THEN NULL ELSE b.value END, b.file_name, "
+            "       b.id_name IS NULL "
+            "FROM closure c LEFT JOIN bindings b ON b.id_name = c.id_name "
+            "ORDER BY c.id_name");
+
+    int result = sqlite3_bind_text(stmt, 1, idname.c_str(), static_cast<int>(idname.size()), SQLITE_STATIC);
+    check_sqlite_result(result, "Failed to bind parameter");
+    result = sqlite3_bind_int(stmt, 2, with_lazy_values ? 1 : 0);
+    check_sqlite_result(result, "Failed to bind parameter");
+
+    ResetGuard reset_guard{stmt};
+
+    // The closure is computed and sorted before the first row comes back. The
+    // visitor is called outside the timers, so that its work is not charged
+    // to reading the bundle.
+    auto step = [&](StartupPhase phase) {
+        PhaseTimer timer(startup_stats_, phase);
+        return sqlite3_step(stmt);
+    };
+    result = step(StartupPhase::DependencyClosure);
+    while (result == SQLITE_ROW) {
+        if (sqlite3_column_int(stmt, 4) != 0) {
+            std::string missing = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            throw BundleReaderError(fmt::format("Binding not found: {}", missing));
         }
+        Binding binding;
+        std::string_view bytecode;
+        {
+            PhaseTimer timer(startup_stats_, StartupPhase::BindingFetch);
+            binding = read_binding(stmt);
+            if (with_bytecode) {
+                // sqlite3_column_blob must be called before sqlite3_column_bytes.
+                const void* blob = sqlite3_column_blob(stmt, 5);
+                bytecode = std::string_view(static_cast<const char*>(blob), sqlite3_column_bytes(stmt, 5));
+            }
+        }
+        visitor(binding, bytecode);
+        result = step(StartupPhase::BindingFetch);
     }
+    check_sqlite_result(result, "Failed to execute dependency bindings query");
 }
 
+bool BundleReader::visit_bytecode(const std::string& idname,
+                                  const std::function<void(std::string_view bytecode)>& visitor) {
+    if (!has_bytecodes_) {
+        return false;
+    }
+    sqlite3_stmt* stmt = prepare_cached(bytecode_stmt_, "SELECT code FROM bytecodes WHERE id_name = ?");
 
+    int result = sqlite3_bind_text(stmt, 1, idname.c_str(), static_cast<int>(idname.size()), SQLITE_STATIC);
+    check_sqlite_result(result, "Failed to bind parameter");
+
+    ResetGuard reset_guard{stmt};
+
+    result = sqlite3_step(stmt);
+    if (result != SQLITE_ROW) {
+        check_sqlite_result(result, "Failed to execute bytecodes query");
+        return false;
+    }
+    const void* blob = sqlite3_column_blob(stmt, 0);
+    if (blob == nullptr) {
+        return false;
+    }
+    visitor(std::string_view(static_cast<const char*>(blob), sqlite3_column_bytes(stmt, 0)));
+    return true;
+}
 
 } // namespace nutmeg
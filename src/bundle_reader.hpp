@@ -3,12 +3,15 @@
 
 #include "function_object.hpp"
 #include "instruction.hpp"
+#include "startup_stats.hpp"
 #include <sqlite3.h>
 #include <string>
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
+#include <functional>
+#include <string_view>
 
 namespace nutmeg {
 
@@ -30,17 +33,42 @@ private:
     sqlite3* db_;
     std::string bundle_path_;
 
+    // Statements are prepared on first use and then reset and reused, rather
+    // than prepared and finalized on every call.
+    sqlite3_stmt* binding_stmt_ = nullptr;
+    sqlite3_stmt* dependencies_stmt_ = nullptr;
+    sqlite3_stmt* direct_dependencies_stmt_ = nullptr;
+    sqlite3_stmt* closure_bindings_stmt_ = nullptr;
+    sqlite3_stmt* closure_bytecodes_stmt_ = nullptr;
+    sqlite3_stmt* bytecode_stmt_ = nullptr;
+
+    // Whether the bundle has the optional bytecodes table of binary-encoded
+    // function objects (see bytecode.hpp).
+    bool has_bytecodes_ = false;
+
+    // Where the closure query is timed, if anywhere (see --startup-stats).
+    StartupStats* startup_stats_ = nullptr;
+
     // Helper to execute queries and handle errors.
     void check_sqlite_result(int result, const std::string& operation);
 
-    // Recursive helper for computing transitive dependencies.
-    // Tracks seen dependencies to prevent infinite loops from cycles.
-    void get_dependencies_recursive(
-        const std::string& idname,
-        std::unordered_map<std::string, bool>& seen,
-        std::vector<std::string>& dependencies);
+    // Prepare sql into stmt if it is not prepared yet, otherwise reset it and
+    // clear its parameters. Returns stmt.
+    sqlite3_stmt* prepare_cached(sqlite3_stmt*& stmt, const char* sql);
+
+public:
+    // A BindingVisitor receives each binding together with a view of its binary
+    // bytecode, which is empty if it has none. The view points into SQLite's
+    // row buffer and is only valid during the call.
+    using BindingVisitor = std::function<void(Binding& binding, std::string_view bytecode)>;
+
+private:
+    // Run the dependency-closure query, with or without the bytecode column.
+    void run_closure_bindings_query(const std::string& idname, bool with_lazy_values, bool with_bytecode,
+                                    const BindingVisitor& visitor);
 
 public:
+    // Open a bundle read-only and immutable, through a memory mapping.
     explicit BundleReader(const std::string& bundle_path);
     ~BundleReader();
 
@@ -54,8 +82,37 @@ public:
     // Get binding by IdName.
     Binding get_binding(const std::string& idname);
 
-    // Get dependencies for a given IdName.
+    // Get the transitive dependencies of idname, including idname itself (first),
+    // computed by a single recursive query. Cycles are allowed.
     std::vector<std::string> get_dependencies(const std::string& idname);
+
+    // Get the names idname depends on directly, not including idname itself.
+    std::vector<std::string> get_direct_dependencies(const std::string& idname);
+
+    // Get the bindings of the transitive dependencies of idname in a single
+    // query, in primary-key order so that the bindings table is read
+    // sequentially. The values of lazy bindings are left empty unless
+    // with_lazy_values, since they are fetched again by get_binding on first use.
+    std::vector<Binding> get_dependency_bindings(const std::string& idname, bool with_lazy_values = false);
+
+    // Visit the same bindings as get_dependency_bindings, in the same order, from
+    // the same single query. A binding with bytecode arrives with its JSON value
+    // left empty, so that only one encoding is read from the file.
+    void visit_dependency_bindings(const std::string& idname, const BindingVisitor& visitor,
+                                   bool with_lazy_values = false);
+
+    // Call visitor with the binary bytecode of idname and return true, or return
+    // false if it has none. The view is only valid during the call.
+    bool visit_bytecode(const std::string& idname, const std::function<void(std::string_view bytecode)>& visitor);
+
+    bool has_bytecodes() const { return has_bytecodes_; }
+
+    // Charge the dependency-closure query to the startup phases of stats: the
+    // time to its first row to DependencyClosure, the rest to BindingFetch.
+    void set_startup_stats(StartupStats* stats) { startup_stats_ = stats; }
+
+    // The SQLite URI used to open bundle_path, with its open flags.
+    static std::string make_uri(const std::string& bundle_path);
 };
 
 } // namespace nutmeg
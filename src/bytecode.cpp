@@ -0,0 +1,282 @@
+#include "bytecode.hpp"
+#include "machine.hpp"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+// Bit 7 of the opcode byte marks an instruction whose integer operand is an
+// unsigned literal above INT64_MAX. Opcode numbers are well below it.
+static constexpr uint8_t UNSIGNED_INDEX_FLAG = 0x80;
+static_assert(NUM_OPCODES < UNSIGNED_INDEX_FLAG, "Opcode numbers must leave bit 7 of the opcode byte free");
+
+static uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static void append_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+BytecodeDecoder::BytecodeDecoder(Machine& machine)
+    : machine_(machine) {
+}
+
+void BytecodeDecoder::fail(const char* what) const {
+    throw std::runtime_error(fmt::format("Bytecode decoding error: {} at offset {}", what, pos_));
+}
+
+uint8_t BytecodeDecoder::read_byte() {
+    if (pos_ >= data_.size()) {
+        fail("unexpected end of input");
+    }
+    return static_cast<uint8_t>(data_[pos_++]);
+}
+
+uint64_t BytecodeDecoder::read_varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = read_byte();
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            // The tenth byte may only contribute the top bit.
+            if (shift == 63 && byte > 1) {
+                fail("varint out of range");
+            }
+            return value;
+        }
+    }
+    fail("varint out of range");
+}
+
+int64_t BytecodeDecoder::read_signed() {
+    return unzigzag(read_varint());
+}
+
+int BytecodeDecoder::read_count() {
+    uint64_t count = read_varint();
+    // Every counted item takes at least one byte, which bounds the count (and any
+    // reservation made for it) by the input size.
+    if (count > data_.size() - pos_) {
+        fail("count exceeds input");
+    }
+    return static_cast<int>(count);
+}
+
+std::string_view BytecodeDecoder::read_string_ref() {
+    uint64_t index = read_varint();
+    if (index >= strings_.size()) {
+        fail("string index out of range");
+    }
+    return strings_[index];
+}
+
+FunctionObject BytecodeDecoder::decode(std::string_view bytecode) {
+    data_ = bytecode;
+    pos_ = 0;
+    strings_.clear();
+    instruction_offsets_.clear();
+    handlers_.clear();
+
+    if (read_byte() != 'N' || read_byte() != 'B') {
+        fail("bad magic number");
+    }
+    if (read_byte() != BYTECODE_VERSION) {
+        fail("unsupported version");
+    }
+
+    FunctionObject func;
+    int64_t nlocals = read_signed();
+    int64_t nparams = read_signed();
+    if (nlocals < std::numeric_limits<int>::min() || nlocals > std::numeric_limits<int>::max() ||
+        nparams < std::numeric_limits<int>::min() || nparams > std::numeric_limits<int>::max()) {
+        fail("integer out of range");
+    }
+    func.nlocals = static_cast<int>(nlocals);
+    func.nparams = static_cast<int>(nparams);
+
+    int num_strings = read_count();
+    strings_.reserve(num_strings);
+    for (int i = 0; i < num_strings; i++) {
+        uint64_t length = read_varint();
+        if (length > data_.size() - pos_) {
+            fail("string exceeds input");
+        }
+        strings_.push_back(data_.substr(pos_, length));
+        pos_ += length;
+    }
+
+    int num_instructions = read_count();
+    instruction_offsets_.reserve(num_instructions);
+    for (int n = 0; n < num_instructions; n++) {
+        uint8_t opcode_byte = read_byte();
+        uint8_t opcode_number = opcode_byte & ~UNSIGNED_INDEX_FLAG;
+        if (opcode_number >= NUM_OPCODES) {
+            fail("unknown opcode");
+        }
+        Instruction inst;
+        inst.opcode = static_cast<Opcode>(opcode_number);
+        inst.unsigned_index = (opcode_byte & UNSIGNED_INDEX_FLAG) != 0;
+
+        const OpcodeDescriptor& descriptor = describe(inst.opcode);
+        for (int i = 0; i < descriptor.num_operands; i++) {
+            switch (descriptor.operands[i]) {
+            case OperandKind::IntLiteral:
+            case OperandKind::Index:
+            case OperandKind::LocalOffset:
+                inst.index = inst.unsigned_index ? static_cast<int64_t>(read_varint()) : read_signed();
+                break;
+            case OperandKind::StringConstant:
+            case OperandKind::GlobalRef:
+                inst.value = read_string_ref();
+                break;
+            case OperandKind::CalleeRef:
+            case OperandKind::SysFunctionRef:
+                inst.name = read_string_ref();
+                break;
+            case OperandKind::HeapConstant:
+            case OperandKind::FunctionRef:
+                // Rejected by plant_instruction with a better message.
+                break;
+            }
+        }
+
+        instruction_offsets_.push_back(static_cast<uint32_t>(func.code.size()));
+        machine_.plant_instruction(func, inst);
+    }
+
+    int num_handlers = read_count();
+    for (int n = 0; n < num_handlers; n++) {
+        // Each field is 0 if absent, otherwise its zigzag encoding plus one.
+        auto read_optional = [&]() -> std::optional<int64_t> {
+            uint64_t word = read_varint();
+            if (word == 0) {
+                return std::nullopt;
+            }
+            return unzigzag(word - 1);
+        };
+        HandlerSpec spec;
+        spec.start = read_optional();
+        spec.end = read_optional();
+        spec.target = read_optional();
+        spec.index = read_optional();
+        handlers_.push_back(spec);
+    }
+    if (pos_ != data_.size()) {
+        fail("unexpected trailing bytes");
+    }
+
+    machine_.finish_function(func, instruction_offsets_, handlers_);
+    return func;
+}
+
+std::string encode_bytecode(std::string_view json_str) {
+    std::string out = {'N', 'B', static_cast<char>(BYTECODE_VERSION)};
+
+    try {
+        nlohmann::json j = nlohmann::json::parse(json_str);
+        append_varint(out, zigzag(j.at("nlocals").get<int>()));
+        append_varint(out, zigzag(j.at("nparams").get<int>()));
+
+        // The string table holds each distinct string once, so the instructions
+        // are encoded into a separate buffer and appended after it.
+        std::vector<const std::string*> strings;
+        std::unordered_map<std::string, uint64_t> string_index;
+        std::string code;
+        auto put_code_varint = [&](uint64_t value) { append_varint(code, value); };
+        auto put_string_ref = [&](const nlohmann::json& inst_json, const char* field, const OpcodeDescriptor& descriptor) {
+            if (!inst_json.contains(field)) {
+                throw std::runtime_error(fmt::format("{} requires a {} field", descriptor.name, field));
+            }
+            auto [it, inserted] = string_index.try_emplace(inst_json.at(field).get<std::string>(), strings.size());
+            if (inserted) {
+                strings.push_back(&it->first);
+            }
+            put_code_varint(it->second);
+        };
+
+        const auto& instructions = j.at("instructions");
+        put_code_varint(instructions.size());
+        for (const auto& inst_json : instructions) {
+            Opcode opcode = string_to_opcode(inst_json.at("type").get_ref<const std::string&>());
+            const OpcodeDescriptor& descriptor = describe(opcode);
+
+            // The same reading of "index" as parse_function_object_dom.
+            std::optional<int64_t> index;
+            bool unsigned_index = false;
+            if (inst_json.contains("index")) {
+                const auto& index_json = inst_json.at("index");
+                unsigned_index = index_json.is_number_unsigned() && index_json.get<uint64_t>() > INT64_MAX;
+                index = unsigned_index ? static_cast<int64_t>(index_json.get<uint64_t>()) : index_json.get<int64_t>();
+            }
+            code.push_back(static_cast<char>(static_cast<uint8_t>(opcode) | (unsigned_index ? UNSIGNED_INDEX_FLAG : 0)));
+
+            for (int i = 0; i < descriptor.num_operands; i++) {
+                switch (descriptor.operands[i]) {
+                case OperandKind::IntLiteral:
+                case OperandKind::LocalOffset:
+                    if (!index.has_value()) {
+                        throw std::runtime_error(fmt::format("{} requires an index field", descriptor.name));
+                    }
+                    [[fallthrough]];
+                case OperandKind::Index: {
+                    int64_t value = index.value_or(0);
+                    put_code_varint(unsigned_index ? static_cast<uint64_t>(value) : zigzag(value));
+                    break;
+                }
+                case OperandKind::StringConstant:
+                case OperandKind::GlobalRef:
+                    put_string_ref(inst_json, "value", descriptor);
+                    break;
+                case OperandKind::CalleeRef:
+                case OperandKind::SysFunctionRef:
+                    put_string_ref(inst_json, "name", descriptor);
+                    break;
+                case OperandKind::HeapConstant:
+                case OperandKind::FunctionRef:
+                    throw std::runtime_error(fmt::format("{} is planted by the runtime and cannot appear in a bundle",
+                                                         descriptor.name));
+                }
+            }
+        }
+
+        auto put_optional = [&](const nlohmann::json& h, const char* field) {
+            put_code_varint(h.contains(field) ? zigzag(h.at(field).get<int64_t>()) + 1 : 0);
+        };
+        if (j.contains("handlers")) {
+            put_code_varint(j.at("handlers").size());
+            for (const auto& h : j.at("handlers")) {
+                put_optional(h, "start");
+                put_optional(h, "end");
+                put_optional(h, "target");
+                put_optional(h, "index");
+            }
+        } else {
+            put_code_varint(0);
+        }
+
+        append_varint(out, strings.size());
+        for (const std::string* str : strings) {
+            append_varint(out, str->size());
+            out += *str;
+        }
+        out += code;
+        return out;
+    } catch (const nlohmann::json::exception& e) {
+        throw std::runtime_error(fmt::format("JSON parsing error: {}", e.what()));
+    }
+}
+
+} // namespace nutmeg
@@ -0,0 +1,71 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include "function_object.hpp"
+#include "instruction.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace nutmeg {
+
+class Machine;
+
+// The binary bytecode format is a compact alternative to the JSON encoding of
+// a function object, stored by the bundler in the optional bytecodes table
+// (see docs/bytecode-format.md). Every integer is an unsigned LEB128 varint;
+// signed integers are zigzag-encoded first.
+//
+//   'N' 'B' VERSION
+//   nlocals nparams
+//   #strings { length bytes }...
+//   #instructions { opcode operand... }...
+//   #handlers { start end target index }...
+//
+// The opcode byte is the Opcode number, with bit 7 set for an integer literal
+// above INT64_MAX. Operands follow the opcode's descriptor: integers are
+// zigzag varints (a plain varint for the unsigned literals) and names and
+// string constants are indexes into the string table. A handler's index is 0
+// if absent and otherwise its zigzag encoding plus one.
+inline constexpr uint8_t BYTECODE_VERSION = 1;
+
+// BytecodeDecoder compiles the binary encoding to threaded code. It is the
+// counterpart of FunctionParser and plants exactly the same code, but does no
+// text scanning or number conversion, and its string fields are views of the
+// input, so nothing is copied except into the heap.
+class BytecodeDecoder {
+private:
+    Machine& machine_;
+    std::string_view data_;
+    size_t pos_ = 0;
+
+    // Per-function scratch, reused when one decoder reads many functions.
+    std::vector<std::string_view> strings_;
+    std::vector<uint32_t> instruction_offsets_;
+    std::vector<HandlerSpec> handlers_;
+
+    [[noreturn]] void fail(const char* what) const;
+    uint8_t read_byte();
+    uint64_t read_varint();
+    int64_t read_signed();
+    int read_count();
+    std::string_view read_string_ref();
+
+public:
+    explicit BytecodeDecoder(Machine& machine);
+
+    // Decode one function object and compile it to threaded code. Throws
+    // std::runtime_error on malformed input or an invalid function object.
+    FunctionObject decode(std::string_view bytecode);
+};
+
+// Translate a JSON function object into the binary bytecode format. This is
+// for bundlers and tests; it checks the schema but does not resolve names, so
+// unknown sys-functions are only reported when the bytecode is decoded.
+std::string encode_bytecode(std::string_view json);
+
+} // namespace nutmeg
+
+#endif // BYTECODE_HPP
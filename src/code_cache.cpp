@@ -0,0 +1,372 @@
+#include "code_cache.hpp"
+#include "machine.hpp"
+#include "instruction.hpp"
+#include "sysfunctions.hpp"
+#include "bignum.hpp"
+#include "binary_file.hpp"
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nutmeg {
+
+// File layout, all 64-bit words in native byte order:
+//
+//   Header:  [MAGIC][key][number of records R][offset of index]
+//   Records: one per function, each padded to a whole number of words.
+//   Index:   R entries of [name offset][name length][record offset][record length].
+//
+// A record is [nlocals][nparams][code words C][handlers H][string bytes S], then
+// the C relocatable code words, the H handler entries (two words each) and S
+// bytes of string data. In the code words each label word is an opcode number
+// and each pointer operand is a reference (offset << 32 | length) into the
+// record's string data. Strings keep their null terminator so they can be
+// copied straight into the heap; names and bignum limbs do not need one.
+static constexpr uint64_t MAGIC = 0x434347454D54554EULL;  // "NUTMEGCC" in little-endian byte order.
+static constexpr uint64_t FORMAT_VERSION = 1;
+static constexpr size_t HEADER_WORDS = 4;
+static constexpr size_t RECORD_HEADER_WORDS = 5;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+
+// The relocatable form depends on the opcode numbering, the operand encodings
+// and the range of tagged ints (which decides when literals become bignums), so
+// all of them are folded into the key. A cache written by a different build is
+// then simply a miss.
+uint64_t build_fingerprint(uint64_t hash) {
+    hash = fnv1a(hash, &FORMAT_VERSION, sizeof(FORMAT_VERSION));
+    for (const OpcodeDescriptor& descriptor : OPCODE_DESCRIPTORS) {
+        hash = fnv1a(hash, descriptor.name, std::strlen(descriptor.name));
+        hash = fnv1a(hash, &descriptor.num_operands, sizeof(descriptor.num_operands));
+        hash = fnv1a(hash, descriptor.operands.data(), sizeof(descriptor.operands));
+    }
+    int64_t tagged_int_max = TAGGED_INT_MAX;
+    return fnv1a(hash, &tagged_int_max, sizeof(tagged_int_max));
+}
+
+uint64_t CodeCache::hash_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(fmt::format("Cannot read bundle for hashing: {}", path));
+    }
+    uint64_t hash = FNV_OFFSET_BASIS;
+    std::vector<char> buffer(64 * 1024);
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        hash = fnv1a(hash, buffer.data(), static_cast<size_t>(in.gcount()));
+    }
+    return hash;
+}
+
+std::string CodeCache::default_dir() {
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+        return std::string(xdg) + "/nutmeg";
+    }
+    if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return std::string(home) + "/.cache/nutmeg";
+    }
+    return ".nutmeg-cache";
+}
+
+CodeCache::CodeCache(const std::string& dir, const std::string& bundle_file)
+    : key_(build_fingerprint(hash_file(bundle_file))) {
+    path_ = fmt::format("{}/{:016x}.ncc", dir, key_);
+    open_mapping();
+}
+
+CodeCache::~CodeCache() {
+    if (map_ != nullptr) {
+        munmap(const_cast<uint8_t*>(map_), map_size_);
+    }
+}
+
+void CodeCache::open_mapping() {
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;  // No cache yet.
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_WORDS * sizeof(uint64_t)) {
+        ::close(fd);
+        return;
+    }
+    void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    map_ = static_cast<const uint8_t*>(map);
+    map_size_ = static_cast<size_t>(st.st_size);
+
+    // The file is trusted no further than its bounds checks: anything malformed
+    // is treated as an empty cache and will be replaced by the next save.
+    const uint64_t* header = reinterpret_cast<const uint64_t*>(map_);
+    uint64_t num_records = header[2];
+    uint64_t index_offset = header[3];
+    if (header[0] != MAGIC || header[1] != key_ || index_offset % sizeof(uint64_t) != 0 ||
+        index_offset > map_size_ || num_records > (map_size_ - index_offset) / (4 * sizeof(uint64_t))) {
+        return;
+    }
+    const uint64_t* index = reinterpret_cast<const uint64_t*>(map_ + index_offset);
+    for (uint64_t i = 0; i < num_records; i++) {
+        const uint64_t* entry = &index[4 * i];
+        uint64_t name_offset = entry[0], name_length = entry[1];
+        uint64_t record_offset = entry[2], record_length = entry[3];
+        if (name_offset > map_size_ || name_length > map_size_ - name_offset ||
+            record_offset % sizeof(uint64_t) != 0 || record_offset > map_size_ ||
+            record_length > map_size_ - record_offset) {
+            mapped_records_.clear();
+            return;
+        }
+        std::string_view name(reinterpret_cast<const char*>(map_ + name_offset), name_length);
+        mapped_records_[name] = std::string_view(reinterpret_cast<const char*>(map_ + record_offset), record_length);
+    }
+}
+
+std::optional<FunctionObject> CodeCache::lookup(Machine& machine, const std::string& name) const {
+    auto it = mapped_records_.find(name);
+    if (it == mapped_records_.end()) {
+        return std::nullopt;
+    }
+    std::string_view record = it->second;
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(record.data());
+    size_t total_words = record.size() / sizeof(uint64_t);
+    if (total_words < RECORD_HEADER_WORDS) {
+        return std::nullopt;
+    }
+    uint64_t num_code = words[2], num_handlers = words[3], string_bytes = words[4];
+    if (num_code > total_words || num_handlers > total_words ||
+        RECORD_HEADER_WORDS + num_code + 2 * num_handlers > total_words ||
+        string_bytes > record.size() - (RECORD_HEADER_WORDS + num_code + 2 * num_handlers) * sizeof(uint64_t)) {
+        return std::nullopt;
+    }
+    const uint64_t* code = words + RECORD_HEADER_WORDS;
+    const uint64_t* handlers = code + num_code;
+    std::string_view strings(reinterpret_cast<const char*>(handlers + 2 * num_handlers), string_bytes);
+
+    // A reference into the string data, or an empty view if it is out of range.
+    auto string_ref = [&](uint64_t ref) { return read_string_ref(strings, ref).value_or(std::string_view()); };
+
+    FunctionObject func;
+    func.nlocals = static_cast<int>(words[0]);
+    func.nparams = static_cast<int>(words[1]);
+    func.code.reserve(num_code);
+
+    // Relocate: one pass, rebuilding the T-block as tagged pointers are planted.
+    for (uint64_t i = 0; i < num_code; ) {
+        if (code[i] >= NUM_OPCODES) {
+            return std::nullopt;
+        }
+        Opcode opcode = static_cast<Opcode>(code[i++]);
+        const OpcodeDescriptor& descriptor = describe(opcode);
+        if (i + descriptor.num_operands > num_code) {
+            return std::nullopt;
+        }
+        Cell label_word;
+        label_word.label_addr = machine.get_opcode_label(opcode);
+        func.code.push_back(label_word);
+
+        for (int k = 0; k < descriptor.num_operands; k++) {
+            uint64_t word = code[i++];
+            switch (descriptor.operands[k]) {
+            case OperandKind::IntLiteral:
+            case OperandKind::Index:
+            case OperandKind::LocalOffset:
+                func.code.push_back(make_raw_u64(word));
+                break;
+
+            case OperandKind::StringConstant: {
+                std::string_view chars = string_ref(word);
+                if (chars.empty() || chars.back() != '\0') {
+                    return std::nullopt;
+                }
+                func.tblock.push_back(static_cast<uint32_t>(2 + func.code.size()));
+                // Bindings may be compiling in the background, so constants are
+                // allocated through the machine, which locks the heap.
+                func.code.push_back(machine.allocate_string_constant(chars.substr(0, chars.size() - 1)));
+                break;
+            }
+
+            case OperandKind::HeapConstant: {
+                // Only bignum literals are cached: a sign word followed by the limbs.
+                std::string_view blob = string_ref(word);
+                if (blob.size() < sizeof(uint64_t) || blob.size() % sizeof(uint64_t) != 0) {
+                    return std::nullopt;
+                }
+                BigInt value;
+                uint64_t sign;
+                std::memcpy(&sign, blob.data(), sizeof(sign));
+                value.negative = sign != 0;
+                value.limbs.resize(blob.size() / sizeof(uint64_t) - 1);
+                std::memcpy(value.limbs.data(), blob.data() + sizeof(uint64_t), blob.size() - sizeof(uint64_t));
+                func.tblock.push_back(static_cast<uint32_t>(2 + func.code.size()));
+                func.code.push_back(machine.allocate_integer_constant(value));
+                break;
+            }
+
+            case OperandKind::GlobalRef:
+            case OperandKind::CalleeRef: {
+                std::string_view global = string_ref(word);
+                if (global.empty()) {
+                    return std::nullopt;
+                }
+                func.code.push_back(make_raw_ptr(machine.resolve_ident(global)));
+                break;
+            }
+
+            case OperandKind::SysFunctionRef: {
+                auto sys = sysfunctions_table.find(string_ref(word));
+                if (sys == sysfunctions_table.end()) {
+                    return std::nullopt;
+                }
+                func.code.push_back(make_raw_ptr(reinterpret_cast<void*>(sys->second)));
+                break;
+            }
+
+            case OperandKind::FunctionRef:
+                return std::nullopt;
+            }
+        }
+    }
+
+    for (uint64_t h = 0; h < num_handlers; h++) {
+        HandlerEntry entry;
+        std::memcpy(&entry, &handlers[2 * h], sizeof(entry));
+        func.handlers.push_back(entry);
+    }
+    return func;
+}
+
+void CodeCache::add(const Machine& machine, const std::string& name, const FunctionObject& func) {
+    std::vector<uint64_t> code;
+    StringTable strings;
+    const Heap& heap = machine.get_heap();
+
+    for (size_t i = 0; i < func.code.size(); ) {
+        std::optional<Opcode> opcode = machine.find_opcode(func.code[i++].label_addr);
+        if (!opcode) {
+            return;
+        }
+        code.push_back(static_cast<uint64_t>(*opcode));
+        const OpcodeDescriptor& descriptor = describe(*opcode);
+        for (int k = 0; k < descriptor.num_operands; k++) {
+            Cell operand = func.code[i++];
+            switch (descriptor.operands[k]) {
+            case OperandKind::IntLiteral:
+            case OperandKind::Index:
+            case OperandKind::LocalOffset:
+                code.push_back(operand.u64);
+                break;
+
+            case OperandKind::StringConstant: {
+                Cell* obj_ptr = static_cast<Cell*>(as_detagged_ptr(operand));
+                code.push_back(strings.add(std::string_view(heap.get_string_data(obj_ptr), heap.get_string_char_count(obj_ptr))));
+                break;
+            }
+
+            case OperandKind::HeapConstant: {
+                if (!is_bignum(heap, operand)) {
+                    return;
+                }
+                BigInt value = to_bigint(heap, operand);
+                uint64_t sign = value.negative ? 1 : 0;
+                std::string blob(reinterpret_cast<const char*>(&sign), sizeof(sign));
+                blob.append(reinterpret_cast<const char*>(value.limbs.data()), value.limbs.size() * sizeof(uint64_t));
+                code.push_back(strings.add(blob));
+                break;
+            }
+
+            case OperandKind::GlobalRef:
+            case OperandKind::CalleeRef: {
+                std::string global = machine.global_name(static_cast<const Ident*>(operand.ptr));
+                code.push_back(strings.add(global));
+                break;
+            }
+
+            case OperandKind::SysFunctionRef: {
+                const std::string* sys_name = sysfunction_name(operand.ptr);
+                if (sys_name == nullptr) {
+                    return;
+                }
+                code.push_back(strings.add(*sys_name));
+                break;
+            }
+
+            case OperandKind::FunctionRef:
+                return;
+            }
+        }
+    }
+
+    std::vector<uint64_t> words = {
+        static_cast<uint64_t>(func.nlocals),
+        static_cast<uint64_t>(func.nparams),
+        code.size(),
+        func.handlers.size(),
+        strings.size(),
+    };
+    words.insert(words.end(), code.begin(), code.end());
+    for (const HandlerEntry& entry : func.handlers) {
+        uint64_t pair[2];
+        std::memcpy(pair, &entry, sizeof(pair));
+        words.push_back(pair[0]);
+        words.push_back(pair[1]);
+    }
+    std::string record(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+    record += strings.data();
+    record.resize((record.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t), '\0');
+    new_records_[name] = std::move(record);
+}
+
+void CodeCache::save() {
+    // Records from the existing file are carried over unless they were replaced.
+    std::vector<std::pair<std::string_view, std::string_view>> records;
+    for (const auto& pair : new_records_) {
+        records.emplace_back(pair.first, pair.second);
+    }
+    for (const auto& pair : mapped_records_) {
+        if (new_records_.find(std::string(pair.first)) == new_records_.end()) {
+            records.push_back(pair);
+        }
+    }
+
+    std::string body;
+    std::vector<uint64_t> index;
+    size_t base = HEADER_WORDS * sizeof(uint64_t);
+    for (const auto& [name, record] : records) {
+        index.push_back(base + body.size() + record.size());  // Name follows its record.
+        index.push_back(name.size());
+        index.push_back(base + body.size());
+        index.push_back(record.size());
+        body.append(record);
+        body.append(name);
+        body.resize((body.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t), '\0');
+    }
+    uint64_t header[HEADER_WORDS] = {MAGIC, key_, records.size(), base + body.size()};
+
+    // Other processes only ever see a complete cache file (see BinaryFileWriter).
+    std::filesystem::create_directories(std::filesystem::path(path_).parent_path());
+    BinaryFileWriter out(path_, "code cache");
+    out.write(header, sizeof(header));
+    out.write(body);
+    out.write(index);
+    out.commit();
+}
+
+} // namespace nutmeg
@@ -0,0 +1,85 @@
+#ifndef CODE_CACHE_HPP
+#define CODE_CACHE_HPP
+
+#include "function_object.hpp"
+#include <string>
+#include <string_view>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace nutmeg {
+
+class Machine;
+
+// Fold everything about this build that compiled code depends on (the opcode
+// numbering, the operand encodings and the range of tagged ints) into hash.
+uint64_t build_fingerprint(uint64_t hash);
+
+// CodeCache is an on-disk cache of compiled function objects, keyed by a hash
+// of the bundle's contents, so that repeated runs of the same bundle skip JSON
+// parsing and code generation.
+//
+// Threaded code contains process-specific addresses (handler labels, Ident and
+// heap pointers) so it cannot be stored verbatim. Instead the cache stores each
+// function in a relocatable form: every label word is replaced by its opcode
+// number and every pointer operand by the name or literal it came from. The
+// OpcodeDescriptor operand kinds say which is which, so loading a function is a
+// single relocation pass over the words with no parsing.
+//
+// The cache file is mapped read-only with MAP_SHARED, so concurrent processes
+// running the same bundle share its physical pages. It is only ever replaced
+// (by an atomic rename), never written in place.
+class CodeCache {
+private:
+    std::string path_;
+    uint64_t key_;
+
+    // The read-only mapping of the existing cache file, if any.
+    const uint8_t* map_ = nullptr;
+    size_t map_size_ = 0;
+
+    // Relocatable records found in the mapping, by binding name.
+    std::unordered_map<std::string_view, std::string_view> mapped_records_;
+
+    // Newly encoded records, to be written by save().
+    std::unordered_map<std::string, std::string> new_records_;
+
+    void open_mapping();
+
+public:
+    // Use the cache for bundle_file, stored in directory dir (created if needed).
+    CodeCache(const std::string& dir, const std::string& bundle_file);
+    ~CodeCache();
+
+    CodeCache(const CodeCache&) = delete;
+    CodeCache& operator=(const CodeCache&) = delete;
+
+    // The default cache directory: $XDG_CACHE_HOME/nutmeg or ~/.cache/nutmeg.
+    static std::string default_dir();
+
+    // FNV-1a hash of a file's contents.
+    static uint64_t hash_file(const std::string& path);
+
+    const std::string& path() const { return path_; }
+
+    // Relocate the cached code for a binding into the machine, or return nullopt
+    // if the binding is not cached (or its record is unusable).
+    std::optional<FunctionObject> lookup(Machine& machine, const std::string& name) const;
+
+    // Record freshly compiled code for a binding. Functions whose code cannot be
+    // expressed in relocatable form are silently not cached.
+    void add(const Machine& machine, const std::string& name, const FunctionObject& func);
+
+    // Have any records been added since the cache was opened?
+    bool is_dirty() const { return !new_records_.empty(); }
+
+    // Write the mapped and newly added records to a fresh cache file.
+    void save();
+};
+
+} // namespace nutmeg
+
+#endif // CODE_CACHE_HPP
@@ -0,0 +1,53 @@
+#include "startup_stats.hpp"
+#include <cstdlib>
+#include <new>
+
+// The replacement global operator new and delete, which count the C++ heap
+// allocations of each thread for --startup-stats (see count_allocation). This
+// is the only definition, linked into nutmeg-run, the tests, the tools and the
+// benchmarks alike, so that all of them allocate the same way.
+
+// Otherwise this behaves as the standard operator new: on failure it calls the
+// installed new-handler and retries, and only throws if there is none.
+void* operator new(std::size_t size) {
+    if (nutmeg::allocation_counting.load(std::memory_order_relaxed)) {
+        nutmeg::count_allocation();
+    }
+    for (;;) {
+        if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+// GCC sees these free pointers that came from operator new, but that is the
+// pairing: the operator new above allocates them with malloc.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,237 @@
+#include "evacuator.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <future>
+#include <thread>
+
+namespace nutmeg {
+
+// The datakey word of an object being copied, and of one that has been copied
+// (whose length cell then holds the copy's identity). No datakey is at address
+// 0 or 1.
+static constexpr uint64_t FORWARDED = 0;
+static constexpr uint64_t BUSY = 1;
+
+// Cells in each thread-local allocation buffer, and the size from which an
+// object is allocated in the target directly rather than in a buffer.
+static constexpr size_t BUFFER_CELLS = 4096;
+static constexpr size_t LARGE_OBJECT_CELLS = BUFFER_CELLS / 4;
+
+// Thrown by a thread waiting on an object that a failed thread will never finish
+// copying, to stop it without recording a failure of its own.
+struct Aborted {};
+
+Evacuator::Evacuator(const Heap& heap, const Pool& young, const Pool* old, Pool& target)
+    : heap_(heap), young_(young), old_(old), target_(target) {
+}
+
+Cell* Evacuator::allocate(Worker& worker, size_t n) {
+    // A single thread allocates exactly, leaving no holes.
+    if (workers_.size() == 1) {
+        return target_.allocate(n);
+    }
+    if (worker.buffer_next + n <= worker.buffer_end) {
+        Cell* result = worker.buffer_next;
+        worker.buffer_next += n;
+        return result;
+    }
+    std::lock_guard<std::mutex> lock(target_mutex_);
+    if (n >= LARGE_OBJECT_CELLS) {
+        return target_.allocate(n);
+    }
+    size_t buffer_cells = std::max(n, std::min(BUFFER_CELLS, target_.available()));
+    worker.buffer_next = target_.allocate(buffer_cells);
+    worker.buffer_end = worker.buffer_next + buffer_cells;
+    Cell* result = worker.buffer_next;
+    worker.buffer_next += n;
+    return result;
+}
+
+void Evacuator::forward(Worker& worker, Cell& slot) {
+    if (!is_tagged_ptr(slot)) {
+        return;
+    }
+    Cell* obj_ptr = static_cast<Cell*>(as_detagged_ptr(slot));
+    if (is_collected(obj_ptr)) {
+        slot = make_tagged_ptr(evacuate(worker, obj_ptr));
+    }
+}
+
+void Evacuator::forward_root(Worker& worker, Cell& slot) {
+    std::atomic_ref<uint64_t> word(slot.u64);
+    Cell value = make_raw_u64(word.load(std::memory_order_relaxed));
+    forward(worker, value);
+    word.store(value.u64, std::memory_order_relaxed);
+}
+
+void Evacuator::forward_root(Worker& worker, uint32_t& slot) {
+    std::atomic_ref<uint32_t> word(slot);
+    Cell value = decompress_slot(word.load(std::memory_order_relaxed), heap_.get_slot_base());
+    forward(worker, value);
+    word.store(compress_slot(value, heap_.get_slot_base()), std::memory_order_relaxed);
+}
+
+Cell* Evacuator::evacuate(Worker& worker, Cell* obj_ptr) {
+    std::atomic_ref<uint64_t> header(obj_ptr[0].u64);
+    uint64_t datakey = header.load(std::memory_order_acquire);
+    for (;;) {
+        if (datakey == FORWARDED) {
+            return static_cast<Cell*>(obj_ptr[-1].ptr);
+        }
+        if (datakey == BUSY) {
+            if (aborted_.load(std::memory_order_relaxed)) {
+                throw Aborted();
+            }
+            std::this_thread::yield();
+            datakey = header.load(std::memory_order_acquire);
+        } else if (header.compare_exchange_weak(datakey, BUSY, std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    // This thread copies the object. Its datakey was replaced by BUSY, so it is
+    // written into the copy separately.
+    const Cell* datakey_ptr = reinterpret_cast<const Cell*>(datakey);
+    size_t total_cells = heap_.collected_object_cells(obj_ptr, datakey_ptr);
+    Cell* base = allocate(worker, total_cells);
+    base[0] = obj_ptr[-1];
+    base[1].u64 = datakey;
+    std::copy(obj_ptr + 1, obj_ptr - 1 + total_cells, base + 2);
+    worker.cells_copied += total_cells;
+
+    obj_ptr[-1].ptr = &base[1];
+    header.store(FORWARDED, std::memory_order_release);
+    if (heap_.has_reference_fields(datakey_ptr)) {
+        push(worker, &base[1]);
+    }
+    return &base[1];
+}
+
+void Evacuator::scan(Worker& worker, Cell* obj_ptr) {
+    size_t num_fields = static_cast<size_t>(as_detagged_int(obj_ptr[-1]));
+    // Fetch the header words (length and datakey) of every target first, so that
+    // the misses overlap instead of being taken one copy at a time.
+    for (size_t i = 0; i < num_fields; i++) {
+        Cell field = heap_.load_slot(obj_ptr, i);
+        if (is_tagged_ptr(field)) {
+            __builtin_prefetch(static_cast<Cell*>(as_detagged_ptr(field)) - 1);
+        }
+    }
+    for (size_t i = 0; i < num_fields; i++) {
+        Cell field = heap_.load_slot(obj_ptr, i);
+        if (is_tagged_ptr(field)) {
+            forward(worker, field);
+            heap_.store_slot(obj_ptr, i, field);
+        }
+    }
+}
+
+void Evacuator::push(Worker& worker, Cell* obj_ptr) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.stack.push_back(obj_ptr);
+}
+
+Cell* Evacuator::pop(Worker& worker) {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.stack.empty()) {
+        return nullptr;
+    }
+    Cell* obj_ptr = worker.stack.back();
+    worker.stack.pop_back();
+    return obj_ptr;
+}
+
+Cell* Evacuator::steal(size_t thief) {
+    // Steal the oldest entry, which is likely to lead to the most work.
+    for (size_t i = 1; i < workers_.size(); i++) {
+        Worker& victim = *workers_[(thief + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.stack.empty()) {
+            Cell* obj_ptr = victim.stack.front();
+            victim.stack.pop_front();
+            return obj_ptr;
+        }
+    }
+    return nullptr;
+}
+
+void Evacuator::fail(std::exception_ptr failure) {
+    std::lock_guard<std::mutex> lock(failure_mutex_);
+    if (!failure_) {
+        failure_ = failure;
+    }
+    aborted_.store(true, std::memory_order_release);
+}
+
+void Evacuator::work(size_t index, const std::vector<Cell*>& roots, const std::vector<uint32_t*>& slot_roots) {
+    try {
+        Worker& worker = *workers_[index];
+        for (size_t i = index; i < roots.size(); i += workers_.size()) {
+            forward_root(worker, *roots[i]);
+        }
+        for (size_t i = index; i < slot_roots.size(); i += workers_.size()) {
+            forward_root(worker, *slot_roots[i]);
+        }
+        pending_.fetch_sub(1, std::memory_order_acq_rel);
+
+        // A failed thread's work is never finished, so the others stop too.
+        while (!aborted_.load(std::memory_order_acquire)) {
+            Cell* obj_ptr = pop(worker);
+            if (obj_ptr == nullptr) {
+                obj_ptr = steal(index);
+            }
+            if (obj_ptr != nullptr) {
+                scan(worker, obj_ptr);
+                pending_.fetch_sub(1, std::memory_order_acq_rel);
+            } else if (pending_.load(std::memory_order_acquire) == 0) {
+                return;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    } catch (const Aborted&) {
+        // Another thread failed first.
+    } catch (...) {
+        fail(std::current_exception());
+    }
+}
+
+void Evacuator::run(const std::vector<Cell*>& roots, const std::vector<uint32_t*>& slot_roots, ThreadPool* workers) {
+    size_t num_workers = 1 + (workers != nullptr ? workers->size() : 0);
+    workers_.clear();
+    for (size_t i = 0; i < num_workers; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    pending_.store(static_cast<int64_t>(num_workers));
+    aborted_.store(false);
+    failure_ = nullptr;
+
+    // The helpers refer to this evacuator and the roots, so every one that
+    // started must finish before run returns, whether or not anything failed.
+    std::vector<std::future<void>> helpers;
+    try {
+        for (size_t i = 1; i < num_workers; i++) {
+            helpers.push_back(workers->submit([this, i, &roots, &slot_roots]() { work(i, roots, slot_roots); }));
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+    work(0, roots, slot_roots);
+    for (std::future<void>& helper : helpers) {
+        helper.wait();
+    }
+    if (failure_) {
+        std::rethrow_exception(failure_);
+    }
+}
+
+size_t Evacuator::get_cells_copied() const {
+    size_t total = 0;
+    for (const auto& worker : workers_) {
+        total += worker->cells_copied;
+    }
+    return total;
+}
+
+} // namespace nutmeg
@@ -0,0 +1,103 @@
+#ifndef EVACUATOR_HPP
+#define EVACUATOR_HPP
+
+#include "heap.hpp"
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nutmeg {
+
+class ThreadPool;
+
+// Evacuator is the scan phase of a copying collection: it copies every object
+// reachable from a set of root slots out of the spaces being collected, and
+// points each slot at the copy.
+//
+// It runs on the calling thread plus the workers of an optional ThreadPool.
+// Each thread has a mark stack of copied objects whose fields have still to be
+// scanned and, when its own runs dry, steals from the others'. Threads race to
+// copy an object by claiming its datakey word; the loser waits for the winner's
+// forwarding pointer. With more than one thread, copies go into thread-local
+// allocation buffers carved from the target, so the target is only locked once
+// per buffer; the unused tail of each buffer is left as a hole.
+//
+// If any thread fails (the target cannot grow, say), the others stop, and run
+// rethrows the first failure once every thread has finished. The spaces are then
+// part-evacuated, so the heap is unusable.
+class Evacuator {
+private:
+    // A thread's share of the work, on its own cache line.
+    struct alignas(64) Worker {
+        std::mutex mutex;         // Guards stack, which other workers steal from.
+        std::deque<Cell*> stack;  // Copied objects with fields to scan.
+        Cell* buffer_next = nullptr;
+        Cell* buffer_end = nullptr;
+        size_t cells_copied = 0;
+    };
+
+    const Heap& heap_;
+    const Pool& young_;
+    const Pool* old_;  // Also collected, if not null.
+    Pool& target_;
+    std::mutex target_mutex_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // Objects pushed on a mark stack but not yet scanned, plus one for each
+    // thread still forwarding its share of the roots. Work is finished when
+    // this reaches zero.
+    std::atomic<int64_t> pending_{0};
+
+    // Set when a thread fails, with the first failure.
+    std::atomic<bool> aborted_{false};
+    std::mutex failure_mutex_;
+    std::exception_ptr failure_;
+
+    void fail(std::exception_ptr failure);
+
+    bool is_collected(const Cell* ptr) const {
+        return young_.contains(ptr) || (old_ != nullptr && old_->contains(ptr));
+    }
+
+    // Allocate n cells of the target for worker.
+    Cell* allocate(Worker& worker, size_t n);
+
+    // If slot refers into a collected space, point it at the object's copy.
+    // Roots may be reached by more than one thread (a slot can be listed twice),
+    // so they are read and written atomically; each thread stores the same copy.
+    void forward(Worker& worker, Cell& slot);
+    void forward_root(Worker& worker, Cell& slot);
+    void forward_root(Worker& worker, uint32_t& slot);
+
+    // Copy obj_ptr unless another thread has, and return the copy's identity.
+    Cell* evacuate(Worker& worker, Cell* obj_ptr);
+
+    // Forward the fields of a copied object.
+    void scan(Worker& worker, Cell* obj_ptr);
+
+    void push(Worker& worker, Cell* obj_ptr);
+    Cell* pop(Worker& worker);
+    Cell* steal(size_t thief);
+
+    // Forward every num_workers-th root starting at index, then scan and steal
+    // until there is no work left anywhere.
+    void work(size_t index, const std::vector<Cell*>& roots, const std::vector<uint32_t*>& slot_roots);
+
+public:
+    // Evacuate young, and old if it is not null, into target.
+    Evacuator(const Heap& heap, const Pool& young, const Pool* old, Pool& target);
+
+    // Forward each root slot, and each compressed one (see compress_slot), and
+    // everything reachable from them, on the calling thread and every thread of
+    // workers (if not null). Throws the first failure of any thread.
+    void run(const std::vector<Cell*>& roots, const std::vector<uint32_t*>& slot_roots, ThreadPool* workers);
+
+    size_t get_cells_copied() const;
+};
+
+} // namespace nutmeg
+
+#endif // EVACUATOR_HPP
@@ -9,11 +9,28 @@
 
 namespace nutmeg {
 
+// HandlerEntry is one row of a function's exception-handler table. Offsets are
+// in instruction words relative to the start of the function's code. An
+// exception raised by an instruction in [start, end) transfers control to
+// target. If stack_local is non-zero it is the (loader-adjusted) offset of the
+// local variable holding the operand stack length to restore before the
+// exception value is pushed.
+struct HandlerEntry {
+    uint32_t start;
+    uint32_t end;
+    uint32_t target;
+    uint32_t stack_local;
+};
+
+static_assert(sizeof(HandlerEntry) == 2 * sizeof(Cell), "HandlerEntry must occupy exactly two cells");
+
 // FunctionObject represents a compiled function with its metadata and threaded code.
 struct FunctionObject {
     int nlocals;
     int nparams;
     std::vector<Cell> code;  // Compiled threaded instruction stream.
+    std::vector<HandlerEntry> handlers;  // Exception-handler table, usually empty.
+    std::vector<uint32_t> tblock;  // Positions (relative to the datakey) of tagged-pointer operands.
 };
 
 } // namespace nutmeg
@@ -0,0 +1,356 @@
+#include "function_parser.hpp"
+#include "machine.hpp"
+#include <stdexcept>
+#include <limits>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+FunctionParser::FunctionParser(Machine& machine)
+    : machine_(machine) {
+}
+
+void FunctionParser::fail(const char* what) const {
+    throw std::runtime_error(fmt::format("JSON parsing error: {} at offset {}", what, pos_));
+}
+
+void FunctionParser::skip_whitespace() {
+    while (pos_ < text_.size()) {
+        char c = text_[pos_];
+        if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            break;
+        }
+        pos_++;
+    }
+}
+
+bool FunctionParser::consume(char c) {
+    skip_whitespace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+        pos_++;
+        return true;
+    }
+    return false;
+}
+
+void FunctionParser::expect(char c) {
+    if (!consume(c)) {
+        char what[] = "expected 'x'";
+        what[10] = c;
+        fail(what);
+    }
+}
+
+std::string_view FunctionParser::parse_string(std::string& buffer) {
+    expect('"');
+    // Fast path: no escapes, so the string is a view of the input.
+    size_t start = pos_;
+    while (pos_ < text_.size()) {
+        char c = text_[pos_];
+        if (c == '"') {
+            return text_.substr(start, pos_++ - start);
+        }
+        if (c == '\\') {
+            break;
+        }
+        if (static_cast<unsigned char>(c) < 0x20) {
+            fail("control character in string");
+        }
+        pos_++;
+    }
+    if (pos_ >= text_.size()) {
+        fail("unterminated string");
+    }
+
+    // Slow path: decode into the buffer, keeping its capacity between calls.
+    buffer.assign(text_.substr(start, pos_ - start));
+    while (pos_ < text_.size()) {
+        char c = text_[pos_++];
+        if (c == '"') {
+            return buffer;
+        }
+        if (c == '\\') {
+            parse_escape(buffer);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fail("control character in string");
+        } else {
+            buffer.push_back(c);
+        }
+    }
+    fail("unterminated string");
+}
+
+void FunctionParser::parse_escape(std::string& buffer) {
+    if (pos_ >= text_.size()) {
+        fail("unterminated escape");
+    }
+    char c = text_[pos_++];
+    switch (c) {
+    case '"': buffer.push_back('"'); return;
+    case '\\': buffer.push_back('\\'); return;
+    case '/': buffer.push_back('/'); return;
+    case 'b': buffer.push_back('\b'); return;
+    case 'f': buffer.push_back('\f'); return;
+    case 'n': buffer.push_back('\n'); return;
+    case 'r': buffer.push_back('\r'); return;
+    case 't': buffer.push_back('\t'); return;
+    case 'u': break;
+    default: fail("invalid escape");
+    }
+
+    auto hex4 = [&]() {
+        if (pos_ + 4 > text_.size()) {
+            fail("truncated \\u escape");
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) {
+            char h = text_[pos_++];
+            value <<= 4;
+            if (h >= '0' && h <= '9') {
+                value |= static_cast<uint32_t>(h - '0');
+            } else if (h >= 'a' && h <= 'f') {
+                value |= static_cast<uint32_t>(h - 'a' + 10);
+            } else if (h >= 'A' && h <= 'F') {
+                value |= static_cast<uint32_t>(h - 'A' + 10);
+            } else {
+                fail("invalid \\u escape");
+            }
+        }
+        return value;
+    };
+
+    uint32_t code_point = hex4();
+    if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+        // A high surrogate must be followed by an escaped low surrogate.
+        if (pos_ + 2 > text_.size() || text_[pos_] != '\\' || text_[pos_ + 1] != 'u') {
+            fail("unpaired surrogate");
+        }
+        pos_ += 2;
+        uint32_t low = hex4();
+        if (low < 0xDC00 || low > 0xDFFF) {
+            fail("unpaired surrogate");
+        }
+        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+    } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+        fail("unpaired surrogate");
+    }
+
+    // Encode as UTF-8.
+    if (code_point < 0x80) {
+        buffer.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+        buffer.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        buffer.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+        buffer.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        buffer.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        buffer.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+        buffer.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        buffer.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        buffer.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        buffer.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+}
+
+int64_t FunctionParser::parse_integer(bool* is_unsigned) {
+    skip_whitespace();
+    bool negative = consume('-');
+    if (pos_ >= text_.size() || text_[pos_] < '0' || text_[pos_] > '9') {
+        fail("expected an integer");
+    }
+    // Accumulate the magnitude, which may use all 64 bits.
+    uint64_t magnitude = 0;
+    while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') {
+        uint64_t digit = static_cast<uint64_t>(text_[pos_++] - '0');
+        if (magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+            fail("integer out of range");
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+    if (pos_ < text_.size() && (text_[pos_] == '.' || text_[pos_] == 'e' || text_[pos_] == 'E')) {
+        fail("expected an integer");
+    }
+
+    if (negative) {
+        if (magnitude > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1) {
+            fail("integer out of range");
+        }
+        // Negate in unsigned arithmetic so that INT64_MIN is handled correctly.
+        return static_cast<int64_t>(~magnitude + 1);
+    }
+    if (magnitude > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        // Only literals may exceed INT64_MAX; they keep their bit pattern.
+        if (is_unsigned == nullptr) {
+            fail("integer out of range");
+        }
+        *is_unsigned = true;
+    }
+    return static_cast<int64_t>(magnitude);
+}
+
+int FunctionParser::parse_int32() {
+    int64_t value = parse_integer();
+    if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+        fail("integer out of range");
+    }
+    return static_cast<int>(value);
+}
+
+void FunctionParser::skip_value() {
+    skip_whitespace();
+    if (pos_ >= text_.size()) {
+        fail("unexpected end of input");
+    }
+    char c = text_[pos_];
+    if (c == '"') {
+        parse_string(key_buffer_);
+    } else if (c == '{') {
+        pos_++;
+        if (!consume('}')) {
+            do {
+                parse_string(key_buffer_);
+                expect(':');
+                skip_value();
+            } while (consume(','));
+            expect('}');
+        }
+    } else if (c == '[') {
+        pos_++;
+        if (!consume(']')) {
+            do {
+                skip_value();
+            } while (consume(','));
+            expect(']');
+        }
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        // Any JSON number, including fractions and exponents.
+        pos_++;
+        while (pos_ < text_.size() && std::string_view("0123456789.eE+-").find(text_[pos_]) != std::string_view::npos) {
+            pos_++;
+        }
+    } else {
+        for (std::string_view literal : {"true", "false", "null"}) {
+            if (text_.substr(pos_, literal.size()) == literal) {
+                pos_ += literal.size();
+                return;
+            }
+        }
+        fail("unexpected character");
+    }
+}
+
+void FunctionParser::parse_instruction(FunctionObject& func) {
+    Instruction inst;
+    bool has_type = false;
+
+    expect('{');
+    if (!consume('}')) {
+        do {
+            std::string_view key = parse_string(key_buffer_);
+            expect(':');
+            if (key == "type") {
+                inst.opcode = string_to_opcode(parse_string(type_buffer_));
+                has_type = true;
+            } else if (key == "index") {
+                inst.index = parse_integer(&inst.unsigned_index);
+            } else if (key == "value") {
+                inst.value = parse_string(value_buffer_);
+            } else if (key == "name") {
+                inst.name = parse_string(name_buffer_);
+            } else {
+                skip_value();
+            }
+        } while (consume(','));
+        expect('}');
+    }
+    if (!has_type) {
+        fail("instruction without a type field");
+    }
+
+    instruction_offsets_.push_back(static_cast<uint32_t>(func.code.size()));
+    machine_.plant_instruction(func, inst);
+}
+
+void FunctionParser::parse_handler() {
+    HandlerSpec spec;
+    expect('{');
+    if (!consume('}')) {
+        do {
+            std::string_view key = parse_string(key_buffer_);
+            expect(':');
+            if (key == "start") {
+                spec.start = parse_integer();
+            } else if (key == "end") {
+                spec.end = parse_integer();
+            } else if (key == "target") {
+                spec.target = parse_integer();
+            } else if (key == "index") {
+                spec.index = parse_integer();
+            } else {
+                skip_value();
+            }
+        } while (consume(','));
+        expect('}');
+    }
+    handlers_.push_back(spec);
+}
+
+FunctionObject FunctionParser::parse(std::string_view json) {
+    text_ = json;
+    pos_ = 0;
+    instruction_offsets_.clear();
+    handlers_.clear();
+
+    FunctionObject func;
+    bool has_nlocals = false;
+    bool has_nparams = false;
+    bool has_instructions = false;
+
+    expect('{');
+    if (!consume('}')) {
+        do {
+            std::string_view key = parse_string(key_buffer_);
+            expect(':');
+            if (key == "nlocals") {
+                func.nlocals = parse_int32();
+                has_nlocals = true;
+            } else if (key == "nparams") {
+                func.nparams = parse_int32();
+                has_nparams = true;
+            } else if (key == "instructions") {
+                expect('[');
+                if (!consume(']')) {
+                    do {
+                        parse_instruction(func);
+                    } while (consume(','));
+                    expect(']');
+                }
+                has_instructions = true;
+            } else if (key == "handlers") {
+                expect('[');
+                if (!consume(']')) {
+                    do {
+                        parse_handler();
+                    } while (consume(','));
+                    expect(']');
+                }
+            } else {
+                skip_value();
+            }
+        } while (consume(','));
+        expect('}');
+    }
+    skip_whitespace();
+    if (pos_ != text_.size()) {
+        fail("unexpected trailing characters");
+    }
+    if (!has_nlocals || !has_nparams || !has_instructions) {
+        fail("function object requires nlocals, nparams and instructions");
+    }
+
+    machine_.finish_function(func, instruction_offsets_, handlers_);
+    return func;
+}
+
+} // namespace nutmeg
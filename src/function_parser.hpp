@@ -0,0 +1,67 @@
+#ifndef FUNCTION_PARSER_HPP
+#define FUNCTION_PARSER_HPP
+
+#include "function_object.hpp"
+#include "instruction.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace nutmeg {
+
+class Machine;
+
+// FunctionParser is a streaming parser for exactly the function-object JSON
+// schema:
+//
+//   {"nlocals": N, "nparams": N,
+//    "instructions": [{"type": T, "index": N, "value": S, "name": S}, ...],
+//    "handlers": [{"start": N, "end": N, "target": N, "index": N}, ...]}
+//
+// It reads the text once and plants threaded code as each instruction object
+// closes, without building a DOM. Strings are views into the input unless they
+// contain escapes, in which case they are decoded into buffers owned by the
+// parser and reused, so no allocation is made per instruction. Keys may appear
+// in any order and unknown keys (such as "nargs") are skipped.
+class FunctionParser {
+private:
+    Machine& machine_;
+    std::string_view text_;
+    size_t pos_ = 0;
+
+    // Decoding buffers for strings with escapes, one per field that may be live
+    // at the same time.
+    std::string key_buffer_;
+    std::string type_buffer_;
+    std::string value_buffer_;
+    std::string name_buffer_;
+
+    // Per-function scratch, reused when one parser reads many functions.
+    std::vector<uint32_t> instruction_offsets_;
+    std::vector<HandlerSpec> handlers_;
+
+    [[noreturn]] void fail(const char* what) const;
+    void skip_whitespace();
+    bool consume(char c);
+    void expect(char c);
+    std::string_view parse_string(std::string& buffer);
+    void parse_escape(std::string& buffer);
+    int64_t parse_integer(bool* is_unsigned = nullptr);
+    int parse_int32();
+    void skip_value();
+    void parse_instruction(FunctionObject& func);
+    void parse_handler();
+
+public:
+    explicit FunctionParser(Machine& machine);
+
+    // Parse one function object and compile it to threaded code. Throws
+    // std::runtime_error on malformed JSON or an invalid function object.
+    FunctionObject parse(std::string_view json);
+};
+
+} // namespace nutmeg
+
+#endif // FUNCTION_PARSER_HPP
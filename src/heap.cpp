@@ -1,7 +1,13 @@
 #include "heap.hpp"
+#include "evacuator.hpp"
+#include "replicator.hpp"
+#include "thread_pool.hpp"
 #include "value.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fmt/core.h>
+#include <sys/mman.h>
 
 namespace nutmeg {
 
@@ -9,17 +15,111 @@ namespace nutmeg {
 static constexpr size_t POOL_SIZE_BYTES = 1024 * 1024;
 static constexpr size_t POOL_SIZE_CELLS = POOL_SIZE_BYTES / sizeof(Cell);
 
-Pool::Pool(size_t num_cells)
-    : cells_(num_cells), next_free_(0) {
+// The nursery is a quarter of a megabyte, small enough to stay in cache. The
+// old space starts out collected whenever it reaches a megabyte, and after each
+// full collection may grow to twice what survived (up to the maximum).
+static constexpr size_t NURSERY_SIZE_CELLS = POOL_SIZE_CELLS / 4;
+static constexpr size_t OLD_SPACE_INITIAL_CELLS = POOL_SIZE_CELLS;
+
+// The region holds the temporaries of the frames on the return stack, which
+// are few, so a small region rarely fills.
+static constexpr size_t REGION_SIZE_CELLS = POOL_SIZE_CELLS / 4;
+
+// Memory is committed 64KB at a time, or 2MB (the huge page size) at a time
+// when huge pages are wanted.
+static constexpr size_t COMMIT_GRANULE_BYTES = 64 * 1024;
+static constexpr size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+static size_t round_up(size_t n, size_t multiple) {
+    return (n + multiple - 1) / multiple * multiple;
 }
 
-Cell* Pool::allocate(size_t n) {
-    if (next_free_ + n > cells_.size()) {
+// Reserve bytes of address space, inaccessible until committed.
+static Cell* reserve(size_t bytes, bool huge_pages) {
+    // Huge pages need 2MB alignment, so over-reserve by a huge page and start at
+    // the first boundary. The slack is only address space.
+    size_t slack = huge_pages ? HUGE_PAGE_BYTES : 0;
+    void* reservation = mmap(nullptr, bytes + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
         throw std::bad_alloc();
     }
-    Cell* result = &cells_[next_free_];
-    next_free_ += n;
-    return result;
+    uintptr_t start = round_up(reinterpret_cast<uintptr_t>(reservation), huge_pages ? HUGE_PAGE_BYTES : 1);
+    if (slack != 0) {
+        size_t before = start - reinterpret_cast<uintptr_t>(reservation);
+        if (before != 0) {
+            munmap(reservation, before);
+        }
+        if (slack - before != 0) {
+            munmap(reinterpret_cast<void*>(start + bytes), slack - before);
+        }
+    }
+    return reinterpret_cast<Cell*>(start);
+}
+
+Pool::Pool(size_t num_cells, bool huge_pages, Cell* placement)
+    : cells_(nullptr), capacity_(num_cells), reserved_(Cage::pool_bytes(num_cells, huge_pages)), committed_(0),
+      granule_(huge_pages ? HUGE_PAGE_BYTES : COMMIT_GRANULE_BYTES), next_free_(0), owned_(placement == nullptr) {
+    cells_ = placement != nullptr ? placement : reserve(reserved_, huge_pages);
+    #ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        // Only advice: the kernel may decline, and then the pool uses small pages.
+        madvise(cells_, reserved_, MADV_HUGEPAGE);
+    }
+    #endif
+}
+
+Pool::~Pool() {
+    if (cells_ != nullptr && owned_) {
+        munmap(cells_, reserved_);
+    }
+}
+
+Pool::Pool(Pool&& other) noexcept
+    : cells_(nullptr), capacity_(0), reserved_(0), committed_(0), granule_(other.granule_), next_free_(0),
+      owned_(true) {
+    *this = std::move(other);
+}
+
+Pool& Pool::operator=(Pool&& other) noexcept {
+    std::swap(cells_, other.cells_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(reserved_, other.reserved_);
+    std::swap(committed_, other.committed_);
+    std::swap(granule_, other.granule_);
+    std::swap(next_free_, other.next_free_);
+    std::swap(owned_, other.owned_);
+    return *this;
+}
+
+void Pool::commit(size_t end) {
+    if (end > capacity_) {
+        throw std::bad_alloc();
+    }
+    size_t committed_bytes = committed_ * sizeof(Cell);
+    size_t new_committed_bytes = std::min(round_up(end * sizeof(Cell), granule_), reserved_);
+    if (mprotect(reinterpret_cast<char*>(cells_) + committed_bytes, new_committed_bytes - committed_bytes,
+                 PROT_READ | PROT_WRITE) != 0) {
+        throw std::bad_alloc();
+    }
+    committed_ = new_committed_bytes / sizeof(Cell);
+}
+
+void Pool::release() {
+    if (committed_ != 0) {
+        // Dropping the pages means they read as zero when next committed.
+        madvise(cells_, committed_ * sizeof(Cell), MADV_DONTNEED);
+        mprotect(cells_, committed_ * sizeof(Cell), PROT_NONE);
+    }
+    committed_ = 0;
+    next_free_ = 0;
+}
+
+void Pool::restore(const Cell* cells, size_t num_cells) {
+    if (num_cells > committed_) {
+        commit(num_cells);
+    }
+    std::copy(cells, cells + num_cells, cells_);
+    next_free_ = num_cells;
 }
 
 Cell* Pool::at(size_t index) {
@@ -32,14 +132,91 @@ const Cell* Pool::at(size_t index) const {
 
 bool Pool::contains(const void* ptr) const {
     const Cell* cell_ptr = static_cast<const Cell*>(ptr);
-    return cell_ptr >= cells_.data() && cell_ptr < cells_.data() + cells_.size();
+    return cell_ptr >= cells_ && cell_ptr < cells_ + capacity_;
+}
+
+void CardTable::clear() {
+    std::fill(cards_.begin(), cards_.end(), 0);
+}
+
+Cage::Cage(size_t bytes, bool huge_pages) : reserved_(bytes), huge_pages_(huge_pages) {
+    if (bytes != 0) {
+        base_ = reserve(bytes, huge_pages);
+    }
+}
+
+Cage::~Cage() {
+    if (base_ != nullptr) {
+        munmap(base_, reserved_);
+    }
+}
+
+size_t Cage::pool_bytes(size_t num_cells, bool huge_pages) {
+    return round_up(std::max<size_t>(num_cells, 1) * sizeof(Cell), huge_pages ? HUGE_PAGE_BYTES : COMMIT_GRANULE_BYTES);
+}
+
+Cell* Cage::carve(size_t num_cells) {
+    if (base_ == nullptr) {
+        return nullptr;
+    }
+    size_t bytes = pool_bytes(num_cells, huge_pages_);
+    // Defensive check: the heap sizes the cage to hold exactly its pools.
+    if (carved_ + bytes > reserved_) {
+        throw std::logic_error("Cage is too small for its pools");
+    }
+    Cell* cells = base_ + carved_ / sizeof(Cell);
+    carved_ += bytes;
+    return cells;
+}
+
+// A full collection copies the nursery as well as the old space, and with
+// several threads leaves a hole at the end of each allocation buffer, so the
+// semispaces are reserved with room to spare (address space only).
+static size_t semispace_cells(size_t max_cells) {
+    return 2 * max_cells + NURSERY_SIZE_CELLS;
+}
+
+// The size of the cage for compressed references, which holds every space, or
+// zero without them.
+static size_t cage_bytes(const HeapOptions& options) {
+    if (!options.compressed_references) {
+        return 0;
+    }
+    if (options.max_bytes > HeapOptions::MAX_COMPRESSED_BYTES) {
+        throw std::runtime_error(fmt::format("A heap with compressed references can be at most {} bytes, not {}",
+                                             HeapOptions::MAX_COMPRESSED_BYTES, options.max_bytes));
+    }
+    size_t max_cells = options.max_bytes / sizeof(Cell);
+    bool huge_pages = options.huge_pages;
+    size_t bytes = Cage::pool_bytes(max_cells, huge_pages) + Cage::pool_bytes(NURSERY_SIZE_CELLS, huge_pages) +
+                   2 * Cage::pool_bytes(semispace_cells(max_cells), huge_pages) +
+                   Cage::pool_bytes(REGION_SIZE_CELLS, huge_pages);
+    // Defensive check: MAX_COMPRESSED_BYTES keeps every offset within a slot.
+    if (bytes > SLOT_MAX_OFFSET_CELLS * sizeof(Cell)) {
+        throw std::logic_error("Compressed references cannot reach the whole heap");
+    }
+    return bytes;
 }
 
-Heap::Heap()
-    : pool_(POOL_SIZE_CELLS) {
+Heap::Heap(const HeapOptions& options)
+    : max_cells_(options.max_bytes / sizeof(Cell)), old_limit_(OLD_SPACE_INITIAL_CELLS),
+      cycle_threshold_(OLD_SPACE_INITIAL_CELLS / 2),
+      pause_target_nanoseconds_(static_cast<uint64_t>(options.pause_target_ms * 1e6)),
+      cage_(cage_bytes(options), options.huge_pages),
+      pool_(max_cells_, options.huge_pages, cage_.carve(max_cells_)), permanent_cards_(pool_),
+      nursery_(NURSERY_SIZE_CELLS, options.huge_pages, cage_.carve(NURSERY_SIZE_CELLS)),
+      from_space_(semispace_cells(max_cells_), options.huge_pages, cage_.carve(semispace_cells(max_cells_))),
+      to_space_(semispace_cells(max_cells_), options.huge_pages, cage_.carve(semispace_cells(max_cells_))),
+      old_cards_(from_space_), region_(REGION_SIZE_CELLS, options.huge_pages, cage_.carve(REGION_SIZE_CELLS)) {
+    if (options.gc_threads > 1) {
+        gc_workers_ = std::make_unique<ThreadPool>(options.gc_threads - 1);
+    }
     init_datakeys();
 }
 
+// Defined here, where ThreadPool and Replicator are complete.
+Heap::~Heap() = default;
+
 void Heap::init_datakeys() {
     // DatakeyDatakey is the first object in the pool.
     // Layout: [Flavour=Datakey][unused][unused][unused][Datakey=self]
@@ -73,9 +250,94 @@ void Heap::init_datakeys() {
     function_datakey_[2].u64 = 0;
     function_datakey_[3].u64 = 0;
     function_datakey_[4].ptr = datakey_datakey_;
+
+    // BignumDatakey: a datakey for binarray with BitWidth=64 and one raw word (the sign).
+    // Layout: [Flavour=Binarray][BitWidth=64][NumWords=1][unused][Datakey=DatakeyDatakey]
+    bignum_datakey_ = pool_.allocate(5);
+    bignum_datakey_[0].u64 = static_cast<uint64_t>(Flavour::Datakey);
+    bignum_datakey_[1].u64 = 64;  // BitWidth for magnitude limbs.
+    bignum_datakey_[2].u64 = 1;   // NumWords: the sign word.
+    bignum_datakey_[3].u64 = 0;
+    bignum_datakey_[4].ptr = datakey_datakey_;
+
+    // VectorDatakey: a datakey for vectors, whose elements may be any value.
+    // Layout: [Flavour=Datakey][unused][unused][Flavour=Vector][Datakey=DatakeyDatakey]
+    vector_datakey_ = pool_.allocate(5);
+    vector_datakey_[0].u64 = static_cast<uint64_t>(Flavour::Datakey);
+    vector_datakey_[1].u64 = 0;
+    vector_datakey_[2].u64 = 0;
+    vector_datakey_[3].u64 = static_cast<uint64_t>(Flavour::Vector);
+    vector_datakey_[4].ptr = datakey_datakey_;
+
+    // BoxDatakey: a datakey for boxes, which hold one raw value.
+    // Layout: [Flavour=Datakey][unused][unused][unused][Datakey=DatakeyDatakey]
+    box_datakey_[0].u64 = static_cast<uint64_t>(Flavour::Datakey);
+    box_datakey_[1].u64 = 0;
+    box_datakey_[2].u64 = 0;
+    box_datakey_[3].u64 = 0;
+    box_datakey_[4].ptr = datakey_datakey_;
+}
+
+Cell* Heap::allocate_record_datakey(size_t num_fields) {
+    // Layout: [Flavour=Datakey][NumFields][unused][Flavour=Record][Datakey=DatakeyDatakey]
+    Cell* datakey = allocate_cells(HeapSpace::Permanent, 5);
+    datakey[0].u64 = static_cast<uint64_t>(Flavour::Datakey);
+    datakey[1].u64 = num_fields;
+    datakey[2].u64 = 0;
+    datakey[3].u64 = static_cast<uint64_t>(Flavour::Record);
+    datakey[4].ptr = datakey_datakey_;
+    count_allocation(datakey_datakey_, 5);
+    return datakey;
+}
+
+void Heap::set_allocation_sampler(uint64_t interval_bytes, AllocationSampler sampler) {
+    sample_interval_bytes_ = interval_bytes;
+    bytes_until_sample_ = interval_bytes;
+    sampling_thread_ = std::this_thread::get_id();
+    allocation_sampler_ = interval_bytes != 0 ? std::move(sampler) : nullptr;
+}
+
+void Heap::sample_allocation(uint64_t bytes) {
+    if (bytes < bytes_until_sample_) {
+        bytes_until_sample_ -= bytes;
+        return;
+    }
+    // The allocation covers the next sampled byte and perhaps several more.
+    uint64_t past_sample = bytes - bytes_until_sample_;
+    uint64_t samples = 1 + past_sample / sample_interval_bytes_;
+    bytes_until_sample_ = sample_interval_bytes_ - past_sample % sample_interval_bytes_;
+    allocation_sampler_(samples * sample_interval_bytes_);
+}
+
+Cell* Heap::allocate_cells(HeapSpace space, size_t n) {
+    if (space == HeapSpace::Permanent) {
+        if (pool_.next_free() + from_space_.next_free() + n > max_cells_) {
+            throw std::bad_alloc();
+        }
+        return pool_.allocate(n);
+    }
+    // A full region is no error: the object is then an ordinary collected one,
+    // which is only less efficient.
+    if (space == HeapSpace::Region && region_.available() >= n) {
+        return region_.allocate(n);
+    }
+    if (nursery_.available() < n && root_enumerator_) {
+        collect_nursery();
+    }
+    if (nursery_.available() >= n) {
+        return nursery_.allocate(n);
+    }
+    // An object too large for the nursery is born old.
+    if (from_space_.next_free() + n > old_limit_ && root_enumerator_) {
+        collect();
+    }
+    if (pool_.next_free() + from_space_.next_free() + n > max_cells_) {
+        throw std::bad_alloc();
+    }
+    return from_space_.allocate(n);
 }
 
-Cell* Heap::allocate_string(const char* str, size_t char_count) {
+Cell* Heap::allocate_string(const char* str, size_t char_count, HeapSpace space) {
     // String layout:
     // [-1: Length (including null terminator)]
     // [0: Datakey pointer (this is the object identity)]
@@ -88,7 +350,7 @@ Cell* Heap::allocate_string(const char* str, size_t char_count) {
     // Total: 1 (length) + 1 (datakey) + data_cells.
     size_t total_cells = 2 + data_cells;
     
-    Cell* base = pool_.allocate(total_cells);
+    Cell* base = allocate_cells(space, total_cells);
     
     // Write length at position -1 (relative to datakey).
     base[0].u64 = char_count;
@@ -97,48 +359,397 @@ Cell* Heap::allocate_string(const char* str, size_t char_count) {
     Cell* obj_ptr = &base[1];
     obj_ptr[0].ptr = string_datakey_;
     
-    // Copy string data starting at position 1.
+    // Copy string data starting at position 1. The terminator is written here
+    // rather than copied, so str need not be null-terminated.
     char* data = reinterpret_cast<char*>(&obj_ptr[1]);
-    std::memcpy(data, str, char_count);
+    std::memcpy(data, str, char_count - 1);
+    data[char_count - 1] = '\0';
+    count_allocation(string_datakey_, total_cells);
     
     return obj_ptr;
 }
 
-Cell* Heap::allocate_function(size_t num_instructions, int nlocals, int nparams) {
+Cell* Heap::allocate_bignum(size_t num_limbs, bool negative, HeapSpace space) {
+    // Bignum layout:
+    // [-1: Length L, number of limbs (as tagged int)]
+    // [0: Datakey pointer (this is the object identity)]
+    // [1: Sign, raw, 1 if negative]
+    // [2..L+1: magnitude limbs, least significant first]
+    size_t total_cells = 3 + num_limbs;
+
+    Cell* base = allocate_cells(space, total_cells);
+    base[0] = make_tagged_int(static_cast<int64_t>(num_limbs));
+
+    Cell* obj_ptr = &base[1];
+    obj_ptr[0].ptr = bignum_datakey_;
+    obj_ptr[1].u64 = negative ? 1 : 0;
+    count_allocation(bignum_datakey_, total_cells);
+
+    return obj_ptr;
+}
+
+Cell* Heap::allocate_fields(Cell* datakey, size_t num_fields) {
+    // Record and vector layout:
+    // [-1: Length, number of fields (as tagged int)]
+    // [0: Datakey pointer (this is the object identity)]
+    // [1..Length: fields, each any value]
+    // With compressed references the fields are slots, two to a cell, and an
+    // odd last one is padded with nil.
+    size_t total_cells = 2 + field_cells(num_fields);
+    Cell* base = allocate_cells(HeapSpace::Collected, total_cells);
+    base[0] = make_tagged_int(static_cast<int64_t>(num_fields));
+
+    Cell* obj_ptr = &base[1];
+    obj_ptr[0].ptr = datakey;
+    if (has_compressed_references()) {
+        uint32_t* slots = reinterpret_cast<uint32_t*>(obj_ptr + 1);
+        std::fill(slots, slots + 2 * field_cells(num_fields), compress_slot(make_nil(), cage_.base()));
+    } else {
+        std::fill(obj_ptr + 1, obj_ptr + 1 + num_fields, make_nil());
+    }
+    count_allocation(datakey, total_cells);
+    return obj_ptr;
+}
+
+Cell Heap::box(Cell value) {
+    // Box layout:
+    // [-1: Length, always 1 (as tagged int)]
+    // [0: Datakey pointer (this is the object identity)]
+    // [1: the value, raw]
+    // A box that does not fit in the nursery is born old, as if it were large.
+    static constexpr size_t BOX_CELLS = 3;
+    Cell* base;
+    if (nursery_.available() >= BOX_CELLS) {
+        base = nursery_.allocate(BOX_CELLS);
+    } else if (pool_.next_free() + from_space_.next_free() + BOX_CELLS <= max_cells_) {
+        base = from_space_.allocate(BOX_CELLS);
+    } else {
+        throw std::bad_alloc();
+    }
+    base[0] = make_tagged_int(1);
+    Cell* obj_ptr = &base[1];
+    obj_ptr[0].ptr = box_datakey_;
+    obj_ptr[1] = value;
+    count_allocation(box_datakey_, BOX_CELLS);
+    return make_tagged_ptr(obj_ptr);
+}
+
+Cell* Heap::allocate_vector(size_t length) {
+    return allocate_fields(vector_datakey_, length);
+}
+
+Cell* Heap::allocate_record(Cell* datakey) {
+    return allocate_fields(datakey, static_cast<size_t>(datakey[1].u64));
+}
+
+Cell* Heap::allocate_function(size_t num_instructions, int nlocals, int nparams, size_t num_handlers,
+                              size_t tblock_length) {
     // Function layout:
+    // [-3: H (exception-handler entry count)]
     // [-2: N (instruction count)]
-    // [-1: L (T-block length, 0 for now)]
+    // [-1: L (T-block length in 32-bit entries)]
     // [0: Datakey pointer (object identity)]
     // [1: nlocals (32-bit) | nparams (32-bit) packed]
     // [2..N+1: instruction words]
-    
-    // Total: 2 (N,L) + 1 (datakey) + 1 (nlocals|nparams) + num_instructions.
-    size_t total_cells = 4 + num_instructions;
-    
-    Cell* base = pool_.allocate(total_cells);
-    
+    // [N+2..: T-block, padded to a whole cell, then H handler entries of two cells each]
+
+    // Total: 3 (H,N,L) + 1 (datakey) + 1 (nlocals|nparams) + num_instructions + T-block + handler table.
+    size_t total_cells = 5 + num_instructions + (tblock_length + 1) / 2 + 2 * num_handlers;
+
+    Cell* base = allocate_cells(HeapSpace::Permanent, total_cells);
+
+    // Write H at position -3 (as tagged int).
+    base[0] = make_tagged_int(static_cast<int64_t>(num_handlers));
+
     // Write N at position -2 (as tagged int).
-    base[0] = make_tagged_int(static_cast<int64_t>(num_instructions));
-    
-    // Write L at position -1 (T-block length = 0 for now, as tagged int).
-    base[1] = make_tagged_int(0);
-    
+    base[1] = make_tagged_int(static_cast<int64_t>(num_instructions));
+
+    // Write L at position -1 (as tagged int).
+    base[2] = make_tagged_int(static_cast<int64_t>(tblock_length));
+
     // Write datakey at position 0 (this is the object pointer we return).
-    Cell* obj_ptr = &base[2];
+    Cell* obj_ptr = &base[3];
     obj_ptr[0].ptr = function_datakey_;
-    
+
     // Pack nlocals and nparams into a single 64-bit field at position 1.
     // nlocals in lower 32 bits, nparams in upper 32 bits.
     obj_ptr[1].u64 = (static_cast<uint64_t>(nparams) << 32) | static_cast<uint32_t>(nlocals);
-    
+    count_allocation(function_datakey_, total_cells);
+
     return obj_ptr;
 }
 
+size_t Heap::collected_object_cells(const Cell* obj_ptr, const Cell* datakey) const {
+    if (datakey == string_datakey_) {
+        return 2 + (static_cast<size_t>(obj_ptr[-1].u64) + sizeof(Cell) - 1) / sizeof(Cell);
+    }
+    if (datakey == bignum_datakey_) {
+        return 3 + static_cast<size_t>(as_detagged_int(obj_ptr[-1]));
+    }
+    if (has_reference_fields(datakey)) {
+        return 2 + field_cells(static_cast<size_t>(as_detagged_int(obj_ptr[-1])));
+    }
+    if (datakey == box_datakey_) {
+        return 3;
+    }
+    // Defensive check: only strings, bignums, records, vectors and boxes are
+    // allocated in the collected space.
+    throw std::logic_error("Unknown object in the collected space");
+}
+
+Cell Heap::promote_from_region(Cell value, size_t mark) {
+    if (!is_tagged_ptr(value) || !region_.contains(as_detagged_ptr(value))) {
+        return value;
+    }
+    Cell* obj_ptr = static_cast<Cell*>(as_detagged_ptr(value));
+    if (obj_ptr - 1 < region_.at(mark)) {
+        return value;
+    }
+    // Region objects are strings and bignums, whose cells can simply be copied.
+    size_t total_cells = collected_object_cells(obj_ptr, static_cast<const Cell*>(obj_ptr[0].ptr));
+    Cell* base = allocate_cells(HeapSpace::Collected, total_cells);
+    std::copy(obj_ptr - 1, obj_ptr - 1 + total_cells, base);
+    return make_tagged_ptr(&base[1]);
+}
+
+void Heap::collect_nursery() {
+    collect_garbage(false);
+}
+
+void Heap::collect() {
+    collect_garbage(true);
+}
+
+std::vector<Cell*> Heap::gather_roots(bool full) {
+    // A full collection's roots include every function's operands. A minor one
+    // only needs those the write barrier remembered, in either older space.
+    std::vector<Cell*> roots;
+    if (full) {
+        for (Cell* obj_ptr : functions_) {
+            const uint32_t* tblock = get_function_tblock(obj_ptr);
+            size_t tblock_length = get_function_tblock_length(obj_ptr);
+            for (size_t i = 0; i < tblock_length; i++) {
+                roots.push_back(&obj_ptr[tblock[i]]);
+            }
+        }
+    } else {
+        permanent_cards_.drain([&roots](Cell& cell) { roots.push_back(&cell); });
+        if (!has_compressed_references()) {
+            old_cards_.drain([&roots](Cell& cell) { roots.push_back(&cell); });
+        }
+    }
+    if (root_enumerator_) {
+        root_enumerator_([&roots](Cell& cell) { roots.push_back(&cell); });
+    }
+    return roots;
+}
+
+std::vector<uint32_t*> Heap::gather_slot_roots() {
+    std::vector<uint32_t*> slots;
+    if (has_compressed_references()) {
+        old_cards_.drain([&slots](Cell& cell) {
+            uint32_t* pair = reinterpret_cast<uint32_t*>(&cell);
+            slots.push_back(&pair[0]);
+            slots.push_back(&pair[1]);
+        });
+    }
+    return slots;
+}
+
+void Heap::flip() {
+    // Nothing refers into the nursery any more, so the cards are all clean.
+    std::swap(from_space_, to_space_);
+    to_space_.release();
+    permanent_cards_.clear();
+    old_cards_ = CardTable(from_space_);
+    old_limit_ = std::max(OLD_SPACE_INITIAL_CELLS, 2 * from_space_.next_free());
+    cycle_threshold_ = (from_space_.next_free() + old_limit_) / 2;
+}
+
+void Heap::start_cycle() {
+    // The nursery is empty, so the snapshot is of the old space alone.
+    to_space_.reset();
+    cycle_ = std::make_unique<Replicator>(*this, from_space_, to_space_);
+    for (Cell* root : gather_roots(true)) {
+        cycle_->shade(*root);
+    }
+}
+
+size_t Heap::finish_cycle() {
+    cycle_->finish(gather_roots(true));
+    size_t cells_copied = cycle_->take_cells_copied();
+    cycle_.reset();
+    flip();
+    gc_stats_.incremental_cycles++;
+    return cells_copied;
+}
+
+void Heap::record_store(Cell* obj_ptr, size_t index) {
+    cycle_->record_store(obj_ptr, index);
+}
+
+void Heap::collect_garbage(bool full) {
+    auto start = std::chrono::steady_clock::now();
+    nursery_high_water_cells_ = std::max(nursery_high_water_cells_, nursery_.next_free());
+    old_high_water_cells_ = std::max(old_high_water_cells_, from_space_.next_free());
+
+    // Every object in the nursery may survive, so promotion needs room for all of
+    // them within the old space's limit. Otherwise the whole collected space is
+    // copied (or an incremental collection finished), which makes what room
+    // there is and sets a new limit.
+    bool over_limit = from_space_.next_free() + nursery_.next_free() > old_limit_;
+    if (pool_.next_free() + from_space_.next_free() + nursery_.next_free() > max_cells_ || (over_limit && !cycle_)) {
+        full = true;
+    }
+    // A full collection does an incremental one's work over again.
+    if (full) {
+        cycle_.reset();
+    }
+
+    // What is reclaimed is what was in the spaces collected less what was copied
+    // out of them, not the change in size: with several threads, the copies
+    // leave holes (see Evacuator), so a space can grow when most of it survives.
+    std::vector<Cell*> roots = gather_roots(full);
+    size_t cells_before = nursery_.next_free() + (full ? from_space_.next_free() : 0);
+    size_t cells_copied;
+    if (full) {
+        to_space_.reset();
+        Evacuator evacuator(*this, nursery_, &from_space_, to_space_);
+        evacuator.run(roots, {}, gc_workers_.get());
+        cells_copied = evacuator.get_cells_copied();
+        flip();
+    } else {
+        Evacuator evacuator(*this, nursery_, nullptr, from_space_);
+        evacuator.run(roots, gather_slot_roots(), gc_workers_.get());
+        cells_copied = evacuator.get_cells_copied();
+    }
+    size_t cells_reclaimed = cells_before - std::min(cells_before, cells_copied);
+    nursery_.reset();
+
+    // With a pause target, whatever is left of it after promotion goes to the
+    // incremental collection, which must finish if the old space is full.
+    const char* kind = full ? "full" : "minor";
+    bool finished_cycle = false;
+    if (!full && pause_target_nanoseconds_ != 0) {
+        if (!cycle_ && from_space_.next_free() > cycle_threshold_) {
+            start_cycle();
+        }
+        if (cycle_) {
+            auto deadline = start + std::chrono::nanoseconds(pause_target_nanoseconds_);
+            if (over_limit || cycle_->step(deadline)) {
+                size_t old_cells_before = from_space_.next_free();
+                cells_copied += finish_cycle();
+                cells_reclaimed += old_cells_before - std::min(old_cells_before, from_space_.next_free());
+                finished_cycle = true;
+                kind = over_limit ? "minor, incremental finish (forced)" : "minor, incremental finish";
+            } else {
+                cells_copied += cycle_->take_cells_copied();
+                kind = "minor, incremental slice";
+            }
+        }
+    }
+
+    // If the survivors leave no room to promote a full nursery, the program has
+    // run out of memory. (After a minor collection, the next one is full.)
+    bool exhausted = (full || finished_cycle) &&
+                     pool_.next_free() + from_space_.next_free() + NURSERY_SIZE_CELLS > max_cells_;
+
+    uint64_t pause = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    size_t bytes_copied = cells_copied * sizeof(Cell);
+    size_t bytes_reclaimed = cells_reclaimed * sizeof(Cell);
+    gc_stats_.collections++;
+    gc_stats_.minor_collections += full ? 0 : 1;
+    gc_stats_.total_pause_nanoseconds += pause;
+    gc_stats_.max_pause_nanoseconds = std::max(gc_stats_.max_pause_nanoseconds, pause);
+    gc_stats_.bytes_copied += bytes_copied;
+    gc_stats_.bytes_reclaimed += bytes_reclaimed;
+    size_t bucket = 0;
+    while (bucket + 1 < GcStats::PAUSE_BUCKETS && pause >= GcStats::pause_bucket_limit_nanoseconds(bucket)) {
+        bucket++;
+    }
+    gc_stats_.pause_histogram[bucket]++;
+    if (gc_log_) {
+        fmt::print(gc_log_, "GC {} ({}): {} bytes copied, {} bytes reclaimed, pause {:.3f} ms\n",
+                   gc_stats_.collections, kind, bytes_copied, bytes_reclaimed, pause / 1e6);
+    }
+    if (exhausted) {
+        throw std::bad_alloc();
+    }
+}
+
+std::string Heap::describe_datakey(const Cell* datakey) const {
+    if (datakey == datakey_datakey_) {
+        return "datakey";
+    }
+    if (datakey == string_datakey_) {
+        return "string";
+    }
+    if (datakey == function_datakey_) {
+        return "function";
+    }
+    if (datakey == bignum_datakey_) {
+        return "bignum";
+    }
+    if (datakey == vector_datakey_) {
+        return "vector";
+    }
+    if (datakey == box_datakey_) {
+        return "box";
+    }
+    if (static_cast<Flavour>(datakey[3].u64) == Flavour::Record) {
+        return fmt::format("record/{}", datakey[1].u64);
+    }
+    return fmt::format("datakey@{}", static_cast<const void*>(datakey));
+}
+
+HeapStats Heap::get_heap_stats() const {
+    HeapStats stats;
+    // Record datakeys of the same size share a name, and a line.
+    std::unordered_map<std::string, AllocationStats> by_name;
+    for (const auto& [datakey, allocations] : allocations_) {
+        AllocationStats& total = by_name[describe_datakey(datakey)];
+        total.objects += allocations.objects;
+        total.bytes += allocations.bytes;
+    }
+    stats.allocations.assign(by_name.begin(), by_name.end());
+    std::sort(stats.allocations.begin(), stats.allocations.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first;
+    });
+
+    stats.max_bytes = max_cells_ * sizeof(Cell);
+    stats.committed_bytes = pool_.committed_bytes() + nursery_.committed_bytes() + from_space_.committed_bytes() +
+                            to_space_.committed_bytes() + region_.committed_bytes();
+    stats.permanent_bytes = pool_.next_free() * sizeof(Cell);
+    stats.nursery_bytes = nursery_.next_free() * sizeof(Cell);
+    stats.nursery_high_water_bytes = std::max(nursery_high_water_cells_, nursery_.next_free()) * sizeof(Cell);
+    stats.old_bytes = from_space_.next_free() * sizeof(Cell);
+    stats.old_high_water_bytes = std::max(old_high_water_cells_, from_space_.next_free()) * sizeof(Cell);
+    return stats;
+}
+
 const char* Heap::get_string_data(Cell* obj_ptr) const {
     // String data starts at position 1 (after datakey).
     return reinterpret_cast<const char*>(&obj_ptr[1]);
 }
 
+size_t Heap::get_string_char_count(Cell* obj_ptr) const {
+    // The length at position -1 is stored raw, and includes the null terminator.
+    return static_cast<size_t>(obj_ptr[-1].u64);
+}
+
+uint64_t* Heap::get_bignum_limbs(Cell* obj_ptr) const {
+    return &obj_ptr[2].u64;
+}
+
+size_t Heap::get_bignum_num_limbs(Cell* obj_ptr) const {
+    return static_cast<size_t>(as_detagged_int(obj_ptr[-1]));
+}
+
+bool Heap::is_bignum_negative(Cell* obj_ptr) const {
+    return obj_ptr[1].u64 != 0;
+}
+
 Cell* Heap::get_function_code(Cell* obj_ptr) const {
     // Instruction words start at position 2 (after datakey and packed nlocals|nparams).
     return &obj_ptr[2];
@@ -154,6 +765,28 @@ int Heap::get_function_nparams(Cell* obj_ptr) const {
     return static_cast<int>(obj_ptr[1].u64 >> 32);
 }
 
+uint32_t* Heap::get_function_tblock(Cell* obj_ptr) const {
+    // The T-block immediately follows the instruction words.
+    size_t num_instructions = static_cast<size_t>(as_detagged_int(obj_ptr[-2]));
+    return reinterpret_cast<uint32_t*>(&obj_ptr[2 + num_instructions]);
+}
+
+size_t Heap::get_function_tblock_length(Cell* obj_ptr) const {
+    return static_cast<size_t>(as_detagged_int(obj_ptr[-1]));
+}
+
+HandlerEntry* Heap::get_function_handlers(Cell* obj_ptr) const {
+    // The handler table follows the T-block, which is packed 32-bit words rounded
+    // up to a whole number of cells.
+    size_t num_instructions = static_cast<size_t>(as_detagged_int(obj_ptr[-2]));
+    size_t tblock_cells = (static_cast<size_t>(as_detagged_int(obj_ptr[-1])) + 1) / 2;
+    return reinterpret_cast<HandlerEntry*>(&obj_ptr[2 + num_instructions + tblock_cells]);
+}
+
+size_t Heap::get_function_num_handlers(Cell* obj_ptr) const {
+    return static_cast<size_t>(as_detagged_int(obj_ptr[-3]));
+}
+
 ObjectBuilder::ObjectBuilder(Pool* pool)
     : pool_(pool) {
 }
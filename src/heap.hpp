@@ -1,10 +1,19 @@
 #ifndef HEAP_HPP
 #define HEAP_HPP
 
+#include <array>
 #include <cstdint>
+#include <cstdio>
 #include <vector>
+#include <functional>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include "value.hpp"
+#include "function_object.hpp"
 
 namespace nutmeg {
 
@@ -17,34 +26,159 @@ enum class Flavour : uint8_t {
     Function = 4
 };
 
+// Where an object is allocated. The datakeys, function objects and the
+// constants planted in compiled code are permanent: code is never collected,
+// and a compiled FunctionObject can wait outside the heap (in a parse future or
+// the BackgroundLoader) while the program runs, so nothing it refers to may
+// move. Everything allocated by running code goes into the collected space,
+// except the results of allocation sites the loader has proven never escape
+// their frame, which go into the region (see Machine::set_region_allocation).
+enum class HeapSpace : uint8_t {
+    Permanent,
+    Collected,
+    Region
+};
+
+// Totals over every collection of the collected space, minor or full.
+struct GcStats {
+    // Pauses are counted by length: the first bucket holds those under 100us,
+    // each bucket after it those under twice its predecessor's limit, and the
+    // last one the rest.
+    static constexpr size_t PAUSE_BUCKETS = 12;
+    static constexpr uint64_t pause_bucket_limit_nanoseconds(size_t bucket) { return uint64_t{100000} << bucket; }
+
+    uint64_t collections = 0;
+    uint64_t minor_collections = 0;
+    uint64_t incremental_cycles = 0;  // Completed incremental collections of the old space.
+    uint64_t total_pause_nanoseconds = 0;
+    uint64_t max_pause_nanoseconds = 0;
+    uint64_t bytes_copied = 0;
+    uint64_t bytes_reclaimed = 0;
+    std::array<uint64_t, PAUSE_BUCKETS> pause_histogram{};
+};
+
+// Allocations of one datakey's objects (see Heap::set_allocation_tracking).
+struct AllocationStats {
+    uint64_t objects = 0;
+    uint64_t bytes = 0;
+};
+
+// A snapshot of the heap's occupancy (see --heap-stats). The high-water marks
+// are the most each space has held, which for the nursery and old space is
+// usually just before a collection.
+struct HeapStats {
+    // Every allocation since tracking was enabled, by kind of object (as named by
+    // Heap::describe_datakey), most bytes first.
+    std::vector<std::pair<std::string, AllocationStats>> allocations;
+
+    size_t max_bytes = 0;
+    size_t committed_bytes = 0;
+    size_t permanent_bytes = 0;
+    size_t nursery_bytes = 0;
+    size_t nursery_high_water_bytes = 0;
+    size_t old_bytes = 0;
+    size_t old_high_water_bytes = 0;
+};
+
 // Forward declarations.
 class Pool;
 class Heap;
 class ObjectBuilder;
+class ThreadPool;
+class Replicator;
+
+// HeapOptions configure the heap's spaces (see --max-heap and --huge-pages).
+struct HeapOptions {
+    // The most the permanent and old spaces may hold between them.
+    size_t max_bytes = size_t{1} << 30;
+
+    // Ask for transparent huge pages, and commit memory 2MB at a time.
+    bool huge_pages = false;
+
+    // The number of threads that copy objects during a collection.
+    unsigned gc_threads = 1;
 
-// Pool is a fixed-size linear allocation arena.
+    // If not zero, collect the old space incrementally, in slices that keep each
+    // pause near this many milliseconds where possible.
+    double pause_target_ms = 0;
+
+    // Store the fields of records and vectors as 32-bit slots rather than cells,
+    // which needs every space in a single reservation of at most 16GB (see
+    // Cage), and so a max_bytes of at most MAX_COMPRESSED_BYTES.
+    bool compressed_references = false;
+    static constexpr size_t MAX_COMPRESSED_BYTES = size_t{3} << 30;
+};
+
+// Pool is a fixed-size linear allocation arena. Its cells are reserved with
+// mmap but only committed, a granule at a time, as allocation reaches them, so
+// a pool can be reserved far larger than it is ever likely to grow. The cells
+// never move, and fresh ones read as zero.
 class Pool {
 private:
-    std::vector<Cell> cells_;
-    size_t next_free_;  // Index of next free cell.
-    
+    Cell* cells_;        // Start of the reservation.
+    size_t capacity_;    // Number of cells that may be allocated.
+    size_t reserved_;    // Number of bytes reserved, a whole number of granules.
+    size_t committed_;   // Number of cells committed.
+    size_t granule_;     // Number of bytes committed at a time.
+    size_t next_free_;   // Index of next free cell.
+    bool owned_;         // Whether the reservation is the pool's own, rather than part of a Cage.
+
+    // Commit enough granules for cells up to end.
+    void commit(size_t end);
+
 public:
-    explicit Pool(size_t num_cells);
+    // Reserve num_cells cells, or if placement is not null, use the ones there,
+    // which must have been carved from a Cage.
+    explicit Pool(size_t num_cells, bool huge_pages = false, Cell* placement = nullptr);
+    ~Pool();
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Moving swaps the reservations.
+    Pool(Pool&& other) noexcept;
+    Pool& operator=(Pool&& other) noexcept;
     
     // Allocate n cells, returns pointer to first cell.
     // Throws std::bad_alloc if insufficient space.
-    Cell* allocate(size_t n);
+    Cell* allocate(size_t n) {
+        if (next_free_ + n > committed_) {
+            commit(next_free_ + n);
+        }
+        Cell* result = cells_ + next_free_;
+        next_free_ += n;
+        return result;
+    }
     
     // Get pointer to cell at index.
     Cell* at(size_t index);
     const Cell* at(size_t index) const;
     
     // Get the start of the pool.
-    Cell* start() { return cells_.data(); }
-    const Cell* start() const { return cells_.data(); }
+    Cell* start() { return cells_; }
+    const Cell* start() const { return cells_; }
     
     // Get current allocation position.
     size_t next_free() const { return next_free_; }
+
+    // Get the number of cells that can still be allocated.
+    size_t available() const { return capacity_ - next_free_; }
+
+    // Get the number of bytes committed.
+    size_t committed_bytes() const { return committed_ * sizeof(Cell); }
+
+    // Replace the pool's contents with a copy of num_cells cells, as if they had
+    // just been allocated. Throws std::bad_alloc if they do not fit.
+    void restore(const Cell* cells, size_t num_cells);
+
+    // Discard every allocation.
+    void reset() { next_free_ = 0; }
+
+    // Discard the allocations made since next_free() was mark.
+    void reset(size_t mark) { next_free_ = mark; }
+
+    // Discard every allocation and return the committed memory to the system.
+    void release();
     
     // Check if pointer is in this pool.
     bool contains(const void* ptr) const;
@@ -84,47 +218,452 @@ public:
     void reset();
 };
 
-// Heap manages the pool and provides typed allocation.
+// CardTable remembers the cells of a pool that may refer into the nursery. The
+// pool is divided into cards of 64 cells, and each card is a word with a bit per
+// cell: a clean card is passed over with a single test, and a dirty one is
+// scanned precisely, visiting only the cells whose bits are set.
+class CardTable {
+private:
+    Cell* base_;
+    std::vector<uint64_t> cards_;
+
+public:
+    static constexpr size_t CELLS_PER_CARD = 64;
+
+    explicit CardTable(Pool& pool) : base_(pool.start()) {}
+
+    // Remember slot, which must be in the pool. The table only grows as far as
+    // the pool is used, since the pool's reservation may be very large.
+    void mark(const Cell* slot) {
+        size_t index = static_cast<size_t>(slot - base_);
+        size_t card = index / CELLS_PER_CARD;
+        if (card >= cards_.size()) {
+            cards_.resize(card + 1);
+        }
+        cards_[card] |= uint64_t{1} << (index % CELLS_PER_CARD);
+    }
+
+    // Call visit with every remembered cell, then forget them all.
+    template <typename Visitor>
+    void drain(Visitor&& visit) {
+        for (size_t card = 0; card < cards_.size(); card++) {
+            for (uint64_t bits = cards_[card]; bits != 0; bits &= bits - 1) {
+                visit(base_[card * CELLS_PER_CARD + static_cast<size_t>(__builtin_ctzll(bits))]);
+            }
+            cards_[card] = 0;
+        }
+    }
+
+    // Forget every remembered cell.
+    void clear();
+};
+
+// Cage is a single reservation holding every space of a heap with compressed
+// references, so that any object can be named by its offset from the base. The
+// pools are carved from it in turn, each reserving as much as it would alone.
+class Cage {
+private:
+    Cell* base_ = nullptr;
+    size_t reserved_ = 0;  // Bytes.
+    size_t carved_ = 0;    // Bytes.
+    bool huge_pages_ = false;
+
+public:
+    // Reserve bytes, which is only address space, or nothing if bytes is zero.
+    Cage(size_t bytes, bool huge_pages);
+    ~Cage();
+
+    Cage(const Cage&) = delete;
+    Cage& operator=(const Cage&) = delete;
+
+    // The number of bytes a pool of num_cells cells reserves.
+    static size_t pool_bytes(size_t num_cells, bool huge_pages);
+
+    // Carve out the cells of the next pool, or return null if nothing is reserved.
+    Cell* carve(size_t num_cells);
+
+    // The start of the reservation, or null.
+    const Cell* base() const { return base_; }
+};
+
+// Heap manages the pools and provides typed allocation.
+//
+// Objects allocated by running code are generational. They are born in a small
+// nursery, and a minor collection, whenever it fills, promotes the survivors to
+// the old space; most objects are dead by then, and cost nothing to collect. The
+// old space is a pair of semispaces: when the next promotion would take the
+// current one past its limit, a full Cheney-style collection copies everything
+// reachable in it and in the nursery to the other one, leaving forwarding
+// pointers behind, and the two swap. Either way the copying is done by an
+// Evacuator, on gc_threads threads.
+//
+// Every space is a Pool reserved at the maximum heap size and committed as it
+// is used, so the heap grows without moving anything and a small program only
+// touches the memory it needs. The maximum bounds the permanent and old spaces
+// together; past it, allocation throws std::bad_alloc.
+//
+// The roots of a full collection are the cells the root enumerator visits (the
+// Machine's stacks and globals) and the tagged-pointer operands of every
+// function object, found through its T-block. A minor collection visits the
+// same roots outside the heap, but of the heap itself it only scans the cells
+// in the card tables, which the write barrier marks when a reference to a
+// nursery object is stored outside the nursery. Only records and vectors have
+// fields that refer to other objects.
+//
+// With a pause target, the old space is instead collected by a Replicator,
+// which starts once the old space is halfway to its limit and runs a slice at
+// the end of every minor collection until it is done. Only if the old space
+// reaches its limit first is the rest done in one pause.
+//
+// With compressed references, every space is carved from one Cage, and the
+// fields of records and vectors are 32-bit slots (see compress_slot) packed two
+// to a cell, which halves the size of pointer-heavy objects. A value that does
+// not fit in a slot is kept in a box, a collected object of its own that the
+// slot refers to: get_field and set_field hide boxes, while the collector,
+// through load_slot and store_slot, sees them as ordinary objects.
 class Heap {
+public:
+    // A RootVisitor updates a cell that may refer into the collected space.
+    using RootVisitor = std::function<void(Cell& cell)>;
+    using RootEnumerator = std::function<void(const RootVisitor& visit)>;
+
+    // An AllocationSampler is told of every sampled allocation, with the number
+    // of bytes the sample stands for (see set_allocation_sampler).
+    using AllocationSampler = std::function<void(uint64_t bytes)>;
+
 private:
+    // The most cells the permanent and old spaces may hold between them.
+    size_t max_cells_;
+
+    // How many cells the old space may hold before the next full collection,
+    // and with a pause target, before the next incremental one starts.
+    size_t old_limit_;
+    size_t cycle_threshold_;
+    uint64_t pause_target_nanoseconds_;
+
+    // The reservation every space is carved from, with compressed references.
+    Cage cage_;
+
+    // The permanent space.
     Pool pool_;
+
+    // The cells of the permanent space that may refer into the nursery.
+    CardTable permanent_cards_;
+
+    // The young generation.
+    Pool nursery_;
+
+    // The old generation: objects are promoted to from_space_ and a full
+    // collection copies the survivors to to_space_.
+    Pool from_space_;
+    Pool to_space_;
+
+    // The cells of the old space that may refer into the nursery.
+    CardTable old_cards_;
+
+    // The region, a stack of frame-scoped leaf objects. It is never collected,
+    // and holds no references, so the collector passes over it.
+    Pool region_;
+
+    // Threads that help the collecting thread copy, if gc_threads > 1.
+    std::unique_ptr<ThreadPool> gc_workers_;
+
+    // The incremental collection under way, if any.
+    std::unique_ptr<Replicator> cycle_;
+
+    // Every function object, in order of registration.
+    std::vector<Cell*> functions_;
+
+    RootEnumerator root_enumerator_;
+    GcStats gc_stats_;
+
+    // The most cells the nursery and old space have held, as of the last collection.
+    size_t nursery_high_water_cells_ = 0;
+    size_t old_high_water_cells_ = 0;
+
+    // Allocations by datakey, if tracked.
+    bool track_allocations_ = false;
+    std::unordered_map<const Cell*, AllocationStats> allocations_;
+
+    // Sampled allocations, if any: the sampler is called every interval bytes
+    // allocated on the thread that set it.
+    AllocationSampler allocation_sampler_;
+    uint64_t sample_interval_bytes_ = 0;
+    uint64_t bytes_until_sample_ = 0;
+    std::thread::id sampling_thread_;
+
+    // Every allocator reports here, once the object's cells are allocated.
+    void count_allocation(const Cell* datakey, size_t num_cells) {
+        if (track_allocations_) {
+            AllocationStats& stats = allocations_[datakey];
+            stats.objects++;
+            stats.bytes += num_cells * sizeof(Cell);
+        }
+        if (sample_interval_bytes_ != 0 && std::this_thread::get_id() == sampling_thread_) {
+            sample_allocation(num_cells * sizeof(Cell));
+        }
+    }
+    void sample_allocation(uint64_t bytes);
+    FILE* gc_log_ = nullptr;
     
     // Pointers to the fundamental datakeys (at start of pool).
     Cell* datakey_datakey_;
     Cell* string_datakey_;
     Cell* function_datakey_;
+    Cell* bignum_datakey_;
+    Cell* vector_datakey_;
+
+    // The datakey of boxes, with compressed references. Boxes are only ever in
+    // the collected space, so it lives outside the heap, where heap images do
+    // not see it.
+    Cell box_datakey_[5];
     
     // Initialize the fundamental datakeys();
     void init_datakeys();
+
+    // Allocate n cells in space, collecting first if the collected space is full.
+    Cell* allocate_cells(HeapSpace space, size_t n);
+
+    // Promote the nursery, or if full (or if the old space has reached its
+    // limit) copy the whole collected space, and record the statistics. Throws
+    // std::bad_alloc if the survivors leave no room below the maximum.
+    void collect_garbage(bool full);
+
+    // The cells that may refer into the collected space: for a full collection
+    // every function's operands, otherwise those in the card tables, and then
+    // the root enumerator's cells.
+    std::vector<Cell*> gather_roots(bool full);
+
+    // With compressed references, the old space's remembered cells hold slots,
+    // which a minor collection gathers separately, two to a cell.
+    std::vector<uint32_t*> gather_slot_roots();
+
+    // Swap the semispaces once the survivors are in to_space_, and set the
+    // limits of the next collection from their size.
+    void flip();
+
+    // Start an incremental collection, or finish it, returning the cells copied.
+    void start_cycle();
+    size_t finish_cycle();
+
+    // The write barrier's part during an incremental collection.
+    void record_store(Cell* obj_ptr, size_t index);
+
+    // Allocate a collected object of num_fields fields, all nil.
+    Cell* allocate_fields(Cell* datakey, size_t num_fields);
+
+    // The number of cells that hold num_fields fields.
+    size_t field_cells(size_t num_fields) const {
+        return has_compressed_references() ? (num_fields + 1) / 2 : num_fields;
+    }
+
+    // Return a reference to a new box holding value. It never collects, since
+    // the caller is part way through a store.
+    Cell box(Cell value);
+
+    bool is_box(Cell value) const {
+        return is_tagged_ptr(value) && static_cast<const Cell*>(as_detagged_ptr(value))[0].ptr == box_datakey_;
+    }
     
 public:
-    Heap();
+    explicit Heap(const HeapOptions& options = {});
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
     
     // Get the fundamental datakeys.
     Cell* get_datakey_datakey() const { return datakey_datakey_; }
     Cell* get_string_datakey() const { return string_datakey_; }
     Cell* get_function_datakey() const { return function_datakey_; }
+    Cell* get_bignum_datakey() const { return bignum_datakey_; }
+    Cell* get_vector_datakey() const { return vector_datakey_; }
+
+    // Allocate a (permanent) datakey for records of num_fields fields.
+    Cell* allocate_record_datakey(size_t num_fields);
     
-    // Allocate a string object.
+    // Allocate a string object from the first char_count - 1 bytes of str, plus
+    // a null terminator (char_count includes it).
     // Returns pointer to the datakey field (the object's identity).
-    Cell* allocate_string(const char* str, size_t char_count);
+    Cell* allocate_string(const char* str, size_t char_count, HeapSpace space = HeapSpace::Collected);
     
-    // Allocate a function object.
+    // Allocate a (permanent) function object with room for a T-block of tblock_length 32-bit
+    // entries and an exception-handler table of num_handlers entries (following
+    // the T-block).
     // Returns pointer to the datakey field.
-    Cell* allocate_function(size_t num_instructions, int nlocals, int nparams);
+    Cell* allocate_function(size_t num_instructions, int nlocals, int nparams, size_t num_handlers = 0,
+                            size_t tblock_length = 0);
     
+    // Allocate a bignum object with room for num_limbs 64-bit magnitude limbs,
+    // which the caller fills in least-significant first.
+    // Returns pointer to the datakey field.
+    Cell* allocate_bignum(size_t num_limbs, bool negative, HeapSpace space = HeapSpace::Collected);
+
+    // Allocate a vector of length elements, or a record of the given datakey,
+    // with every field nil. Fields are only written through set_field.
+    // Returns pointer to the datakey field.
+    Cell* allocate_vector(size_t length);
+    Cell* allocate_record(Cell* datakey);
+
+    // Get the number of fields of a record or vector, and read or write one.
+    // With compressed references, storing a value that does not fit in a slot
+    // (a float, or an integer of more than 30 bits) allocates a box, but never
+    // collects, so obj_ptr stays valid.
+    size_t get_num_fields(Cell* obj_ptr) const { return static_cast<size_t>(as_detagged_int(obj_ptr[-1])); }
+    Cell get_field(Cell* obj_ptr, size_t index) const {
+        Cell value = load_slot(obj_ptr, index);
+        if (has_compressed_references() && is_box(value)) {
+            return static_cast<const Cell*>(as_detagged_ptr(value))[1];
+        }
+        return value;
+    }
+    void set_field(Cell* obj_ptr, size_t index, Cell value) {
+        if (cycle_ && from_space_.contains(obj_ptr)) {
+            record_store(obj_ptr, index);
+        }
+        if (!has_compressed_references()) {
+            obj_ptr[1 + index] = value;
+            write_barrier(&obj_ptr[1 + index]);
+            return;
+        }
+        if (!fits_slot(value, cage_.base())) {
+            value = box(value);
+        }
+        store_slot(obj_ptr, index, value);
+        write_barrier(&obj_ptr[1 + index / 2], value);
+    }
+
+    // Whether the fields of records and vectors are compressed slots, and the
+    // base their references are offsets from.
+    bool has_compressed_references() const { return cage_.base() != nullptr; }
+    const Cell* get_slot_base() const { return cage_.base(); }
+    const Cell* get_box_datakey() const { return box_datakey_; }
+
+    // Read or write a field as the collector sees it, where a boxed value is a
+    // reference to its box. The value stored must fit in a slot.
+    Cell load_slot(const Cell* obj_ptr, size_t index) const {
+        if (has_compressed_references()) {
+            return decompress_slot(reinterpret_cast<const uint32_t*>(obj_ptr + 1)[index], cage_.base());
+        }
+        return obj_ptr[1 + index];
+    }
+    void store_slot(Cell* obj_ptr, size_t index, Cell value) const {
+        if (has_compressed_references()) {
+            reinterpret_cast<uint32_t*>(obj_ptr + 1)[index] = compress_slot(value, cage_.base());
+        } else {
+            obj_ptr[1 + index] = value;
+        }
+    }
+
+    // Make a filled-in function object's T-block a root of the collector. Every
+    // function object must be registered once it is complete.
+    void register_function(Cell* obj_ptr) { functions_.push_back(obj_ptr); }
+
+    // The write barrier, called after storing a value into slot, a cell of the
+    // heap, or into a compressed slot within it. Stores into the nursery, the
+    // stacks and the globals need no barrier.
+    void write_barrier(Cell* slot) { write_barrier(slot, *slot); }
+    void write_barrier(Cell* slot, Cell value) {
+        if (is_tagged_ptr(value) && nursery_.contains(as_detagged_ptr(value))) {
+            if (pool_.contains(slot)) {
+                permanent_cards_.mark(slot);
+            } else if (from_space_.contains(slot)) {
+                old_cards_.mark(slot);
+            }
+        }
+    }
+
+    // The number of cells an object in the collected space occupies, including
+    // the length cell before its datakey, which is given separately.
+    size_t collected_object_cells(const Cell* obj_ptr, const Cell* datakey) const;
+
+    // Whether objects of a datakey have fields that refer to other objects.
+    bool has_reference_fields(const Cell* datakey) const {
+        Flavour flavour = static_cast<Flavour>(datakey[3].u64);
+        return flavour == Flavour::Record || flavour == Flavour::Vector;
+    }
+
+    // Collect the nursery now, or the whole collected space. Without a root
+    // enumerator only the function objects are roots. Allocation collects by
+    // itself when needed.
+    void collect_nursery();
+    void collect();
+
+    // Set the source of the roots beyond the function objects. Until one is set,
+    // a full collected space throws std::bad_alloc rather than collecting.
+    void set_root_enumerator(RootEnumerator enumerator) { root_enumerator_ = std::move(enumerator); }
+
+    // Print a line per collection to log, or stop if it is null (see --gc-stats).
+    void set_gc_log(FILE* log) { gc_log_ = log; }
+    const GcStats& get_gc_stats() const { return gc_stats_; }
+
+    // Count every allocation by datakey from now on, or stop (see --heap-stats).
+    // Off by default, since it costs a hash lookup per allocation.
+    void set_allocation_tracking(bool enabled) { track_allocations_ = enabled; }
+    HeapStats get_heap_stats() const;
+
+    // Call sampler for every interval_bytes allocated from now on, or stop if
+    // interval_bytes is zero (see --alloc-profile). An allocation that spans
+    // several intervals is one call, for all of them. The sampler runs inside
+    // the allocator, so it must not allocate from this heap. Only allocations on
+    // the calling thread are sampled: constants planted by bindings compiling
+    // in the background (see --pipeline) belong to no running instruction.
+    void set_allocation_sampler(uint64_t interval_bytes, AllocationSampler sampler);
+
+    // Name the kind of object a datakey describes: "string", "record/3" (for a
+    // record of three fields) and so on.
+    std::string describe_datakey(const Cell* datakey) const;
+
+    // The region is reset a frame at a time: a frame takes a mark before it
+    // first allocates there, and resets to it when it returns.
+    size_t get_region_mark() const { return region_.next_free(); }
+    void reset_region(size_t mark) { region_.reset(mark); }
+
+    // If value refers to an object allocated in the region since mark, return a
+    // reference to a copy of it in the collected space, so that it survives the
+    // region being reset; otherwise return value.
+    Cell promote_from_region(Cell value, size_t mark);
+
+    // Get the number of bytes in use in the collected space, live or not.
+    size_t get_collected_bytes() const { return (nursery_.next_free() + from_space_.next_free()) * sizeof(Cell); }
+
+    // Check whether ptr is in the collected space, and whether it is in the nursery.
+    bool in_collected_space(const void* ptr) const { return nursery_.contains(ptr) || from_space_.contains(ptr); }
+    bool in_nursery(const void* ptr) const { return nursery_.contains(ptr); }
+
     // Get string data from a string object pointer.
     const char* get_string_data(Cell* obj_ptr) const;
+
+    // Get the number of bytes of string data, including the null terminator.
+    size_t get_string_char_count(Cell* obj_ptr) const;
     
+    // Get bignum fields from a bignum object pointer.
+    uint64_t* get_bignum_limbs(Cell* obj_ptr) const;
+    size_t get_bignum_num_limbs(Cell* obj_ptr) const;
+    bool is_bignum_negative(Cell* obj_ptr) const;
+
     // Get function instruction array from a function object pointer.
     Cell* get_function_code(Cell* obj_ptr) const;
     
     // Get function metadata.
     int get_function_nlocals(Cell* obj_ptr) const;
     int get_function_nparams(Cell* obj_ptr) const;
+
+    // Get the function's T-block and its number of entries.
+    uint32_t* get_function_tblock(Cell* obj_ptr) const;
+    size_t get_function_tblock_length(Cell* obj_ptr) const;
+
+    // Get the function's exception-handler table and its number of entries.
+    HandlerEntry* get_function_handlers(Cell* obj_ptr) const;
+    size_t get_function_num_handlers(Cell* obj_ptr) const;
     
-    // Get access to the pool for ObjectBuilder.
+    // Get access to the permanent pool for ObjectBuilder and heap images, and to
+    // the collected spaces and the region for heap dumps.
     Pool* get_pool() { return &pool_; }
+    const Pool* get_pool() const { return &pool_; }
+    const Pool* get_nursery() const { return &nursery_; }
+    const Pool* get_old_space() const { return &from_space_; }
+    const Pool* get_region() const { return &region_; }
 };
 
 } // namespace nutmeg
@@ -0,0 +1,439 @@
+#include "heap_dump.hpp"
+#include "binary_file.hpp"
+#include "code_cache.hpp"
+#include "heap.hpp"
+#include "machine.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace nutmeg {
+
+// File layout, all 64-bit words in native byte order:
+//
+//   Header:   [MAGIC][fingerprint][spaces S][roots R][string bytes B]
+//   Datakeys: the addresses of the datakey, string, function, bignum, vector and box datakeys.
+//   Slots:    the base of compressed references, or 0 if fields are cells.
+//   Spaces:   S entries of [name][base address][cells C], each followed by its C cells.
+//   Roots:    R entries of [name][value]. A stack is one root, with an entry per cell.
+//   Strings:  B bytes of names.
+//
+// Names are references (offset << 32 | length) into the strings, as in heap images.
+static constexpr uint64_t MAGIC = 0x504D4448474D544EULL;  // "NTMGHDMP" in little-endian byte order.
+static constexpr uint64_t FORMAT_VERSION = 2;
+static constexpr size_t HEADER_WORDS = 5;
+static constexpr size_t NUM_DATAKEYS = 6;
+
+// Dumps depend on the object layouts and the value representation, which the
+// fingerprint covers.
+static uint64_t dump_fingerprint() {
+    return build_fingerprint(FORMAT_VERSION ^ make_undef().u64);
+}
+
+// HeapDumpWriter accumulates the words and names of a dump.
+struct HeapDumpWriter {
+    std::vector<uint64_t> words;
+    StringTable strings;
+    uint64_t num_spaces = 0;
+    uint64_t num_roots = 0;
+
+    void add_space(std::string_view name, const Pool& pool) {
+        words.push_back(strings.add(name));
+        words.push_back(reinterpret_cast<uint64_t>(pool.start()));
+        words.push_back(pool.next_free());
+        for (size_t i = 0; i < pool.next_free(); i++) {
+            words.push_back(pool.at(i)->u64);
+        }
+        num_spaces++;
+    }
+
+    void add_root(uint64_t name_ref, Cell value) {
+        words.push_back(name_ref);
+        words.push_back(value.u64);
+        num_roots++;
+    }
+};
+
+void write_heap_dump(const Machine& machine, const std::string& path) {
+    const Heap& heap = machine.get_heap();
+    HeapDumpWriter writer;
+    const Cell* datakeys[NUM_DATAKEYS] = {heap.get_datakey_datakey(), heap.get_string_datakey(),
+                                          heap.get_function_datakey(), heap.get_bignum_datakey(),
+                                          heap.get_vector_datakey(), heap.get_box_datakey()};
+    for (const Cell* datakey : datakeys) {
+        writer.words.push_back(reinterpret_cast<uint64_t>(datakey));
+    }
+    writer.words.push_back(reinterpret_cast<uint64_t>(heap.get_slot_base()));
+    writer.add_space("permanent", *heap.get_pool());
+    writer.add_space("nursery", *heap.get_nursery());
+    writer.add_space("old", *heap.get_old_space());
+    writer.add_space("region", *heap.get_region());
+
+    machine.for_each_global([&](const std::string& name, Ident* ident) {
+        writer.add_root(writer.strings.add(name), ident->cell);
+    });
+    uint64_t operand_stack = writer.strings.add("(operand stack)");
+    for (Cell cell : machine.get_operand_stack()) {
+        writer.add_root(operand_stack, cell);
+    }
+    uint64_t return_stack = writer.strings.add("(return stack)");
+    for (Cell cell : machine.get_return_stack()) {
+        writer.add_root(return_stack, cell);
+    }
+
+    uint64_t header[HEADER_WORDS] = {MAGIC, dump_fingerprint(), writer.num_spaces, writer.num_roots,
+                                     writer.strings.size()};
+
+    // A reader never sees a partial dump (see BinaryFileWriter).
+    BinaryFileWriter out(path, "heap dump");
+    out.write(header, sizeof(header));
+    out.write(writer.words);
+    out.write(writer.strings.data());
+    out.commit();
+}
+
+HeapDump::HeapDump(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(fmt::format("Cannot open heap dump: {}", path));
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Read the words in order, checking each against the end of the file.
+    size_t position = 0;
+    auto next_word = [&]() {
+        if (data.size() - position < sizeof(uint64_t)) {
+            throw std::runtime_error(fmt::format("Heap dump is truncated or malformed: {}", path));
+        }
+        uint64_t word;
+        std::memcpy(&word, data.data() + position, sizeof(word));
+        position += sizeof(word);
+        return word;
+    };
+
+    if (data.size() < HEADER_WORDS * sizeof(uint64_t) || next_word() != MAGIC) {
+        throw std::runtime_error(fmt::format("Not a heap dump: {}", path));
+    }
+    if (next_word() != dump_fingerprint()) {
+        throw std::runtime_error(fmt::format("Heap dump was written by a different build: {}", path));
+    }
+    uint64_t num_spaces = next_word();
+    uint64_t num_roots = next_word();
+    uint64_t string_bytes = next_word();
+    if (string_bytes > data.size() - position) {
+        throw std::runtime_error(fmt::format("Heap dump is truncated or malformed: {}", path));
+    }
+    std::string strings = data.substr(data.size() - string_bytes);
+    data.resize(data.size() - string_bytes);
+    auto string_ref = [&](uint64_t ref) {
+        std::optional<std::string_view> name = read_string_ref(strings, ref);
+        if (!name) {
+            throw std::runtime_error(fmt::format("Heap dump has a bad name reference: {}", path));
+        }
+        return std::string(*name);
+    };
+
+    uint64_t* datakeys[NUM_DATAKEYS] = {&datakey_datakey_, &string_datakey_, &function_datakey_, &bignum_datakey_,
+                                        &vector_datakey_, &box_datakey_};
+    for (uint64_t* datakey : datakeys) {
+        *datakey = next_word();
+    }
+    slot_base_ = next_word();
+    for (uint64_t s = 0; s < num_spaces; s++) {
+        Space space;
+        space.name = string_ref(next_word());
+        space.base = next_word();
+        uint64_t num_cells = next_word();
+        if (num_cells > (data.size() - position) / sizeof(Cell)) {
+            throw std::runtime_error(fmt::format("Heap dump is truncated or malformed: {}", path));
+        }
+        space.cells.resize(num_cells);
+        std::memcpy(space.cells.data(), data.data() + position, num_cells * sizeof(Cell));
+        position += num_cells * sizeof(Cell);
+        spaces_.push_back(std::move(space));
+    }
+    for (uint64_t r = 0; r < num_roots; r++) {
+        std::string name = string_ref(next_word());
+        Cell value = make_raw_u64(next_word());
+        if (roots_.empty() || roots_.back().first != name) {
+            roots_.emplace_back(std::move(name), std::vector<Cell>());
+        }
+        roots_.back().second.push_back(value);
+    }
+    if (position != data.size()) {
+        throw std::runtime_error(fmt::format("Heap dump is truncated or malformed: {}", path));
+    }
+
+    find_reachable_objects();
+}
+
+const Cell& HeapDump::cell_at(uint64_t address) const {
+    for (const Space& space : spaces_) {
+        if (address >= space.base && address - space.base < space.cells.size() * sizeof(Cell)) {
+            return space.cells[(address - space.base) / sizeof(Cell)];
+        }
+    }
+    // Only possible if the dump is corrupt: an object runs off its space.
+    throw std::runtime_error(fmt::format("Heap dump has no cell at {:#x}", address));
+}
+
+Cell HeapDump::field_at(uint64_t address, uint64_t index) const {
+    if (slot_base_ == 0) {
+        return cell_at(address + (1 + index) * sizeof(Cell));
+    }
+    uint64_t pair = cell_at(address + (1 + index / 2) * sizeof(Cell)).u64;
+    uint32_t slot;
+    std::memcpy(&slot, reinterpret_cast<const char*>(&pair) + index % 2 * sizeof(uint32_t), sizeof(slot));
+    return decompress_slot(slot, reinterpret_cast<const Cell*>(slot_base_));
+}
+
+bool HeapDump::reach(Cell value, std::vector<uint32_t>& pending, uint32_t& index) {
+    if (!is_tagged_ptr(value)) {
+        return false;
+    }
+    uint64_t address = reinterpret_cast<uint64_t>(as_detagged_ptr(value));
+    auto found = object_index_.find(address);
+    if (found != object_index_.end()) {
+        index = found->second;
+        return true;
+    }
+    bool dumped = std::any_of(spaces_.begin(), spaces_.end(), [address](const Space& space) {
+        return address >= space.base && address - space.base < space.cells.size() * sizeof(Cell);
+    });
+    if (!dumped) {
+        return false;
+    }
+
+    // The object's kind and size, from its datakey and the cells before it.
+    uint64_t datakey = cell_at(address).u64;
+    auto prefix = [&](int k) { return static_cast<uint64_t>(as_detagged_int(cell_at(address - k * sizeof(Cell)))); };
+    Object object{address, "", 0};
+    auto field_cells = [&]() { return slot_base_ != 0 ? (prefix(1) + 1) / 2 : prefix(1); };
+    if (datakey == string_datakey_) {
+        object.kind = "string";
+        object.bytes = (2 + (cell_at(address - sizeof(Cell)).u64 + sizeof(Cell) - 1) / sizeof(Cell)) * sizeof(Cell);
+    } else if (datakey == bignum_datakey_) {
+        object.kind = "bignum";
+        object.bytes = (3 + prefix(1)) * sizeof(Cell);
+    } else if (datakey == function_datakey_) {
+        object.kind = "function";
+        object.bytes = (5 + prefix(2) + (prefix(1) + 1) / 2 + 2 * prefix(3)) * sizeof(Cell);
+    } else if (datakey == vector_datakey_) {
+        object.kind = "vector";
+        object.bytes = (2 + field_cells()) * sizeof(Cell);
+    } else if (datakey == box_datakey_) {
+        object.kind = "box";
+        object.bytes = 3 * sizeof(Cell);
+    } else if (datakey == datakey_datakey_) {
+        object.kind = "datakey";
+        object.bytes = 5 * sizeof(Cell);
+    } else if (static_cast<Flavour>(cell_at(datakey + 3 * sizeof(Cell)).u64) == Flavour::Record) {
+        object.kind = fmt::format("record/{}", cell_at(datakey + sizeof(Cell)).u64);
+        object.bytes = (2 + field_cells()) * sizeof(Cell);
+    } else {
+        throw std::runtime_error(fmt::format("Heap dump has an object with an unknown datakey at {:#x}", address));
+    }
+
+    index = static_cast<uint32_t>(objects_.size());
+    objects_.push_back(std::move(object));
+    references_.emplace_back();
+    object_index_.emplace(address, index);
+    pending.push_back(index);
+    return true;
+}
+
+void HeapDump::find_reachable_objects() {
+    std::vector<uint32_t> pending;
+    uint32_t index;
+    for (const auto& root : roots_) {
+        for (Cell value : root.second) {
+            reach(value, pending, index);
+        }
+    }
+    while (!pending.empty()) {
+        uint32_t from = pending.back();
+        pending.pop_back();
+        uint64_t address = objects_[from].address;
+        uint64_t datakey = cell_at(address).u64;
+        std::vector<uint32_t> references;
+        if (datakey == function_datakey_) {
+            // The T-block follows the instructions, as 32-bit offsets from the datakey.
+            uint64_t num_instructions = static_cast<uint64_t>(as_detagged_int(cell_at(address - 2 * sizeof(Cell))));
+            uint64_t tblock_length = static_cast<uint64_t>(as_detagged_int(cell_at(address - sizeof(Cell))));
+            uint64_t tblock = address + (2 + num_instructions) * sizeof(Cell);
+            for (uint64_t i = 0; i < tblock_length; i++) {
+                uint64_t entries = cell_at(tblock + i / 2 * sizeof(Cell)).u64;
+                uint32_t offset;
+                std::memcpy(&offset, reinterpret_cast<const char*>(&entries) + i % 2 * sizeof(uint32_t), sizeof(offset));
+                if (reach(cell_at(address + offset * sizeof(Cell)), pending, index)) {
+                    references.push_back(index);
+                }
+            }
+        } else if (objects_[from].kind == "vector" || objects_[from].kind.rfind("record/", 0) == 0) {
+            uint64_t num_fields = static_cast<uint64_t>(as_detagged_int(cell_at(address - sizeof(Cell))));
+            for (uint64_t i = 0; i < num_fields; i++) {
+                if (reach(field_at(address, i), pending, index)) {
+                    references.push_back(index);
+                }
+            }
+        }
+        references_[from] = std::move(references);
+    }
+}
+
+std::string HeapDump::get_string(const Object& object) const {
+    if (object.kind != "string") {
+        return {};
+    }
+    uint64_t char_count = cell_at(object.address - sizeof(Cell)).u64;
+    std::string value;
+    for (uint64_t i = 0; i + 1 < char_count; i++) {
+        const Cell& cell = cell_at(object.address + (1 + i / sizeof(Cell)) * sizeof(Cell));
+        value.push_back(reinterpret_cast<const char*>(&cell)[i % sizeof(Cell)]);
+    }
+    return value;
+}
+
+std::vector<HeapDump::Retained> HeapDump::retained_by_root() const {
+    // Nodes are a virtual start node, then the roots, then the objects; the
+    // start node leads to every root. The dominators are found by the iterative
+    // algorithm of Cooper, Harvey and Kennedy, over a reverse postorder.
+    size_t num_roots = roots_.size();
+    size_t num_nodes = 1 + num_roots + objects_.size();
+    std::vector<std::vector<uint32_t>> successors(num_nodes);
+    for (size_t r = 0; r < num_roots; r++) {
+        successors[0].push_back(static_cast<uint32_t>(1 + r));
+        for (Cell value : roots_[r].second) {
+            auto found = is_tagged_ptr(value)
+                ? object_index_.find(reinterpret_cast<uint64_t>(as_detagged_ptr(value)))
+                : object_index_.end();
+            if (found != object_index_.end()) {
+                successors[1 + r].push_back(static_cast<uint32_t>(1 + num_roots + found->second));
+            }
+        }
+    }
+    for (size_t i = 0; i < objects_.size(); i++) {
+        for (uint32_t reference : references_[i]) {
+            successors[1 + num_roots + i].push_back(static_cast<uint32_t>(1 + num_roots + reference));
+        }
+    }
+
+    // Postorder numbers, by an explicit depth-first search.
+    constexpr uint32_t NONE = UINT32_MAX;
+    std::vector<uint32_t> postorder(num_nodes, NONE);
+    std::vector<uint32_t> order;  // Nodes in postorder.
+    std::vector<bool> visited(num_nodes, false);
+    std::vector<std::pair<uint32_t, size_t>> stack{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next < successors[node].size()) {
+            uint32_t successor = successors[node][next++];
+            if (!visited[successor]) {
+                visited[successor] = true;
+                stack.emplace_back(successor, 0);
+            }
+        } else {
+            postorder[node] = static_cast<uint32_t>(order.size());
+            order.push_back(node);
+            stack.pop_back();
+        }
+    }
+    std::vector<std::vector<uint32_t>> predecessors(num_nodes);
+    for (size_t node = 0; node < num_nodes; node++) {
+        for (uint32_t successor : successors[node]) {
+            predecessors[successor].push_back(static_cast<uint32_t>(node));
+        }
+    }
+
+    std::vector<uint32_t> idom(num_nodes, NONE);
+    idom[0] = 0;
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (postorder[a] < postorder[b]) {
+                a = idom[a];
+            }
+            while (postorder[b] < postorder[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto it = order.rbegin() + 1; it != order.rend(); ++it) {
+            uint32_t new_idom = NONE;
+            for (uint32_t predecessor : predecessors[*it]) {
+                if (idom[predecessor] != NONE) {
+                    new_idom = new_idom == NONE ? predecessor : intersect(predecessor, new_idom);
+                }
+            }
+            if (idom[*it] != new_idom) {
+                idom[*it] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Each node's retained size is its own plus those of the nodes it
+    // immediately dominates, which come after it in reverse postorder.
+    std::vector<uint64_t> bytes(num_nodes, 0);
+    std::vector<uint64_t> objects(num_nodes, 0);
+    for (size_t i = 0; i < objects_.size(); i++) {
+        bytes[1 + num_roots + i] = objects_[i].bytes;
+        objects[1 + num_roots + i] = 1;
+    }
+    for (uint32_t node : order) {
+        if (node != 0) {
+            bytes[idom[node]] += bytes[node];
+            objects[idom[node]] += objects[node];
+        }
+    }
+
+    std::vector<Retained> retained;
+    for (size_t r = 0; r < num_roots; r++) {
+        retained.push_back(Retained{roots_[r].first, objects[1 + r], bytes[1 + r]});
+    }
+    std::stable_sort(retained.begin(), retained.end(),
+                     [](const Retained& a, const Retained& b) { return a.bytes > b.bytes; });
+    return retained;
+}
+
+std::vector<HeapDump::Object> HeapDump::largest_objects(size_t count) const {
+    std::vector<Object> largest = objects_;
+    count = std::min(count, largest.size());
+    std::partial_sort(largest.begin(), largest.begin() + static_cast<std::ptrdiff_t>(count), largest.end(),
+                      [](const Object& a, const Object& b) {
+                          return a.bytes != b.bytes ? a.bytes > b.bytes : a.address < b.address;
+                      });
+    largest.resize(count);
+    return largest;
+}
+
+std::vector<HeapDump::DuplicateString> HeapDump::duplicate_strings() const {
+    std::unordered_map<std::string, DuplicateString> by_value;
+    for (const Object& object : objects_) {
+        if (object.kind == "string") {
+            std::string value = get_string(object);
+            DuplicateString& duplicate = by_value[value];
+            duplicate.value = value;
+            duplicate.count++;
+            duplicate.bytes_each = object.bytes;
+        }
+    }
+    std::vector<DuplicateString> duplicates;
+    for (auto& [value, duplicate] : by_value) {
+        if (duplicate.count > 1) {
+            duplicates.push_back(std::move(duplicate));
+        }
+    }
+    std::sort(duplicates.begin(), duplicates.end(), [](const DuplicateString& a, const DuplicateString& b) {
+        return a.wasted_bytes() != b.wasted_bytes() ? a.wasted_bytes() > b.wasted_bytes() : a.value < b.value;
+    });
+    return duplicates;
+}
+
+} // namespace nutmeg
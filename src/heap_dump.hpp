@@ -0,0 +1,120 @@
+#ifndef HEAP_DUMP_HPP
+#define HEAP_DUMP_HPP
+
+#include "value.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nutmeg {
+
+class Machine;
+
+// A heap dump is a complete copy of a machine's heap, for offline analysis
+// (see --heap-dump and tools/nutmeg-heapdump). It holds the used cells of the
+// permanent space, the nursery, the old space and the region (which holds the
+// sys-call temporaries of frames still running) at the addresses they had,
+// the fundamental datakeys, and the roots: every global, by name, and both
+// stacks. Unlike a heap image (see image.hpp) nothing is relocated, so a dump
+// cannot be loaded back into a machine; it is only read by HeapDump, in a
+// program of the same build.
+
+// Write machine's heap to path. The file is written privately and renamed
+// into place.
+void write_heap_dump(const Machine& machine, const std::string& path);
+
+// HeapDump reads a dump and finds the objects reachable from its roots, which
+// its reports are about. Objects are found by following the fields of records
+// and vectors and the T-block operands of functions (datakeys are not counted
+// as references).
+class HeapDump {
+public:
+    // A used part of one space, at its original address.
+    struct Space {
+        std::string name;
+        uint64_t base;
+        std::vector<Cell> cells;
+    };
+
+    // A reachable object. Its size includes the cells before its datakey.
+    struct Object {
+        uint64_t address;
+        std::string kind;
+        uint64_t bytes;
+    };
+
+    // The objects only reachable through a root: if the root were cleared,
+    // they would all be garbage.
+    struct Retained {
+        std::string root;
+        uint64_t objects;
+        uint64_t bytes;
+    };
+
+    // A string value held by several objects.
+    struct DuplicateString {
+        std::string value;
+        uint64_t count;
+        uint64_t bytes_each;
+        uint64_t wasted_bytes() const { return (count - 1) * bytes_each; }
+    };
+
+private:
+    std::vector<Space> spaces_;
+    std::vector<std::pair<std::string, std::vector<Cell>>> roots_;  // By name, in dump order.
+
+    // The fundamental datakeys, by their original addresses.
+    uint64_t datakey_datakey_ = 0;
+    uint64_t string_datakey_ = 0;
+    uint64_t function_datakey_ = 0;
+    uint64_t bignum_datakey_ = 0;
+    uint64_t vector_datakey_ = 0;
+    uint64_t box_datakey_ = 0;
+
+    // The base of compressed references, or 0 if the fields of records and
+    // vectors are cells.
+    uint64_t slot_base_ = 0;
+
+    // The reachable objects, and for each, the objects it refers to.
+    std::vector<Object> objects_;
+    std::vector<std::vector<uint32_t>> references_;
+    std::unordered_map<uint64_t, uint32_t> object_index_;
+
+    // The cell at address, which must be in a space.
+    const Cell& cell_at(uint64_t address) const;
+
+    // The field at index of the record or vector at address, as stored: a
+    // boxed value is a reference to its box.
+    Cell field_at(uint64_t address, uint64_t index) const;
+
+    // If value refers to a dumped object, return its index, adding it (and
+    // queueing it for scanning) if it is new.
+    bool reach(Cell value, std::vector<uint32_t>& pending, uint32_t& index);
+
+    void find_reachable_objects();
+
+public:
+    explicit HeapDump(const std::string& path);
+
+    const std::vector<Space>& get_spaces() const { return spaces_; }
+    const std::vector<Object>& get_objects() const { return objects_; }
+    size_t get_num_roots() const { return roots_.size(); }
+
+    // The string an object holds, if it is a string.
+    std::string get_string(const Object& object) const;
+
+    // Every root's retained size, most bytes first, found from the dominator
+    // tree of the object graph.
+    std::vector<Retained> retained_by_root() const;
+
+    // The count largest objects, largest first.
+    std::vector<Object> largest_objects(size_t count) const;
+
+    // Every string value held by more than one object, most wasted bytes first.
+    std::vector<DuplicateString> duplicate_strings() const;
+};
+
+} // namespace nutmeg
+
+#endif // HEAP_DUMP_HPP
@@ -0,0 +1,349 @@
+#include "image.hpp"
+#include "machine.hpp"
+#include "instruction.hpp"
+#include "sysfunctions.hpp"
+#include "code_cache.hpp"
+#include "binary_file.hpp"
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstring>
+#include <fmt/core.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nutmeg {
+
+// File layout, all 64-bit words in native byte order:
+//
+//   Header:      [MAGIC][fingerprint][cells C][globals G][relocations R][string bytes S][entry point]
+//   Pool:        C cells, the used part of the heap pool, with every relocated word zeroed.
+//   Globals:     G entries of [name][kind][value].
+//   Relocations: R entries of [cell index][kind][payload].
+//   Strings:     S bytes of names.
+//
+// Names are references (offset << 32 | length) into the strings. A global's
+// value is either an immediate cell or the cell offset of a heap object.
+static constexpr uint64_t MAGIC = 0x47414D49474D544EULL;  // "NTMGIMAG" in little-endian byte order.
+static constexpr uint64_t FORMAT_VERSION = 1;
+static constexpr size_t HEADER_WORDS = 7;
+
+enum GlobalKind : uint64_t {
+    GLOBAL_IMMEDIATE = 0,
+    GLOBAL_HEAP = 1,
+};
+
+enum RelocationKind : uint64_t {
+    RELOCATE_RAW_HEAP_PTR = 0,     // Payload is the cell offset of the target.
+    RELOCATE_TAGGED_HEAP_PTR = 1,  // Payload is the cell offset of the target.
+    RELOCATE_LABEL = 2,            // Payload is the opcode.
+    RELOCATE_IDENT = 3,            // Payload is the global's number.
+    RELOCATE_SYS_FUNCTION = 4,     // Payload is a reference to the name.
+};
+
+// Images also depend on the encoding of special values such as undefined, which
+// may be stored immediately in a global.
+static uint64_t image_fingerprint() {
+    return build_fingerprint(FORMAT_VERSION ^ make_undef().u64);
+}
+
+// ImageWriter finds every word of the used pool that needs relocating, by
+// walking the heap from the globals.
+struct ImageWriter {
+    const Machine& machine;
+    const Heap& heap;
+    const Cell* pool_start;
+    size_t pool_cells;
+
+    std::vector<uint64_t> globals;
+    std::vector<uint64_t> relocations;
+    StringTable strings;
+    std::unordered_map<const Ident*, uint64_t> ident_numbers;
+    std::unordered_set<const Cell*> visited;
+    std::vector<const Cell*> pending;
+
+    explicit ImageWriter(const Machine& m)
+        : machine(m), heap(m.get_heap()), pool_start(heap.get_pool()->start()),
+          pool_cells(heap.get_pool()->next_free()) {}
+
+    uint64_t offset_of(const Cell* ptr) const {
+        // Defensive check: a pointer outside the used pool cannot be relocated.
+        if (ptr < pool_start || ptr >= pool_start + pool_cells) {
+            throw std::runtime_error("Cannot save an image of a pointer outside the heap");
+        }
+        return static_cast<uint64_t>(ptr - pool_start);
+    }
+
+    void relocate(const Cell* at, RelocationKind kind, uint64_t payload) {
+        relocations.push_back(offset_of(at));
+        relocations.push_back(kind);
+        relocations.push_back(payload);
+    }
+
+    // The offset of a heap object, which is queued for scanning.
+    uint64_t reach(const Cell* obj_ptr) {
+        if (visited.insert(obj_ptr).second) {
+            pending.push_back(obj_ptr);
+        }
+        return offset_of(obj_ptr);
+    }
+
+    void add_globals() {
+        machine.for_each_global([&](const std::string& name, Ident* ident) {
+            uint64_t number = ident_numbers.size();
+            ident_numbers[ident] = number;
+            globals.push_back(strings.add(name));
+            if (is_tagged_ptr(ident->cell)) {
+                globals.push_back(GLOBAL_HEAP);
+                globals.push_back(reach(static_cast<const Cell*>(as_detagged_ptr(ident->cell))));
+            } else {
+                globals.push_back(GLOBAL_IMMEDIATE);
+                globals.push_back(ident->cell.u64);
+            }
+        });
+    }
+
+    void add_datakeys() {
+        // Each fundamental datakey's own datakey field is its fifth cell.
+        for (const Cell* datakey : {heap.get_datakey_datakey(), heap.get_string_datakey(),
+                                    heap.get_function_datakey(), heap.get_bignum_datakey(),
+                                    heap.get_vector_datakey()}) {
+            relocate(&datakey[4], RELOCATE_RAW_HEAP_PTR, offset_of(static_cast<const Cell*>(datakey[4].ptr)));
+        }
+    }
+
+    void scan_function(const Cell* obj_ptr) {
+        Cell* func_obj = const_cast<Cell*>(obj_ptr);
+        const Cell* code = heap.get_function_code(func_obj);
+        int64_t length = as_detagged_int(obj_ptr[-2]);
+        for (int64_t i = 0; i < length; ) {
+            std::optional<Opcode> opcode = machine.find_opcode(code[i].label_addr);
+            if (!opcode) {
+                // Only possible if the function object is corrupt.
+                throw std::runtime_error("Unrecognised label word in function code");
+            }
+            relocate(&code[i++], RELOCATE_LABEL, static_cast<uint64_t>(*opcode));
+            const OpcodeDescriptor& descriptor = describe(*opcode);
+            for (int k = 0; k < descriptor.num_operands; k++) {
+                const Cell* operand = &code[i++];
+                switch (descriptor.operands[k]) {
+                case OperandKind::IntLiteral:
+                case OperandKind::Index:
+                case OperandKind::LocalOffset:
+                    break;
+
+                case OperandKind::StringConstant:
+                case OperandKind::HeapConstant:
+                    relocate(operand, RELOCATE_TAGGED_HEAP_PTR,
+                             reach(static_cast<const Cell*>(as_detagged_ptr(*operand))));
+                    break;
+
+                case OperandKind::GlobalRef:
+                case OperandKind::CalleeRef: {
+                    auto it = ident_numbers.find(static_cast<const Ident*>(operand->ptr));
+                    if (it == ident_numbers.end()) {
+                        throw std::runtime_error("Cannot save an image of code that refers to an unknown global");
+                    }
+                    relocate(operand, RELOCATE_IDENT, it->second);
+                    break;
+                }
+
+                case OperandKind::SysFunctionRef: {
+                    const std::string* sys_name = sysfunction_name(operand->ptr);
+                    if (sys_name == nullptr) {
+                        throw std::runtime_error("Cannot save an image of code that calls an unknown sys-function");
+                    }
+                    relocate(operand, RELOCATE_SYS_FUNCTION, strings.add(*sys_name));
+                    break;
+                }
+
+                case OperandKind::FunctionRef:
+                    throw std::runtime_error("Cannot save an image of code with a function pointer operand");
+                }
+            }
+        }
+    }
+
+    void scan() {
+        while (!pending.empty()) {
+            const Cell* obj_ptr = pending.back();
+            pending.pop_back();
+            const void* datakey = obj_ptr[0].ptr;
+            relocate(obj_ptr, RELOCATE_RAW_HEAP_PTR, offset_of(static_cast<const Cell*>(datakey)));
+            if (datakey == heap.get_function_datakey()) {
+                scan_function(obj_ptr);
+            } else if (datakey != heap.get_string_datakey() && datakey != heap.get_bignum_datakey()) {
+                throw std::runtime_error("Cannot save an image of a heap object with an unknown datakey");
+            }
+        }
+    }
+};
+
+// A read-only private mapping of a whole file, unmapped on destruction.
+struct FileMapping {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    explicit FileMapping(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error(fmt::format("Cannot open image: {}", path));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error(fmt::format("Cannot read image: {}", path));
+        }
+        void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error(fmt::format("Cannot map image: {}", path));
+        }
+        data = static_cast<const uint8_t*>(map);
+        size = static_cast<size_t>(st.st_size);
+    }
+
+    ~FileMapping() { munmap(const_cast<uint8_t*>(data), size); }
+
+    FileMapping(const FileMapping&) = delete;
+    FileMapping& operator=(const FileMapping&) = delete;
+};
+
+void save_image(const Machine& machine, const std::string& entry_point, const std::string& path) {
+    ImageWriter writer(machine);
+    writer.add_globals();
+    writer.add_datakeys();
+    writer.scan();
+    uint64_t entry_ref = writer.strings.add(entry_point);
+
+    // Relocated words hold this process's addresses, which are of no use to the
+    // next one, so the image has zeros there instead.
+    std::vector<Cell> cells(writer.pool_start, writer.pool_start + writer.pool_cells);
+    for (size_t r = 0; r < writer.relocations.size(); r += 3) {
+        cells[writer.relocations[r]].u64 = 0;
+    }
+
+    uint64_t header[HEADER_WORDS] = {
+        MAGIC, image_fingerprint(), cells.size(), writer.globals.size() / 3, writer.relocations.size() / 3,
+        writer.strings.size(), entry_ref,
+    };
+
+    // A running process never sees a partial image (see BinaryFileWriter).
+    BinaryFileWriter out(path, "image");
+    out.write(header, sizeof(header));
+    out.write(cells);
+    out.write(writer.globals);
+    out.write(writer.relocations);
+    out.write(writer.strings.data());
+    out.commit();
+}
+
+std::string load_image(Machine& machine, const std::string& path) {
+    FileMapping file(path);
+    const uint64_t* header = reinterpret_cast<const uint64_t*>(file.data);
+    if (file.size < HEADER_WORDS * sizeof(uint64_t) || header[0] != MAGIC) {
+        throw std::runtime_error(fmt::format("Not a heap image: {}", path));
+    }
+    if (header[1] != image_fingerprint()) {
+        throw std::runtime_error(fmt::format("Heap image was written by a different build: {}", path));
+    }
+
+    // Check the section sizes against the file before trusting any of them.
+    uint64_t num_cells = header[2], num_globals = header[3], num_relocations = header[4];
+    uint64_t string_bytes = header[5];
+    uint64_t available_words = file.size / sizeof(uint64_t) - HEADER_WORDS;
+    if (num_cells > available_words || num_globals > (available_words - num_cells) / 3 ||
+        num_relocations > (available_words - num_cells - 3 * num_globals) / 3 ||
+        string_bytes != file.size - (HEADER_WORDS + num_cells + 3 * (num_globals + num_relocations)) * sizeof(uint64_t)) {
+        throw std::runtime_error(fmt::format("Heap image is truncated or malformed: {}", path));
+    }
+    const Cell* pool_cells = reinterpret_cast<const Cell*>(header + HEADER_WORDS);
+    const uint64_t* globals = reinterpret_cast<const uint64_t*>(pool_cells + num_cells);
+    const uint64_t* relocations = globals + 3 * num_globals;
+    std::string_view strings(reinterpret_cast<const char*>(relocations + 3 * num_relocations), string_bytes);
+
+    auto string_ref = [&](uint64_t ref) {
+        std::optional<std::string_view> name = read_string_ref(strings, ref);
+        if (!name) {
+            throw std::runtime_error(fmt::format("Heap image has a bad name reference: {}", path));
+        }
+        return *name;
+    };
+
+    // The image replaces the whole pool, including the fundamental datakeys, so
+    // nothing may have been allocated since they were.
+    bool fresh = true;
+    machine.for_each_global([&](const std::string&, Ident*) { fresh = false; });
+    if (!fresh) {
+        throw std::runtime_error("A heap image can only be loaded into a fresh machine");
+    }
+
+    std::vector<Ident*> idents;
+    idents.reserve(num_globals);
+    for (uint64_t g = 0; g < num_globals; g++) {
+        idents.push_back(machine.resolve_ident(string_ref(globals[3 * g])));
+    }
+
+    Pool* pool = machine.get_heap().get_pool();
+    pool->restore(pool_cells, num_cells);
+    Cell* cells = pool->start();
+    for (uint64_t r = 0; r < num_relocations; r++) {
+        uint64_t index = relocations[3 * r], kind = relocations[3 * r + 1], payload = relocations[3 * r + 2];
+        if (index >= num_cells) {
+            throw std::runtime_error(fmt::format("Heap image has a relocation outside the heap: {}", path));
+        }
+        switch (kind) {
+        case RELOCATE_RAW_HEAP_PTR:
+        case RELOCATE_TAGGED_HEAP_PTR:
+            if (payload >= num_cells) {
+                throw std::runtime_error(fmt::format("Heap image has a pointer outside the heap: {}", path));
+            }
+            cells[index] = kind == RELOCATE_RAW_HEAP_PTR ? make_raw_ptr(&cells[payload]) : make_tagged_ptr(&cells[payload]);
+            // The datakey field of a function object is its identity.
+            if (kind == RELOCATE_RAW_HEAP_PTR && &cells[payload] == machine.get_heap().get_function_datakey()) {
+                machine.get_heap().register_function(&cells[index]);
+            }
+            break;
+        case RELOCATE_LABEL:
+            if (payload >= NUM_OPCODES) {
+                throw std::runtime_error(fmt::format("Heap image has an unknown opcode: {}", path));
+            }
+            cells[index].label_addr = machine.get_opcode_label(static_cast<Opcode>(payload));
+            break;
+        case RELOCATE_IDENT:
+            if (payload >= num_globals) {
+                throw std::runtime_error(fmt::format("Heap image has an unknown global: {}", path));
+            }
+            cells[index] = make_raw_ptr(idents[payload]);
+            break;
+        case RELOCATE_SYS_FUNCTION: {
+            auto sys = sysfunctions_table.find(string_ref(payload));
+            if (sys == sysfunctions_table.end()) {
+                throw std::runtime_error(fmt::format("Heap image calls an unknown sys-function: {}", path));
+            }
+            cells[index] = make_raw_ptr(reinterpret_cast<void*>(sys->second));
+            break;
+        }
+        default:
+            throw std::runtime_error(fmt::format("Heap image has an unknown relocation: {}", path));
+        }
+    }
+
+    for (uint64_t g = 0; g < num_globals; g++) {
+        uint64_t kind = globals[3 * g + 1], value = globals[3 * g + 2];
+        if (kind == GLOBAL_HEAP) {
+            if (value >= num_cells) {
+                throw std::runtime_error(fmt::format("Heap image has a pointer outside the heap: {}", path));
+            }
+            idents[g]->cell = make_tagged_ptr(&cells[value]);
+        } else {
+            idents[g]->cell = make_raw_u64(value);
+        }
+    }
+    return std::string(string_ref(header[6]));
+}
+
+} // namespace nutmeg
@@ -0,0 +1,32 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <string>
+
+namespace nutmeg {
+
+class Machine;
+
+// A heap image is a snapshot of a loaded machine: its heap pool, its globals
+// and the entry point to run. Restoring one replaces reading the bundle,
+// parsing and heap allocation with a single copy of the pool and a pass over
+// its relocations (see --save-image and --load-image in main).
+//
+// Like the code cache, an image cannot hold process-specific addresses, so
+// every word that holds one is listed in a relocation table, found by walking
+// the heap from the globals. Label words become opcode numbers, Ident pointers
+// become global numbers, sys-function pointers become names, and pointers into
+// the heap become cell offsets from the start of the pool. An image only
+// loads into the same build that wrote it (see build_fingerprint).
+
+// Write machine's heap and globals to path, with entry_point as the function
+// to run. The file is written privately and renamed into place.
+void save_image(const Machine& machine, const std::string& entry_point, const std::string& path);
+
+// Restore the image at path into machine, which must be freshly constructed,
+// and return its entry point.
+std::string load_image(Machine& machine, const std::string& path);
+
+} // namespace nutmeg
+
+#endif // IMAGE_HPP
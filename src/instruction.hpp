@@ -2,7 +2,11 @@
 #define INSTRUCTION_HPP
 
 #include <string>
+#include <string_view>
 #include <optional>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 
 namespace nutmeg {
 
@@ -10,40 +14,186 @@ namespace nutmeg {
 enum class Opcode {
     PUSH_INT,
     PUSH_STRING,
+    PUSH_CONSTANT,
     POP_LOCAL,
     PUSH_LOCAL,
     PUSH_GLOBAL,
     LAUNCH,
+    LAZY,
     CALL_GLOBAL_COUNTED,
     SYSCALL_COUNTED,
     STACK_LENGTH,
+    THROW,
     RETURN,
     HALT,
+    SYSCALL_REGION,
+    RETURN_REGION,
 };
 
+// Number of opcodes, used to size per-opcode tables. Bytecode numbers opcodes by
+// position, so new ones are appended, and the last one must be named here.
+constexpr size_t NUM_OPCODES = static_cast<size_t>(Opcode::RETURN_REGION) + 1;
+
+// OperandKind says how the loader encodes an operand word from the JSON fields of
+// an instruction, and therefore what anyone walking compiled code will find there.
+enum class OperandKind : uint8_t {
+    IntLiteral,      // "index" as a raw i64, or a bignum constant if it does not fit.
+    Index,           // "index" as a raw i64 (0 if absent).
+    LocalOffset,     // "index" + 3 as a raw i64 return-stack offset (required).
+    StringConstant,  // "value" allocated as a heap string: a tagged pointer.
+    HeapConstant,    // A tagged pointer to a heap object planted by the loader.
+    GlobalRef,       // "value" resolved to an Ident* (raw).
+    CalleeRef,       // "name" resolved to an Ident* (raw).
+    SysFunctionRef,  // "name" resolved to a SysFunction pointer (raw).
+    FunctionRef,     // A raw pointer to a function object.
+};
+
+// Operands of these kinds hold tagged pointers into the heap, and are therefore
+// recorded in the T-block of the function object for the garbage collector.
+constexpr bool is_tagged_pointer_operand(OperandKind kind) {
+    return kind == OperandKind::StringConstant || kind == OperandKind::HeapConstant;
+}
+
+// Marker for a stack effect that depends on a runtime count.
+constexpr int VARIABLE_STACK_EFFECT = -1;
+
+// OpcodeDescriptor is everything the runtime knows about an opcode. The table of
+// descriptors below is the single source of truth: the JSON names, the dispatch
+// table size and the loader's operand encoding are all derived from it.
+struct OpcodeDescriptor {
+    Opcode opcode;
+    const char* name;                      // Name for debugging and tracing.
+    std::array<const char*, 2> aliases;    // JSON type names, nullptr if unused.
+    int num_operands;                      // Operand words following the label word.
+    std::array<OperandKind, 2> operands;   // Kinds of the first num_operands operands.
+    int pops;                              // Operand stack effect, or VARIABLE_STACK_EFFECT,
+    int pushes;                            // as followed by the loader's escape analysis.
+};
+
+inline constexpr std::array<OpcodeDescriptor, NUM_OPCODES> OPCODE_DESCRIPTORS = {{
+    {Opcode::PUSH_INT, "PUSH_INT", {"push.int", "PushInt"},
+        1, {OperandKind::IntLiteral}, 0, 1},
+    {Opcode::PUSH_STRING, "PUSH_STRING", {"push.string", "PushString"},
+        1, {OperandKind::StringConstant}, 0, 1},
+    {Opcode::PUSH_CONSTANT, "PUSH_CONSTANT", {nullptr, nullptr},
+        1, {OperandKind::HeapConstant}, 0, 1},
+    {Opcode::POP_LOCAL, "POP_LOCAL", {"pop.local", "PopLocal"},
+        1, {OperandKind::Index}, 1, 0},
+    {Opcode::PUSH_LOCAL, "PUSH_LOCAL", {"push.local", "PushLocal"},
+        1, {OperandKind::Index}, 0, 1},
+    {Opcode::PUSH_GLOBAL, "PUSH_GLOBAL", {"push.global", "PushGlobal"},
+        1, {OperandKind::GlobalRef}, 0, 1},
+    {Opcode::LAUNCH, "LAUNCH", {nullptr, nullptr},
+        1, {OperandKind::FunctionRef}, VARIABLE_STACK_EFFECT, 0},
+    {Opcode::LAZY, "LAZY", {nullptr, nullptr},
+        2, {OperandKind::CalleeRef, OperandKind::HeapConstant}, VARIABLE_STACK_EFFECT, VARIABLE_STACK_EFFECT},
+    {Opcode::CALL_GLOBAL_COUNTED, "CALL_GLOBAL_COUNTED", {"call.global.counted", "CallGlobalCounted"},
+        2, {OperandKind::LocalOffset, OperandKind::CalleeRef}, VARIABLE_STACK_EFFECT, VARIABLE_STACK_EFFECT},
+    {Opcode::SYSCALL_COUNTED, "SYSCALL_COUNTED", {"syscall.counted", "SyscallCounted"},
+        2, {OperandKind::LocalOffset, OperandKind::SysFunctionRef}, VARIABLE_STACK_EFFECT, VARIABLE_STACK_EFFECT},
+    {Opcode::STACK_LENGTH, "STACK_LENGTH", {"stack.length", nullptr},
+        1, {OperandKind::LocalOffset}, 0, 0},
+    {Opcode::THROW, "THROW", {"throw", "Throw"},
+        0, {}, 1, 0},
+    {Opcode::RETURN, "RETURN", {"return", nullptr},
+        0, {}, 0, 0},
+    {Opcode::HALT, "HALT", {"halt", nullptr},
+        0, {}, 0, 0},
+    {Opcode::SYSCALL_REGION, "SYSCALL_REGION", {nullptr, nullptr},
+        2, {OperandKind::LocalOffset, OperandKind::SysFunctionRef}, VARIABLE_STACK_EFFECT, VARIABLE_STACK_EFFECT},
+    {Opcode::RETURN_REGION, "RETURN_REGION", {nullptr, nullptr},
+        0, {}, 0, 0},
+}};
+
+// The table is indexed by opcode, so its order must match the enum.
+constexpr bool descriptors_are_in_opcode_order() {
+    for (size_t i = 0; i < NUM_OPCODES; i++) {
+        if (static_cast<size_t>(OPCODE_DESCRIPTORS[i].opcode) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(descriptors_are_in_opcode_order(), "OPCODE_DESCRIPTORS must be in Opcode order");
+
+constexpr const OpcodeDescriptor& describe(Opcode opcode) {
+    return OPCODE_DESCRIPTORS[static_cast<size_t>(opcode)];
+}
+
 // Map JSON instruction type strings to opcodes.
-Opcode string_to_opcode(const std::string& type);
+Opcode string_to_opcode(std::string_view type);
 
 // Get the instruction name for debugging.
 const char* opcode_to_string(Opcode opcode);
 
+// Get the number of operand words that follow the label word of an instruction
+// in threaded code. Used to walk compiled code one instruction at a time.
+inline int opcode_operand_count(Opcode opcode) {
+    return describe(opcode).num_operands;
+}
+
+// DispatchTable maps each opcode to the address of its handler label. It is a flat
+// array indexed by opcode, filled in by the init phase of the threaded interpreter.
+class DispatchTable {
+private:
+    std::array<void*, NUM_OPCODES> labels_{};
+
+public:
+    void*& operator[](Opcode opcode) { return labels_[static_cast<size_t>(opcode)]; }
+    void* operator[](Opcode opcode) const { return labels_[static_cast<size_t>(opcode)]; }
+    void* at(Opcode opcode) const { return labels_.at(static_cast<size_t>(opcode)); }
+
+    // Find the opcode whose label is label_addr, if any.
+    std::optional<Opcode> find(const void* label_addr) const {
+        for (size_t i = 0; i < NUM_OPCODES; i++) {
+            if (labels_[i] == label_addr) {
+                return static_cast<Opcode>(i);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Are all the labels present?
+    bool is_complete() const {
+        for (void* label : labels_) {
+            if (label == nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
 // Instruction represents a single instruction in the function body.
 // This uses an adjacently tagged union format with a Type field and type-specific fields.
+// The string fields are views into the loader's input, which must outlive planting.
 struct Instruction {
-    std::string type;        // Original JSON type (for now, during transition).
     Opcode opcode;           // Mapped opcode.
 
     // Fields for different instruction types.
     // Only the relevant fields for each type will be populated.
 
-    // PUSH_INT, POP_LOCAL, PUSH_LOCAL.
-    std::optional<int> index;
+    // PUSH_INT, POP_LOCAL, PUSH_LOCAL, STACK_LENGTH and the counted calls.
+    std::optional<int64_t> index;
+
+    // The index holds the bit pattern of an unsigned literal above INT64_MAX.
+    bool unsigned_index = false;
 
     // PUSH_STRING, PUSH_GLOBAL.
-    std::optional<std::string> value;
+    std::optional<std::string_view> value;
 
     // SYSCALL_COUNTED, CALL_GLOBAL_COUNTED.
-    std::optional<std::string> name;
+    std::optional<std::string_view> name;
+};
+
+// HandlerSpec is an exception-handler entry as written in the bundle, where the
+// range and target are instruction indexes rather than code offsets, and index
+// is the local holding the stack length to restore.
+struct HandlerSpec {
+    std::optional<int64_t> start;
+    std::optional<int64_t> end;
+    std::optional<int64_t> target;
+    std::optional<int64_t> index;
 };
 
 } // namespace nutmeg
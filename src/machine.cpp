@@ -1,7 +1,11 @@
 #include "machine.hpp"
 #include "instruction.hpp"
 #include "sysfunctions.hpp"
+#include "bignum.hpp"
+#include "function_parser.hpp"
+#include "bytecode.hpp"
 #include <nlohmann/json.hpp>
+#include <algorithm>
 #include <stdexcept>
 #include <fmt/core.h>
 #include <iostream>
@@ -14,14 +18,15 @@
 
 namespace nutmeg {
 
-Machine::Machine()
-    : pc_(0) {
+Machine::Machine(const HeapOptions& heap_options)
+    : heap_(heap_options), pc_(0), instrumented_(false), trace_instructions_(false), instruction_counts_{} {
     // Initialize the threaded interpreter by capturing label addresses.
     #ifdef __GNUC__
     threaded_impl(static_cast<std::vector<Cell>*>(nullptr), true);
     #else
     throw std::runtime_error("Threaded interpreter requires GCC/Clang with computed goto support");
     #endif
+    heap_.set_root_enumerator([this](const Heap::RootVisitor& visit) { visit_roots(visit); });
 }
 
 Machine::~Machine() {
@@ -30,6 +35,9 @@ Machine::~Machine() {
 // Stack operations.
 void Machine::push(Cell value) {
     operand_stack_.push_back(value);
+    if (track_stack_depths_) {
+        max_operand_depth_ = std::max(max_operand_depth_, operand_stack_.size());
+    }
 }
 
 Cell Machine::pop() {
@@ -73,6 +81,9 @@ size_t Machine::stack_size() const {
 // Return stack operations.
 void Machine::push_return(Cell value) {
     return_stack_.push_back(value);
+    if (track_stack_depths_) {
+        max_return_depth_ = std::max(max_return_depth_, return_stack_.size());
+    }
 }
 
 Cell Machine::pop_return() {
@@ -103,6 +114,7 @@ void Machine::define_global(const std::string& name, Cell value) {
     #ifdef TRACE_CODEGEN
     fmt::print("DEFINING global: {}\n", name);
     #endif
+    std::unique_lock<std::shared_mutex> lock(globals_mutex_);
     auto it = globals_.find(name);
     if (it == globals_.end()) {
         // Update existing global.
@@ -143,7 +155,8 @@ Cell* Machine::get_global_cell_ptr(const std::string& name) {
     return static_cast<Cell*>(as_detagged_ptr(it->second->cell));
 }
 
-Ident * Machine::lookup_ident(const std::string& name) const {
+Ident * Machine::lookup_ident(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock(globals_mutex_);
     auto it = globals_.find(name);
     if (it == globals_.end()) {
         return nullptr;
@@ -152,13 +165,23 @@ Ident * Machine::lookup_ident(const std::string& name) const {
 }
 
 // Heap allocation.
-Cell Machine::allocate_string(const std::string& value) {
+Cell Machine::allocate_string(std::string_view value, HeapSpace space) {
     // Allocate string in heap (includes null terminator in char_count).
     size_t char_count = value.size() + 1;
-    Cell* obj_ptr = heap_.allocate_string(value.c_str(), char_count);
+    Cell* obj_ptr = heap_.allocate_string(value.data(), char_count, space);
     return make_tagged_ptr(obj_ptr);
 }
 
+Cell Machine::allocate_string_constant(std::string_view value) {
+    std::lock_guard<std::mutex> lock(heap_mutex_);
+    return allocate_string(value, HeapSpace::Permanent);
+}
+
+Cell Machine::allocate_integer_constant(const BigInt& value) {
+    std::lock_guard<std::mutex> lock(heap_mutex_);
+    return make_integer(heap_, value, HeapSpace::Permanent);
+}
+
 const char* Machine::get_string(Cell cell) {
     if (!is_tagged_ptr(cell)) {
         throw std::runtime_error("Cell is not a pointer");
@@ -167,9 +190,18 @@ const char* Machine::get_string(Cell cell) {
     return heap_.get_string_data(obj_ptr);
 }
 
-Cell* Machine::allocate_function(const std::vector<Cell>& code, int nlocals, int nparams) {
-    // Allocate function in heap.
-    Cell* obj_ptr = heap_.allocate_function(code.size(), nlocals, nparams);
+Cell* Machine::allocate_function(const std::vector<Cell>& code, int nlocals, int nparams,
+                                 const std::vector<HandlerEntry>& handlers,
+                                 const std::vector<uint32_t>& tblock) {
+    PhaseTimer timer(startup_stats_, StartupPhase::HeapAllocation);
+
+    // Allocate function in heap. Only the allocation is shared; the object is
+    // filled in outside the lock.
+    Cell* obj_ptr;
+    {
+        std::lock_guard<std::mutex> lock(heap_mutex_);
+        obj_ptr = heap_.allocate_function(code.size(), nlocals, nparams, handlers.size(), tblock.size());
+    }
 
     // Copy instruction words into the heap.
     Cell* code_ptr = heap_.get_function_code(obj_ptr);
@@ -178,9 +210,164 @@ Cell* Machine::allocate_function(const std::vector<Cell>& code, int nlocals, int
         // fmt::print("allocate_function: code[{}] = {}\n", i, static_cast<void*>(code[i].label_addr));
     }
 
+    // Copy the T-block, which follows the instruction words.
+    std::copy(tblock.begin(), tblock.end(), heap_.get_function_tblock(obj_ptr));
+
+    // Copy the exception-handler table, which follows the T-block.
+    HandlerEntry* handler_ptr = heap_.get_function_handlers(obj_ptr);
+    for (size_t i = 0; i < handlers.size(); i++) {
+        handler_ptr[i] = handlers[i];
+    }
+
+    // Only now is the T-block complete enough for the collector to scan. Its
+    // operands are stores into the permanent space, so they pass the write barrier.
+    {
+        std::lock_guard<std::mutex> lock(heap_mutex_);
+        heap_.register_function(obj_ptr);
+        for (uint32_t position : tblock) {
+            heap_.write_barrier(&obj_ptr[position]);
+        }
+    }
+
+    if (region_allocation_) {
+        mark_region_sites(obj_ptr);
+    }
     return obj_ptr;
 }
 
+void Machine::mark_region_sites(Cell* func_obj) {
+    // Only straight-line code can be followed: a handler resumes with whatever
+    // the stack held when the exception was raised.
+    if (heap_.get_function_num_handlers(func_obj) != 0) {
+        return;
+    }
+    Cell* code = heap_.get_function_code(func_obj);
+    int64_t length = as_detagged_int(func_obj[-2]);
+
+    // Follow the values the function pushes above whatever its caller left,
+    // each as the code offset of the sys-call that allocated it, or NOT_A_SITE.
+    // A site escapes if its result is still on the stack when control leaves
+    // the function, or is stored anywhere; after anything the analysis does not
+    // understand, every value it was following is taken to escape.
+    constexpr int64_t NOT_A_SITE = -1;
+    std::vector<int64_t> stack;
+    std::unordered_map<int64_t, size_t> stack_lengths;  // By local offset, as set by STACK_LENGTH.
+    std::map<int64_t, bool> escapes;  // By site.
+    auto escape_all = [&]() {
+        for (int64_t site : stack) {
+            if (site != NOT_A_SITE) {
+                escapes[site] = true;
+            }
+        }
+        stack.clear();
+        stack_lengths.clear();
+    };
+    for (int64_t i = 0; i < length; ) {
+        std::optional<Opcode> opcode = find_opcode(code[i].label_addr);
+        if (!opcode) {
+            // Only possible if the function object is corrupt, and walking further would be meaningless.
+            throw std::runtime_error("Unrecognised label word in function code");
+        }
+        const OpcodeDescriptor& descriptor = describe(*opcode);
+        switch (*opcode) {
+        case Opcode::STACK_LENGTH:
+            stack_lengths[code[i + 1].i64] = stack.size();
+            break;
+        case Opcode::SYSCALL_COUNTED:
+        case Opcode::SYSCALL_REGION: {
+            // The stack effect of a sys-call depends on the sys-function, so it
+            // comes from the sys-function's effect rather than the descriptor.
+            auto arguments = stack_lengths.find(code[i + 1].i64);
+            auto effect = sysfunction_effects.find(reinterpret_cast<SysFunction>(code[i + 2].ptr));
+            if (arguments == stack_lengths.end() || arguments->second > stack.size() ||
+                effect == sysfunction_effects.end()) {
+                escape_all();
+                break;
+            }
+            // The arguments are only read, so they do not escape.
+            stack.resize(arguments->second);
+            int64_t site = effect->second.allocates_results ? i : NOT_A_SITE;
+            if (site != NOT_A_SITE) {
+                escapes.try_emplace(site, false);
+            }
+            stack.insert(stack.end(), static_cast<size_t>(effect->second.results), site);
+            break;
+        }
+        case Opcode::THROW:
+        case Opcode::RETURN:
+        case Opcode::RETURN_REGION:
+        case Opcode::HALT:
+            // Control leaves the function with the stack as it is.
+            escape_all();
+            break;
+        default:
+            // Anything else is followed by its descriptor's stack effect. The
+            // values it pops are stored, so they escape; those it pushes are
+            // not sites. Calls have a variable effect and are not followed.
+            if (descriptor.pops == VARIABLE_STACK_EFFECT || descriptor.pushes == VARIABLE_STACK_EFFECT ||
+                static_cast<size_t>(descriptor.pops) > stack.size()) {
+                escape_all();
+                break;
+            }
+            for (int popped = 0; popped < descriptor.pops; popped++) {
+                if (stack.back() != NOT_A_SITE) {
+                    escapes[stack.back()] = true;
+                }
+                stack.pop_back();
+            }
+            stack.insert(stack.end(), static_cast<size_t>(descriptor.pushes), NOT_A_SITE);
+            break;
+        }
+        i += 1 + descriptor.num_operands;
+    }
+
+    // Rewrite the sites and returns in place, keeping to plain or instrumented labels.
+    auto rewrite = [&](Cell& label_word, Opcode opcode) {
+        bool instrumented = instrumented_opcode_map_.find(label_word.label_addr).has_value();
+        label_word.label_addr = instrumented ? instrumented_opcode_map_[opcode] : opcode_map_[opcode];
+    };
+    bool any_sites = false;
+    for (const auto& [site, escaped] : escapes) {
+        if (!escaped) {
+            rewrite(code[site], Opcode::SYSCALL_REGION);
+            any_sites = true;
+        }
+    }
+    if (!any_sites) {
+        return;
+    }
+    for (int64_t i = 0; i < length; ) {
+        std::optional<Opcode> opcode = find_opcode(code[i].label_addr);
+        if (opcode == Opcode::RETURN) {
+            rewrite(code[i], Opcode::RETURN_REGION);
+        }
+        i += 1 + opcode_operand_count(*opcode);
+    }
+}
+
+Cell* Machine::allocate_function(const FunctionObject& func) {
+    return allocate_function(func.code, func.nlocals, func.nparams, func.handlers, func.tblock);
+}
+
+Cell* Machine::allocate_lazy_stub(std::string_view name) {
+    // The stub is [LAZY ident name][HALT]. It takes no parameters, so the caller's
+    // arguments stay on the operand stack for the real function. The name is kept
+    // as a heap string so that the loader can be called without a reverse lookup.
+    FunctionObject stub;
+    stub.nlocals = 0;
+    stub.nparams = 0;
+    Cell label_word;
+    label_word.label_addr = get_opcode_label(Opcode::LAZY);
+    stub.code.push_back(label_word);
+    stub.code.push_back(make_raw_ptr(resolve_ident(name)));
+    stub.tblock.push_back(static_cast<uint32_t>(2 + stub.code.size()));
+    stub.code.push_back(allocate_string_constant(name));
+    Cell halt_word;
+    halt_word.label_addr = get_opcode_label(Opcode::HALT);
+    stub.code.push_back(halt_word);
+    return allocate_function(stub);
+}
+
 Cell* Machine::get_function_ptr(Cell cell) {
     if (!is_tagged_ptr(cell)) {
         throw std::runtime_error("Cell is not a pointer");
@@ -210,9 +397,9 @@ void Machine::execute(Cell* func_obj) {
 
     // Create tiny launcher code.
     std::vector<Cell> launcher(3);
-    launcher[0].label_addr = opcode_map_[Opcode::LAUNCH];
+    launcher[0].label_addr = get_opcode_label(Opcode::LAUNCH);
     launcher[1].ptr = func_obj;
-    launcher[2].label_addr = opcode_map_[Opcode::HALT];
+    launcher[2].label_addr = get_opcode_label(Opcode::HALT);
 
     #ifdef TRACE_CODEGEN_DETAILED
     fmt::print("About to call threaded_impl\n");
@@ -223,6 +410,164 @@ void Machine::execute(Cell* func_obj) {
     #endif
 }
 
+void* Machine::get_opcode_label(Opcode opcode) const {
+    return instrumented_ ? instrumented_opcode_map_[opcode] : opcode_map_[opcode];
+}
+
+std::optional<Opcode> Machine::find_opcode(const void* label_addr) const {
+    std::optional<Opcode> opcode = opcode_map_.find(label_addr);
+    return opcode ? opcode : instrumented_opcode_map_.find(label_addr);
+}
+
+void Machine::set_instrumentation(bool enabled) {
+    instrumented_ = enabled;
+    // Rewrite every function object that is reachable through a global. Other
+    // values (strings, nil, undefined) are skipped.
+    for (const auto& pair : globals_) {
+        Cell cell = pair.second->cell;
+        if (!is_tagged_ptr(cell)) {
+            continue;
+        }
+        Cell* obj_ptr = static_cast<Cell*>(as_detagged_ptr(cell));
+        if (obj_ptr[0].ptr == heap_.get_function_datakey()) {
+            set_function_instrumentation(obj_ptr, enabled);
+        }
+    }
+}
+
+void Machine::set_function_instrumentation(Cell* func_obj, bool enabled) {
+    const auto& target = enabled ? instrumented_opcode_map_ : opcode_map_;
+    Cell* code = heap_.get_function_code(func_obj);
+    int64_t length = as_detagged_int(func_obj[-2]);
+    // Walk the code an instruction at a time, replacing each label word and
+    // stepping over its operands.
+    for (int64_t i = 0; i < length; ) {
+        std::optional<Opcode> opcode = find_opcode(code[i].label_addr);
+        if (!opcode) {
+            // Only possible if the function object is corrupt, and walking further would be meaningless.
+            throw std::runtime_error("Unrecognised label word in function code");
+        }
+        code[i].label_addr = target[*opcode];
+        i += 1 + opcode_operand_count(*opcode);
+    }
+}
+
+void Machine::instrument_instruction(Opcode opcode, const Cell* pc) {
+    instruction_counts_[static_cast<size_t>(opcode)] += 1;
+    current_instruction_ = pc;
+    if (trace_instructions_) {
+        fmt::print(stderr, "[trace] {} @ {} (stack={}, rstack={})\n", opcode_to_string(opcode),
+                   static_cast<const void*>(pc), operand_stack_.size(), return_stack_.size());
+    }
+}
+
+void Machine::set_allocation_profiling(uint64_t interval_bytes) {
+    if (interval_bytes == 0) {
+        heap_.set_allocation_sampler(0, nullptr);
+        return;
+    }
+    set_instrumentation(true);
+    heap_.set_allocation_sampler(interval_bytes, [this](uint64_t bytes) { sample_allocation(bytes); });
+}
+
+void Machine::sample_allocation(uint64_t bytes) {
+    // The current instruction belongs to the function of the innermost frame,
+    // unless none is running (the launcher, or an allocation between runs), in
+    // which case the sample is charged to no function.
+    Cell* function = nullptr;
+    const Cell* instruction = nullptr;
+    if (return_stack_.size() >= 2 && current_instruction_ != nullptr) {
+        Cell* func_obj = static_cast<Cell*>(get_frame_function_object().ptr);
+        const Cell* code = heap_.get_function_code(func_obj);
+        if (current_instruction_ >= code && current_instruction_ < code + as_detagged_int(func_obj[-2])) {
+            function = func_obj;
+            instruction = current_instruction_;
+        }
+    }
+    SampleCounts& counts = allocation_samples_[{function, instruction}];
+    counts.samples++;
+    counts.bytes += bytes;
+}
+
+std::vector<AllocationSite> Machine::get_allocation_profile() const {
+    // Functions are named by the globals that hold them.
+    std::unordered_map<const Cell*, std::string> names;
+    for_each_global([&names](const std::string& name, Ident* ident) {
+        if (is_tagged_ptr(ident->cell)) {
+            names.emplace(static_cast<const Cell*>(as_detagged_ptr(ident->cell)), name);
+        }
+    });
+    std::vector<AllocationSite> sites;
+    for (const auto& [key, counts] : allocation_samples_) {
+        const auto& [function, instruction] = key;
+        AllocationSite site{"", 0, "", counts.samples, counts.bytes};
+        if (function != nullptr) {
+            auto found = names.find(function);
+            site.function = found != names.end() ? found->second : "<anonymous>";
+            site.offset = static_cast<size_t>(instruction - heap_.get_function_code(function));
+            std::optional<Opcode> opcode = find_opcode(instruction->label_addr);
+            site.instruction = opcode ? opcode_to_string(*opcode) : "?";
+        }
+        sites.push_back(std::move(site));
+    }
+    std::stable_sort(sites.begin(), sites.end(),
+                     [](const AllocationSite& a, const AllocationSite& b) { return a.bytes > b.bytes; });
+    return sites;
+}
+
+Cell* Machine::unwind(Cell* pc, Cell value, size_t base_depth) {
+    while (return_stack_.size() > base_depth) {
+        Cell* func_obj = static_cast<Cell*>(get_frame_function_object().ptr);
+        Cell* code = heap_.get_function_code(func_obj);
+
+        // The pc has always been advanced past at least the label word of the
+        // instruction that raised the exception (or the call that is being
+        // unwound through), so pc - 1 lies inside that instruction.
+        size_t offset = static_cast<size_t>(pc - 1 - code);
+        const HandlerEntry* handlers = heap_.get_function_handlers(func_obj);
+        size_t num_handlers = heap_.get_function_num_handlers(func_obj);
+        for (size_t i = 0; i < num_handlers; i++) {
+            const HandlerEntry& h = handlers[i];
+            if (h.start <= offset && offset < h.end) {
+                if (h.stack_local != 0) {
+                    size_t saved = static_cast<size_t>(as_detagged_int(get_local_variable(h.stack_local)));
+                    // Defensive check: only ever discard values (as the saved
+                    // length could be stale if the local was reassigned).
+                    if (saved < operand_stack_.size()) {
+                        operand_stack_.resize(saved);
+                    }
+                }
+                push(value);
+                return code + h.target;
+            }
+        }
+
+        // No handler in this function: discard its frame exactly as RETURN would
+        // and continue in the caller. If the frame has region objects, any the
+        // exception left on the operand stack are first moved to the collected
+        // space (with the exception rooted there meanwhile). Promotion may
+        // collect, so it takes heap_mutex_ like any allocation during execution.
+        if (!region_marks_.empty() && region_marks_.back().first == return_stack_.size()) {
+            size_t mark = region_marks_.back().second;
+            push(value);
+            {
+                std::lock_guard<std::mutex> lock(heap_mutex_);
+                for (Cell& cell : operand_stack_) {
+                    cell = heap_.promote_from_region(cell, mark);
+                }
+            }
+            value = pop();
+            heap_.reset_region(mark);
+            region_marks_.pop_back();
+        }
+        Cell return_cell = pop_return();
+        pop_return();
+        pop_return_frame(heap_.get_function_nlocals(func_obj));
+        pc = static_cast<Cell*>(return_cell.ptr);
+    }
+    return nullptr;
+}
+
 void Machine::execute_syscall(const std::string& name, int nargs) {
     if (name == "println") {
         // Pop the value to print from the stack.
@@ -252,7 +597,19 @@ void Machine::execute_syscall(const std::string& name, int nargs) {
     }
 }
 
-FunctionObject Machine::parse_function_object(const std::string& json_str) {
+FunctionObject Machine::parse_function_object(std::string_view json_str) {
+    PhaseTimer timer(startup_stats_, StartupPhase::Parse);
+    FunctionParser parser(*this);
+    return parser.parse(json_str);
+}
+
+FunctionObject Machine::decode_function_object(std::string_view bytecode) {
+    PhaseTimer timer(startup_stats_, StartupPhase::Parse);
+    BytecodeDecoder decoder(*this);
+    return decoder.decode(bytecode);
+}
+
+FunctionObject Machine::parse_function_object_dom(std::string_view json_str) {
     try {
         nlohmann::json j = nlohmann::json::parse(json_str);
 
@@ -260,183 +617,233 @@ FunctionObject Machine::parse_function_object(const std::string& json_str) {
         func.nlocals = j.at("nlocals").get<int>();
         func.nparams = j.at("nparams").get<int>();
 
+        // Code offset of each instruction, so that handler ranges expressed as
+        // instruction indexes can be translated into code offsets.
+        std::vector<uint32_t> instruction_offsets;
+
         // Compile instructions to threaded code.
         for (const auto& inst_json : j.at("instructions")) {
+            instruction_offsets.push_back(static_cast<uint32_t>(func.code.size()));
             Instruction inst;
-            inst.type = inst_json.at("type").get<std::string>();
-            inst.opcode = string_to_opcode(inst.type);
+            const std::string& type = inst_json.at("type").get_ref<const std::string&>();
+            inst.opcode = string_to_opcode(type);
             #ifdef TRACE_CODEGEN_DETAILED
-            fmt::print("  Parsing instruction: {} of type {}\n", inst.type, static_cast<int>(inst.opcode));
+            fmt::print("  Parsing instruction: {} of type {}\n", type, static_cast<int>(inst.opcode));
             #endif
 
-            // Optional fields.
+            // Optional fields. JSON numbers above INT64_MAX (such as 64-bit
+            // checksums) arrive as unsigned and keep their bit pattern.
             if (inst_json.contains("index")) {
-                inst.index = inst_json.at("index").get<int>();
+                const auto& index = inst_json.at("index");
+                inst.unsigned_index = index.is_number_unsigned() && index.get<uint64_t>() > INT64_MAX;
+                inst.index = inst.unsigned_index ? static_cast<int64_t>(index.get<uint64_t>()) : index.get<int64_t>();
                 #ifdef TRACE_CODEGEN_DETAILED
                 fmt::print("    Found index field: {}\n", inst.index.value());
-                fmt::print("    index.hasvalue() = {}\n", inst.index.has_value());
                 #endif
             }
             if (inst_json.contains("value")) {
-                inst.value = inst_json.at("value").get<std::string>();
+                inst.value = inst_json.at("value").get_ref<const std::string&>();
             }
             if (inst_json.contains("name")) {
-                inst.name = inst_json.at("name").get<std::string>();
+                inst.name = inst_json.at("name").get_ref<const std::string&>();
             }
 
-            // Compile to threaded code: emit label address followed by operands.
-            Cell label_word;
-            label_word.label_addr = opcode_map_.at(inst.opcode);
-            func.code.push_back(label_word);
-            #ifdef TRACE_CODEGEN_DETAILED
-            fmt::print("  Compiling instruction: {} at label {}\n", inst.type, static_cast<void*>(label_word.label_addr));
-            #endif
+            plant_instruction(func, inst);
+        }
 
-            // Add immediate operands based on instruction type.
-            switch (inst.opcode) {
-            case Opcode::PUSH_INT:
-            case Opcode::POP_LOCAL:
-            case Opcode::PUSH_LOCAL: {
-                Cell operand;
-                operand.i64 = inst.index.value_or(0);
-                func.code.push_back(operand);
-                break;
+        // The optional exception-handler table.
+        std::vector<HandlerSpec> handlers;
+        if (j.contains("handlers")) {
+            for (const auto& h : j.at("handlers")) {
+                HandlerSpec spec;
+                spec.start = h.at("start").get<int64_t>();
+                spec.end = h.at("end").get<int64_t>();
+                spec.target = h.at("target").get<int64_t>();
+                if (h.contains("index")) {
+                    spec.index = h.at("index").get<int64_t>();
+                }
+                handlers.push_back(spec);
             }
+        }
 
-            case Opcode::PUSH_STRING: {
-                #ifdef TRACE_PLANT_INSTRUCTIONS
-                fmt::print("Plant: PUSH_STRING\n");
-                #endif
-                // Allocate string in heap and store the Cell.
-                std::string str_value = inst.value.value();
-                Cell str_cell = allocate_string(str_value);
-                func.code.push_back(str_cell);
-                break;
-            }
+        finish_function(func, instruction_offsets, handlers);
+        return func;
+    } catch (const nlohmann::json::exception& e) {
+        throw std::runtime_error(fmt::format("JSON parsing error: {}", e.what()));
+    }
+}
 
-            case Opcode::PUSH_GLOBAL: {
-                #ifdef TRACE_PLANT_INSTRUCTIONS
-                fmt::print("Plant: PUSH_GLOBAL\n");
-                #endif
-                // Store pointer to global name string (kept in static storage).
-                Cell operand;
-                static thread_local std::vector<std::string> string_storage;
-                string_storage.push_back(inst.value.value());
-                operand.str_ptr = &string_storage.back();
-                func.code.push_back(operand);
-                break;
-            }
+void Machine::finish_function(FunctionObject& func, std::vector<uint32_t>& instruction_offsets,
+                              const std::vector<HandlerSpec>& handlers) {
+    PhaseTimer timer(startup_stats_, StartupPhase::CodeGeneration);
 
-            case Opcode::CALL_GLOBAL_COUNTED: {
-                #ifdef TRACE_PLANT_INSTRUCTIONS
-                fmt::print("Plant: CALL_GLOBAL_COUNTED\n");
-                #endif
-                // CALL_GLOBAL has two arguments:
-                // * index = the local variable index to get the previous stack length from, and
-                // * name = the name of the global function to call.
-                if (!inst.index.has_value()) {
-                    throw std::runtime_error("CALL_GLOBAL_COUNTED requires an index field");
-                }
-                if (!inst.name.has_value()) {
-                    throw std::runtime_error("CALL_GLOBAL_COUNTED requires a name field");
-                }
+    // The end of the last instruction is a valid range limit.
+    instruction_offsets.push_back(static_cast<uint32_t>(func.code.size()));
 
-                // Translate the name into an Ident* pointer.
-                Ident* ident_ptr = lookup_ident(inst.name.value());
-                if (ident_ptr == nullptr) {
-                    // Create and define the global on the fly if it doesn't exist.
-                    define_global(inst.name.value(), make_nil());
-                    ident_ptr = lookup_ident(inst.name.value());
-                }
+    // Add HALT at the end.
+    Cell halt_word;
+    halt_word.label_addr = get_opcode_label(Opcode::HALT);
+    func.code.push_back(halt_word);
 
-                #ifdef TRACE_CODEGEN_DETAILED
-                fmt::print("  CALL_GLOBAL_COUNTED compiling with index={} name={} ident_ptr={}\n",
-                           inst.index.value(), inst.name.value(), static_cast<void*>(ident_ptr));
-                #endif
+    // Translate the exception-handler table. Ranges and targets are instruction
+    // indexes in the JSON and become code offsets here.
+    auto to_offset = [&](const std::optional<int64_t>& index, const char* field) {
+        if (!index.has_value()) {
+            throw std::runtime_error(fmt::format("Handler requires a {} field", field));
+        }
+        if (*index < 0 || static_cast<uint64_t>(*index) >= instruction_offsets.size()) {
+            throw std::runtime_error(fmt::format("Handler {} out of range: {}", field, *index));
+        }
+        return instruction_offsets[*index];
+    };
+    for (const HandlerSpec& spec : handlers) {
+        HandlerEntry entry;
+        entry.start = to_offset(spec.start, "start");
+        entry.end = to_offset(spec.end, "end");
+        entry.target = to_offset(spec.target, "target");
+        entry.stack_local = spec.index ? static_cast<uint32_t>(*spec.index + 3) : 0;
+        func.handlers.push_back(entry);
+    }
+}
 
-                // Generate the index operand as a raw offset.
-                Cell index_operand = make_raw_i64(inst.index.value() + 3);
-                func.code.push_back(index_operand);
-                #ifdef TRACE_PLANT_INSTRUCTIONS_DETAILED
-                fmt::print("    Pushed index operand: {}\n", index_operand.i64);
-                #endif
+void Machine::plant_instruction(FunctionObject& func, const Instruction& inst) {
+    PhaseTimer timer(startup_stats_, StartupPhase::CodeGeneration);
+
+    // Compile to threaded code: emit label address followed by operands, each
+    // encoded according to the opcode's descriptor.
+    const OpcodeDescriptor& descriptor = describe(inst.opcode);
+    Cell label_word;
+    label_word.label_addr = get_opcode_label(inst.opcode);
+    size_t label_position = func.code.size();
+    func.code.push_back(label_word);
+    #ifdef TRACE_PLANT_INSTRUCTIONS
+    fmt::print("Plant: {}\n", descriptor.name);
+    #endif
 
-                // Now push the Ident* pointer as the function operand.
-                Cell func_operand;
-                func_operand.ptr = static_cast<void*>(ident_ptr);
-                func.code.push_back(func_operand);
+    auto require_index = [&]() {
+        if (!inst.index.has_value()) {
+            throw std::runtime_error(fmt::format("{} requires an index field", descriptor.name));
+        }
+        return inst.index.value();
+    };
+    auto require_string = [&](const std::optional<std::string_view>& field, const char* field_name) {
+        if (!field.has_value()) {
+            throw std::runtime_error(fmt::format("{} requires a {} field", descriptor.name, field_name));
+        }
+        return field.value();
+    };
+    // Tagged-pointer operands are recorded in the T-block by their position
+    // relative to the datakey, which is two cells before the code.
+    auto plant_tagged_pointer = [&](Cell cell) {
+        func.tblock.push_back(static_cast<uint32_t>(2 + func.code.size()));
+        func.code.push_back(cell);
+    };
+
+    for (int i = 0; i < descriptor.num_operands; i++) {
+        switch (descriptor.operands[i]) {
+        case OperandKind::IntLiteral: {
+            // Integer literals that do not fit in a tagged int become bignum
+            // constants, pushed by PUSH_CONSTANT instead.
+            int64_t index = require_index();
+            if (!inst.unsigned_index && fits_tagged_int(index)) {
+                func.code.push_back(make_raw_i64(index));
                 break;
             }
+            BigInt value = inst.unsigned_index ? BigInt::from_uint64(static_cast<uint64_t>(index))
+                                               : BigInt::from_int64(index);
+            func.code[label_position].label_addr = get_opcode_label(Opcode::PUSH_CONSTANT);
+            plant_tagged_pointer(allocate_integer_constant(value));
+            break;
+        }
 
+        case OperandKind::Index:
+            func.code.push_back(make_raw_i64(inst.index.value_or(0)));
+            break;
 
-            case Opcode::SYSCALL_COUNTED: {
-                // SYSCALL has two arguments:
-                // * index = the local variable index to get the previous stack length from, and
-                // * name = the name of the syscall.
-                #ifdef TRACE_PLANT_INSTRUCTIONS
-                fmt::print("Plant: SYSCALL_COUNTED\n");
-                #endif
-                if (!inst.index.has_value()) {
-                    throw std::runtime_error("SYSCALL_COUNTED requires an index field");
-                }
-                if (!inst.name.has_value()) {
-                    throw std::runtime_error("SYSCALL_COUNTED requires a name field");
-                }
-                #ifdef TRACE_PLANT_INSTRUCTIONS_DETAILED
-                fmt::print("  SYSCALL_COUNTED compiling with index={} name={}\n", inst.index.value(), inst.name.value());
-                #endif
-                // L_SYSCALL_COUNTED requires two operands: the index and the sys-function pointer.
-                Cell index_operand = make_raw_i64(inst.index.value() + 3);
-                func.code.push_back(index_operand);
-
-                // Look up sys-function in the table.
-                auto it = sysfunctions_table.find(inst.name.value());
-                if (it == sysfunctions_table.end()) {
-                    throw std::runtime_error(fmt::format("Unknown sys-function: {}", inst.name.value()));
-                }
-                SysFunction sys_function = it->second;
-                Cell func_operand;
-                func_operand.ptr = reinterpret_cast<void*>(sys_function);
-                func.code.push_back(func_operand);
-                break;
-            }
+        case OperandKind::LocalOffset:
+            // +3 for return address and func_obj and 0-based.
+            func.code.push_back(make_raw_i64(require_index() + 3));
+            break;
 
+        case OperandKind::StringConstant: {
+            // Allocate string in heap and store the Cell.
+            plant_tagged_pointer(allocate_string_constant(require_string(inst.value, "value")));
+            break;
+        }
 
-            case Opcode::STACK_LENGTH: {
-                // We will assign the current stack length into the local
-                // variable defined by index.
-                #ifdef TRACE_PLANT_INSTRUCTIONS
-                fmt::print("Plant: STACK_LENGTH\n");
-                #endif
-                 if (!inst.index.has_value()) {
-                    throw std::runtime_error("STACK_LENGTH requires an index field");
-                }
-               int offset = inst.index.value() + 3; // +3 for return address and func_obj and 0-based.
-                Cell c = make_raw_i64(offset);
-                func.code.push_back(c);
-                break;
-            }
+        case OperandKind::GlobalRef:
+            func.code.push_back(make_raw_ptr(resolve_ident(require_string(inst.value, "value"))));
+            break;
 
-            case Opcode::RETURN:
-            case Opcode::HALT:
-                // No operands.
-                break;
+        case OperandKind::CalleeRef:
+            func.code.push_back(make_raw_ptr(resolve_ident(require_string(inst.name, "name"))));
+            break;
+
+        case OperandKind::SysFunctionRef: {
+            // Look up sys-function in the table.
+            std::string_view name = require_string(inst.name, "name");
+            auto it = sysfunctions_table.find(name);
+            if (it == sysfunctions_table.end()) {
+                throw std::runtime_error(fmt::format("Unknown sys-function: {}", name));
             }
+            func.code.push_back(make_raw_ptr(reinterpret_cast<void*>(it->second)));
+            break;
         }
 
-        // Add HALT at the end.
-        Cell halt_word;
-        halt_word.label_addr = opcode_map_.at(Opcode::HALT);
-        func.code.push_back(halt_word);
+        case OperandKind::HeapConstant:
+        case OperandKind::FunctionRef:
+            throw std::runtime_error(fmt::format("{} is planted by the runtime and cannot appear in a bundle",
+                                                 descriptor.name));
+        }
+    }
+}
 
-        return func;
-    } catch (const nlohmann::json::exception& e) {
-        throw std::runtime_error(fmt::format("JSON parsing error: {}", e.what()));
+Ident* Machine::resolve_ident(std::string_view name) {
+    // Translate the name into an Ident* pointer, declaring the global (as
+    // undefined) on the fly if it does not exist yet.
+    Ident* ident_ptr = lookup_ident(name);
+    if (ident_ptr == nullptr) {
+        // Another thread may have declared it since the lookup, so try_emplace
+        // decides under the exclusive lock.
+        std::unique_lock<std::shared_mutex> lock(globals_mutex_);
+        auto [it, inserted] = globals_.try_emplace(std::string(name), nullptr);
+        if (inserted) {
+            it->second = new Ident{make_undef()};
+        }
+        ident_ptr = it->second;
+    }
+    return ident_ptr;
+}
+
+std::string Machine::global_name(const Ident* ident) const {
+    // Only needed to report errors, so a linear search is fine.
+    std::shared_lock<std::shared_mutex> lock(globals_mutex_);
+    for (const auto& pair : globals_) {
+        if (pair.second == ident) {
+            return pair.first;
+        }
+    }
+    return "<anonymous>";
+}
+
+void Machine::for_each_global(const std::function<void(const std::string& name, Ident* ident)>& visitor) const {
+    std::shared_lock<std::shared_mutex> lock(globals_mutex_);
+    for (const auto& pair : globals_) {
+        visitor(pair.first, pair.second);
     }
 }
 
 
 
+// RegionResults directs sys-function results into the region for as long as it
+// lives, even if the sys-function throws.
+struct RegionResults {
+    HeapSpace& space;
+
+    explicit RegionResults(HeapSpace& result_space) : space(result_space) { space = HeapSpace::Region; }
+    ~RegionResults() { space = HeapSpace::Collected; }
+};
+
 // Combined init/run function for threaded interpreter (like Poppy's init_or_run).
 //
 // Key implementation constraint: This must be a SINGLE function handling both
@@ -463,19 +870,42 @@ void Machine::threaded_impl(std::vector<Cell>* code, bool init_mode) {
         #ifdef TRACE_CODEGEN
         fmt::print("In init mode, capturing labels\n");
         #endif
-        opcode_map_ = {
-            {Opcode::PUSH_INT, &&L_PUSH_INT},
-            {Opcode::PUSH_STRING, &&L_PUSH_STRING},
-            {Opcode::POP_LOCAL, &&L_POP_LOCAL},
-            {Opcode::PUSH_LOCAL, &&L_PUSH_LOCAL},
-            {Opcode::PUSH_GLOBAL, &&L_PUSH_GLOBAL},
-            {Opcode::LAUNCH, &&L_LAUNCH},
-            {Opcode::CALL_GLOBAL_COUNTED, &&L_CALL_GLOBAL_COUNTED},
-            {Opcode::SYSCALL_COUNTED, &&L_SYSCALL_COUNTED},
-            {Opcode::STACK_LENGTH, &&L_STACK_LENGTH},
-            {Opcode::RETURN, &&L_RETURN},
-            {Opcode::HALT, &&L_HALT},
-        };
+        opcode_map_[Opcode::PUSH_INT] = &&L_PUSH_INT;
+        opcode_map_[Opcode::PUSH_STRING] = &&L_PUSH_STRING;
+        opcode_map_[Opcode::PUSH_CONSTANT] = &&L_PUSH_CONSTANT;
+        opcode_map_[Opcode::POP_LOCAL] = &&L_POP_LOCAL;
+        opcode_map_[Opcode::PUSH_LOCAL] = &&L_PUSH_LOCAL;
+        opcode_map_[Opcode::PUSH_GLOBAL] = &&L_PUSH_GLOBAL;
+        opcode_map_[Opcode::LAUNCH] = &&L_LAUNCH;
+        opcode_map_[Opcode::LAZY] = &&L_LAZY;
+        opcode_map_[Opcode::CALL_GLOBAL_COUNTED] = &&L_CALL_GLOBAL_COUNTED;
+        opcode_map_[Opcode::SYSCALL_COUNTED] = &&L_SYSCALL_COUNTED;
+        opcode_map_[Opcode::SYSCALL_REGION] = &&L_SYSCALL_REGION;
+        opcode_map_[Opcode::STACK_LENGTH] = &&L_STACK_LENGTH;
+        opcode_map_[Opcode::THROW] = &&L_THROW;
+        opcode_map_[Opcode::RETURN] = &&L_RETURN;
+        opcode_map_[Opcode::RETURN_REGION] = &&L_RETURN_REGION;
+        opcode_map_[Opcode::HALT] = &&L_HALT;
+        instrumented_opcode_map_[Opcode::PUSH_INT] = &&I_PUSH_INT;
+        instrumented_opcode_map_[Opcode::PUSH_STRING] = &&I_PUSH_STRING;
+        instrumented_opcode_map_[Opcode::PUSH_CONSTANT] = &&I_PUSH_CONSTANT;
+        instrumented_opcode_map_[Opcode::POP_LOCAL] = &&I_POP_LOCAL;
+        instrumented_opcode_map_[Opcode::PUSH_LOCAL] = &&I_PUSH_LOCAL;
+        instrumented_opcode_map_[Opcode::PUSH_GLOBAL] = &&I_PUSH_GLOBAL;
+        instrumented_opcode_map_[Opcode::LAUNCH] = &&I_LAUNCH;
+        instrumented_opcode_map_[Opcode::LAZY] = &&I_LAZY;
+        instrumented_opcode_map_[Opcode::CALL_GLOBAL_COUNTED] = &&I_CALL_GLOBAL_COUNTED;
+        instrumented_opcode_map_[Opcode::SYSCALL_COUNTED] = &&I_SYSCALL_COUNTED;
+        instrumented_opcode_map_[Opcode::SYSCALL_REGION] = &&I_SYSCALL_REGION;
+        instrumented_opcode_map_[Opcode::STACK_LENGTH] = &&I_STACK_LENGTH;
+        instrumented_opcode_map_[Opcode::THROW] = &&I_THROW;
+        instrumented_opcode_map_[Opcode::RETURN] = &&I_RETURN;
+        instrumented_opcode_map_[Opcode::RETURN_REGION] = &&I_RETURN_REGION;
+        instrumented_opcode_map_[Opcode::HALT] = &&I_HALT;
+        // A missing entry would send dispatch to a null address, so fail early.
+        if (!opcode_map_.is_complete() || !instrumented_opcode_map_.is_complete()) {
+            throw std::runtime_error("Dispatch table is missing a handler label");
+        }
         return;
     }
 
@@ -488,174 +918,269 @@ void Machine::threaded_impl(std::vector<Cell>* code, bool init_mode) {
     fmt::print("pc = {}, label = {}\n", static_cast<void*>(pc), static_cast<void*>(pc->label_addr));
     #endif
 
-    // Jump to the first instruction.
-    #ifdef TRACE_CODEGEN_DETAILED
-    fmt::print("About to jump\n");
-    #endif
-    goto *pc++->label_addr;
-
-    L_PUSH_INT: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("PUSH_INT\n");
+    // The dispatch loop runs inside a try block so that failures, whether raised
+    // by THROW or by a handler's C++ runtime checks, can be offered to the Nutmeg
+    // exception-handler tables. Entering the try block costs nothing on the
+    // non-throwing path; the return stack is only unwound once something throws.
+    // Frames below base_depth belong to whoever called us and are left alone.
+    size_t base_depth = return_stack_.size();
+    for (;;) try {
+        // Jump to the first instruction (or to a handler, after an exception).
+        #ifdef TRACE_CODEGEN_DETAILED
+        fmt::print("About to jump\n");
         #endif
-        int64_t value = (pc++)->i64;
-        push(make_tagged_int(value));
-        goto *(pc++)->label_addr;
-    }
+        goto *pc++->label_addr;
 
-    L_PUSH_STRING: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("PUSH_STRING\n");
-        #endif
-        Cell str_cell = *(pc++);
-        push(str_cell);
-        goto *(pc++)->label_addr;
-    }
-
-    L_POP_LOCAL: {
-    //     #ifdef DEBUG_INSTRUCTIONS
-    //     fmt::print("POP_LOCAL\n");
-    //     #endif
-    //     int64_t idx = (pc++)->i64;
-    //     Cell value = pop();
-    //     int nlocals = heap_.get_function_nlocals(current_function_);
-    //     size_t offset = return_stack_.size() - nlocals + idx;
-    //     return_stack_[offset] = value;
-        goto *(pc++)->label_addr;
-    }
-
-    L_PUSH_LOCAL: {
-    //     #ifdef DEBUG_INSTRUCTIONS
-    //     fmt::print("PUSH_LOCAL\n");
-    //     #endif
-    //     int64_t idx = (pc++)->i64;
-    //     int nlocals = heap_.get_function_nlocals(current_function_);
-    //     size_t offset = return_stack_.size() - nlocals + idx;
-    //     push(return_stack_[offset]);
-        goto *(pc++)->label_addr;
-    }
-
-    L_PUSH_GLOBAL: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("PUSH_GLOBAL\n");
-        #endif
-        std::string* name = (pc++)->str_ptr;
-        push(lookup_global(*name));
-        goto *(pc++)->label_addr;
-    }
+        L_PUSH_INT: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("PUSH_INT\n");
+            #endif
+            int64_t value = (pc++)->i64;
+            push(make_tagged_int(value));
+            goto *(pc++)->label_addr;
+        }
 
-    L_CALL_GLOBAL_COUNTED: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("CALL_GLOBAL_COUNTED\n");
-        #endif
+        L_PUSH_STRING: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("PUSH_STRING\n");
+            #endif
+            Cell str_cell = *(pc++);
+            push(str_cell);
+            goto *(pc++)->label_addr;
+        }
 
-        // Get the count of arguments from the local variable.
-        int64_t offset = (pc++)->i64;
-        uint64_t count = operand_stack_.size() - as_detagged_int(get_local_variable(offset));
+        L_PUSH_CONSTANT: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("PUSH_CONSTANT\n");
+            #endif
+            // Push a heap constant planted by the loader (such as a bignum literal).
+            push(*(pc++));
+            goto *(pc++)->label_addr;
+        }
 
-        // Get the Ident* pointer to the function to call.
-        Ident* ident_ptr = static_cast<Ident*>((pc++)->ptr);
-        Cell* func_ptr = get_function_ptr(ident_ptr->cell);
+        L_POP_LOCAL: {
+        //     #ifdef DEBUG_INSTRUCTIONS
+        //     fmt::print("POP_LOCAL\n");
+        //     #endif
+        //     int64_t idx = (pc++)->i64;
+        //     Cell value = pop();
+        //     int nlocals = heap_.get_function_nlocals(current_function_);
+        //     size_t offset = return_stack_.size() - nlocals + idx;
+        //     return_stack_[offset] = value;
+            goto *(pc++)->label_addr;
+        }
 
-        // Get the number of nlocals and nparams from the function object.
-        int nlocals = heap_.get_function_nlocals(func_ptr);
-        int nparams = heap_.get_function_nparams(func_ptr);
+        L_PUSH_LOCAL: {
+        //     #ifdef DEBUG_INSTRUCTIONS
+        //     fmt::print("PUSH_LOCAL\n");
+        //     #endif
+        //     int64_t idx = (pc++)->i64;
+        //     int nlocals = heap_.get_function_nlocals(current_function_);
+        //     size_t offset = return_stack_.size() - nlocals + idx;
+        //     push(return_stack_[offset]);
+            goto *(pc++)->label_addr;
+        }
 
-        // Build stack frame: [return_address][func_obj][local_0]...[local_nlocals-1]
-        // Initialize remaining locals to nil.
-        for (int i = nparams; i < nlocals; i++)
-        {
-            push_return(make_nil());
+        L_PUSH_GLOBAL: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("PUSH_GLOBAL\n");
+            #endif
+            Ident* ident = static_cast<Ident*>((pc++)->ptr);
+            Cell value = ident->cell;
+            // Globals referenced by compiled code are declared undefined until loaded.
+            if (value.u64 == SPECIAL_UNDEF) {
+                throw std::runtime_error(fmt::format("Undefined global: {}", global_name(ident)));
+            }
+            push(value);
+            goto *(pc++)->label_addr;
         }
 
-        // Pop parameters from operand stack and push to return stack.
-        // Operand stack has params in reverse order, so popping gives us the right order.
-        for (int i = 0; i < nparams; i++)
-        {
-            push_return(pop());
+        L_CALL_GLOBAL_COUNTED: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("CALL_GLOBAL_COUNTED\n");
+            #endif
+
+            // Skip the local holding the argument count: the callee takes its
+            // nparams arguments whatever the count.
+            pc++;
+
+            // Get the Ident* pointer to the function to call, and pass control to it.
+            Ident* ident_ptr = static_cast<Ident*>((pc++)->ptr);
+            pc = enter_function(get_function_ptr(ident_ptr->cell), pc);
+
+            goto *(pc++)->label_addr;
         }
 
-        // Save func_obj pointer so RETURN can read nlocals.
-        Cell func_cell;
-        func_cell.ptr = func_ptr;
-        push_return(func_cell);
+        L_SYSCALL_COUNTED: {
+            #ifdef DEBUG_INSTRUCTIONS
+            int64_t offset = (pc++)->i64;
+            fmt::print("SYSCALL_COUNTED, offset={}, value={}\n", offset, get_local_variable(offset).i64);
+            #else
+            int64_t offset = (pc++)->i64;
+            #endif
+            uint64_t count = operand_stack_.size() - as_detagged_int(get_local_variable(offset));
+            SysFunction sys_function = reinterpret_cast<SysFunction>((pc++)->ptr);
+            sys_function(*this, static_cast<int>(count));
 
-        // Save return address on return stack (points to next instruction after operand).
-        Cell return_cell;
-        return_cell.ptr = pc;
-        push_return(return_cell);
+            goto *(pc++)->label_addr;
+        }
 
-        // Now pass control to the called function.
-        pc = heap_.get_function_code(func_ptr);
+        L_SYSCALL_REGION: {
+            // A SYSCALL_COUNTED whose results the loader has proven never leave
+            // this frame, so they are allocated in the region. The frame takes
+            // its region mark the first time it gets here.
+            int64_t offset = (pc++)->i64;
+            uint64_t count = operand_stack_.size() - as_detagged_int(get_local_variable(offset));
+            SysFunction sys_function = reinterpret_cast<SysFunction>((pc++)->ptr);
+            if (region_marks_.empty() || region_marks_.back().first != return_stack_.size()) {
+                region_marks_.emplace_back(return_stack_.size(), heap_.get_region_mark());
+            }
+            {
+                RegionResults region_results(result_space_);
+                sys_function(*this, static_cast<int>(count));
+            }
 
-        goto *(pc++)->label_addr;
-    }
+            goto *(pc++)->label_addr;
+        }
 
-    L_SYSCALL_COUNTED: {
-        #ifdef DEBUG_INSTRUCTIONS
-        int64_t offset = (pc++)->i64;
-        fmt::print("SYSCALL_COUNTED, offset={}, value={}\n", offset, get_local_variable(offset).i64);
-        #else
-        int64_t offset = (pc++)->i64;
-        #endif
-        uint64_t count = operand_stack_.size() - as_detagged_int(get_local_variable(offset));
-        SysFunction sys_function = reinterpret_cast<SysFunction>((pc++)->ptr);
-        sys_function(*this, static_cast<int>(count));
+        L_STACK_LENGTH: {
+            // Assign the current stack length into the local variable defined by
+            // the operand, which is a raw i64.
+            int64_t offset = (pc++)->i64;
+            get_local_variable(offset) = make_tagged_int(static_cast<int64_t>(operand_stack_.size()));
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("STACK_LENGTH, offset = {}, size = {}\n", offset, operand_stack_.size());
+            #endif
 
-        goto *(pc++)->label_addr;
-    }
+            goto *(pc++)->label_addr;
+        }
 
-    L_STACK_LENGTH: {
-        // Assign the current stack length into the local variable defined by
-        // the operand, which is a raw i64.
-        int64_t offset = (pc++)->i64;
-        get_local_variable(offset) = make_tagged_int(static_cast<int64_t>(operand_stack_.size()));
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("STACK_LENGTH, offset = {}, size = {}\n", offset, operand_stack_.size());
-        #endif
+        L_THROW: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("THROW\n");
+            #endif
+            // Raise the value on top of the stack. The pc has already moved past
+            // the label word, so the unwinder attributes it to this instruction.
+            Cell value = pop();
+            bool is_string = is_tagged_ptr(value) &&
+                static_cast<Cell*>(as_detagged_ptr(value))[0].ptr == heap_.get_string_datakey();
+            throw NutmegException(value, is_string ? get_string(value) : cell_to_string(value));
+        }
 
-        goto *(pc++)->label_addr;
-    }
+        L_RETURN_REGION: {
+            // The RETURN of a function with region sites: reset the region to
+            // the frame's mark, if it took one, freeing its objects.
+            if (!region_marks_.empty() && region_marks_.back().first == return_stack_.size()) {
+                heap_.reset_region(region_marks_.back().second);
+                region_marks_.pop_back();
+            }
+            goto L_RETURN;
+        }
 
-    L_RETURN: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("RETURN\n");
-        #endif
-        // Clean up stack frame: [return_address][func_obj][local_0]...[local_nlocals-1]
+        L_RETURN: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("RETURN\n");
+            #endif
+            // Clean up stack frame: [return_address][func_obj][local_0]...[local_nlocals-1]
 
-        // Restore return address (raw).
-        Cell return_cell = pop_return();
+            // Restore return address (raw).
+            Cell return_cell = pop_return();
 
-        // Pop the func_obj pointer (raw) and restore previous function context.
-        Cell * func_obj = static_cast<Cell *>(pop_return().ptr);
+            // Pop the func_obj pointer (raw) and restore previous function context.
+            Cell * func_obj = static_cast<Cell *>(pop_return().ptr);
 
-        // Pop nlocals slots first.
-        // Get nlocals from current_function_.
-        int nlocals = heap_.get_function_nlocals(func_obj);
-        pop_return_frame(nlocals);
+            // Pop nlocals slots first.
+            // Get nlocals from current_function_.
+            int nlocals = heap_.get_function_nlocals(func_obj);
+            pop_return_frame(nlocals);
 
-        pc = static_cast<Cell*>(return_cell.ptr);
+            pc = static_cast<Cell*>(return_cell.ptr);
 
-        // Continue execution at return address.
-        goto *pc++->label_addr;
-    }
+            // Continue execution at return address.
+            goto *pc++->label_addr;
+        }
 
-    L_HALT: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("HALT\n");
-        #endif
-        return;
-    }
+        L_HALT: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("HALT\n");
+            #endif
+            return;
+        }
 
-    L_LAUNCH: {
-        #ifdef DEBUG_INSTRUCTIONS
-        fmt::print("LAUNCH\n");
-        #endif
-        pc = LaunchInstruction(pc);
-        #ifdef DEBUG_INSTRUCTIONS_DETAIL
-        fmt::print("&&L_STACK_LENGTH = {}, new pc = {}\n", static_cast<void*>(&&L_STACK_LENGTH), static_cast<void*>(pc));
-        #endif
-        goto *pc++->label_addr;
+        L_LAUNCH: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("LAUNCH\n");
+            #endif
+            pc = LaunchInstruction(pc);
+            #ifdef DEBUG_INSTRUCTIONS_DETAIL
+            fmt::print("&&L_STACK_LENGTH = {}, new pc = {}\n", static_cast<void*>(&&L_STACK_LENGTH), static_cast<void*>(pc));
+            #endif
+            goto *pc++->label_addr;
+        }
+
+        L_LAZY: {
+            #ifdef DEBUG_INSTRUCTIONS
+            fmt::print("LAZY\n");
+            #endif
+            // We are in the stub of a binding that has not been compiled yet.
+            Ident* ident = static_cast<Ident*>((pc++)->ptr);
+            const char* name = get_string(*(pc++));
+
+            // Discard the stub's frame (it has no locals). Failures while loading
+            // are then reported as raised by the call instruction.
+            Cell* return_pc = static_cast<Cell*>(pop_return().ptr);
+            pop_return();
+            pc = return_pc;
+
+            if (!lazy_loader_) {
+                throw std::runtime_error(fmt::format("No loader for lazy binding: {}", name));
+            }
+            Cell stub = ident->cell;
+            lazy_loader_(name);
+            // Defensive check: re-entering an unchanged stub would loop forever.
+            if (ident->cell.u64 == stub.u64) {
+                throw std::runtime_error(fmt::format("Lazy binding was not defined: {}", name));
+            }
+
+            // Enter the real function exactly as the call would have done.
+            pc = enter_function(get_function_ptr(ident->cell), return_pc);
+            goto *pc++->label_addr;
+        }
+
+        // Instrumented handlers. The dispatch has already stepped past the label word,
+        // so pc - 1 is the address of the instruction being executed.
+        I_PUSH_INT: instrument_instruction(Opcode::PUSH_INT, pc - 1); goto L_PUSH_INT;
+        I_PUSH_STRING: instrument_instruction(Opcode::PUSH_STRING, pc - 1); goto L_PUSH_STRING;
+        I_PUSH_CONSTANT: instrument_instruction(Opcode::PUSH_CONSTANT, pc - 1); goto L_PUSH_CONSTANT;
+        I_POP_LOCAL: instrument_instruction(Opcode::POP_LOCAL, pc - 1); goto L_POP_LOCAL;
+        I_PUSH_LOCAL: instrument_instruction(Opcode::PUSH_LOCAL, pc - 1); goto L_PUSH_LOCAL;
+        I_PUSH_GLOBAL: instrument_instruction(Opcode::PUSH_GLOBAL, pc - 1); goto L_PUSH_GLOBAL;
+        I_CALL_GLOBAL_COUNTED: instrument_instruction(Opcode::CALL_GLOBAL_COUNTED, pc - 1); goto L_CALL_GLOBAL_COUNTED;
+        I_SYSCALL_COUNTED: instrument_instruction(Opcode::SYSCALL_COUNTED, pc - 1); goto L_SYSCALL_COUNTED;
+        I_SYSCALL_REGION: instrument_instruction(Opcode::SYSCALL_REGION, pc - 1); goto L_SYSCALL_REGION;
+        I_STACK_LENGTH: instrument_instruction(Opcode::STACK_LENGTH, pc - 1); goto L_STACK_LENGTH;
+        I_THROW: instrument_instruction(Opcode::THROW, pc - 1); goto L_THROW;
+        I_RETURN: instrument_instruction(Opcode::RETURN, pc - 1); goto L_RETURN;
+        I_RETURN_REGION: instrument_instruction(Opcode::RETURN_REGION, pc - 1); goto L_RETURN_REGION;
+        I_HALT: instrument_instruction(Opcode::HALT, pc - 1); goto L_HALT;
+        I_LAUNCH: instrument_instruction(Opcode::LAUNCH, pc - 1); goto L_LAUNCH;
+        I_LAZY: instrument_instruction(Opcode::LAZY, pc - 1); goto L_LAZY;
+    } catch (const NutmegException& e) {
+        pc = unwind(pc, e.value(), base_depth);
+        if (pc == nullptr) {
+            throw;
+        }
+    } catch (const std::runtime_error& e) {
+        // A runtime failure inside a handler is raised in Nutmeg as its message.
+        Cell message;
+        {
+            std::lock_guard<std::mutex> lock(heap_mutex_);
+            message = allocate_string(e.what());
+        }
+        pc = unwind(pc, message, base_depth);
+        if (pc == nullptr) {
+            throw;
+        }
     }
 
     #else
@@ -687,10 +1212,40 @@ Cell * Machine::LaunchInstruction(Cell *pc)
     }
     #endif
 
+    pc = enter_function(func_obj, pc);
+    #ifdef DEBUG_INSTRUCTIONS_DETAIL
+    fmt::print("LaunchInstruction: func_obj={}, returned pc={}\n", static_cast<void*>(func_obj), static_cast<void*>(pc));
+    if (pc == func_obj) {
+        fmt::print("ERROR: get_function_code returned func_obj itself!\n");
+    }
+    #endif
+    return pc;
+}
+
+void Machine::visit_roots(const Heap::RootVisitor& visit) {
+    for (Cell& cell : operand_stack_) {
+        visit(cell);
+    }
+    for (Cell& cell : return_stack_) {
+        visit(cell);
+    }
+    std::shared_lock<std::shared_mutex> lock(globals_mutex_);
+    for (const auto& pair : globals_) {
+        visit(pair.second->cell);
+    }
+}
+
+Cell* Machine::enter_function(Cell* func_obj, Cell* return_pc) {
     // Get function metadata.
     int nlocals = heap_.get_function_nlocals(func_obj);
     int nparams = heap_.get_function_nparams(func_obj);
 
+    // Defensive check: fail before the frame is half-built, so that an
+    // exception handler never sees a partial frame on the return stack.
+    if (operand_stack_.size() < static_cast<size_t>(nparams)) {
+        throw std::runtime_error("Stack underflow");
+    }
+
     // Build stack frame: [return_address][func_obj][local_0]...[local_nlocals-1]
 
     // Initialize remaining locals to nil.
@@ -711,21 +1266,13 @@ Cell * Machine::LaunchInstruction(Cell *pc)
     func_cell.ptr = func_obj;
     push_return(func_cell);
 
-    // Save return address on return stack (points to next instruction after operand).
+    // Save return address on return stack.
     Cell return_cell;
-    return_cell.ptr = pc;
+    return_cell.ptr = return_pc;
     push_return(return_cell);
 
-
-    // Set pc to function code (caller will do the goto).
-    pc = heap_.get_function_code(func_obj);
-    #ifdef DEBUG_INSTRUCTIONS_DETAIL
-    fmt::print("LaunchInstruction: func_obj={}, returned pc={}\n", static_cast<void*>(func_obj), static_cast<void*>(pc));
-    if (pc == func_obj) {
-        fmt::print("ERROR: get_function_code returned func_obj itself!\n");
-    }
-    #endif
-    return pc;
+    // The caller will do the goto.
+    return heap_.get_function_code(func_obj);
 }
 
 } // namespace nutmeg
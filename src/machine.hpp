@@ -4,13 +4,49 @@
 #include "value.hpp"
 #include "function_object.hpp"
 #include "heap.hpp"
+#include "instruction.hpp"
+#include "string_hash.hpp"
+#include "startup_stats.hpp"
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include <string>
 #include <memory>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+#include <stdexcept>
 
 namespace nutmeg {
 
+struct BigInt;
+
+// NutmegException carries a Nutmeg value raised by THROW. If no handler in the
+// Nutmeg call stack accepts it, it escapes from Machine::execute as a C++
+// exception.
+class NutmegException : public std::runtime_error {
+private:
+    Cell value_;
+
+public:
+    NutmegException(Cell value, const std::string& msg) : std::runtime_error(msg), value_(value) {}
+
+    Cell value() const { return value_; }
+};
+
+// The sampled allocations of one instruction (see Machine::set_allocation_profiling).
+struct AllocationSite {
+    std::string function;     // The global naming the function, or "<anonymous>"; empty outside any function.
+    size_t offset;            // The instruction's offset, in cells, from the start of the function's code.
+    std::string instruction;  // The instruction's opcode.
+    uint64_t samples;
+    uint64_t bytes;           // The bytes the samples stand for.
+};
+
 // The virtual machine with dual-stack architecture.
 class Machine {
 private:
@@ -20,25 +56,118 @@ private:
     // Return stack (for function calls and local variables).
     std::vector<Cell> return_stack_;
 
+    // The deepest each stack has been, in cells, if tracked (see --heap-stats).
+    bool track_stack_depths_ = false;
+    size_t max_operand_depth_ = 0;
+    size_t max_return_depth_ = 0;
+
     // Global dictionary mapping names to values via indirection.
     // Indirection ensures stable pointers that won't be invalidated by map resizing.
-    std::unordered_map<std::string, Ident* > globals_;
+    std::unordered_map<std::string, Ident*, StringHash, std::equal_to<>> globals_;
 
     // Heap for objects (strings, function objects, etc.).
     Heap heap_;
 
+    // Bindings may be compiled on several threads at once (see main), so the
+    // compilation path locks the state it shares. globals_mutex_ guards globals_
+    // in define_global, lookup_ident, resolve_ident and global_name; readers take
+    // it shared because nearly every name is declared before compilation starts.
+    // heap_mutex_ guards heap allocation by plant_instruction, allocate_function,
+    // allocate_lazy_stub and the constant allocators. Execution is single-threaded, but bindings may still be
+    // compiling in the background (see BackgroundLoader), so its occasional heap
+    // allocations take heap_mutex_ as well. They may collect the collected space,
+    // which compilation never touches.
+    mutable std::shared_mutex globals_mutex_;
+    std::mutex heap_mutex_;
+
     // Current function being executed (for local variable access).
     int pc_;  // Program counter.
 
     // Threaded interpreter support.
-    std::unordered_map<Opcode, void*> opcode_map_;  // Maps opcodes to label addresses.
+    DispatchTable opcode_map_;  // Maps opcodes to label addresses.
+
+    // Instrumented handler labels. Each one counts (and optionally traces) the
+    // instruction and then falls into the plain handler. Code only pays for this
+    // when its label words have been switched over to these addresses.
+    DispatchTable instrumented_opcode_map_;
+
+    // Whether newly compiled code should use the instrumented labels.
+    bool instrumented_;
+
+    // Whether instrumented handlers should print a trace line to stderr.
+    bool trace_instructions_;
+
+    // Per-opcode execution counts, maintained by the instrumented handlers.
+    std::array<uint64_t, NUM_OPCODES> instruction_counts_;
+
+    // The label word of the instruction the instrumented handlers last
+    // dispatched, which is the one executing when it allocates.
+    const Cell* current_instruction_ = nullptr;
+
+    // Sampled allocations by function and instruction (see --alloc-profile).
+    struct SampleCounts {
+        uint64_t samples = 0;
+        uint64_t bytes = 0;
+    };
+    std::map<std::pair<Cell*, const Cell*>, SampleCounts> allocation_samples_;
+
+    // Whether the loader looks for allocation sites whose results never leave
+    // their frame (see set_region_allocation).
+    bool region_allocation_ = false;
+
+    // Where sys-functions allocate their results: the region while a
+    // SYSCALL_REGION runs, otherwise the collected space.
+    HeapSpace result_space_ = HeapSpace::Collected;
+
+    // The region marks of the frames that have allocated there, innermost last,
+    // each with the return-stack length that identifies its frame.
+    std::vector<std::pair<size_t, size_t>> region_marks_;
+
+public:
+    // A LazyLoader compiles the named binding and defines it as a global, on the
+    // first call of its lazy stub.
+    using LazyLoader = std::function<void(std::string_view name)>;
+
+private:
+    LazyLoader lazy_loader_;
+
+    // Where parsing, code generation and heap allocation are timed, if anywhere
+    // (see --startup-stats).
+    StartupStats* startup_stats_ = nullptr;
 
 public:
-    Machine();
+    explicit Machine(const HeapOptions& heap_options = {});
     ~Machine();
 
     // Get the opcode map for compiling functions.
-    const std::unordered_map<Opcode, void*>& get_opcode_map() const { return opcode_map_; }
+    const DispatchTable& get_opcode_map() const { return opcode_map_; }
+
+    // Get the label address the compiler should plant for an opcode, which depends
+    // on whether instrumentation is currently enabled.
+    void* get_opcode_label(Opcode opcode) const;
+
+    // Find the opcode of a label word, whether plain or instrumented.
+    std::optional<Opcode> find_opcode(const void* label_addr) const;
+
+    // Instrumentation. Switching rewrites the label words of every function object
+    // reachable from the globals (or of a single function) between the plain and
+    // instrumented handlers, and determines the labels planted by later compilation.
+    void set_instrumentation(bool enabled);
+    void set_function_instrumentation(Cell* func_obj, bool enabled);
+    bool is_instrumented() const { return instrumented_; }
+    void set_instruction_tracing(bool enabled) { trace_instructions_ = enabled; }
+    const std::array<uint64_t, NUM_OPCODES>& get_instruction_counts() const { return instruction_counts_; }
+    void reset_instruction_counts() { instruction_counts_.fill(0); }
+
+    // Allocation-site profiling. Every interval_bytes allocated from now on is
+    // charged to the instruction that allocated it, or profiling stops if
+    // interval_bytes is zero. Since only instrumented handlers say which
+    // instruction is executing, starting turns instrumentation on. Call it on
+    // the thread that executes: allocations on other threads are not sampled.
+    void set_allocation_profiling(uint64_t interval_bytes);
+
+    // The sites sampled so far, most bytes first.
+    std::vector<AllocationSite> get_allocation_profile() const;
 
     // Stack operations.
     void push(Cell value);
@@ -53,6 +182,16 @@ public:
     void push_return(Cell value);
     Cell pop_return();
 
+    // Both stacks in full, bottom first, for heap dumps.
+    const std::vector<Cell>& get_operand_stack() const { return operand_stack_; }
+    const std::vector<Cell>& get_return_stack() const { return return_stack_; }
+
+    // Track the deepest each stack has been from now on, or stop. Off by
+    // default, since it costs a comparison on every push.
+    void set_stack_depth_tracking(bool enabled) { track_stack_depths_ = enabled; }
+    size_t get_max_operand_depth() const { return max_operand_depth_; }
+    size_t get_max_return_depth() const { return max_return_depth_; }
+
     Cell& get_return_address();
     Cell& get_frame_function_object();
     Cell& get_local_variable(int offset);
@@ -67,21 +206,82 @@ public:
     Cell lookup_global(const std::string& name) const;
     bool has_global(const std::string& name) const;
     Cell* get_global_cell_ptr(const std::string& name);
-    Ident * lookup_ident(const std::string& name) const;
+    Ident * lookup_ident(std::string_view name) const;
+
+    // Translate a global name into its Ident, declaring it as undefined if needed.
+    Ident* resolve_ident(std::string_view name);
+
+    // Reverse lookup of a global's name, for error messages and the code cache.
+    std::string global_name(const Ident* ident) const;
+
+    // Call visitor with the name and Ident of every global, defined or only declared.
+    void for_each_global(const std::function<void(const std::string& name, Ident* ident)>& visitor) const;
 
 
     // Heap allocation.
-    Cell allocate_string(const std::string& value);
+    Cell allocate_string(std::string_view value, HeapSpace space = HeapSpace::Collected);
     const char* get_string(Cell cell);
 
-    Cell* allocate_function(const std::vector<Cell>& code, int nlocals, int nparams);
+    // Allocate a constant for compiled code, in the permanent space and under
+    // the heap lock, as compilation and code-cache relocation do.
+    Cell allocate_string_constant(std::string_view value);
+    Cell allocate_integer_constant(const BigInt& value);
+
+    Cell* allocate_function(const std::vector<Cell>& code, int nlocals, int nparams,
+                            const std::vector<HandlerEntry>& handlers = {},
+                            const std::vector<uint32_t>& tblock = {});
+    Cell* allocate_function(const FunctionObject& func);
     Cell* get_function_ptr(Cell cell);
 
-    // Parse JSON function object and compile to threaded code.
-    FunctionObject parse_function_object(const std::string& json_str);
+    // Allocate a stub function object for a binding that is compiled on first
+    // use. Calling the stub runs the lazy loader for name, which replaces the
+    // global, and then enters the real function in the stub's place.
+    Cell* allocate_lazy_stub(std::string_view name);
+    void set_lazy_loader(LazyLoader loader) { lazy_loader_ = std::move(loader); }
+
+    // Region allocation. When enabled, each function the machine allocates is
+    // analysed for sys-calls whose results are only ever read by later sys-calls
+    // in the same frame. Those are rewritten to allocate their results in the
+    // heap's region, which is reset when the frame returns, and so never reach
+    // the collector. Only functions without exception handlers are analysed.
+    void set_region_allocation(bool enabled) { region_allocation_ = enabled; }
+
+    // The space a sys-function should allocate its results in.
+    HeapSpace get_result_space() const { return result_space_; }
+
+    // Charge compilation to the startup phases of stats, or stop if it is null.
+    void set_startup_stats(StartupStats* stats) { startup_stats_ = stats; }
+
+    // Parse JSON function object and compile to threaded code. This uses the
+    // streaming FunctionParser, which plants code as it reads.
+    FunctionObject parse_function_object(std::string_view json_str);
+
+    // Decode a function object from the binary bytecode format (see bytecode.hpp)
+    // and compile it to threaded code.
+    FunctionObject decode_function_object(std::string_view bytecode);
+
+    // The same via an nlohmann::json DOM. Slower, but kept as the reference
+    // implementation that FunctionParser is tested and benchmarked against.
+    FunctionObject parse_function_object_dom(std::string_view json_str);
+
+    // Compile one instruction onto the end of func.code, encoding its operands as
+    // described by its OpcodeDescriptor and recording tagged-pointer operands in
+    // func.tblock. Safe to call from several threads, as are parse_function_object,
+    // finish_function, allocate_function, allocate_lazy_stub and define_global.
+    void plant_instruction(FunctionObject& func, const Instruction& inst);
+
+    // Complete a function once all its instructions are planted: append the final
+    // HALT and translate the handler table from instruction indexes to code
+    // offsets, given the code offset of each instruction.
+    void finish_function(FunctionObject& func, std::vector<uint32_t>& instruction_offsets,
+                         const std::vector<HandlerSpec>& handlers);
+
+    // The lock that heap allocation must hold while other threads may be compiling.
+    std::mutex& get_heap_mutex() { return heap_mutex_; }
 
     // Get the heap for external use (e.g., initializing globals).
     Heap& get_heap() { return heap_; }
+    const Heap& get_heap() const { return heap_; }
 
     // Execution.
     void execute(Cell* func_ptr);
@@ -92,6 +292,33 @@ private:
     // Combined init/run function for threaded interpreter (like Poppy).
     void threaded_impl(std::vector<Cell> *code, bool init_mode);
     Cell * LaunchInstruction(Cell *pc);
+
+    // Push a frame for calling func_obj, which returns to return_pc, and return
+    // the address of the function's first instruction. Every call instruction
+    // builds its frame here, so the layout is defined once.
+    Cell* enter_function(Cell* func_obj, Cell* return_pc);
+
+    // Unwind the return stack frame-by-frame looking for a handler that covers
+    // the instruction before pc. Frames at or below base_depth belong to the
+    // caller of threaded_impl and are never unwound. Returns the handler's pc
+    // with the exception value pushed, or nullptr if the exception is uncaught.
+    Cell* unwind(Cell* pc, Cell value, size_t base_depth);
+
+    // Bookkeeping performed by every instrumented handler before it falls into the
+    // plain handler. The pc points at the label word of the instruction.
+    void instrument_instruction(Opcode opcode, const Cell* pc);
+
+    // Charge a sampled allocation of bytes to the current instruction.
+    void sample_allocation(uint64_t bytes);
+
+    // Rewrite the sys-calls of a new function whose results cannot escape its
+    // frame to SYSCALL_REGION, and if there are any, its returns to RETURN_REGION.
+    void mark_region_sites(Cell* func_obj);
+
+    // Visit the collector's roots: both stacks and every global. The return stack
+    // also holds raw return addresses and function pointers, but a raw pointer is
+    // never a tagged pointer, so the collector passes over them.
+    void visit_roots(const Heap::RootVisitor& visit);
 }; // class Machine
 
 } // namespace nutmeg
@@ -3,19 +3,115 @@
 #include <vector>
 #include <optional>
 #include <cstring>
-#include <unordered_set>
+#include <cstdlib>
 #include "bundle_reader.hpp"
 #include "machine.hpp"
 #include "heap.hpp"
+#include "code_cache.hpp"
+#include "thread_pool.hpp"
+#include "startup_stats.hpp"
+#include "program_loader.hpp"
+#include "image.hpp"
+#include "heap_dump.hpp"
 
 // #define TRACE_MAIN
 
 struct CommandLineArgs {
     std::optional<std::string> entry_point;
+    bool instrument = false;       // Count executed instructions and report at exit.
+    bool trace = false;            // Trace every executed instruction to stderr.
+    std::optional<std::string> code_cache_dir;  // Directory of the compiled-code cache, if enabled.
+    bool lazy = false;             // Compile every binding on first use, not just those marked lazy.
+    unsigned jobs = nutmeg::ThreadPool::default_size();  // Threads used to compile bindings at load.
+    bool startup_stats = false;    // Report the time and allocations of each startup phase.
+    bool gc_stats = false;         // Log every garbage collection and report the totals at exit.
+    bool heap_stats = false;       // Report allocations by kind, occupancy and stack depths at exit.
+    std::optional<std::string> heap_dump;  // Write a heap dump here at exit, or if execution fails.
+    uint64_t alloc_profile = 0;    // If not zero, sample an allocation every this many bytes and report the sites.
+    nutmeg::HeapOptions heap_options;  // The maximum heap size, huge pages and collector threads.
+    bool pipeline = false;         // Start executing before every binding is compiled.
+    bool regions = false;          // Allocate temporaries that never leave their frame in the region.
+    std::optional<std::string> save_image;  // Write a heap image here instead of executing.
+    std::optional<std::string> load_image;  // Run this heap image instead of a bundle.
     std::string bundle_file;
     std::vector<std::string> program_args;
 };
 
+// Parse the thread count given to option (--jobs or --gc-threads), which must
+// be a positive integer.
+unsigned parse_threads(const std::string& option, const std::string& text) {
+    char* end = nullptr;
+    unsigned long jobs = std::strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || jobs == 0 || jobs > 1024) {
+        fmt::print(stderr, "Error: {} requires a positive number of threads, not '{}'\n", option, text);
+        std::exit(1);
+    }
+    return static_cast<unsigned>(jobs);
+}
+
+// Parse the size given to --max-heap: a number of bytes with an optional K, M
+// or G suffix, at least a megabyte.
+size_t parse_heap_size(const std::string& text) {
+    char* end = nullptr;
+    unsigned long long size = std::strtoull(text.c_str(), &end, 10);
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if (*end == 'M' || *end == 'm') {
+        shift = 20;
+    } else if (*end == 'G' || *end == 'g') {
+        shift = 30;
+    }
+    if (shift != 0) {
+        end++;
+    }
+    if (text.empty() || *end != '\0' || size > (1ULL << 40) >> shift || (size << shift) < (1ULL << 20)) {
+        fmt::print(stderr, "Error: --max-heap requires a size of at least 1M (such as 512M or 4G), not '{}'\n", text);
+        std::exit(1);
+    }
+    return static_cast<size_t>(size << shift);
+}
+
+// Parse the pause target given to --gc-pause-target: a positive number of
+// milliseconds, which may be fractional.
+double parse_pause_target(const std::string& text) {
+    char* end = nullptr;
+    double ms = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !(ms > 0) || ms > 1e6) {
+        fmt::print(stderr, "Error: --gc-pause-target requires a positive number of milliseconds, not '{}'\n", text);
+        std::exit(1);
+    }
+    return ms;
+}
+
+// The sampling interval of --alloc-profile when none is given.
+constexpr uint64_t DEFAULT_ALLOC_SAMPLE_BYTES = 64 * 1024;
+
+// The most allocation sites --alloc-profile reports.
+constexpr size_t MAX_ALLOCATION_SITES = 20;
+
+// Parse the sampling interval given to --alloc-profile: a positive number of
+// bytes with an optional K or M suffix.
+uint64_t parse_sample_interval(const std::string& text) {
+    char* end = nullptr;
+    unsigned long long bytes = std::strtoull(text.c_str(), &end, 10);
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if (*end == 'M' || *end == 'm') {
+        shift = 20;
+    }
+    if (shift != 0) {
+        end++;
+    }
+    if (text.empty() || *end != '\0' || bytes == 0 || bytes > (1ULL << 40) >> shift) {
+        fmt::print(stderr, "Error: --alloc-profile requires a positive number of bytes (such as 4096 or 512K), not '{}'\n",
+                   text);
+        std::exit(1);
+    }
+    return static_cast<uint64_t>(bytes << shift);
+}
+
 // Parse command-line arguments according to: nutmeg-run [OPTIONS] BUNDLE_FILE [ARGUMENTS...].
 CommandLineArgs parse_args(int argc, char* argv[]) {
     CommandLineArgs args;
@@ -53,6 +149,164 @@ CommandLineArgs parse_args(int argc, char* argv[]) {
             args.entry_point = arg.substr(3);  // Length of "-e=".
             i++;
         }
+        // Check for --instrument (count instructions using the instrumented handlers).
+        else if (arg == "--instrument") {
+            args.instrument = true;
+            i++;
+        }
+        // Check for --trace (implies --instrument).
+        else if (arg == "--trace") {
+            args.instrument = true;
+            args.trace = true;
+            i++;
+        }
+        // Check for --code-cache (use the default cache directory).
+        else if (arg == "--code-cache") {
+            args.code_cache_dir = nutmeg::CodeCache::default_dir();
+            i++;
+        }
+        // Check for --code-cache=DIR.
+        else if (arg.rfind("--code-cache=", 0) == 0) {
+            args.code_cache_dir = arg.substr(13);  // Length of "--code-cache=".
+            i++;
+        }
+        // Check for --lazy (treat every binding as lazy).
+        else if (arg == "--lazy") {
+            args.lazy = true;
+            i++;
+        }
+        // Check for --jobs=N.
+        else if (arg.rfind("--jobs=", 0) == 0) {
+            args.jobs = parse_threads("--jobs", arg.substr(7));  // Length of "--jobs=".
+            i++;
+        }
+        // Check for --jobs N or -j N.
+        else if (arg == "--jobs" || arg == "-j") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            args.jobs = parse_threads(arg, argv[i + 1]);
+            i += 2;
+        }
+        // Check for --max-heap=SIZE.
+        else if (arg.rfind("--max-heap=", 0) == 0) {
+            args.heap_options.max_bytes = parse_heap_size(arg.substr(11));  // Length of "--max-heap=".
+            i++;
+        }
+        // Check for --max-heap SIZE.
+        else if (arg == "--max-heap") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            args.heap_options.max_bytes = parse_heap_size(argv[i + 1]);
+            i += 2;
+        }
+        // Check for --huge-pages.
+        else if (arg == "--huge-pages") {
+            args.heap_options.huge_pages = true;
+            i++;
+        }
+        // Check for --compressed-refs.
+        else if (arg == "--compressed-refs") {
+            args.heap_options.compressed_references = true;
+            i++;
+        }
+        // Check for --gc-threads=N.
+        else if (arg.rfind("--gc-threads=", 0) == 0) {
+            args.heap_options.gc_threads = parse_threads("--gc-threads", arg.substr(13));  // Length of "--gc-threads=".
+            i++;
+        }
+        // Check for --gc-threads N.
+        else if (arg == "--gc-threads") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            args.heap_options.gc_threads = parse_threads(arg, argv[i + 1]);
+            i += 2;
+        }
+        // Check for --gc-pause-target=MS.
+        else if (arg.rfind("--gc-pause-target=", 0) == 0) {
+            args.heap_options.pause_target_ms = parse_pause_target(arg.substr(18));  // Length of "--gc-pause-target=".
+            i++;
+        }
+        // Check for --gc-pause-target MS.
+        else if (arg == "--gc-pause-target") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            args.heap_options.pause_target_ms = parse_pause_target(argv[i + 1]);
+            i += 2;
+        }
+        // Check for --pipeline.
+        else if (arg == "--pipeline") {
+            args.pipeline = true;
+            i++;
+        }
+        // Check for --regions.
+        else if (arg == "--regions") {
+            args.regions = true;
+            i++;
+        }
+        // Check for --save-image=FILE or --load-image=FILE.
+        else if (arg.rfind("--save-image=", 0) == 0) {
+            args.save_image = arg.substr(13);  // Length of "--save-image=".
+            i++;
+        }
+        else if (arg.rfind("--load-image=", 0) == 0) {
+            args.load_image = arg.substr(13);  // Length of "--load-image=".
+            i++;
+        }
+        // Check for --save-image FILE or --load-image FILE.
+        else if (arg == "--save-image" || arg == "--load-image") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            (arg == "--save-image" ? args.save_image : args.load_image) = argv[i + 1];
+            i += 2;
+        }
+        // Check for --startup-stats.
+        else if (arg == "--startup-stats") {
+            args.startup_stats = true;
+            i++;
+        }
+        // Check for --gc-stats.
+        else if (arg == "--gc-stats") {
+            args.gc_stats = true;
+            i++;
+        }
+        // Check for --heap-stats.
+        else if (arg == "--heap-stats") {
+            args.heap_stats = true;
+            i++;
+        }
+        // Check for --alloc-profile or --alloc-profile=BYTES.
+        else if (arg == "--alloc-profile") {
+            args.alloc_profile = DEFAULT_ALLOC_SAMPLE_BYTES;
+            i++;
+        }
+        else if (arg.rfind("--alloc-profile=", 0) == 0) {
+            args.alloc_profile = parse_sample_interval(arg.substr(16));  // Length of "--alloc-profile=".
+            i++;
+        }
+        // Check for --heap-dump=FILE.
+        else if (arg.rfind("--heap-dump=", 0) == 0) {
+            args.heap_dump = arg.substr(12);  // Length of "--heap-dump=".
+            i++;
+        }
+        // Check for --heap-dump FILE.
+        else if (arg == "--heap-dump") {
+            if (i + 1 >= argc) {
+                fmt::print(stderr, "Error: {} option requires an argument\n", arg);
+                std::exit(1);
+            }
+            args.heap_dump = argv[i + 1];
+            i += 2;
+        }
         // Stop at first non-option argument (the bundle file).
         else if (arg[0] != '-') {
             break;
@@ -63,16 +317,59 @@ CommandLineArgs parse_args(int argc, char* argv[]) {
         }
     }
 
-    // Next argument is the bundle file (required).
-    if (i >= argc) {
+    // An image is a snapshot of every binding, compiled, and needs no bundle.
+    if (args.save_image && (args.lazy || args.pipeline || args.load_image)) {
+        fmt::print(stderr, "Error: --save-image cannot be combined with --lazy, --pipeline or --load-image\n");
+        std::exit(1);
+    }
+
+    // Compressed references reach a limited span of address space.
+    if (args.heap_options.compressed_references &&
+        args.heap_options.max_bytes > nutmeg::HeapOptions::MAX_COMPRESSED_BYTES) {
+        fmt::print(stderr, "Error: --compressed-refs allows a --max-heap of at most 3G\n");
+        std::exit(1);
+    }
+
+    // Next argument is the bundle file (required unless running an image).
+    if (i >= argc && !args.load_image) {
         fmt::print(stderr, "Error: Missing BUNDLE_FILE argument\n");
         fmt::print(stderr, "Usage: nutmeg-run [OPTIONS] BUNDLE_FILE [ARGUMENTS...]\n");
         fmt::print(stderr, "Options:\n");
         fmt::print(stderr, "  -e NAME, -e=NAME, --entry-point NAME, --entry-point=NAME\n");
         fmt::print(stderr, "                          Specify the entry point to invoke\n");
+        fmt::print(stderr, "  --instrument            Count executed instructions and report them at exit\n");
+        fmt::print(stderr, "  --trace                 Trace every executed instruction to stderr\n");
+        fmt::print(stderr, "  --code-cache, --code-cache=DIR\n");
+        fmt::print(stderr, "                          Reuse compiled code cached in DIR (default ~/.cache/nutmeg)\n");
+        fmt::print(stderr, "  --lazy                  Compile every binding on first use, not only lazy ones\n");
+        fmt::print(stderr, "  -j N, --jobs N, --jobs=N\n");
+        fmt::print(stderr, "                          Compile bindings on N threads (default: one per core)\n");
+        fmt::print(stderr, "  --pipeline              Run the entry point while the rest of its dependencies compile\n");
+        fmt::print(stderr, "  --regions               Allocate frame-local temporaries in a region freed on return\n");
+        fmt::print(stderr, "  --startup-stats         Report the time and allocations of each startup phase\n");
+        fmt::print(stderr, "  --gc-stats              Report the pause and bytes copied of each garbage collection\n");
+        fmt::print(stderr, "  --heap-stats            Report allocations by kind, heap occupancy and stack depths at exit\n");
+        fmt::print(stderr, "  --alloc-profile, --alloc-profile=BYTES\n");
+        fmt::print(stderr, "                          Sample an allocation every BYTES (default 64K) and report by site\n");
+        fmt::print(stderr, "  --heap-dump FILE, --heap-dump=FILE\n");
+        fmt::print(stderr, "                          Write the heap to FILE at exit, or when execution fails\n");
+        fmt::print(stderr, "  --max-heap SIZE, --max-heap=SIZE\n");
+        fmt::print(stderr, "                          Limit the heap to SIZE bytes, with a K, M or G suffix (default 1G)\n");
+        fmt::print(stderr, "  --huge-pages            Back the heap with transparent huge pages where available\n");
+        fmt::print(stderr, "  --compressed-refs       Store the fields of records and vectors in 32 bits (max heap 3G)\n");
+        fmt::print(stderr, "  --gc-threads N, --gc-threads=N\n");
+        fmt::print(stderr, "                          Copy objects on N threads during garbage collection (default 1)\n");
+        fmt::print(stderr, "  --gc-pause-target MS, --gc-pause-target=MS\n");
+        fmt::print(stderr, "                          Collect the old space incrementally, aiming for pauses of MS ms\n");
+        fmt::print(stderr, "  --save-image FILE, --save-image=FILE\n");
+        fmt::print(stderr, "                          Compile every binding and write a heap image instead of running\n");
+        fmt::print(stderr, "  --load-image FILE, --load-image=FILE\n");
+        fmt::print(stderr, "                          Run a heap image instead of a bundle (no BUNDLE_FILE)\n");
         std::exit(1);
     }
-    args.bundle_file = argv[i++];
+    if (!args.load_image) {
+        args.bundle_file = argv[i++];
+    }
 
     // Remaining arguments are passed to the program.
     while (i < argc) {
@@ -82,15 +379,202 @@ CommandLineArgs parse_args(int argc, char* argv[]) {
     return args;
 }
 
+// Report the per-opcode counts gathered by the instrumented handlers.
+void print_instruction_counts(const nutmeg::Machine& machine) {
+    const auto& counts = machine.get_instruction_counts();
+    uint64_t total = 0;
+    fmt::print(stderr, "Instruction counts:\n");
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        total += counts[i];
+        fmt::print(stderr, "  {:<24} {:>12}\n", nutmeg::opcode_to_string(static_cast<nutmeg::Opcode>(i)), counts[i]);
+    }
+    fmt::print(stderr, "  {:<24} {:>12}\n", "TOTAL", total);
+}
+
+// Report the garbage collection totals.
+void print_gc_stats(const nutmeg::Machine& machine) {
+    const nutmeg::GcStats& gc = machine.get_heap().get_gc_stats();
+    fmt::print(stderr, "Garbage collections: {} ({} minor)\n", gc.collections, gc.minor_collections);
+    fmt::print(stderr, "  {:<24} {:>12.3f} ms\n", "Total pause", gc.total_pause_nanoseconds / 1e6);
+    fmt::print(stderr, "  {:<24} {:>12.3f} ms\n", "Longest pause", gc.max_pause_nanoseconds / 1e6);
+    fmt::print(stderr, "  {:<24} {:>12} bytes\n", "Copied", gc.bytes_copied);
+    fmt::print(stderr, "  {:<24} {:>12} bytes\n", "Reclaimed", gc.bytes_reclaimed);
+    if (gc.incremental_cycles != 0) {
+        fmt::print(stderr, "  {:<24} {:>12}\n", "Incremental cycles", gc.incremental_cycles);
+    }
+    if (gc.collections != 0) {
+        fmt::print(stderr, "Pauses:\n");
+    }
+    for (size_t bucket = 0; bucket < nutmeg::GcStats::PAUSE_BUCKETS; bucket++) {
+        if (gc.pause_histogram[bucket] == 0) {
+            continue;
+        }
+        double limit = nutmeg::GcStats::pause_bucket_limit_nanoseconds(bucket) / 1e6;
+        std::string range = bucket + 1 < nutmeg::GcStats::PAUSE_BUCKETS
+            ? fmt::format("< {:g} ms", limit)
+            : fmt::format(">= {:g} ms", limit / 2);
+        fmt::print(stderr, "  {:<24} {:>12}\n", range, gc.pause_histogram[bucket]);
+    }
+}
+
+// Report what was allocated, how full the heap got, and how deep the stacks.
+void print_heap_stats(const nutmeg::Machine& machine) {
+    nutmeg::HeapStats heap = machine.get_heap().get_heap_stats();
+    fmt::print(stderr, "Heap allocations:\n");
+    fmt::print(stderr, "  {:<24} {:>12} {:>16}\n", "Kind", "Objects", "Bytes");
+    for (const auto& [kind, allocations] : heap.allocations) {
+        fmt::print(stderr, "  {:<24} {:>12} {:>16}\n", kind, allocations.objects, allocations.bytes);
+    }
+    fmt::print(stderr, "Heap occupancy:\n");
+    fmt::print(stderr, "  {:<24} {:>12} bytes\n", "Permanent space", heap.permanent_bytes);
+    fmt::print(stderr, "  {:<24} {:>12} bytes (high water {})\n", "Nursery", heap.nursery_bytes,
+               heap.nursery_high_water_bytes);
+    fmt::print(stderr, "  {:<24} {:>12} bytes (high water {})\n", "Old space", heap.old_bytes,
+               heap.old_high_water_bytes);
+    fmt::print(stderr, "  {:<24} {:>12} bytes\n", "Committed", heap.committed_bytes);
+    fmt::print(stderr, "  {:<24} {:>12} bytes\n", "Maximum", heap.max_bytes);
+    fmt::print(stderr, "Stack depths (most cells):\n");
+    fmt::print(stderr, "  {:<24} {:>12}\n", "Operand stack", machine.get_max_operand_depth());
+    fmt::print(stderr, "  {:<24} {:>12}\n", "Return stack", machine.get_max_return_depth());
+}
+
+// Report the sampled allocations by the instruction that made them, most bytes
+// first.
+void print_allocation_profile(const nutmeg::Machine& machine, uint64_t interval_bytes) {
+    std::vector<nutmeg::AllocationSite> sites = machine.get_allocation_profile();
+    uint64_t total = 0;
+    for (const nutmeg::AllocationSite& site : sites) {
+        total += site.bytes;
+    }
+    fmt::print(stderr, "Allocation sites (a sample every {} bytes):\n", interval_bytes);
+    if (sites.empty()) {
+        fmt::print(stderr, "  No allocations were sampled\n");
+        return;
+    }
+    fmt::print(stderr, "  {:<24} {:>8} {:<24} {:>10} {:>14} {:>7}\n", "Function", "Offset", "Instruction", "Samples",
+               "Bytes", "%");
+    for (size_t i = 0; i < sites.size() && i < MAX_ALLOCATION_SITES; i++) {
+        const nutmeg::AllocationSite& site = sites[i];
+        double percent = 100.0 * static_cast<double>(site.bytes) / static_cast<double>(total);
+        if (site.function.empty()) {
+            fmt::print(stderr, "  {:<24} {:>8} {:<24} {:>10} {:>14} {:>6.1f}%\n", "(no function)", "", "", site.samples,
+                       site.bytes, percent);
+        } else {
+            fmt::print(stderr, "  {:<24} {:>8} {:<24} {:>10} {:>14} {:>6.1f}%\n", site.function, site.offset,
+                       site.instruction, site.samples, site.bytes, percent);
+        }
+    }
+    if (sites.size() > MAX_ALLOCATION_SITES) {
+        fmt::print(stderr, "  ({} more sites)\n", sites.size() - MAX_ALLOCATION_SITES);
+    }
+}
+
+// Run the entry point, then print the reports asked for. The heap statistics
+// are printed even if execution fails, since running out of memory is when they
+// are most wanted.
+void execute_entry_point(nutmeg::Machine& machine, const CommandLineArgs& args, nutmeg::Cell* entry_func_ptr) {
+    if (args.gc_stats) {
+        machine.get_heap().set_gc_log(stderr);
+    }
+    try {
+        machine.execute(entry_func_ptr);
+    } catch (...) {
+        if (args.heap_stats) {
+            print_heap_stats(machine);
+        }
+        // A failure to write the dump must not hide why execution failed,
+        // which is often that the heap is exhausted.
+        if (args.heap_dump) {
+            try {
+                nutmeg::write_heap_dump(machine, *args.heap_dump);
+            } catch (const std::exception& e) {
+                fmt::print(stderr, "Error: {}\n", e.what());
+            }
+        }
+        throw;
+    }
+    if (args.instrument) {
+        print_instruction_counts(machine);
+    }
+    if (args.gc_stats) {
+        print_gc_stats(machine);
+    }
+    if (args.heap_stats) {
+        print_heap_stats(machine);
+    }
+    if (args.alloc_profile != 0) {
+        print_allocation_profile(machine, args.alloc_profile);
+    }
+    if (args.heap_dump) {
+        nutmeg::write_heap_dump(machine, *args.heap_dump);
+    }
+}
+
+// Restore a heap image and run its entry point (or the one given), skipping the
+// bundle entirely.
+int run_image(const CommandLineArgs& args, nutmeg::StartupStats* stats, std::optional<nutmeg::PhaseTimer>& startup_timer) {
+    nutmeg::Machine machine(args.heap_options);
+    machine.get_heap().set_allocation_tracking(args.heap_stats);
+    machine.set_stack_depth_tracking(args.heap_stats);
+    machine.set_region_allocation(args.regions);
+    std::string entry_point_name;
+    {
+        nutmeg::PhaseTimer timer(stats, nutmeg::StartupPhase::HeapAllocation);
+        entry_point_name = nutmeg::load_image(machine, *args.load_image);
+    }
+    if (args.entry_point) {
+        entry_point_name = *args.entry_point;
+    }
+    nutmeg::Cell* entry_func_ptr = machine.get_global_cell_ptr(entry_point_name);
+    if (args.instrument) {
+        machine.set_instruction_tracing(args.trace);
+        machine.set_instrumentation(true);
+    }
+    if (args.alloc_profile != 0) {
+        machine.set_allocation_profiling(args.alloc_profile);
+    }
+    startup_timer.reset();
+    if (stats) {
+        stats->print(stderr);
+    }
+    execute_entry_point(machine, args, entry_func_ptr);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     try {
         CommandLineArgs args = parse_args(argc, argv);
 
+        // Under --startup-stats, each phase of loading is timed. Whatever the other
+        // phases do not account for on this thread is charged to the startup timer,
+        // which stops just before the first instruction is dispatched.
+        std::optional<nutmeg::StartupStats> startup_stats;
+        if (args.startup_stats) {
+            startup_stats.emplace();
+            nutmeg::set_allocation_counting(true);
+        }
+        nutmeg::StartupStats* stats = startup_stats ? &*startup_stats : nullptr;
+        std::optional<nutmeg::PhaseTimer> startup_timer;
+        startup_timer.emplace(stats, nutmeg::StartupPhase::FirstInstruction);
+
+        if (args.load_image) {
+            return run_image(args, stats, startup_timer);
+        }
+
         // Open the bundle file.
-        nutmeg::BundleReader reader(args.bundle_file);
+        nutmeg::BundleReader reader = [&]() {
+            nutmeg::PhaseTimer timer(stats, nutmeg::StartupPhase::BundleOpen);
+            return nutmeg::BundleReader(args.bundle_file);
+        }();
+        reader.set_startup_stats(stats);
 
         // Determine which entry point to use.
         std::string entry_point_name;
+        std::optional<nutmeg::PhaseTimer> entry_point_timer;
+        entry_point_timer.emplace(stats, nutmeg::StartupPhase::EntryPoint);
         if (args.entry_point) {
             entry_point_name = *args.entry_point;
         } else {
@@ -109,47 +593,64 @@ int main(int argc, char* argv[]) {
             }
             entry_point_name = entry_points[0];
         }
+        entry_point_timer.reset();
 
         // Create the machine (initializes threaded interpreter).
-        nutmeg::Machine machine;
+        nutmeg::Machine machine(args.heap_options);
+        machine.get_heap().set_allocation_tracking(args.heap_stats);
+        machine.set_stack_depth_tracking(args.heap_stats);
+        machine.set_region_allocation(args.regions);
+        machine.set_startup_stats(stats);
 
         // Load all bindings transitively from the entry point.
         #ifdef TRACE_MAIN
         fmt::print("Loading entry point: {}\n", entry_point_name);
         #endif
-        std::vector<std::string> deps = reader.get_dependencies(entry_point_name);
-        nutmeg::Cell undef = nutmeg::make_undef();
-        for (const auto& idname : deps) {
-            // Each dependency should be declared as a global variable with an undefined value.
-            machine.define_global(idname, undef);
-            #ifdef TRACE_MAIN
-            fmt::print("  Found dependency: {}\n", idname);
-            #endif
-        }
-
-        for (const auto& idname : deps) {
-            #ifdef TRACE_MAIN
-            fmt::print("  Dependency: {}\n", idname);
-            #endif
-            nutmeg::Binding binding = reader.get_binding(idname);
-            nutmeg::FunctionObject func = machine.parse_function_object(binding.value);
-            nutmeg::Cell* func_obj = machine.allocate_function(func.code, func.nlocals, func.nparams);
-            machine.define_global(idname, make_tagged_ptr(func_obj));
-            #ifdef TRACE_MAIN
-            fmt::print("  Loaded func_object {}\n", static_cast<void*>(func_obj));
-            fmt::print("  Recovering func object: {}\n", as_detagged_ptr(make_tagged_ptr(func_obj)));
-            #endif
-        }
+        nutmeg::LoadOptions load_options;
+        load_options.lazy = args.lazy;
+        load_options.pipeline = args.pipeline;
+        // An image must not depend on the bundle, so lazy bindings are compiled
+        // now when one is to be saved.
+        load_options.compile_all = args.save_image.has_value();
+        load_options.jobs = args.jobs;
+        load_options.code_cache_dir = args.code_cache_dir;
+        nutmeg::ProgramLoader loader(reader, machine, args.bundle_file, load_options, stats);
+        loader.load(entry_point_name);
         #ifdef TRACE_MAIN
         fmt::print("All dependencies loaded.\n");
         #endif
+        loader.save_code_cache();
+
+        if (args.save_image) {
+            nutmeg::save_image(machine, entry_point_name, *args.save_image);
+            return 0;
+        }
 
         // Get the entry point function and execute it.
         nutmeg::Cell* entry_func_ptr = machine.get_global_cell_ptr(entry_point_name);
         #ifdef TRACE_MAIN
         fmt::print("Recovered func_object {}\n", static_cast<void*>(entry_func_ptr));
         #endif
-        machine.execute(entry_func_ptr);
+        if (args.instrument) {
+            machine.set_instruction_tracing(args.trace);
+            machine.set_instrumentation(true);
+        }
+        if (args.alloc_profile != 0) {
+            machine.set_allocation_profiling(args.alloc_profile);
+        }
+
+        // Bindings compiled lazily during execution are not part of startup.
+        startup_timer.reset();
+        if (stats) {
+            machine.set_startup_stats(nullptr);
+            reader.set_startup_stats(nullptr);
+            stats->print(stderr);
+        }
+        loader.start_background();
+        execute_entry_point(machine, args, entry_func_ptr);
+
+        // Lazily loaded bindings may have added to the cache.
+        loader.save_code_cache();
 
         return 0;
 
@@ -0,0 +1,190 @@
+#include "program_loader.hpp"
+#include "machine.hpp"
+#include "thread_pool.hpp"
+#include <future>
+#include <unordered_set>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+ProgramLoader::ProgramLoader(BundleReader& reader, Machine& machine, const std::string& bundle_file,
+                             LoadOptions options, StartupStats* stats)
+    : reader_(reader), machine_(machine), options_(std::move(options)), stats_(stats) {
+    // The code cache, when enabled, replaces parsing and code generation by
+    // relocation of previously compiled code.
+    if (options_.code_cache_dir) {
+        code_cache_.emplace(*options_.code_cache_dir, bundle_file);
+    }
+    if (options_.pipeline) {
+        background_.emplace(options_.jobs);
+    }
+}
+
+void ProgramLoader::load_binding(const std::string& idname) {
+    // Binary bytecode is preferred to JSON; the code cache, when enabled,
+    // replaces parsing and code generation of the JSON.
+    std::optional<FunctionObject> func;
+    reader_.visit_bytecode(idname, [&](std::string_view bytecode) {
+        func = machine_.decode_function_object(bytecode);
+    });
+    if (!func && code_cache_) {
+        func = code_cache_->lookup(machine_, idname);
+    }
+    if (!func) {
+        func = machine_.parse_function_object(reader_.get_binding(idname).value);
+        if (code_cache_) {
+            code_cache_->add(machine_, idname, *func);
+        }
+    }
+    machine_.define_global(idname, make_tagged_ptr(machine_.allocate_function(*func)));
+}
+
+void ProgramLoader::load(const std::string& entry_point) {
+    // The bindings come from one batched query, which skips the values of lazy
+    // bindings. When everything is lazy nothing is compiled up front, so only
+    // the names are needed. Bindings with binary bytecode are decoded straight
+    // from the query's row buffer; ready holds their code, and later the code
+    // found in the code cache.
+    //
+    // When pipelining, only the entry point and its direct callees are compiled
+    // before execution starts. The other bindings are installed as stubs and
+    // compiled in the background; calling one that is not ready yet waits for it
+    // alone. Their bytecode is copied out of the row buffer for later.
+    std::unordered_set<std::string> eager;
+    if (options_.pipeline && !options_.lazy) {
+        eager.insert(entry_point);
+        for (auto& idname : reader_.get_direct_dependencies(entry_point)) {
+            eager.insert(std::move(idname));
+        }
+    }
+    auto is_deferred = [&](const Binding& binding) {
+        return options_.pipeline && !binding.lazy && eager.count(binding.idname) == 0;
+    };
+    std::vector<std::optional<FunctionObject>> ready;
+    if (options_.lazy) {
+        std::vector<std::string> idnames;
+        {
+            PhaseTimer timer(stats_, StartupPhase::DependencyClosure);
+            idnames = reader_.get_dependencies(entry_point);
+        }
+        for (auto& idname : idnames) {
+            Binding binding;
+            binding.idname = std::move(idname);
+            binding.lazy = true;
+            deps_.push_back(std::move(binding));
+        }
+        ready.resize(deps_.size());
+        deferred_bytecode_.resize(deps_.size());
+    } else {
+        bool compile_all = options_.compile_all;
+        reader_.visit_dependency_bindings(entry_point, [&](Binding& binding, std::string_view bytecode) {
+            if (compile_all) {
+                binding.lazy = false;
+            }
+            std::optional<FunctionObject> func;
+            std::string deferred;
+            if (!bytecode.empty()) {
+                if (is_deferred(binding)) {
+                    deferred = bytecode;
+                } else {
+                    func = machine_.decode_function_object(bytecode);
+                }
+            }
+            deps_.push_back(std::move(binding));
+            ready.push_back(std::move(func));
+            deferred_bytecode_.push_back(std::move(deferred));
+        }, compile_all);
+    }
+    {
+        // Each dependency is declared as a global with an undefined value.
+        PhaseTimer timer(stats_, StartupPhase::HeapAllocation);
+        for (const auto& binding : deps_) {
+            machine_.define_global(binding.idname, make_undef());
+        }
+    }
+
+    // Lazy bindings are installed as stubs that compile them on first use, as
+    // are the bindings left to the background loader.
+    machine_.set_lazy_loader([this](std::string_view name) {
+        if (background_ && background_->has(name)) {
+            std::string idname(name);
+            FunctionObject func = background_->take(name);
+            if (code_cache_) {
+                code_cache_->add(machine_, idname, func);
+            }
+            machine_.define_global(idname, make_tagged_ptr(machine_.allocate_function(func)));
+            return;
+        }
+        load_binding(std::string(name));
+    });
+
+    // Compile the remaining bindings. Cached code is relocated first, on this
+    // thread, since the cache is not shared. JSON parsing and code generation
+    // for the rest run on the thread pool, while this thread places each result
+    // on the heap and defines its global in dependency order.
+    if (code_cache_) {
+        for (size_t i = 0; i < deps_.size(); i++) {
+            if (!deps_[i].lazy && !ready[i]) {
+                ready[i] = code_cache_->lookup(machine_, deps_[i].idname);
+            }
+        }
+    }
+    std::optional<ThreadPool> pool;
+    std::vector<std::future<FunctionObject>> compiled(deps_.size());
+    if (options_.jobs > 1) {
+        pool.emplace(options_.jobs);
+        for (size_t i = 0; i < deps_.size(); i++) {
+            if (!deps_[i].lazy && !ready[i] && !is_deferred(deps_[i])) {
+                const std::string& value = deps_[i].value;
+                compiled[i] = pool->submit([this, &value]() { return machine_.parse_function_object(value); });
+            }
+        }
+    }
+    for (size_t i = 0; i < deps_.size(); i++) {
+        const Binding& binding = deps_[i];
+        if (binding.lazy) {
+            PhaseTimer timer(stats_, StartupPhase::HeapAllocation);
+            machine_.define_global(binding.idname, make_tagged_ptr(machine_.allocate_lazy_stub(binding.idname)));
+            continue;
+        }
+        if (!ready[i] && is_deferred(binding)) {
+            const std::string& bytecode = deferred_bytecode_[i];
+            background_->add(binding.idname, [this, &binding, &bytecode]() {
+                return bytecode.empty() ? machine_.parse_function_object(binding.value)
+                                        : machine_.decode_function_object(bytecode);
+            });
+            PhaseTimer timer(stats_, StartupPhase::HeapAllocation);
+            machine_.define_global(binding.idname, make_tagged_ptr(machine_.allocate_lazy_stub(binding.idname)));
+            continue;
+        }
+        FunctionObject func;
+        if (ready[i]) {
+            func = std::move(*ready[i]);
+        } else {
+            func = pool ? compiled[i].get() : machine_.parse_function_object(binding.value);
+            if (code_cache_) {
+                code_cache_->add(machine_, binding.idname, func);
+            }
+        }
+        PhaseTimer timer(stats_, StartupPhase::HeapAllocation);
+        machine_.define_global(binding.idname, make_tagged_ptr(machine_.allocate_function(func)));
+    }
+}
+
+void ProgramLoader::start_background() {
+    if (background_) {
+        background_->start();
+    }
+}
+
+void ProgramLoader::save_code_cache() {
+    if (code_cache_ && code_cache_->is_dirty()) {
+        try {
+            code_cache_->save();
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "Warning: {}\n", e.what());
+        }
+    }
+}
+
+} // namespace nutmeg
@@ -0,0 +1,74 @@
+#ifndef PROGRAM_LOADER_HPP
+#define PROGRAM_LOADER_HPP
+
+#include "background_loader.hpp"
+#include "bundle_reader.hpp"
+#include "code_cache.hpp"
+#include "function_object.hpp"
+#include "startup_stats.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace nutmeg {
+
+class Machine;
+
+// How a ProgramLoader compiles bindings. These are nutmeg-run's options of the
+// same names (see main).
+struct LoadOptions {
+    bool lazy = false;        // Compile every binding on first use, not just those marked lazy.
+    bool pipeline = false;    // Leave all but the entry point and its callees to the background.
+    bool compile_all = false; // Compile bindings marked lazy up front too (as images require).
+    unsigned jobs = 1;        // Threads used to compile bindings during load.
+    std::optional<std::string> code_cache_dir;  // Directory of the compiled-code cache, if enabled.
+};
+
+// ProgramLoader loads the bindings an entry point depends on from a bundle into
+// a machine: nutmeg-run's load path, shared with the startup benchmark so that
+// the benchmark measures what the binary does.
+//
+// Bindings are declared first, then compiled and defined in dependency order.
+// Lazy bindings, and under pipelining those left to the background, are
+// installed as stubs; the machine's lazy loader compiles them through this
+// loader, which must therefore outlive execution.
+class ProgramLoader {
+private:
+    BundleReader& reader_;
+    Machine& machine_;
+    LoadOptions options_;
+    StartupStats* stats_;
+    std::optional<CodeCache> code_cache_;
+    std::optional<BackgroundLoader> background_;
+
+    // The bindings loaded, and the bytecode of those deferred to the background,
+    // which the background compiles refer to.
+    std::vector<Binding> deps_;
+    std::vector<std::string> deferred_bytecode_;
+
+    // Compile a binding that was not compiled at load time and define it.
+    void load_binding(const std::string& idname);
+
+public:
+    // Load from reader, opened on bundle_file (which keys the code cache), into
+    // machine, charging phases to stats if it is not null.
+    ProgramLoader(BundleReader& reader, Machine& machine, const std::string& bundle_file,
+                  LoadOptions options, StartupStats* stats = nullptr);
+
+    ProgramLoader(const ProgramLoader&) = delete;
+    ProgramLoader& operator=(const ProgramLoader&) = delete;
+
+    // Load every binding entry_point depends on, and install the lazy loader.
+    void load(const std::string& entry_point);
+
+    // Start compiling the deferred bindings, once execution is about to begin.
+    void start_background();
+
+    // Write the code cache if bindings were added to it. A cache that cannot be
+    // written only costs the next run its speed-up, so failure is a warning.
+    void save_code_cache();
+};
+
+} // namespace nutmeg
+
+#endif // PROGRAM_LOADER_HPP
@@ -0,0 +1,78 @@
+#include "replicator.hpp"
+#include <algorithm>
+
+namespace nutmeg {
+
+// How many replicas a slice scans between looks at the clock.
+static constexpr size_t SCANS_PER_CLOCK_CHECK = 64;
+
+Replicator::Replicator(const Heap& heap, const Pool& from, Pool& to)
+    : heap_(heap), from_(from), to_(to) {
+}
+
+Cell* Replicator::replicate(Cell* obj_ptr) {
+    auto [it, inserted] = replicas_.try_emplace(obj_ptr, nullptr);
+    if (!inserted) {
+        return it->second;
+    }
+    const Cell* datakey = static_cast<const Cell*>(obj_ptr[0].ptr);
+    size_t total_cells = heap_.collected_object_cells(obj_ptr, datakey);
+    Cell* base = to_.allocate(total_cells);
+    std::copy(obj_ptr - 1, obj_ptr - 1 + total_cells, base);
+    cells_copied_ += total_cells;
+    it->second = &base[1];
+    if (heap_.has_reference_fields(datakey)) {
+        grey_.push_back(&base[1]);
+    }
+    return &base[1];
+}
+
+Cell Replicator::forward(Cell value) {
+    if (is_tagged_ptr(value) && from_.contains(as_detagged_ptr(value))) {
+        return make_tagged_ptr(replicate(static_cast<Cell*>(as_detagged_ptr(value))));
+    }
+    return value;
+}
+
+void Replicator::shade(Cell value) {
+    forward(value);
+}
+
+void Replicator::scan(Cell* replica) {
+    size_t num_fields = heap_.get_num_fields(replica);
+    for (size_t i = 0; i < num_fields; i++) {
+        heap_.store_slot(replica, i, forward(heap_.load_slot(replica, i)));
+    }
+}
+
+bool Replicator::step(std::chrono::steady_clock::time_point deadline) {
+    for (size_t scanned = 0; !grey_.empty(); scanned++) {
+        if (scanned % SCANS_PER_CLOCK_CHECK == 0 && scanned != 0 && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        Cell* replica = grey_.back();
+        grey_.pop_back();
+        scan(replica);
+    }
+    return true;
+}
+
+void Replicator::finish(const std::vector<Cell*>& roots) {
+    for (Cell* root : roots) {
+        *root = forward(*root);
+    }
+    // A logged object without a replica is copied as it is now, if at all.
+    for (const auto& [obj_ptr, index] : log_) {
+        auto it = replicas_.find(obj_ptr);
+        if (it != replicas_.end()) {
+            heap_.store_slot(it->second, index, forward(heap_.load_slot(obj_ptr, index)));
+        }
+    }
+    while (!grey_.empty()) {
+        Cell* replica = grey_.back();
+        grey_.pop_back();
+        scan(replica);
+    }
+}
+
+} // namespace nutmeg
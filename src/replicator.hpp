@@ -0,0 +1,75 @@
+#ifndef REPLICATOR_HPP
+#define REPLICATOR_HPP
+
+#include "heap.hpp"
+#include <chrono>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nutmeg {
+
+// Replicator is an incremental collection of the old space: it copies the
+// reachable objects to the other semispace a slice at a time, between which
+// the program keeps running on the originals. Nothing the program can see
+// changes until finish, a short pause that brings the replicas up to date,
+// points the roots at them, and lets the heap swap the semispaces.
+//
+// Its write barrier is a snapshot-at-the-beginning one. The cycle starts by
+// shading what the roots refer to, and every store into an old object shades
+// the value it overwrites, so each object reachable when the cycle started is
+// replicated by the slices even if the program unlinks it. Each such store is
+// also logged, since the replica of the object may already have been made,
+// and finish replays the log onto the replicas. Objects promoted while the
+// cycle runs, and anything reachable only through them, are left to finish.
+//
+// Unlike an Evacuator, a Replicator does not overwrite the originals, so the
+// forwarding pointers live in a side table.
+class Replicator {
+private:
+    const Heap& heap_;
+    const Pool& from_;
+    Pool& to_;
+    std::unordered_map<const Cell*, Cell*> replicas_;
+    std::vector<Cell*> grey_;  // Replicas whose fields have still to be forwarded.
+    std::vector<std::pair<Cell*, size_t>> log_;  // Stores into old objects: (original, field).
+    size_t cells_copied_ = 0;
+
+    // Get the replica of obj_ptr, an object in the old space, making it if need be.
+    Cell* replicate(Cell* obj_ptr);
+
+    // If value refers to an old object, return a reference to its replica instead.
+    Cell forward(Cell value);
+
+    // Forward the fields of a replica.
+    void scan(Cell* replica);
+
+public:
+    // Replicate the reachable objects of from into to.
+    Replicator(const Heap& heap, const Pool& from, Pool& to);
+
+    // Make sure the object value refers to, if it is old, will be replicated.
+    void shade(Cell value);
+
+    // The write barrier, called before the program writes to a field of an old
+    // object.
+    void record_store(Cell* obj_ptr, size_t index) {
+        shade(heap_.load_slot(obj_ptr, index));
+        log_.emplace_back(obj_ptr, index);
+    }
+
+    // Forward the fields of replicas until there are none left, returning true,
+    // or until deadline has passed.
+    bool step(std::chrono::steady_clock::time_point deadline);
+
+    // Replay the log, point each root at its replica and replicate whatever the
+    // slices have not. Afterwards the replicas are the live objects.
+    void finish(const std::vector<Cell*>& roots);
+
+    // The cells copied since the last call.
+    size_t take_cells_copied() { return std::exchange(cells_copied_, 0); }
+};
+
+} // namespace nutmeg
+
+#endif // REPLICATOR_HPP
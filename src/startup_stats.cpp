@@ -0,0 +1,82 @@
+#include "startup_stats.hpp"
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+const char* startup_phase_name(StartupPhase phase) {
+    switch (phase) {
+    case StartupPhase::BundleOpen: return "bundle open";
+    case StartupPhase::EntryPoint: return "entry point";
+    case StartupPhase::DependencyClosure: return "dependency closure";
+    case StartupPhase::BindingFetch: return "binding fetch";
+    case StartupPhase::Parse: return "parse";
+    case StartupPhase::CodeGeneration: return "code generation";
+    case StartupPhase::HeapAllocation: return "heap allocation";
+    case StartupPhase::FirstInstruction: return "first instruction";
+    }
+    return "?";
+}
+
+static uint64_t nanoseconds_between(std::chrono::steady_clock::time_point start,
+                                    std::chrono::steady_clock::time_point stop) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+}
+
+void StartupStats::add(StartupPhase phase, uint64_t nanoseconds, uint64_t allocations) {
+    Totals& totals = phases_[static_cast<size_t>(phase)];
+    totals.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    totals.allocations.fetch_add(allocations, std::memory_order_relaxed);
+}
+
+uint64_t StartupStats::get_nanoseconds(StartupPhase phase) const {
+    return phases_[static_cast<size_t>(phase)].nanoseconds.load(std::memory_order_relaxed);
+}
+
+uint64_t StartupStats::get_allocations(StartupPhase phase) const {
+    return phases_[static_cast<size_t>(phase)].allocations.load(std::memory_order_relaxed);
+}
+
+void StartupStats::print(std::FILE* out) const {
+    uint64_t total_nanoseconds = 0;
+    uint64_t total_allocations = 0;
+    fmt::print(out, "Startup phases:\n");
+    fmt::print(out, "  {:<24} {:>12} {:>12}\n", "phase", "ms", "allocations");
+    for (size_t i = 0; i < NUM_STARTUP_PHASES; i++) {
+        StartupPhase phase = static_cast<StartupPhase>(i);
+        total_nanoseconds += get_nanoseconds(phase);
+        total_allocations += get_allocations(phase);
+        fmt::print(out, "  {:<24} {:>12.3f} {:>12}\n", startup_phase_name(phase),
+                   static_cast<double>(get_nanoseconds(phase)) / 1e6, get_allocations(phase));
+    }
+    fmt::print(out, "  {:<24} {:>12.3f} {:>12}\n", "TOTAL", static_cast<double>(total_nanoseconds) / 1e6,
+               total_allocations);
+}
+
+thread_local PhaseTimer* PhaseTimer::current_ = nullptr;
+
+PhaseTimer::PhaseTimer(StartupStats* stats, StartupPhase phase)
+    : stats_(stats), phase_(phase), parent_(nullptr) {
+    if (stats_ == nullptr) {
+        return;
+    }
+    parent_ = current_;
+    current_ = this;
+    start_allocations_ = thread_allocation_count;
+    start_ = std::chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (stats_ == nullptr) {
+        return;
+    }
+    uint64_t elapsed = nanoseconds_between(start_, std::chrono::steady_clock::now());
+    uint64_t allocations = thread_allocation_count - start_allocations_;
+    stats_->add(phase_, elapsed - nested_nanoseconds_, allocations - nested_allocations_);
+    if (parent_ != nullptr) {
+        parent_->nested_nanoseconds_ += elapsed;
+        parent_->nested_allocations_ += allocations;
+    }
+    current_ = parent_;
+}
+
+} // namespace nutmeg
@@ -0,0 +1,95 @@
+#ifndef STARTUP_STATS_HPP
+#define STARTUP_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace nutmeg {
+
+// The phases of startup reported by --startup-stats, in the order they run.
+enum class StartupPhase : uint8_t {
+    BundleOpen,         // Opening the bundle database.
+    EntryPoint,         // Finding the entry point.
+    DependencyClosure,  // Computing the dependency closure (up to its first row).
+    BindingFetch,       // Reading the bindings' rows.
+    Parse,              // Reading JSON or bytecode, excluding code generation.
+    CodeGeneration,     // Planting threaded code, including its heap constants.
+    HeapAllocation,     // Placing function objects on the heap and defining globals.
+    FirstInstruction,   // The rest of the main thread's time until execution starts.
+};
+
+inline constexpr size_t NUM_STARTUP_PHASES = static_cast<size_t>(StartupPhase::FirstInstruction) + 1;
+
+const char* startup_phase_name(StartupPhase phase);
+
+// The number of C++ heap allocations made by the current thread. The
+// replacement operator new (see counting_allocator.cpp) calls count_allocation
+// while allocation counting is enabled, as it is under --startup-stats;
+// otherwise the count stays where it was.
+inline thread_local uint64_t thread_allocation_count = 0;
+inline std::atomic<bool> allocation_counting{false};
+
+inline void count_allocation() {
+    thread_allocation_count++;
+}
+
+inline void set_allocation_counting(bool enabled) {
+    allocation_counting.store(enabled, std::memory_order_relaxed);
+}
+
+// StartupStats accumulates wall time and allocation counts per startup phase.
+// Phases are measured by PhaseTimer scopes, which may nest: each phase is
+// charged only its own time, not that of the phases nested inside it, so the
+// phases of one thread add up to its elapsed time. A FirstInstruction timer
+// around the whole of startup therefore collects whatever the other phases do
+// not. Timers on worker threads (see ThreadPool) add to the same totals, which
+// are then summed over threads.
+class StartupStats {
+private:
+    struct Totals {
+        std::atomic<uint64_t> nanoseconds{0};
+        std::atomic<uint64_t> allocations{0};
+    };
+    std::array<Totals, NUM_STARTUP_PHASES> phases_;
+
+public:
+    void add(StartupPhase phase, uint64_t nanoseconds, uint64_t allocations);
+
+    uint64_t get_nanoseconds(StartupPhase phase) const;
+    uint64_t get_allocations(StartupPhase phase) const;
+
+    // Print the table of phases to out.
+    void print(std::FILE* out) const;
+};
+
+// PhaseTimer charges the lifetime of its scope to a phase. It does nothing if
+// stats is null, so instrumented code paths cost only a test when disabled.
+class PhaseTimer {
+private:
+    StartupStats* stats_;
+    StartupPhase phase_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t start_allocations_;
+
+    // Time and allocations already charged to timers nested inside this one.
+    uint64_t nested_nanoseconds_ = 0;
+    uint64_t nested_allocations_ = 0;
+    PhaseTimer* parent_;
+
+    // The innermost live timer on this thread.
+    static thread_local PhaseTimer* current_;
+
+public:
+    PhaseTimer(StartupStats* stats, StartupPhase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+} // namespace nutmeg
+
+#endif // STARTUP_STATS_HPP
@@ -0,0 +1,23 @@
+#ifndef STRING_HASH_HPP
+#define STRING_HASH_HPP
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstddef>
+
+namespace nutmeg {
+
+// StringHash enables heterogeneous lookup in unordered containers keyed by
+// std::string, so that they can be searched with a std::string_view (such as a
+// name still sitting in the loader's input buffer) without building a string.
+// Use together with std::equal_to<>.
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
+
+} // namespace nutmeg
+
+#endif // STRING_HASH_HPP
@@ -0,0 +1,110 @@
+#include "sysarith.hpp"
+#include "bignum.hpp"
+#include "machine.hpp"
+#include "value.hpp"
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <fmt/core.h>
+
+namespace nutmeg {
+
+// Integer arithmetic is overwhelmingly performed on two small integers, so each
+// sys-function first tries a fast path: both operands are tagged ints and the
+// overflow-checked operation of the value representation succeeds (for the
+// low-bit tagging scheme that is a single add plus an overflow flag check). Only
+// when that fails do we fall back to BigInt arithmetic, promoting to a bignum.
+
+// Collect the nargs operands on top of the stack as BigInts, in push order.
+// This copies everything out of the heap before any result is allocated.
+static std::vector<BigInt> bigint_args(Machine& machine, uint64_t nargs, const char* name) {
+    // Defensive check: Ensure we have enough values on the stack (to avoid confusion from partial pops).
+    if (machine.stack_size() < nargs) {
+        throw std::runtime_error(fmt::format("{}: Stack underflow, insufficient values for count.", name));
+    }
+    std::vector<BigInt> args;
+    size_t base_index = machine.stack_size() - nargs;
+    for (uint64_t i = 0; i < nargs; ++i) {
+        Cell value = machine.peek_at(base_index + i);
+        if (!is_integer(machine.get_heap(), value)) {
+            throw std::runtime_error(fmt::format("{}: argument is not an integer: {}", name, cell_to_string(value)));
+        }
+        args.push_back(to_bigint(machine.get_heap(), value));
+    }
+    return args;
+}
+
+// Replace the nargs operands with the single result.
+static void replace_args(Machine& machine, uint64_t nargs, const BigInt& result) {
+    Cell cell;
+    {
+        std::lock_guard<std::mutex> lock(machine.get_heap_mutex());
+        cell = make_integer(machine.get_heap(), result, machine.get_result_space());
+    }
+    machine.pop_multiple(nargs);
+    machine.push(cell);
+}
+
+// Sys-function implementation for "+": the sum of all N values (0 when N = 0).
+void sys_add(Machine& machine, uint64_t nargs) {
+    if (nargs == 2 && machine.stack_size() >= 2) {
+        Cell a = machine.peek_at(machine.stack_size() - 2);
+        Cell b = machine.peek_at(machine.stack_size() - 1);
+        Cell sum;
+        if (is_tagged_int(a) && is_tagged_int(b) && add_tagged_ints(a, b, sum)) {
+            machine.pop_multiple(2);
+            machine.push(sum);
+            return;
+        }
+    }
+    BigInt total;
+    for (const BigInt& arg : bigint_args(machine, nargs, "+")) {
+        total = total + arg;
+    }
+    replace_args(machine, nargs, total);
+}
+
+// Sys-function implementation for "-": negation when N = 1, otherwise the first
+// value minus all the others.
+void sys_subtract(Machine& machine, uint64_t nargs) {
+    if (nargs == 0) {
+        throw std::runtime_error("-: requires at least one argument.");
+    }
+    if (nargs == 2 && machine.stack_size() >= 2) {
+        Cell a = machine.peek_at(machine.stack_size() - 2);
+        Cell b = machine.peek_at(machine.stack_size() - 1);
+        Cell difference;
+        if (is_tagged_int(a) && is_tagged_int(b) && subtract_tagged_ints(a, b, difference)) {
+            machine.pop_multiple(2);
+            machine.push(difference);
+            return;
+        }
+    }
+    std::vector<BigInt> args = bigint_args(machine, nargs, "-");
+    BigInt result = nargs == 1 ? -args[0] : args[0];
+    for (size_t i = 1; i < args.size(); i++) {
+        result = result - args[i];
+    }
+    replace_args(machine, nargs, result);
+}
+
+// Sys-function implementation for "*": the product of all N values (1 when N = 0).
+void sys_multiply(Machine& machine, uint64_t nargs) {
+    if (nargs == 2 && machine.stack_size() >= 2) {
+        Cell a = machine.peek_at(machine.stack_size() - 2);
+        Cell b = machine.peek_at(machine.stack_size() - 1);
+        Cell product;
+        if (is_tagged_int(a) && is_tagged_int(b) && multiply_tagged_ints(a, b, product)) {
+            machine.pop_multiple(2);
+            machine.push(product);
+            return;
+        }
+    }
+    BigInt total = BigInt::from_int64(1);
+    for (const BigInt& arg : bigint_args(machine, nargs, "*")) {
+        total = total * arg;
+    }
+    replace_args(machine, nargs, total);
+}
+
+} // namespace nutmeg
@@ -0,0 +1,17 @@
+#include <cstdint>
+
+#ifndef SYSARITH_HPP
+#define SYSARITH_HPP
+
+namespace nutmeg {
+
+class Machine;
+
+// Sys-function implementations for integer arithmetic "+", "-" and "*".
+void sys_add(Machine& machine, uint64_t nargs);
+void sys_subtract(Machine& machine, uint64_t nargs);
+void sys_multiply(Machine& machine, uint64_t nargs);
+
+} // namespace nutmeg
+
+#endif // SYSARITH_HPP
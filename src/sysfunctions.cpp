@@ -1,12 +1,32 @@
 #include "sysfunctions.hpp"
 #include "sysprintln.hpp"
+#include "sysarith.hpp"
 #include "machine.hpp"
 
 namespace nutmeg {
 
 // Global sys-functions table mapping names to function pointers.
-const std::unordered_map<std::string, SysFunction> sysfunctions_table = {
-    {"println", sys_println}
+const std::unordered_map<std::string, SysFunction, StringHash, std::equal_to<>> sysfunctions_table = {
+    {"println", sys_println},
+    {"+", sys_add},
+    {"-", sys_subtract},
+    {"*", sys_multiply},
+};
+
+const std::string* sysfunction_name(const void* ptr) {
+    for (const auto& pair : sysfunctions_table) {
+        if (reinterpret_cast<const void*>(pair.second) == ptr) {
+            return &pair.first;
+        }
+    }
+    return nullptr;
+}
+
+const std::unordered_map<SysFunction, SysFunctionEffect> sysfunction_effects = {
+    {sys_println, {0, false}},
+    {sys_add, {1, true}},
+    {sys_subtract, {1, true}},
+    {sys_multiply, {1, true}},
 };
 
 } // namespace nutmeg
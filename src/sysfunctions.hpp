@@ -1,6 +1,7 @@
 #ifndef SYSFUNCTIONS_HPP
 #define SYSFUNCTIONS_HPP
 
+#include "string_hash.hpp"
 #include <unordered_map>
 #include <string>
 #include <cstdint>
@@ -15,9 +16,29 @@ using SysFunction = void (*)(Machine&, uint64_t);
 
 // Sys-function implementations.
 void sys_println(Machine& machine, uint64_t nargs);
+void sys_add(Machine& machine, uint64_t nargs);
+void sys_subtract(Machine& machine, uint64_t nargs);
+void sys_multiply(Machine& machine, uint64_t nargs);
 
 // Global sys-functions table.
-extern const std::unordered_map<std::string, SysFunction> sysfunctions_table;
+extern const std::unordered_map<std::string, SysFunction, StringHash, std::equal_to<>> sysfunctions_table;
+
+// The table's name for a sys-function pointer (as planted in compiled code), or
+// nullptr if it is not in the table. A linear search; the table is small.
+const std::string* sysfunction_name(const void* ptr);
+
+// What the loader's escape analysis knows of a sys-function (see
+// Machine::set_region_allocation): how many results it pushes, and whether
+// they may be objects it has just allocated, in the machine's result space.
+// Every sys-function only reads its arguments and keeps no reference to them.
+struct SysFunctionEffect {
+    int results;
+    bool allocates_results;
+};
+
+// The effects of the sys-functions the escape analysis understands. Calling
+// any other is taken to let every value on the stack escape.
+extern const std::unordered_map<SysFunction, SysFunctionEffect> sysfunction_effects;
 
 } // namespace nutmeg
 
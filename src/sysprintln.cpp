@@ -1,6 +1,7 @@
 #include "sysprintln.hpp"
 #include "machine.hpp"
 #include "value.hpp"
+#include "bignum.hpp"
 #include <fmt/core.h>
 #include <stdexcept>
 
@@ -30,6 +31,8 @@ void sys_println(Machine& machine, uint64_t nargs) {
         
         if (is_tagged_int(value)) {
             fmt::print("{}", as_detagged_int(value));
+        } else if (is_bignum(machine.get_heap(), value)) {
+            fmt::print("{}", bignum_to_string(machine.get_heap(), value));
         } else if (is_tagged_ptr(value)) {
             // Get string data from heap.
             const char* str = machine.get_string(value);
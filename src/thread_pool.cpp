@@ -0,0 +1,46 @@
+#include "thread_pool.hpp"
+
+namespace nutmeg {
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    workers_.reserve(num_threads);
+    for (unsigned i = 0; i < num_threads; i++) {
+        workers_.emplace_back([this]() { run_worker(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_ready_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::default_size() {
+    // hardware_concurrency may return 0 when it cannot tell.
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+void ThreadPool::run_worker() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_ready_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        // Exceptions are captured by the packaged_task, so none escape here.
+        task();
+    }
+}
+
+} // namespace nutmeg
@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace nutmeg {
+
+// ThreadPool runs submitted tasks on a fixed set of worker threads, in
+// submission order. The result (or exception) of each task is delivered
+// through the std::future returned by submit. Destroying the pool finishes the
+// tasks already queued and then joins the workers.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_ready_;
+    bool stopping_ = false;
+
+    void run_worker();
+
+public:
+    explicit ThreadPool(unsigned num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The number of threads the hardware runs concurrently (at least 1).
+    static unsigned default_size();
+
+    size_t size() const { return workers_.size(); }
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F task) {
+        // std::function requires a copyable target, so the move-only
+        // packaged_task is held by a shared_ptr.
+        auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(task));
+        std::future<std::invoke_result_t<F>> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back([packaged]() { (*packaged)(); });
+        }
+        task_ready_.notify_one();
+        return result;
+    }
+};
+
+} // namespace nutmeg
+
+#endif // THREAD_POOL_HPP
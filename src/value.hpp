@@ -15,18 +15,8 @@ union Cell {
     void* ptr;
     uint64_t u64;
     void* label_addr;          // Instruction handler label address (for threaded interpreter).
-    std::string* str_ptr;      // Pointer to string (for instruction operands).
 };
 
-// Type tags.
-constexpr uint64_t TAG_INT    = 0x0;  // x00 pattern.
-constexpr uint64_t TAG_FLOAT  = 0x2;  // x10 pattern.
-constexpr uint64_t TAG_PTR    = 0x1;  // 001 pattern.
-constexpr uint64_t TAG_SPECIAL = 0x7;  // 111 pattern.
-
-constexpr uint64_t TAG_MASK_2BIT = 0x3;  // For x00 and x10.
-constexpr uint64_t TAG_MASK_3BIT = 0x7;  // For 001 and 111.
-
 inline Cell make_raw_i64(int64_t value) {
     Cell c;
     c.i64 = value;
@@ -39,82 +29,279 @@ inline Cell make_raw_ptr(void* ptr) {
     return c;
 }
 
-// Integer operations (x00 tag - 62-bit integers).
-// Bit 2 is the low-order bit of the integer, bits 0-1 are always 00.
-// Even integers: 000, odd integers: 100.
-inline Cell make_tagged_int(int64_t value) {
+inline Cell make_raw_u64(uint64_t value) {
     Cell c;
-    c.u64 = static_cast<uint64_t>(value) << 2;
+    c.u64 = value;
     return c;
 }
 
+// Value representation policies.
+//
+// The tagging scheme is a compile-time policy: a struct of static functions that
+// encode and decode each kind of value. The free functions further down (such as
+// make_tagged_int) forward to the policy selected by NUTMEG_NAN_BOXING, so the
+// rest of the runtime never depends on the bit-level layout. Both policies are
+// always compiled, which lets tests and benchmarks compare them side by side.
+//
+// Each policy provides: the tagged integer range; make/as/is for ints, floats,
+// pointers and special literals; and overflow-checked integer arithmetic that
+// returns false when the result does not fit in a tagged integer.
+
+// LowTagRepr is the scheme described in docs/tagging-scheme.md: the bottom
+// three bits are the tag.
+struct LowTagRepr {
+    // Type tags.
+    static constexpr uint64_t TAG_INT    = 0x0;  // x00 pattern.
+    static constexpr uint64_t TAG_FLOAT  = 0x2;  // x10 pattern.
+    static constexpr uint64_t TAG_PTR    = 0x1;  // 001 pattern.
+    static constexpr uint64_t TAG_SPECIAL = 0x7;  // 111 pattern.
+
+    static constexpr uint64_t TAG_MASK_2BIT = 0x3;  // For x00 and x10.
+    static constexpr uint64_t TAG_MASK_3BIT = 0x7;  // For 001 and 111.
+
+    static constexpr int64_t INT_MIN_VALUE = -(INT64_C(1) << 61);
+    static constexpr int64_t INT_MAX_VALUE = (INT64_C(1) << 61) - 1;
+
+    // Integer operations (x00 tag - 62-bit integers).
+    // Bit 2 is the low-order bit of the integer, bits 0-1 are always 00.
+    // Even integers: 000, odd integers: 100.
+    static Cell make_int(int64_t value) {
+        return make_raw_u64(static_cast<uint64_t>(value) << 2);
+    }
+
+    static int64_t as_int(Cell cell) {
+        // Arithmetic right shift by 2 to preserve sign and recover all 62 bits.
+        return static_cast<int64_t>(cell.u64) >> 2;
+    }
+
+    static bool is_int(Cell cell) {
+        // Check that bits 0-1 are 00.
+        return (cell.u64 & TAG_MASK_2BIT) == TAG_INT;
+    }
+
+    // Because a tagged int is the value shifted left by two, two tagged ints can
+    // be added or subtracted directly, and the 64-bit overflow flag is exactly the
+    // 62-bit overflow condition. Multiplying by a detagged int keeps the tag.
+    static bool add_ints(Cell a, Cell b, Cell& result) {
+        return !__builtin_add_overflow(a.i64, b.i64, &result.i64);
+    }
+
+    static bool subtract_ints(Cell a, Cell b, Cell& result) {
+        return !__builtin_sub_overflow(a.i64, b.i64, &result.i64);
+    }
+
+    static bool multiply_ints(Cell a, Cell b, Cell& result) {
+        return !__builtin_mul_overflow(a.i64, as_int(b), &result.i64);
+    }
+
+    // Floating point operations (x10 tag - 62-bit floats).
+    // The two low-order mantissa bits are replaced by the tag, so floats keep their
+    // sign, exponent and all but the last two bits of precision.
+    static Cell make_float(double value) {
+        uint64_t bits = std::bit_cast<uint64_t>(value);
+        return make_raw_u64((bits & ~TAG_MASK_2BIT) | TAG_FLOAT);
+    }
+
+    static double as_float(Cell cell) {
+        // Clear the tag, which reads back as zeros in the low mantissa bits.
+        return std::bit_cast<double>(cell.u64 & ~TAG_MASK_2BIT);
+    }
+
+    static bool is_float(Cell cell) {
+        // Check that bits 0-1 are 10.
+        return (cell.u64 & TAG_MASK_2BIT) == TAG_FLOAT;
+    }
+
+    // Pointer operations (001 tag).
+    // Bottom 3 bits are 001. Assumes pointers are 8-byte aligned (bottom 3 bits are 000).
+    static Cell make_ptr(void* ptr) {
+        return make_raw_u64(reinterpret_cast<uint64_t>(ptr) | TAG_PTR);
+    }
+
+    static void* as_ptr(Cell cell) {
+        // Clear the bottom 3 bits to recover the original pointer.
+        // Note: Going via a Cell rather than reinterpret_cast<void*> works around an issue
+        // where inline + reinterpret_cast<void*> causes fmt::print to print incorrect pointer
+        // values (the address of a temporary rather than the pointer value itself). This
+        // generates no additional code (verified via assembly inspection).
+        return make_raw_u64(cell.u64 & ~TAG_MASK_3BIT).ptr;
+    }
+
+    static bool is_ptr(Cell cell) {
+        return (cell.u64 & TAG_MASK_3BIT) == TAG_PTR;
+    }
+
+    // Special literals (111 tag).
+    // Use upper bits to distinguish between bool true, bool false, nil, etc.
+    static constexpr uint64_t special(uint64_t n) {
+        return (n << 3) | TAG_SPECIAL;
+    }
+};
+
+// NanBoxRepr stores doubles unboxed and at full precision. Every other value is
+// hidden in the payload of a negative quiet NaN, which real arithmetic never
+// produces once NaNs are canonicalised to the positive quiet NaN:
+//
+//   1111 1111 1111 1ttt  pppp ... pppp   (t = 3-bit tag, p = 48-bit payload)
+//
+// Tag 000 is left unused so that the negative quiet NaN itself stays free.
+// Integers are 48-bit and pointers are 48-bit user-space addresses.
+struct NanBoxRepr {
+    static constexpr uint64_t BOX_PREFIX   = 0xFFF8000000000000ULL;
+    static constexpr uint64_t BOX_MASK     = 0xFFFF000000000000ULL;
+    static constexpr uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+    static constexpr uint64_t BOX_INT      = BOX_PREFIX | (1ULL << 48);
+    static constexpr uint64_t BOX_PTR      = BOX_PREFIX | (2ULL << 48);
+    static constexpr uint64_t BOX_SPECIAL  = BOX_PREFIX | (3ULL << 48);
+    static constexpr uint64_t CANONICAL_NAN = 0x7FF8000000000000ULL;
+
+    static constexpr int64_t INT_MIN_VALUE = -(INT64_C(1) << 47);
+    static constexpr int64_t INT_MAX_VALUE = (INT64_C(1) << 47) - 1;
+
+    static Cell make_int(int64_t value) {
+        return make_raw_u64(BOX_INT | (static_cast<uint64_t>(value) & PAYLOAD_MASK));
+    }
+
+    static int64_t as_int(Cell cell) {
+        // Shift the payload up to the top and back down again to sign-extend it.
+        return static_cast<int64_t>(cell.u64 << 16) >> 16;
+    }
+
+    static bool is_int(Cell cell) {
+        return (cell.u64 & BOX_MASK) == BOX_INT;
+    }
+
+    // The operands are at most 48 bits, so the 64-bit arithmetic cannot overflow
+    // (the product of two 48-bit values aside) and only the range needs checking.
+    static bool add_ints(Cell a, Cell b, Cell& result) {
+        return make_checked_int(as_int(a) + as_int(b), result);
+    }
+
+    static bool subtract_ints(Cell a, Cell b, Cell& result) {
+        return make_checked_int(as_int(a) - as_int(b), result);
+    }
+
+    static bool multiply_ints(Cell a, Cell b, Cell& result) {
+        int64_t product;
+        return !__builtin_mul_overflow(as_int(a), as_int(b), &product) && make_checked_int(product, result);
+    }
+
+    static Cell make_float(double value) {
+        // Canonicalise NaNs so that no float can be mistaken for a boxed value.
+        return make_raw_u64(value != value ? CANONICAL_NAN : std::bit_cast<uint64_t>(value));
+    }
+
+    static double as_float(Cell cell) {
+        return cell.f64;
+    }
+
+    static bool is_float(Cell cell) {
+        // Anything outside the boxed range is a double.
+        return (cell.u64 & BOX_PREFIX) != BOX_PREFIX || (cell.u64 & BOX_MASK) == BOX_PREFIX;
+    }
+
+    static Cell make_ptr(void* ptr) {
+        return make_raw_u64(BOX_PTR | reinterpret_cast<uint64_t>(ptr));
+    }
+
+    static void* as_ptr(Cell cell) {
+        return make_raw_u64(cell.u64 & PAYLOAD_MASK).ptr;
+    }
+
+    static bool is_ptr(Cell cell) {
+        return (cell.u64 & BOX_MASK) == BOX_PTR;
+    }
+
+    static constexpr uint64_t special(uint64_t n) {
+        return BOX_SPECIAL | n;
+    }
+
+private:
+    static bool make_checked_int(int64_t value, Cell& result) {
+        if (value < INT_MIN_VALUE || value > INT_MAX_VALUE) {
+            return false;
+        }
+        result = make_int(value);
+        return true;
+    }
+};
+
+#if NUTMEG_NAN_BOXING
+using ValueRepr = NanBoxRepr;
+#else
+using ValueRepr = LowTagRepr;
+#endif
+
+// Range of integers that fit in a tagged cell. Anything outside it must be
+// promoted to a bignum on the heap.
+constexpr int64_t TAGGED_INT_MIN = ValueRepr::INT_MIN_VALUE;
+constexpr int64_t TAGGED_INT_MAX = ValueRepr::INT_MAX_VALUE;
+
+inline bool fits_tagged_int(int64_t value) {
+    return TAGGED_INT_MIN <= value && value <= TAGGED_INT_MAX;
+}
+
+// Integer operations.
+inline Cell make_tagged_int(int64_t value) {
+    return ValueRepr::make_int(value);
+}
+
 inline int64_t as_detagged_int(Cell cell) {
-    // Arithmetic right shift by 2 to preserve sign and recover all 62 bits.
-    return static_cast<int64_t>(cell.u64) >> 2;
+    return ValueRepr::as_int(cell);
 }
 
 inline bool is_tagged_int(Cell cell) {
-    // Check that bits 0-1 are 00.
-    return (cell.u64 & 0x3) == 0;
+    return ValueRepr::is_int(cell);
+}
+
+// Overflow-checked arithmetic on two tagged ints. Returns false, leaving result
+// unspecified, if the result does not fit in a tagged int.
+inline bool add_tagged_ints(Cell a, Cell b, Cell& result) {
+    return ValueRepr::add_ints(a, b, result);
+}
+
+inline bool subtract_tagged_ints(Cell a, Cell b, Cell& result) {
+    return ValueRepr::subtract_ints(a, b, result);
+}
+
+inline bool multiply_tagged_ints(Cell a, Cell b, Cell& result) {
+    return ValueRepr::multiply_ints(a, b, result);
 }
 
-// Floating point operations (x10 tag - 62-bit floats).
-// Bit 2 is the low-order bit of the float, bits 0-1 are always 10.
+// Floating point operations.
 inline Cell make_tagged_float(double value) {
-    uint64_t bits = std::bit_cast<uint64_t>(value);
-    Cell c;
-    c.u64 = (bits << 2) | TAG_FLOAT;
-    return c;
+    return ValueRepr::make_float(value);
 }
 
 inline double as_detagged_float(Cell cell) {
-    // Right shift by 2 to extract all 62 bits.
-    uint64_t bits = cell.u64 >> 2;
-    return std::bit_cast<double>(bits);
+    return ValueRepr::as_float(cell);
 }
 
 inline bool is_tagged_float(Cell cell) {
-    // Check that bits 0-1 are 10.
-    return (cell.u64 & 0x3) == 0x2;
+    return ValueRepr::is_float(cell);
 }
 
-// Pointer operations (001 tag).
-// Bottom 3 bits are 001. Assumes pointers are 8-byte aligned (bottom 3 bits are 000).
+// Pointer operations.
 inline Cell make_tagged_ptr(void* ptr) {
-    Cell c;
-    c.u64 = reinterpret_cast<uint64_t>(ptr) | TAG_PTR;
-    return c;
+    return ValueRepr::make_ptr(ptr);
 }
 
-
 inline void* as_detagged_ptr(Cell cell) {
-    // Clear the bottom 3 bits to recover the original pointer.
-    // Note: The static_cast<void*> wrapper is necessary to work around an issue where inline +
-    // reinterpret_cast<void*> causes fmt::print to print incorrect pointer values. Without the
-    // static_cast, fmt::print may print the address of a temporary rather than the pointer value
-    // itself. The cast generates no additional code (verified via assembly inspection) but changes
-    // how the value is presented to template instantiation, avoiding the issue.
-    Cell c;
-    c.u64 = cell.u64 & ~TAG_MASK_3BIT;
-    return c.ptr;
-    // return static_cast<void*>(reinterpret_cast<void*>(cell.u64 & ~TAG_MASK_3BIT));
+    return ValueRepr::as_ptr(cell);
 }
 
 inline bool is_tagged_ptr(Cell cell) {
-    return (cell.u64 & TAG_MASK_3BIT) == TAG_PTR;
+    return ValueRepr::is_ptr(cell);
 }
 
-// Special literals (111 tag).
-// Use upper bits to distinguish between bool true, bool false, nil, etc.
-constexpr uint64_t SPECIAL_FALSE = TAG_SPECIAL;           // 0x7
-constexpr uint64_t SPECIAL_TRUE  = (1ULL << 3) | TAG_SPECIAL;  // 0xF
-constexpr uint64_t SPECIAL_NIL   = (2ULL << 3) | TAG_SPECIAL;  // 0x17
-constexpr uint64_t SPECIAL_UNDEF   = (3ULL << 3) | TAG_SPECIAL;  // 0x1F
+// Special literals.
+constexpr uint64_t SPECIAL_FALSE = ValueRepr::special(0);
+constexpr uint64_t SPECIAL_TRUE  = ValueRepr::special(1);
+constexpr uint64_t SPECIAL_NIL   = ValueRepr::special(2);
+constexpr uint64_t SPECIAL_UNDEF = ValueRepr::special(3);
 
 inline Cell make_bool(bool value) {
-    Cell c;
-    c.u64 = value ? SPECIAL_TRUE : SPECIAL_FALSE;
-    return c;
+    return make_raw_u64(value ? SPECIAL_TRUE : SPECIAL_FALSE);
 }
 
 inline bool as_bool(Cell cell) {
@@ -126,21 +313,65 @@ inline bool is_bool(Cell cell) {
 }
 
 inline Cell make_undef() {
-    Cell c;
-    c.u64 = SPECIAL_UNDEF;
-    return c;
+    return make_raw_u64(SPECIAL_UNDEF);
 }
 
 inline Cell make_nil() {
-    Cell c;
-    c.u64 = SPECIAL_NIL;
-    return c;
+    return make_raw_u64(SPECIAL_NIL);
 }
 
 inline bool is_nil(Cell cell) {
     return cell.u64 == SPECIAL_NIL;
 }
 
+// Compressed slots. In a heap with compressed references (see
+// HeapOptions::compressed_references) each field of a record or vector is a
+// 32-bit slot rather than a cell, holding one of:
+//
+//   oooo ... ooo1   a reference, o being the object's offset in cells from the heap's base
+//   iiii ... ii00   a 30-bit integer
+//   0000 ... nn10   the special literal n
+//
+// A value that fits none of these is boxed (see Heap::set_field).
+constexpr int64_t SLOT_INT_MIN = -(INT64_C(1) << 29);
+constexpr int64_t SLOT_INT_MAX = (INT64_C(1) << 29) - 1;
+constexpr size_t SLOT_MAX_OFFSET_CELLS = size_t{1} << 31;
+
+inline bool fits_slot(Cell value, const Cell* base) {
+    if (is_tagged_ptr(value)) {
+        const Cell* ptr = static_cast<const Cell*>(as_detagged_ptr(value));
+        return ptr >= base && static_cast<size_t>(ptr - base) < SLOT_MAX_OFFSET_CELLS;
+    }
+    if (is_tagged_int(value)) {
+        int64_t n = as_detagged_int(value);
+        return SLOT_INT_MIN <= n && n <= SLOT_INT_MAX;
+    }
+    return value.u64 == SPECIAL_FALSE || value.u64 == SPECIAL_TRUE || value.u64 == SPECIAL_NIL ||
+           value.u64 == SPECIAL_UNDEF;
+}
+
+// Compress a value, which must fit in a slot.
+inline uint32_t compress_slot(Cell value, const Cell* base) {
+    if (is_tagged_ptr(value)) {
+        return static_cast<uint32_t>(static_cast<const Cell*>(as_detagged_ptr(value)) - base) << 1 | 1;
+    }
+    if (is_tagged_int(value)) {
+        return static_cast<uint32_t>(as_detagged_int(value)) << 2;
+    }
+    uint32_t n = value.u64 == SPECIAL_FALSE ? 0 : value.u64 == SPECIAL_TRUE ? 1 : value.u64 == SPECIAL_NIL ? 2 : 3;
+    return n << 2 | 2;
+}
+
+inline Cell decompress_slot(uint32_t slot, const Cell* base) {
+    if ((slot & 1) != 0) {
+        return make_tagged_ptr(const_cast<Cell*>(base) + (slot >> 1));
+    }
+    if ((slot & 2) != 0) {
+        return make_raw_u64(ValueRepr::special(slot >> 2));
+    }
+    return make_tagged_int(static_cast<int32_t>(slot) >> 2);
+}
+
 class Ident {
 public:
     Cell cell;
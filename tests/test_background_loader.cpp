@@ -0,0 +1,52 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/background_loader.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+using namespace nutmeg;
+
+// A function object whose nlocals identifies it.
+static FunctionObject make_function(int id) {
+    FunctionObject func;
+    func.nlocals = id;
+    func.nparams = 0;
+    return func;
+}
+
+TEST_CASE("BackgroundLoader compiles on the taking thread before it starts", "[background_loader]") {
+    std::atomic<int> compiles{0};
+    BackgroundLoader loader(2);
+    loader.add("a", [&]() { compiles++; return make_function(1); });
+    loader.add("b", [&]() { compiles++; return make_function(2); });
+    REQUIRE(loader.has("a"));
+    REQUIRE_FALSE(loader.has("c"));
+    REQUIRE(loader.take("b").nlocals == 2);
+    REQUIRE_FALSE(loader.has("b"));
+    REQUIRE(compiles == 1);
+    REQUIRE_THROWS_AS(loader.take("b"), std::runtime_error);
+}
+
+TEST_CASE("BackgroundLoader compiles each binding exactly once", "[background_loader]") {
+    std::atomic<int> compiles{0};
+    BackgroundLoader loader(3);
+    for (int i = 0; i < 200; i++) {
+        loader.add("f" + std::to_string(i), [&compiles, i]() { compiles++; return make_function(i); });
+    }
+    loader.start();
+    // Taking in reverse order races the workers for most of the bindings.
+    for (int i = 199; i >= 0; i--) {
+        REQUIRE(loader.take("f" + std::to_string(i)).nlocals == i);
+    }
+    REQUIRE(compiles == 200);
+}
+
+TEST_CASE("BackgroundLoader rethrows compile errors when taken", "[background_loader]") {
+    BackgroundLoader loader(1);
+    loader.add("bad", []() -> FunctionObject { throw std::runtime_error("cannot compile"); });
+    loader.add("good", []() { return make_function(7); });
+    loader.start();
+    REQUIRE_THROWS_AS(loader.take("bad"), std::runtime_error);
+    REQUIRE(loader.take("good").nlocals == 7);
+    REQUIRE_THROWS_AS(loader.add("late", []() { return make_function(0); }), std::logic_error);
+}
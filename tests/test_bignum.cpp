@@ -0,0 +1,73 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/bignum.hpp"
+#include "../src/machine.hpp"
+#include "../src/sysarith.hpp"
+#include "../src/value.hpp"
+
+using namespace nutmeg;
+
+TEST_CASE("Small integer arithmetic stays tagged", "[bignum]") {
+    Machine machine;
+
+    machine.push(make_tagged_int(40));
+    machine.push(make_tagged_int(2));
+    sys_add(machine, 2);
+
+    REQUIRE(machine.stack_size() == 1);
+    Cell result = machine.pop();
+    REQUIRE(is_tagged_int(result));
+    REQUIRE(as_detagged_int(result) == 42);
+}
+
+TEST_CASE("Integer overflow promotes to a bignum and back", "[bignum]") {
+    Machine machine;
+
+    machine.push(make_tagged_int(TAGGED_INT_MAX));
+    machine.push(make_tagged_int(1));
+    sys_add(machine, 2);
+
+    Cell big = machine.peek();
+    REQUIRE(is_bignum(machine.get_heap(), big));
+    REQUIRE(bignum_to_string(machine.get_heap(), big) == std::to_string(TAGGED_INT_MAX + 1));
+
+    // Subtracting brings the result back into the tagged range.
+    machine.push(make_tagged_int(1));
+    sys_subtract(machine, 2);
+    Cell small = machine.pop();
+    REQUIRE(is_tagged_int(small));
+    REQUIRE(as_detagged_int(small) == TAGGED_INT_MAX);
+}
+
+TEST_CASE("Bignum multiplication", "[bignum]") {
+    Machine machine;
+
+    // 2^64 - 1 squared.
+    machine.push(make_integer(machine.get_heap(), BigInt::from_uint64(UINT64_MAX)));
+    machine.push(make_integer(machine.get_heap(), BigInt::from_uint64(UINT64_MAX)));
+    sys_multiply(machine, 2);
+
+    REQUIRE(bignum_to_string(machine.get_heap(), machine.pop()) == "340282366920938463426481119284349108225");
+
+    machine.push(make_tagged_int(-3));
+    machine.push(make_integer(machine.get_heap(), BigInt::from_int64(INT64_MIN)));
+    sys_multiply(machine, 2);
+    REQUIRE(bignum_to_string(machine.get_heap(), machine.pop()) == "27670116110564327424");
+}
+
+TEST_CASE("Large integer literals are loaded as bignum constants", "[bignum]") {
+    Machine machine;
+
+    FunctionObject func = machine.parse_function_object(R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.int", "index": 18446744073709551615},
+            {"type": "push.int", "index": 7}
+        ]
+    })");
+    Cell* func_obj = machine.allocate_function(func.code, func.nlocals, func.nparams);
+    machine.execute(func_obj);
+
+    REQUIRE(as_detagged_int(machine.pop()) == 7);
+    REQUIRE(bignum_to_string(machine.get_heap(), machine.pop()) == "18446744073709551615");
+}
@@ -1,6 +1,12 @@
 #include <catch2/catch_test_macros.hpp>
+#include "../benchmarks/bench_support.hpp"
 #include "../src/bundle_reader.hpp"
 #include "../src/machine.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/core.h>
+#include <sqlite3.h>
+#include <unistd.h>
 
 using namespace nutmeg;
 
@@ -35,3 +41,129 @@ TEST_CASE("Machine can parse function object JSON", "[bundle_reader]") {
     // That's 1+1 + 1+1 + 1+2 + 1 = 8 instruction words.
     REQUIRE(func.code.size() == 8);
 }
+
+// Write a small bundle with the standard schema: main -> a -> b -> a (a cycle),
+// main -> lazy, and b -> missing (which has no binding).
+static std::string make_test_bundle(bool with_missing) {
+    bench::BundleWriter bundle("test");
+    bundle.add_entry_point("main");
+    for (auto [idname, needs] : {std::pair{"main", "a"}, {"main", "lazy"}, {"a", "b"}, {"b", "a"}}) {
+        bundle.add_dependency(idname, needs);
+    }
+    if (with_missing) {
+        bundle.add_dependency("b", "missing");
+    }
+    bundle.add_binding("main", "main-json");
+    bundle.add_binding("a", "a-json");
+    bundle.add_binding("b", "b-json");
+    bundle.add_binding("lazy", "lazy-json", true);
+    return bundle.close();
+}
+
+TEST_CASE("BundleReader computes the dependency closure in one query", "[bundle_reader]") {
+    std::string path = make_test_bundle(false);
+    {
+        BundleReader reader(path);
+        // The entry point comes first and the cycle is visited once. The
+        // statement is reused by the second call.
+        for (int i = 0; i < 2; i++) {
+            std::vector<std::string> deps = reader.get_dependencies("main");
+            REQUIRE(deps.front() == "main");
+            std::sort(deps.begin(), deps.end());
+            REQUIRE(deps == std::vector<std::string>{"a", "b", "lazy", "main"});
+        }
+
+        std::vector<Binding> bindings = reader.get_dependency_bindings("main");
+        REQUIRE(bindings.size() == 4);
+        REQUIRE(bindings[0].idname == "a");
+        REQUIRE(bindings[0].value == "a-json");
+        REQUIRE(bindings[2].idname == "lazy");
+        REQUIRE(bindings[2].lazy);
+        REQUIRE(bindings[2].value.empty());
+        REQUIRE(reader.get_dependency_bindings("main", true)[2].value == "lazy-json");
+
+        std::vector<std::string> direct = reader.get_direct_dependencies("main");
+        std::sort(direct.begin(), direct.end());
+        REQUIRE(direct == std::vector<std::string>{"a", "lazy"});
+        REQUIRE(reader.get_direct_dependencies("lazy").empty());
+
+        REQUIRE(reader.get_binding("lazy").value == "lazy-json");
+        REQUIRE(reader.get_binding("b").value == "b-json");
+        REQUIRE_THROWS_AS(reader.get_binding("nope"), BundleReaderError);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("BundleReader reports dependencies without bindings", "[bundle_reader]") {
+    std::string path = make_test_bundle(true);
+    {
+        BundleReader reader(path);
+        REQUIRE(reader.get_dependencies("main").size() == 5);
+        REQUIRE_THROWS_AS(reader.get_dependency_bindings("main"), BundleReaderError);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("BundleReader reads binary bytecode in place of the JSON value", "[bundle_reader]") {
+    std::string path = make_test_bundle(false);
+    {
+        BundleReader reader(path);
+        REQUIRE_FALSE(reader.has_bytecodes());
+        REQUIRE_FALSE(reader.visit_bytecode("a", [](std::string_view) { FAIL("No bytecodes table"); }));
+    }
+
+    sqlite3* db = nullptr;
+    REQUIRE(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+    REQUIRE(sqlite3_exec(db, R"(
+        CREATE TABLE bytecodes (id_name text, code blob, PRIMARY KEY (id_name));
+        INSERT INTO bytecodes VALUES ('a', x'4e420100'), ('lazy', x'4e420101');
+    )", nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(db);
+
+    {
+        BundleReader reader(path);
+        REQUIRE(reader.has_bytecodes());
+        std::vector<std::string> seen;
+        reader.visit_dependency_bindings("main", [&](Binding& binding, std::string_view bytecode) {
+            seen.push_back(binding.idname);
+            if (binding.idname == "a") {
+                REQUIRE(bytecode == std::string_view("NB\x01\x00", 4));
+                REQUIRE(binding.value.empty());
+            } else {
+                // Lazy bindings are not read up front, in either encoding.
+                REQUIRE(bytecode.empty());
+                REQUIRE(binding.value == (binding.lazy ? "" : binding.idname + "-json"));
+            }
+        });
+        REQUIRE(seen == std::vector<std::string>{"a", "b", "lazy", "main"});
+
+        // get_dependency_bindings still supplies the JSON.
+        REQUIRE(reader.get_dependency_bindings("main").front().value == "a-json");
+
+        std::string lazy_bytecode;
+        REQUIRE(reader.visit_bytecode("lazy", [&](std::string_view bytecode) { lazy_bytecode = bytecode; }));
+        REQUIRE(lazy_bytecode == std::string("NB\x01\x01", 4));
+        REQUIRE_FALSE(reader.visit_bytecode("b", [](std::string_view) { FAIL("b has no bytecode"); }));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("BundleReader opens bundles read-only and immutable", "[bundle_reader]") {
+    REQUIRE(BundleReader::make_uri("a/b.bundle") == "file:a/b.bundle?immutable=1");
+    REQUIRE(BundleReader::make_uri("/tmp/what?#%.bundle") == "file:///tmp/what%3F%23%25.bundle?immutable=1");
+    REQUIRE(BundleReader::make_uri("//host/b.bundle") == "file:////host/b.bundle?immutable=1");
+
+    // A directory name with URI metacharacters still opens.
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / fmt::format("nutmeg-test-{}-?#%", getpid());
+    std::filesystem::create_directories(dir);
+    std::string original = make_test_bundle(false);
+    std::string path = (dir / "test.bundle").string();
+    std::filesystem::rename(original, path);
+    {
+        BundleReader reader(path);
+        REQUIRE(reader.get_entry_points() == std::vector<std::string>{"main"});
+    }
+    std::filesystem::remove_all(dir);
+
+    REQUIRE_THROWS_AS(BundleReader((dir / "missing.bundle").string()), BundleReaderError);
+}
@@ -0,0 +1,113 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/bytecode.hpp"
+#include "../src/machine.hpp"
+#include "../src/bignum.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace nutmeg;
+
+static const char* const SAMPLE_JSON = R"({
+    "nlocals": 2,
+    "nparams": 1,
+    "instructions": [
+        {"type": "stack.length", "index": 1},
+        {"type": "push.string", "value": "Hello, world!"},
+        {"type": "push.string", "value": "Hello, world!"},
+        {"type": "push.int", "index": -9223372036854775808},
+        {"type": "push.int", "index": 18446744073709551615},
+        {"type": "push.int", "index": -3},
+        {"type": "push.global", "value": "x"},
+        {"type": "call.global.counted", "index": 1, "name": "f"},
+        {"type": "syscall.counted", "index": 1, "name": "println", "nargs": 1},
+        {"type": "return"}
+    ],
+    "handlers": [
+        {"start": 7, "end": 8, "target": 9, "index": 0},
+        {"start": 1, "end": 2, "target": 9}
+    ]
+})";
+
+// Render a heap constant for comparison, since each load allocates its own copy.
+static std::string describe_constant(Machine& machine, Cell cell) {
+    if (is_bignum(machine.get_heap(), cell)) {
+        return bignum_to_string(machine.get_heap(), cell);
+    }
+    return machine.get_string(cell);
+}
+
+TEST_CASE("Bytecode decodes to the same code as the JSON", "[bytecode]") {
+    Machine machine;
+    std::string bytecode = encode_bytecode(SAMPLE_JSON);
+    FunctionObject decoded = machine.decode_function_object(bytecode);
+    FunctionObject parsed = machine.parse_function_object(SAMPLE_JSON);
+
+    REQUIRE(decoded.nlocals == parsed.nlocals);
+    REQUIRE(decoded.nparams == parsed.nparams);
+    REQUIRE(decoded.tblock == parsed.tblock);
+    REQUIRE(decoded.code.size() == parsed.code.size());
+    for (size_t i = 0; i < decoded.code.size(); i++) {
+        bool is_constant = std::find(decoded.tblock.begin(), decoded.tblock.end(), i + 2) != decoded.tblock.end();
+        if (is_constant) {
+            REQUIRE(describe_constant(machine, decoded.code[i]) == describe_constant(machine, parsed.code[i]));
+        } else {
+            REQUIRE(decoded.code[i].u64 == parsed.code[i].u64);
+        }
+    }
+    REQUIRE(decoded.handlers.size() == parsed.handlers.size());
+    for (size_t i = 0; i < decoded.handlers.size(); i++) {
+        REQUIRE(decoded.handlers[i].start == parsed.handlers[i].start);
+        REQUIRE(decoded.handlers[i].end == parsed.handlers[i].end);
+        REQUIRE(decoded.handlers[i].target == parsed.handlers[i].target);
+        REQUIRE(decoded.handlers[i].stack_local == parsed.handlers[i].stack_local);
+    }
+}
+
+TEST_CASE("Bytecode stores each string once and is smaller than the JSON", "[bytecode]") {
+    std::string bytecode = encode_bytecode(SAMPLE_JSON);
+    std::string_view view(bytecode);
+    REQUIRE(view.find("Hello, world!") != std::string_view::npos);
+    REQUIRE(view.find("Hello, world!") == view.rfind("Hello, world!"));
+    REQUIRE(bytecode.size() * 4 < std::string(SAMPLE_JSON).size());
+}
+
+TEST_CASE("Bytecode decoder rejects malformed input", "[bytecode]") {
+    Machine machine;
+    std::string good = encode_bytecode(SAMPLE_JSON);
+    REQUIRE_NOTHROW(machine.decode_function_object(good));
+
+    // Every truncation is an error, as is trailing data.
+    for (size_t length = 0; length < good.size(); length++) {
+        INFO(length);
+        REQUIRE_THROWS_AS(machine.decode_function_object(std::string_view(good).substr(0, length)),
+                          std::runtime_error);
+    }
+    REQUIRE_THROWS_AS(machine.decode_function_object(good + '\0'), std::runtime_error);
+
+    std::string bad_magic = good;
+    bad_magic[0] = 'X';
+    REQUIRE_THROWS_AS(machine.decode_function_object(bad_magic), std::runtime_error);
+    std::string bad_version = good;
+    bad_version[2] = static_cast<char>(BYTECODE_VERSION + 1);
+    REQUIRE_THROWS_AS(machine.decode_function_object(bad_version), std::runtime_error);
+
+    // No strings, one instruction with an out-of-range opcode.
+    REQUIRE_THROWS_AS(machine.decode_function_object(std::string("NB\x01\x00\x00\x00\x01\x7f\x00", 9)),
+                      std::runtime_error);
+    // One instruction, PUSH_STRING, referring to a string that is not in the table.
+    std::string bad_ref = std::string("NB\x01\x00\x00\x00\x01", 7);
+    bad_ref += static_cast<char>(Opcode::PUSH_STRING);
+    bad_ref += std::string("\x05\x00", 2);
+    REQUIRE_THROWS_AS(machine.decode_function_object(bad_ref), std::runtime_error);
+}
+
+TEST_CASE("Bytecode encoder checks the schema", "[bytecode]") {
+    REQUIRE_THROWS_AS(encode_bytecode(R"({"nlocals": 0, "nparams": 0})"), std::runtime_error);
+    REQUIRE_THROWS_AS(encode_bytecode(R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "push.int"}]})"),
+                      std::runtime_error);
+    REQUIRE_THROWS_AS(encode_bytecode(R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "push.string"}]})"),
+                      std::runtime_error);
+    REQUIRE_THROWS_AS(encode_bytecode(R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "no.such.type"}]})"),
+                      std::runtime_error);
+}
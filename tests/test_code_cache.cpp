@@ -0,0 +1,143 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/code_cache.hpp"
+#include "../src/machine.hpp"
+#include "../src/bignum.hpp"
+#include "../src/background_loader.hpp"
+#include "test_support.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace nutmeg;
+using namespace nutmeg::test;
+
+namespace {
+
+// A scratch cache directory and a stand-in bundle file whose contents key the cache.
+struct CacheFixture {
+    ScratchPath dir{"cache-test"};
+    std::string bundle;
+
+    CacheFixture() {
+        std::filesystem::create_directories(dir.path);
+        bundle = (dir.path / "fake.bundle").string();
+        std::ofstream(bundle) << "bundle contents";
+    }
+};
+
+// Pushes a string constant and a bignum constant.
+const char* const CONSTANTS_JSON = R"({
+    "nlocals": 0,
+    "nparams": 0,
+    "instructions": [
+        {"type": "push.string", "value": "constant"},
+        {"type": "push.int", "index": 18446744073709551615},
+        {"type": "return"}
+    ]
+})";
+
+} // namespace
+
+TEST_CASE("Code cache round-trips compiled functions between machines", "[code_cache]") {
+    CacheFixture fixture;
+
+    {
+        Machine machine;
+        CodeCache cache(fixture.dir.string(), fixture.bundle);
+        REQUIRE_FALSE(cache.lookup(machine, "main").has_value());
+        cache.add(machine, "callee", machine.parse_function_object(CALLEE_JSON));
+        cache.add(machine, "main", machine.parse_function_object(MAIN_JSON));
+        REQUIRE(cache.is_dirty());
+        cache.save();
+    }
+
+    Machine machine;
+    CodeCache cache(fixture.dir.string(), fixture.bundle);
+    REQUIRE_FALSE(cache.is_dirty());
+    std::optional<FunctionObject> callee = cache.lookup(machine, "callee");
+    std::optional<FunctionObject> main = cache.lookup(machine, "main");
+    REQUIRE(callee.has_value());
+    REQUIRE(main.has_value());
+
+    // The relocated code is what the loader would have produced in this machine.
+    Machine reference_machine;
+    FunctionObject reference = reference_machine.parse_function_object(MAIN_JSON);
+    REQUIRE(main->code.size() == reference.code.size());
+    REQUIRE(main->tblock == reference.tblock);
+    REQUIRE(main->handlers.size() == 1);
+
+    machine.define_global("callee", make_tagged_ptr(machine.allocate_function(*callee)));
+    machine.define_global("answer", make_tagged_int(40));
+    machine.execute(machine.allocate_function(*main));
+    require_main_result(machine);
+}
+
+TEST_CASE("Code cache is keyed by bundle contents", "[code_cache]") {
+    CacheFixture fixture;
+    {
+        Machine machine;
+        CodeCache cache(fixture.dir.string(), fixture.bundle);
+        cache.add(machine, "callee", machine.parse_function_object(CALLEE_JSON));
+        cache.save();
+    }
+
+    std::ofstream(fixture.bundle, std::ios::app) << " changed";
+    Machine machine;
+    CodeCache cache(fixture.dir.string(), fixture.bundle);
+    REQUIRE_FALSE(cache.lookup(machine, "callee").has_value());
+}
+
+TEST_CASE("Code cache ignores a corrupt cache file", "[code_cache]") {
+    CacheFixture fixture;
+    std::string path;
+    {
+        Machine machine;
+        CodeCache cache(fixture.dir.string(), fixture.bundle);
+        cache.add(machine, "callee", machine.parse_function_object(CALLEE_JSON));
+        cache.save();
+        path = cache.path();
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+
+    Machine machine;
+    CodeCache cache(fixture.dir.string(), fixture.bundle);
+    REQUIRE_FALSE(cache.lookup(machine, "callee").has_value());
+}
+
+TEST_CASE("Code cache relocates constants while bindings compile in the background", "[code_cache]") {
+    CacheFixture fixture;
+    {
+        Machine machine;
+        CodeCache cache(fixture.dir.string(), fixture.bundle);
+        cache.add(machine, "constants", machine.parse_function_object(CONSTANTS_JSON));
+        cache.save();
+    }
+
+    // As with --pipeline, lazy bindings are looked up in the cache on this thread
+    // while the workers plant the same constants in the permanent space.
+    Machine machine;
+    CodeCache cache(fixture.dir.string(), fixture.bundle);
+    const int num_bindings = 50;
+    BackgroundLoader loader(2);
+    for (int i = 0; i < num_bindings; i++) {
+        loader.add("f" + std::to_string(i), [&machine]() { return machine.parse_function_object(CONSTANTS_JSON); });
+    }
+    loader.start();
+    std::vector<FunctionObject> funcs;
+    for (int i = 0; i < num_bindings; i++) {
+        std::optional<FunctionObject> func = cache.lookup(machine, "constants");
+        REQUIRE(func.has_value());
+        funcs.push_back(std::move(*func));
+    }
+    for (int i = 0; i < num_bindings; i++) {
+        funcs.push_back(loader.take("f" + std::to_string(i)));
+    }
+
+    for (const FunctionObject& func : funcs) {
+        machine.execute(machine.allocate_function(func));
+        REQUIRE(machine.stack_size() == 2);
+        REQUIRE(bignum_to_string(machine.get_heap(), machine.pop()) == "18446744073709551615");
+        REQUIRE(std::string(machine.get_string(machine.pop())) == "constant");
+    }
+}
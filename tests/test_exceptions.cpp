@@ -0,0 +1,93 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/machine.hpp"
+#include "../src/value.hpp"
+
+using namespace nutmeg;
+
+// Compile a JSON function object and bind it to a global.
+static Cell* define_function(Machine& machine, const std::string& name, const std::string& json) {
+    FunctionObject func = machine.parse_function_object(json);
+    Cell* func_obj = machine.allocate_function(func.code, func.nlocals, func.nparams, func.handlers);
+    machine.define_global(name, make_tagged_ptr(func_obj));
+    return func_obj;
+}
+
+TEST_CASE("Exceptions unwind to a handler in a calling function", "[exceptions]") {
+    Machine machine;
+
+    define_function(machine, "thrower", R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.int", "index": 99},
+            {"type": "push.string", "value": "boom"},
+            {"type": "throw"},
+            {"type": "return"}
+        ]
+    })");
+
+    // The handler covers the call and restores the stack length saved in local 0,
+    // which discards the 99 left behind by the thrower.
+    Cell* main_obj = define_function(machine, "main", R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "call.global.counted", "index": 0, "name": "thrower"},
+            {"type": "push.int", "index": 1},
+            {"type": "return"},
+            {"type": "push.int", "index": 2},
+            {"type": "return"}
+        ],
+        "handlers": [
+            {"start": 1, "end": 2, "target": 4, "index": 0}
+        ]
+    })");
+
+    machine.execute(main_obj);
+
+    REQUIRE(machine.stack_size() == 2);
+    REQUIRE(as_detagged_int(machine.pop()) == 2);
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "boom");
+}
+
+TEST_CASE("Uncaught exceptions escape from execute", "[exceptions]") {
+    Machine machine;
+
+    Cell* func_obj = define_function(machine, "main", R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.string", "value": "unhandled"},
+            {"type": "throw"},
+            {"type": "return"}
+        ]
+    })");
+
+    REQUIRE_THROWS_AS(machine.execute(func_obj), NutmegException);
+}
+
+TEST_CASE("Runtime failures are raised as Nutmeg exceptions", "[exceptions]") {
+    Machine machine;
+
+    // Calling a global that is not a function fails inside the handler; the
+    // failure is caught and its message is pushed.
+    Cell* func_obj = define_function(machine, "main", R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "call.global.counted", "index": 0, "name": "missing"},
+            {"type": "return"},
+            {"type": "return"}
+        ],
+        "handlers": [
+            {"start": 0, "end": 3, "target": 3}
+        ]
+    })");
+
+    machine.execute(func_obj);
+
+    REQUIRE(machine.stack_size() == 1);
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "Cell is not a pointer");
+}
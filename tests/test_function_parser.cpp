@@ -0,0 +1,133 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/function_parser.hpp"
+#include "../src/machine.hpp"
+#include "../src/bignum.hpp"
+#include "../src/thread_pool.hpp"
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+// Render a heap constant for comparison, since the two parsers allocate their own copies.
+static std::string describe_constant(Machine& machine, Cell cell) {
+    if (is_bignum(machine.get_heap(), cell)) {
+        return bignum_to_string(machine.get_heap(), cell);
+    }
+    return machine.get_string(cell);
+}
+
+// Check that the streaming parser and the DOM parser compile json identically.
+static void require_same_code(const std::string& json) {
+    Machine machine;
+    FunctionObject streamed = machine.parse_function_object(json);
+    FunctionObject reference = machine.parse_function_object_dom(json);
+
+    REQUIRE(streamed.nlocals == reference.nlocals);
+    REQUIRE(streamed.nparams == reference.nparams);
+    REQUIRE(streamed.tblock == reference.tblock);
+    REQUIRE(streamed.code.size() == reference.code.size());
+    for (size_t i = 0; i < streamed.code.size(); i++) {
+        bool is_constant = std::find(streamed.tblock.begin(), streamed.tblock.end(), i + 2) != streamed.tblock.end();
+        if (is_constant) {
+            REQUIRE(describe_constant(machine, streamed.code[i]) == describe_constant(machine, reference.code[i]));
+        } else {
+            REQUIRE(streamed.code[i].u64 == reference.code[i].u64);
+        }
+    }
+    REQUIRE(streamed.handlers.size() == reference.handlers.size());
+    for (size_t i = 0; i < streamed.handlers.size(); i++) {
+        REQUIRE(streamed.handlers[i].start == reference.handlers[i].start);
+        REQUIRE(streamed.handlers[i].end == reference.handlers[i].end);
+        REQUIRE(streamed.handlers[i].target == reference.handlers[i].target);
+        REQUIRE(streamed.handlers[i].stack_local == reference.handlers[i].stack_local);
+    }
+}
+
+TEST_CASE("Streaming parser matches the DOM parser", "[function_parser]") {
+    require_same_code(R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "push.string", "value": "Hello, world!"},
+            {"type": "push.int", "index": -9223372036854775808},
+            {"type": "push.int", "index": 18446744073709551615},
+            {"type": "push.global", "value": "x"},
+            {"type": "call.global.counted", "index": 0, "name": "f"},
+            {"type": "syscall.counted", "index": 0, "name": "println"},
+            {"type": "return"}
+        ],
+        "handlers": [
+            {"start": 5, "end": 6, "target": 7, "index": 0}
+        ]
+    })");
+}
+
+TEST_CASE("Streaming parser accepts keys in any order and skips unknown keys", "[function_parser]") {
+    require_same_code(R"({"instructions": [{"index": 3, "nargs": [1, {"a": null}], "type": "push.int"},
+        {"name": "println", "index": 0, "type": "SyscallCounted"}], "comment": {"x": [true, false, 1.5e3]},
+        "nparams": 0, "nlocals": 1})");
+}
+
+TEST_CASE("Streaming parser decodes string escapes", "[function_parser]") {
+    Machine machine;
+    FunctionObject func = machine.parse_function_object(R"({
+        "nlocals": 0, "nparams": 0,
+        "instructions": [{"type": "push.string", "value": "a\"b\\c\né😀"}]
+    })");
+    REQUIRE(std::string(machine.get_string(func.code[1])) == "a\"b\\c\n\xC3\xA9\xF0\x9F\x98\x80");
+}
+
+TEST_CASE("Streaming parser rejects malformed function objects", "[function_parser]") {
+    Machine machine;
+    const char* const bad[] = {
+        R"({"nlocals": 0, "nparams": 0})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [{"index": 1}]})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "push.int", "index": 1.5}]})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [],})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": []} extra)",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "push.string", "value": "unterminated}]})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "no.such.type"}]})",
+        R"({"nlocals": 0, "nparams": 0, "instructions": [], "handlers": [{"start": 0, "end": 9, "target": 0}]})",
+    };
+    for (const char* json : bad) {
+        INFO(json);
+        REQUIRE_THROWS_AS(machine.parse_function_object(json), std::runtime_error);
+    }
+}
+
+TEST_CASE("Function objects can be compiled on several threads at once", "[function_parser]") {
+    Machine machine;
+    std::vector<std::string> bundle;
+    for (int i = 0; i < 64; i++) {
+        bundle.push_back(fmt::format(R"({{"nlocals": 1, "nparams": 0, "instructions": [
+            {{"type": "push.string", "value": "s{0}"}},
+            {{"type": "push.int", "index": 18446744073709551615}},
+            {{"type": "push.global", "value": "new{0}"}},
+            {{"type": "call.global.counted", "index": 0, "name": "shared"}},
+            {{"type": "return"}}]}})", i));
+    }
+
+    ThreadPool pool(4);
+    std::vector<std::future<FunctionObject>> compiled;
+    for (const std::string& json : bundle) {
+        compiled.push_back(pool.submit([&machine, &json]() { return machine.parse_function_object(json); }));
+    }
+    Ident* shared = nullptr;
+    for (int i = 0; i < 64; i++) {
+        FunctionObject func = compiled[i].get();
+        REQUIRE(std::string(machine.get_string(func.code[1])) == fmt::format("s{}", i));
+        REQUIRE(bignum_to_string(machine.get_heap(), func.code[3]) == "18446744073709551615");
+        REQUIRE(func.code[5].ptr == machine.lookup_ident(fmt::format("new{}", i)));
+        // Every function refers to the same Ident, whichever thread declared it.
+        if (shared == nullptr) {
+            shared = static_cast<Ident*>(func.code[8].ptr);
+        }
+        REQUIRE(func.code[8].ptr == shared);
+    }
+    REQUIRE(shared == machine.lookup_ident("shared"));
+}
@@ -0,0 +1,461 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/machine.hpp"
+#include "../src/bignum.hpp"
+#include "../src/evacuator.hpp"
+#include "../src/thread_pool.hpp"
+#include <new>
+#include <string>
+
+using namespace nutmeg;
+
+namespace {
+
+const char* const ADD_JSON = R"({
+    "nlocals": 1,
+    "nparams": 0,
+    "instructions": [
+        {"type": "stack.length", "index": 0},
+        {"type": "push.string", "value": "constant"},
+        {"type": "syscall.counted", "index": 0, "name": "+"},
+        {"type": "return"}
+    ]
+})";
+
+const char* const INCREMENT_JSON = R"({
+    "nlocals": 1,
+    "nparams": 0,
+    "instructions": [
+        {"type": "stack.length", "index": 0},
+        {"type": "push.global", "value": "big"},
+        {"type": "push.int", "index": 1},
+        {"type": "syscall.counted", "index": 0, "name": "+"},
+        {"type": "return"}
+    ]
+})";
+
+// A string long enough that a few thousand of them fill a semispace.
+std::string filler(int i) {
+    return std::string(200, 'x') + std::to_string(i);
+}
+
+} // namespace
+
+TEST_CASE("Collection copies reachable objects and reclaims the rest", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    for (int i = 0; i < 100; i++) {
+        machine.allocate_string(filler(i));
+    }
+    Cell kept = machine.allocate_string("kept");
+    machine.push(kept);
+    machine.define_global("big", make_integer(heap, BigInt::from_uint64(UINT64_MAX)));
+    size_t bytes_before = heap.get_collected_bytes();
+
+    heap.collect();
+
+    // A string of 5 bytes takes 3 cells and the one-limb bignum 4.
+    REQUIRE(heap.get_gc_stats().collections == 1);
+    REQUIRE(heap.get_collected_bytes() == 7 * sizeof(Cell));
+    REQUIRE(heap.get_gc_stats().bytes_copied == 7 * sizeof(Cell));
+    REQUIRE(heap.get_gc_stats().bytes_reclaimed == bytes_before - 7 * sizeof(Cell));
+    Cell moved = machine.peek();
+    REQUIRE(moved.u64 != kept.u64);
+    REQUIRE(heap.in_collected_space(as_detagged_ptr(moved)));
+    REQUIRE(std::string(machine.get_string(moved)) == "kept");
+    REQUIRE(bignum_to_string(heap, machine.lookup_global("big")) == "18446744073709551615");
+}
+
+TEST_CASE("Allocation collects when the collected space is full", "[gc]") {
+    HeapOptions options;
+    options.max_bytes = 4 << 20;
+    Machine machine(options);
+    machine.push(machine.allocate_string("survivor"));
+    for (int i = 0; i < 20000; i++) {
+        machine.allocate_string(filler(i));
+    }
+    REQUIRE(machine.get_heap().get_gc_stats().collections > 0);
+    REQUIRE(std::string(machine.get_string(machine.peek())) == "survivor");
+
+    // Once the survivors alone reach the maximum, allocation fails.
+    REQUIRE_THROWS_AS([&]() {
+        for (int i = 0; i < 20000; i++) {
+            machine.push(machine.allocate_string(filler(i)));
+        }
+    }(), std::bad_alloc);
+}
+
+TEST_CASE("Function objects are scanned through their T-blocks", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+
+    // Compiled constants are permanent and never move.
+    Cell* compiled = machine.allocate_function(machine.parse_function_object(ADD_JSON));
+    Cell constant = heap.get_function_code(compiled)[3];
+    REQUIRE_FALSE(heap.in_collected_space(as_detagged_ptr(constant)));
+
+    // A pointer operand into the collected space is a root, updated in place.
+    std::vector<Cell> code(3);
+    code[0].label_addr = machine.get_opcode_label(Opcode::PUSH_STRING);
+    code[1] = machine.allocate_string("operand");
+    code[2].label_addr = machine.get_opcode_label(Opcode::HALT);
+    Cell* func = machine.allocate_function(code, 0, 0, {}, {3});
+    machine.allocate_string("garbage");
+
+    heap.collect();
+
+    REQUIRE(heap.get_function_code(compiled)[3].u64 == constant.u64);
+    Cell operand = heap.get_function_code(func)[1];
+    REQUIRE(operand.u64 != code[1].u64);
+    REQUIRE(std::string(machine.get_string(operand)) == "operand");
+    REQUIRE(heap.get_collected_bytes() == 3 * sizeof(Cell));
+}
+
+TEST_CASE("Execution continues with objects moved by a collection", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    Cell* increment = machine.allocate_function(machine.parse_function_object(INCREMENT_JSON));
+    machine.define_global("increment", make_tagged_ptr(increment));
+    machine.define_global("big", make_integer(heap, BigInt::from_uint64(UINT64_MAX)));
+    machine.allocate_string("garbage");
+    heap.collect();
+
+    machine.execute(machine.get_global_cell_ptr("increment"));
+    machine.allocate_string("garbage");
+    heap.collect();
+
+    REQUIRE(machine.stack_size() == 1);
+    REQUIRE(bignum_to_string(heap, machine.peek()) == "18446744073709551616");
+    REQUIRE(bignum_to_string(heap, machine.lookup_global("big")) == "18446744073709551615");
+}
+
+TEST_CASE("Minor collections promote the nursery's survivors", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    machine.push(machine.allocate_string("kept"));
+    machine.allocate_string("garbage");
+    REQUIRE(heap.in_nursery(as_detagged_ptr(machine.peek())));
+
+    heap.collect_nursery();
+    REQUIRE(heap.get_gc_stats().minor_collections == 1);
+    REQUIRE(heap.get_gc_stats().bytes_copied == 3 * sizeof(Cell));
+    REQUIRE_FALSE(heap.in_nursery(as_detagged_ptr(machine.peek())));
+    REQUIRE(heap.in_collected_space(as_detagged_ptr(machine.peek())));
+
+    // Old objects are not copied again by later minor collections.
+    machine.allocate_string("garbage");
+    heap.collect_nursery();
+    REQUIRE(heap.get_gc_stats().minor_collections == 2);
+    REQUIRE(heap.get_gc_stats().bytes_copied == 3 * sizeof(Cell));
+    REQUIRE(std::string(machine.get_string(machine.peek())) == "kept");
+}
+
+TEST_CASE("The write barrier makes permanent cells roots of minor collections", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    std::vector<Cell> code(3);
+    code[0].label_addr = machine.get_opcode_label(Opcode::PUSH_STRING);
+    code[1] = machine.allocate_string("operand");
+    code[2].label_addr = machine.get_opcode_label(Opcode::HALT);
+    Cell* func = machine.allocate_function(code, 0, 0, {}, {3});
+
+    heap.collect_nursery();
+    Cell operand = heap.get_function_code(func)[1];
+    REQUIRE(heap.in_collected_space(as_detagged_ptr(operand)));
+    REQUIRE_FALSE(heap.in_nursery(as_detagged_ptr(operand)));
+    REQUIRE(std::string(machine.get_string(operand)) == "operand");
+}
+
+TEST_CASE("CardTable visits each marked cell once", "[gc]") {
+    Pool pool(1000);
+    pool.allocate(1000);
+    CardTable cards(pool);
+    cards.mark(pool.at(3));
+    cards.mark(pool.at(3));
+    cards.mark(pool.at(64));
+    cards.mark(pool.at(999));
+    std::vector<Cell*> visited;
+    cards.drain([&](Cell& cell) { visited.push_back(&cell); });
+    REQUIRE(visited == std::vector<Cell*>{pool.at(3), pool.at(64), pool.at(999)});
+    visited.clear();
+    cards.drain([&](Cell& cell) { visited.push_back(&cell); });
+    REQUIRE(visited.empty());
+}
+
+TEST_CASE("Function objects count against the maximum heap size", "[gc]") {
+    HeapOptions options;
+    options.max_bytes = 1 << 20;
+    Heap heap(options);
+    heap.allocate_function(1000, 0, 0);
+    REQUIRE_THROWS_AS(heap.allocate_function(options.max_bytes / sizeof(Cell), 0, 0), std::bad_alloc);
+}
+
+TEST_CASE("The old space grows past its initial limit", "[gc]") {
+    Machine machine;
+    for (int i = 0; i < 20000; i++) {
+        machine.push(machine.allocate_string(filler(i)));
+    }
+    REQUIRE(machine.get_heap().get_collected_bytes() > 4 << 20);
+    REQUIRE(std::string(machine.get_string(machine.peek_at(0))) == filler(0));
+    REQUIRE(std::string(machine.get_string(machine.peek())) == filler(19999));
+}
+
+TEST_CASE("Pools commit memory as they are used", "[gc]") {
+    Pool pool(1 << 20);
+    REQUIRE(pool.committed_bytes() == 0);
+    Cell* first = pool.allocate(10);
+    REQUIRE(first[9].u64 == 0);
+    size_t granule = pool.committed_bytes();
+    REQUIRE(granule > 0);
+    pool.allocate(granule / sizeof(Cell));
+    REQUIRE(pool.committed_bytes() == 2 * granule);
+
+    first[0].u64 = 42;
+    pool.release();
+    REQUIRE(pool.committed_bytes() == 0);
+    REQUIRE(pool.allocate(1)[0].u64 == 0);
+
+    REQUIRE_THROWS_AS(pool.allocate(1 << 20), std::bad_alloc);
+    Pool huge(1000, true);
+    REQUIRE(huge.allocate(1000) == huge.start());
+    REQUIRE(reinterpret_cast<uintptr_t>(huge.start()) % (2 << 20) == 0);
+}
+
+TEST_CASE("Records and vectors are copied with their graph intact", "[gc]") {
+    for (unsigned gc_threads : {1u, 4u}) {
+        HeapOptions options;
+        options.gc_threads = gc_threads;
+        Machine machine(options);
+        Heap& heap = machine.get_heap();
+        Cell* pair = heap.allocate_record_datakey(2);
+
+        // A list of 1000 pairs, each holding its index and a shared vector that
+        // refers back to the head of the list.
+        Cell* shared = heap.allocate_vector(3);
+        Cell list = make_nil();
+        for (int i = 999; i >= 0; i--) {
+            Cell* node = heap.allocate_record(pair);
+            heap.set_field(node, 0, make_tagged_int(i));
+            heap.set_field(node, 1, list);
+            list = make_tagged_ptr(node);
+            machine.allocate_string("garbage");
+        }
+        heap.set_field(shared, 0, list);
+        heap.set_field(shared, 1, machine.allocate_string("shared"));
+        machine.push(make_tagged_ptr(shared));
+
+        heap.collect();
+
+        Cell* moved = static_cast<Cell*>(as_detagged_ptr(machine.peek()));
+        REQUIRE(moved != shared);
+        REQUIRE(heap.get_num_fields(moved) == 3);
+        REQUIRE(std::string(machine.get_string(heap.get_field(moved, 1))) == "shared");
+        REQUIRE(is_nil(heap.get_field(moved, 2)));
+        int count = 0;
+        for (Cell node = heap.get_field(moved, 0); !is_nil(node); count++) {
+            Cell* node_ptr = static_cast<Cell*>(as_detagged_ptr(node));
+            REQUIRE(node_ptr[0].ptr == pair);
+            REQUIRE(as_detagged_int(heap.get_field(node_ptr, 0)) == count);
+            node = heap.get_field(node_ptr, 1);
+        }
+        REQUIRE(count == 1000);
+        REQUIRE(heap.get_gc_stats().bytes_copied == (5 + 1000 * 4 + 3) * sizeof(Cell));
+    }
+}
+
+TEST_CASE("The write barrier makes old fields roots of minor collections", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    machine.push(make_tagged_ptr(heap.allocate_vector(1)));
+    heap.collect_nursery();
+    Cell* old = static_cast<Cell*>(as_detagged_ptr(machine.peek()));
+    REQUIRE_FALSE(heap.in_nursery(old));
+
+    heap.set_field(old, 0, machine.allocate_string("young"));
+    heap.collect_nursery();
+    Cell young = heap.get_field(old, 0);
+    REQUIRE_FALSE(heap.in_nursery(as_detagged_ptr(young)));
+    REQUIRE(std::string(machine.get_string(young)) == "young");
+}
+
+TEST_CASE("Incremental collection keeps a graph the program is changing intact", "[gc]") {
+    // Compressed references change how the replicas' fields are forwarded.
+    for (bool compressed_references : {false, true}) {
+        HeapOptions options;
+        options.pause_target_ms = 0.01;
+        options.compressed_references = compressed_references;
+        Machine machine(options);
+        Heap& heap = machine.get_heap();
+        Cell* pair = heap.allocate_record_datakey(2);
+        auto elements = [&]() { return static_cast<Cell*>(as_detagged_ptr(machine.peek())); };
+        auto element = [&](size_t i) { return static_cast<Cell*>(as_detagged_ptr(heap.get_field(elements(), i))); };
+
+        // A vector of records, each holding its original index and a string (by
+        // original index in strings).
+        const size_t count = 20000;
+        machine.push(make_tagged_ptr(heap.allocate_vector(count)));
+        for (size_t i = 0; i < count; i++) {
+            Cell* record = heap.allocate_record(pair);
+            heap.set_field(record, 0, make_tagged_int(static_cast<int64_t>(i)));
+            heap.set_field(elements(), i, make_tagged_ptr(record));
+        }
+
+        // Swap elements and replace strings while cycles run, until two have finished.
+        std::vector<size_t> expected(count);
+        for (size_t i = 0; i < count; i++) {
+            expected[i] = i;
+        }
+        std::vector<std::string> strings(count);
+        for (size_t iteration = 0; heap.get_gc_stats().incremental_cycles < 2 && iteration < 2000000; iteration++) {
+            size_t j = iteration * 7919 % count;
+            size_t k = (j + 1) % count;
+            Cell first = heap.get_field(elements(), j);
+            heap.set_field(elements(), j, heap.get_field(elements(), k));
+            heap.set_field(elements(), k, first);
+            std::swap(expected[j], expected[k]);
+
+            strings[expected[j]] = filler(static_cast<int>(iteration));
+            Cell string = machine.allocate_string(strings[expected[j]]);
+            heap.set_field(element(j), 1, string);
+        }
+
+        REQUIRE(heap.get_gc_stats().incremental_cycles == 2);
+        uint64_t pauses = 0;
+        for (uint64_t bucket_count : heap.get_gc_stats().pause_histogram) {
+            pauses += bucket_count;
+        }
+        REQUIRE(pauses == heap.get_gc_stats().collections);
+        heap.collect();
+        for (size_t i = 0; i < count; i++) {
+            REQUIRE(static_cast<size_t>(as_detagged_int(heap.get_field(element(i), 0))) == expected[i]);
+            if (!strings[expected[i]].empty()) {
+                REQUIRE(std::string(machine.get_string(heap.get_field(element(i), 1))) == strings[expected[i]]);
+            }
+        }
+    }
+}
+
+TEST_CASE("A minor collection that leaves holes reclaims only the garbage", "[gc]") {
+    HeapOptions options;
+    options.gc_threads = 4;
+    Machine machine(options);
+    Heap& heap = machine.get_heap();
+
+    // Almost all of the nursery survives, in more objects than one thread's
+    // allocation buffer holds.
+    const size_t count = 5000;
+    Cell* strings = heap.allocate_vector(count);
+    for (size_t i = 0; i < count; i++) {
+        heap.set_field(strings, i, machine.allocate_string("live"));
+    }
+    machine.push(make_tagged_ptr(strings));
+    machine.allocate_string("garbage");
+    size_t bytes_before = heap.get_collected_bytes();
+
+    heap.collect_nursery();
+
+    const GcStats& stats = heap.get_gc_stats();
+    REQUIRE(stats.minor_collections == 1);
+    REQUIRE(stats.bytes_copied == (2 + count + count * 3) * sizeof(Cell));
+    REQUIRE(stats.bytes_reclaimed == bytes_before - stats.bytes_copied);
+    REQUIRE(stats.bytes_reclaimed == 3 * sizeof(Cell));
+}
+
+TEST_CASE("Evacuation reports a failure on any thread once every thread has stopped", "[gc]") {
+    for (unsigned num_helpers : {0u, 3u}) {
+        Machine machine;
+        Heap& heap = machine.get_heap();
+        std::vector<Cell> values;
+        for (int i = 0; i < 500; i++) {
+            values.push_back(machine.allocate_string(filler(i)));
+        }
+        std::vector<Cell*> roots;
+        for (Cell& value : values) {
+            roots.push_back(&value);
+        }
+
+        // The target is too small for the survivors, so some thread cannot copy.
+        Pool target(1000);
+        ThreadPool helpers(num_helpers);
+        Evacuator evacuator(heap, *heap.get_nursery(), nullptr, target);
+        REQUIRE_THROWS_AS(evacuator.run(roots, {}, num_helpers != 0 ? &helpers : nullptr), std::bad_alloc);
+    }
+}
+
+TEST_CASE("Compressed references halve fields and keep every value across collections", "[gc]") {
+    for (unsigned gc_threads : {1u, 4u}) {
+        HeapOptions options;
+        options.gc_threads = gc_threads;
+        options.compressed_references = true;
+        Machine machine(options);
+        Heap& heap = machine.get_heap();
+        REQUIRE(heap.has_compressed_references());
+        auto vector = [&]() { return static_cast<Cell*>(as_detagged_ptr(machine.peek())); };
+
+        // Five fields take three cells, the last one half padding.
+        size_t bytes_before = heap.get_collected_bytes();
+        machine.push(make_tagged_ptr(heap.allocate_vector(5)));
+        REQUIRE(heap.get_collected_bytes() - bytes_before == (2 + 3) * sizeof(Cell));
+        heap.set_field(vector(), 0, make_tagged_int(-7));
+        heap.set_field(vector(), 1, make_tagged_int(INT64_C(1) << 40));
+        heap.set_field(vector(), 2, make_tagged_float(2.5));
+        heap.set_field(vector(), 3, make_bool(true));
+        heap.collect_nursery();
+        REQUIRE_FALSE(heap.in_nursery(vector()));
+
+        // Stores of young objects into the old vector are remembered, a slot at a time.
+        heap.set_field(vector(), 4, machine.allocate_string("young"));
+        heap.set_field(vector(), 2, make_tagged_float(-0.5));
+        heap.collect_nursery();
+        heap.collect();
+
+        REQUIRE(as_detagged_int(heap.get_field(vector(), 0)) == -7);
+        REQUIRE(as_detagged_int(heap.get_field(vector(), 1)) == INT64_C(1) << 40);
+        REQUIRE(as_detagged_float(heap.get_field(vector(), 2)) == -0.5);
+        REQUIRE(as_bool(heap.get_field(vector(), 3)));
+        REQUIRE(std::string(machine.get_string(heap.get_field(vector(), 4))) == "young");
+        // The large integer and the float are boxed, and the boxes copied with the
+        // vector (with several threads, copies leave holes).
+        if (gc_threads == 1) {
+            REQUIRE(heap.get_collected_bytes() == (5 + 3 + 3 + 3) * sizeof(Cell));
+        }
+    }
+}
+
+TEST_CASE("Heap statistics count allocations by datakey and track high-water marks", "[gc]") {
+    Machine machine;
+    Heap& heap = machine.get_heap();
+    heap.set_allocation_tracking(true);
+    machine.set_stack_depth_tracking(true);
+    Cell* pair = heap.allocate_record_datakey(2);
+    machine.push(machine.allocate_string("kept"));
+    machine.allocate_string("garbage");
+    heap.allocate_record(pair);
+    heap.allocate_vector(5);
+    heap.collect_nursery();
+
+    HeapStats stats = heap.get_heap_stats();
+    auto find = [&](const std::string& kind) {
+        for (const auto& [name, allocations] : stats.allocations) {
+            if (name == kind) {
+                return allocations;
+            }
+        }
+        return AllocationStats{};
+    };
+    REQUIRE(find("string").objects == 2);
+    REQUIRE(find("string").bytes == 6 * sizeof(Cell));
+    REQUIRE(find("record/2").objects == 1);
+    REQUIRE(find("record/2").bytes == 4 * sizeof(Cell));
+    REQUIRE(find("vector").bytes == 7 * sizeof(Cell));
+    REQUIRE(find("datakey").objects == 1);
+    REQUIRE(stats.allocations.front().first == "vector");
+    REQUIRE(stats.nursery_bytes == 0);
+    REQUIRE(stats.nursery_high_water_bytes == 17 * sizeof(Cell));
+    REQUIRE(stats.old_bytes == 3 * sizeof(Cell));
+    REQUIRE(stats.committed_bytes > 0);
+
+    machine.push(make_tagged_int(1));
+    machine.pop();
+    machine.pop();
+    REQUIRE(machine.get_max_operand_depth() == 2);
+}
@@ -0,0 +1,99 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/heap_dump.hpp"
+#include "../src/machine.hpp"
+#include "test_support.hpp"
+#include <filesystem>
+#include <fstream>
+
+using namespace nutmeg;
+using namespace nutmeg::test;
+
+namespace {
+
+Cell string_value(Heap& heap, const std::string& text) {
+    return make_tagged_ptr(heap.allocate_string(text.c_str(), text.size() + 1));
+}
+
+// Dump a machine with three globals: shared, a string; tree, a vector of two
+// copies of "dup" and shared; and alone, another copy of "dup".
+void write_test_dump(const std::string& path, const HeapOptions& options = {}) {
+    Machine machine(options);
+    Heap& heap = machine.get_heap();
+    Cell shared = string_value(heap, "hello");
+    Cell* tree = heap.allocate_vector(3);
+    heap.set_field(tree, 0, string_value(heap, "dup"));
+    heap.set_field(tree, 1, string_value(heap, "dup"));
+    heap.set_field(tree, 2, shared);
+    machine.define_global("shared", shared);
+    machine.define_global("tree", make_tagged_ptr(tree));
+    machine.define_global("alone", string_value(heap, "dup"));
+    write_heap_dump(machine, path);
+}
+
+} // namespace
+
+TEST_CASE("Heap dumps report retained sizes, largest objects and duplicate strings", "[heap_dump]") {
+    ScratchPath dump_file("heap-dump-test");
+    write_test_dump(dump_file.string());
+    HeapDump dump(dump_file.string());
+
+    REQUIRE(dump.get_spaces().size() == 4);
+    REQUIRE(dump.get_objects().size() == 5);
+
+    // A vector of three is five cells, and a string of up to seven characters three.
+    std::vector<HeapDump::Retained> retained = dump.retained_by_root();
+    auto find_root = [&](const std::string& name) {
+        for (const HeapDump::Retained& root : retained) {
+            if (root.root == name) {
+                return root;
+            }
+        }
+        FAIL("No root named " << name);
+        return HeapDump::Retained{};
+    };
+    REQUIRE(retained.front().root == "tree");
+    CHECK(find_root("tree").objects == 3);
+    CHECK(find_root("tree").bytes == 40 + 2 * 24);
+    // Both shared and tree reach the shared string, so neither alone retains it.
+    CHECK(find_root("shared").objects == 0);
+    CHECK(find_root("shared").bytes == 0);
+    CHECK(find_root("alone").bytes == 24);
+
+    std::vector<HeapDump::Object> largest = dump.largest_objects(2);
+    REQUIRE(largest.size() == 2);
+    CHECK(largest[0].kind == "vector");
+    CHECK(largest[0].bytes == 40);
+    CHECK(largest[1].kind == "string");
+
+    std::vector<HeapDump::DuplicateString> duplicates = dump.duplicate_strings();
+    REQUIRE(duplicates.size() == 1);
+    CHECK(duplicates[0].value == "dup");
+    CHECK(duplicates[0].count == 3);
+    CHECK(duplicates[0].wasted_bytes() == 48);
+}
+
+TEST_CASE("Heap dumps follow compressed references", "[heap_dump]") {
+    ScratchPath dump_file("heap-dump-test");
+    HeapOptions options;
+    options.compressed_references = true;
+    write_test_dump(dump_file.string(), options);
+    HeapDump dump(dump_file.string());
+
+    // The vector's three fields now take two cells.
+    std::vector<HeapDump::Object> largest = dump.largest_objects(1);
+    REQUIRE(largest.size() == 1);
+    CHECK(largest[0].kind == "vector");
+    CHECK(largest[0].bytes == 32);
+    REQUIRE(dump.retained_by_root().front().root == "tree");
+    CHECK(dump.retained_by_root().front().bytes == 32 + 2 * 24);
+}
+
+TEST_CASE("Heap dumps reject truncated files", "[heap_dump]") {
+    ScratchPath dump_file("heap-dump-test");
+    write_test_dump(dump_file.string());
+    std::filesystem::resize_file(dump_file.string(), std::filesystem::file_size(dump_file.string()) / 2);
+    REQUIRE_THROWS_AS(HeapDump(dump_file.string()), std::runtime_error);
+
+    std::ofstream(dump_file.string(), std::ios::binary | std::ios::trunc) << "not a heap dump";
+    REQUIRE_THROWS_AS(HeapDump(dump_file.string()), std::runtime_error);
+}
@@ -0,0 +1,55 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/image.hpp"
+#include "../src/machine.hpp"
+#include "test_support.hpp"
+#include <filesystem>
+
+using namespace nutmeg;
+using namespace nutmeg::test;
+
+namespace {
+
+// Save a machine holding callee, main, the number answer and a lazy stub.
+void save_test_image(const std::string& path) {
+    Machine machine;
+    machine.define_global("callee", make_tagged_ptr(machine.allocate_function(machine.parse_function_object(CALLEE_JSON))));
+    machine.define_global("main", make_tagged_ptr(machine.allocate_function(machine.parse_function_object(MAIN_JSON))));
+    machine.define_global("answer", make_tagged_int(40));
+    machine.define_global("later", make_tagged_ptr(machine.allocate_lazy_stub("later")));
+    save_image(machine, "main", path);
+}
+
+} // namespace
+
+TEST_CASE("Heap images restore a runnable machine", "[image]") {
+    ScratchPath image("image-test");
+    save_test_image(image.string());
+
+    Machine machine;
+    REQUIRE(load_image(machine, image.string()) == "main");
+    REQUIRE(as_detagged_int(machine.lookup_global("answer")) == 40);
+    Cell* stub = machine.get_global_cell_ptr("later");
+    REQUIRE(stub[0].ptr == machine.get_heap().get_function_datakey());
+    REQUIRE(machine.find_opcode(machine.get_heap().get_function_code(stub)[0].label_addr) == Opcode::LAZY);
+
+    machine.execute(machine.get_global_cell_ptr("main"));
+    require_main_result(machine);
+}
+
+TEST_CASE("Heap images only load into a fresh machine", "[image]") {
+    ScratchPath image("image-test");
+    save_test_image(image.string());
+
+    Machine machine;
+    machine.define_global("answer", make_tagged_int(1));
+    REQUIRE_THROWS_AS(load_image(machine, image.string()), std::runtime_error);
+}
+
+TEST_CASE("Heap images reject truncated files", "[image]") {
+    ScratchPath image("image-test");
+    save_test_image(image.string());
+    std::filesystem::resize_file(image.string(), std::filesystem::file_size(image.string()) - 8);
+
+    Machine machine;
+    REQUIRE_THROWS_AS(load_image(machine, image.string()), std::runtime_error);
+}
@@ -0,0 +1,99 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/machine.hpp"
+#include "../src/value.hpp"
+#include "../src/instruction.hpp"
+#include <stdexcept>
+
+using namespace nutmeg;
+
+TEST_CASE("Opcode descriptors map JSON names to opcodes", "[instruction]") {
+    REQUIRE(string_to_opcode("push.int") == Opcode::PUSH_INT);
+    REQUIRE(string_to_opcode("PushInt") == Opcode::PUSH_INT);
+    REQUIRE(string_to_opcode("syscall.counted") == Opcode::SYSCALL_COUNTED);
+    REQUIRE_THROWS_AS(string_to_opcode("no.such.instruction"), std::runtime_error);
+    REQUIRE(std::string(opcode_to_string(Opcode::CALL_GLOBAL_COUNTED)) == "CALL_GLOBAL_COUNTED");
+    REQUIRE(opcode_operand_count(Opcode::CALL_GLOBAL_COUNTED) == 2);
+    REQUIRE(opcode_operand_count(Opcode::RETURN) == 0);
+}
+
+TEST_CASE("Dispatch table is complete and labels are distinct", "[instruction]") {
+    Machine machine;
+    const DispatchTable& table = machine.get_opcode_map();
+    REQUIRE(table.is_complete());
+    for (size_t i = 0; i < NUM_OPCODES; i++) {
+        Opcode opcode = static_cast<Opcode>(i);
+        REQUIRE(table.find(table[opcode]) == opcode);
+    }
+}
+
+TEST_CASE("Tagged-pointer operands are recorded in the T-block", "[instruction]") {
+    Machine machine;
+    FunctionObject func = machine.parse_function_object(R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.int", "index": 1},
+            {"type": "push.string", "value": "a"},
+            {"type": "push.int", "index": 18446744073709551615},
+            {"type": "return"}
+        ]
+    })");
+
+    // Positions are relative to the datakey: code starts at 2, and the operands
+    // of the second and third instructions are at code offsets 3 and 5.
+    REQUIRE(func.tblock == std::vector<uint32_t>{5, 7});
+
+    Cell* func_obj = machine.allocate_function(func);
+    Heap& heap = machine.get_heap();
+    REQUIRE(heap.get_function_tblock_length(func_obj) == 2);
+    const uint32_t* tblock = heap.get_function_tblock(func_obj);
+    for (size_t i = 0; i < 2; i++) {
+        REQUIRE(is_tagged_ptr(func_obj[tblock[i]]));
+    }
+}
+
+TEST_CASE("PUSH_GLOBAL reports undefined globals by name", "[instruction]") {
+    Machine machine;
+    FunctionObject func = machine.parse_function_object(R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.global", "value": "later"},
+            {"type": "return"}
+        ]
+    })");
+    Cell* func_obj = machine.allocate_function(func);
+
+    try {
+        machine.execute(func_obj);
+        FAIL("Expected an undefined global error");
+    } catch (const std::runtime_error& e) {
+        REQUIRE(std::string(e.what()) == "Undefined global: later");
+    }
+
+    // Defining the global afterwards is seen by the already-compiled code.
+    Machine machine2;
+    FunctionObject func2 = machine2.parse_function_object(R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "push.global", "value": "later"},
+            {"type": "return"}
+        ]
+    })");
+    Cell* func_obj2 = machine2.allocate_function(func2);
+    machine2.define_global("later", make_tagged_int(7));
+    machine2.execute(func_obj2);
+    REQUIRE(as_detagged_int(machine2.pop()) == 7);
+}
+
+TEST_CASE("Operand fields are validated when planting", "[instruction]") {
+    Machine machine;
+    REQUIRE_THROWS_AS(machine.parse_function_object(R"({
+        "nlocals": 0,
+        "nparams": 0,
+        "instructions": [
+            {"type": "syscall.counted", "name": "println"}
+        ]
+    })"), std::runtime_error);
+}
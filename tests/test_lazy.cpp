@@ -0,0 +1,102 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/machine.hpp"
+#include "../src/value.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+using namespace nutmeg;
+
+// Takes two parameters (which the frame moves off the operand stack) and
+// pushes a marker.
+static const char* const ADD_JSON = R"({
+    "nlocals": 2,
+    "nparams": 2,
+    "instructions": [
+        {"type": "push.string", "value": "added"},
+        {"type": "return"}
+    ]
+})";
+
+// Calls add twice.
+static const char* const MAIN_JSON = R"({
+    "nlocals": 1,
+    "nparams": 0,
+    "instructions": [
+        {"type": "stack.length", "index": 0},
+        {"type": "push.int", "index": 1},
+        {"type": "push.int", "index": 2},
+        {"type": "call.global.counted", "index": 0, "name": "add"},
+        {"type": "stack.length", "index": 0},
+        {"type": "push.int", "index": 30},
+        {"type": "push.int", "index": 40},
+        {"type": "call.global.counted", "index": 0, "name": "add"},
+        {"type": "return"}
+    ]
+})";
+
+static Cell* compile(Machine& machine, const char* json) {
+    return machine.allocate_function(machine.parse_function_object(json));
+}
+
+TEST_CASE("Lazy stubs compile the binding on first call only", "[lazy]") {
+    Machine machine;
+    std::vector<std::string> loaded;
+    machine.set_lazy_loader([&](std::string_view name) {
+        loaded.emplace_back(name);
+        machine.define_global(std::string(name), make_tagged_ptr(compile(machine, ADD_JSON)));
+    });
+    machine.define_global("add", make_tagged_ptr(machine.allocate_lazy_stub("add")));
+
+    machine.execute(compile(machine, MAIN_JSON));
+
+    REQUIRE(loaded == std::vector<std::string>{"add"});
+    REQUIRE(machine.stack_size() == 2);
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "added");
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "added");
+}
+
+TEST_CASE("Lazy stubs report loaders that do not define the binding", "[lazy]") {
+    Machine machine;
+    machine.define_global("add", make_tagged_ptr(machine.allocate_lazy_stub("add")));
+    Cell* main_obj = compile(machine, MAIN_JSON);
+
+    REQUIRE_THROWS_AS(machine.execute(main_obj), std::runtime_error);
+
+    machine.set_lazy_loader([](std::string_view) {});
+    try {
+        machine.execute(main_obj);
+        FAIL("Expected the lazy load to fail");
+    } catch (const std::runtime_error& e) {
+        REQUIRE(std::string(e.what()) == "Lazy binding was not defined: add");
+    }
+}
+
+TEST_CASE("Failures while loading lazily can be handled by the caller", "[lazy]") {
+    Machine machine;
+    machine.set_lazy_loader([](std::string_view name) {
+        throw std::runtime_error(fmt::format("Cannot load {}", name));
+    });
+    machine.define_global("add", make_tagged_ptr(machine.allocate_lazy_stub("add")));
+
+    Cell* main_obj = compile(machine, R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "push.int", "index": 1},
+            {"type": "push.int", "index": 2},
+            {"type": "call.global.counted", "index": 0, "name": "add"},
+            {"type": "return"},
+            {"type": "return"}
+        ],
+        "handlers": [
+            {"start": 3, "end": 4, "target": 5, "index": 0}
+        ]
+    })");
+    machine.execute(main_obj);
+
+    REQUIRE(machine.stack_size() == 1);
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "Cannot load add");
+}
@@ -0,0 +1,54 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/startup_stats.hpp"
+#include "../src/machine.hpp"
+#include <chrono>
+#include <thread>
+
+using namespace nutmeg;
+
+TEST_CASE("PhaseTimer does nothing without stats", "[startup_stats]") {
+    PhaseTimer outer(nullptr, StartupPhase::Parse);
+    StartupStats stats;
+    {
+        PhaseTimer inner(&stats, StartupPhase::CodeGeneration);
+    }
+    // The untimed outer scope must not have become the inner timer's parent.
+    REQUIRE(stats.get_nanoseconds(StartupPhase::Parse) == 0);
+}
+
+TEST_CASE("PhaseTimer charges nested phases only their own time and allocations", "[startup_stats]") {
+    StartupStats stats;
+    {
+        PhaseTimer outer(&stats, StartupPhase::Parse);
+        count_allocation();
+        {
+            PhaseTimer inner(&stats, StartupPhase::CodeGeneration);
+            count_allocation();
+            count_allocation();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    REQUIRE(stats.get_nanoseconds(StartupPhase::CodeGeneration) >= 20'000'000);
+    REQUIRE(stats.get_nanoseconds(StartupPhase::Parse) < stats.get_nanoseconds(StartupPhase::CodeGeneration));
+    REQUIRE(stats.get_allocations(StartupPhase::Parse) == 1);
+    REQUIRE(stats.get_allocations(StartupPhase::CodeGeneration) == 2);
+    REQUIRE(stats.get_nanoseconds(StartupPhase::HeapAllocation) == 0);
+}
+
+TEST_CASE("Machine charges compilation to the startup phases", "[startup_stats]") {
+    StartupStats stats;
+    Machine machine;
+    machine.set_startup_stats(&stats);
+    FunctionObject func = machine.parse_function_object(
+        R"({"nlocals": 0, "nparams": 0, "instructions": [{"type": "push.int", "index": 1}, {"type": "return"}]})");
+    machine.allocate_function(func);
+    REQUIRE(stats.get_nanoseconds(StartupPhase::Parse) > 0);
+    REQUIRE(stats.get_nanoseconds(StartupPhase::CodeGeneration) > 0);
+    REQUIRE(stats.get_nanoseconds(StartupPhase::HeapAllocation) > 0);
+
+    // Once detached, nothing more is recorded.
+    machine.set_startup_stats(nullptr);
+    uint64_t parse = stats.get_nanoseconds(StartupPhase::Parse);
+    machine.parse_function_object(R"({"nlocals": 0, "nparams": 0, "instructions": []})");
+    REQUIRE(stats.get_nanoseconds(StartupPhase::Parse) == parse);
+}
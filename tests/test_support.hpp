@@ -0,0 +1,76 @@
+#ifndef TEST_SUPPORT_HPP
+#define TEST_SUPPORT_HPP
+
+#include <catch2/catch_test_macros.hpp>
+#include "../src/machine.hpp"
+#include "../src/bignum.hpp"
+#include <filesystem>
+#include <string>
+#include <fmt/core.h>
+#include <unistd.h>
+
+namespace nutmeg::test {
+
+// A scratch file or directory in the temporary directory, keyed by the process
+// so that concurrent test runs do not collide, and removed before and after use.
+struct ScratchPath {
+    std::filesystem::path path;
+
+    explicit ScratchPath(const std::string& name)
+        : path(std::filesystem::temp_directory_path() / fmt::format("nutmeg-{}-{}", name, getpid())) {
+        std::filesystem::remove_all(path);
+    }
+
+    ~ScratchPath() {
+        std::filesystem::remove_all(path);
+    }
+
+    std::string string() const { return path.string(); }
+};
+
+// A program that exercises every kind of operand the code cache and heap images
+// relocate: main calls callee, which throws a string; main's handler pushes a
+// bignum and 1, then adds 2 to the global answer with a sys-call.
+inline const char* const CALLEE_JSON = R"({
+    "nlocals": 0,
+    "nparams": 0,
+    "instructions": [
+        {"type": "push.string", "value": "boom"},
+        {"type": "throw"},
+        {"type": "return"}
+    ]
+})";
+
+inline const char* const MAIN_JSON = R"({
+    "nlocals": 1,
+    "nparams": 0,
+    "instructions": [
+        {"type": "stack.length", "index": 0},
+        {"type": "call.global.counted", "index": 0, "name": "callee"},
+        {"type": "return"},
+        {"type": "push.int", "index": 18446744073709551615},
+        {"type": "push.int", "index": 1},
+        {"type": "stack.length", "index": 0},
+        {"type": "push.global", "value": "answer"},
+        {"type": "push.int", "index": 2},
+        {"type": "syscall.counted", "index": 0, "name": "+"},
+        {"type": "return"}
+    ],
+    "handlers": [
+        {"start": 1, "end": 2, "target": 3, "index": 0}
+    ]
+})";
+
+// Check the stack main leaves with answer defined as 40: the handler leaves the
+// exception, the bignum and 1; then 40 + 2 is pushed.
+inline void require_main_result(Machine& machine) {
+    REQUIRE(machine.stack_size() == 4);
+    REQUIRE(as_detagged_int(machine.pop()) == 42);
+    REQUIRE(as_detagged_int(machine.pop()) == 1);
+    REQUIRE(bignum_to_string(machine.get_heap(), machine.pop()) == "18446744073709551615");
+    REQUIRE(std::string(machine.get_string(machine.pop())) == "boom");
+}
+
+} // namespace nutmeg::test
+
+#endif // TEST_SUPPORT_HPP
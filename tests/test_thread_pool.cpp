@@ -0,0 +1,39 @@
+#include <catch2/catch_test_macros.hpp>
+#include "../src/thread_pool.hpp"
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+using namespace nutmeg;
+
+TEST_CASE("ThreadPool runs every task and returns its result", "[thread_pool]") {
+    ThreadPool pool(4);
+    REQUIRE(pool.size() == 4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i++) {
+        results.push_back(pool.submit([i]() { return i * i; }));
+    }
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(results[i].get() == i * i);
+    }
+}
+
+TEST_CASE("ThreadPool delivers exceptions through the future", "[thread_pool]") {
+    ThreadPool pool(2);
+    std::future<int> failed = pool.submit([]() -> int { throw std::runtime_error("task failed"); });
+    std::future<int> succeeded = pool.submit([]() { return 1; });
+    REQUIRE_THROWS_AS(failed.get(), std::runtime_error);
+    REQUIRE(succeeded.get() == 1);
+}
+
+TEST_CASE("ThreadPool finishes queued tasks before it is destroyed", "[thread_pool]") {
+    std::atomic<int> count{0};
+    {
+        ThreadPool pool(3);
+        for (int i = 0; i < 50; i++) {
+            pool.submit([&count]() { count++; });
+        }
+    }
+    REQUIRE(count == 50);
+}
@@ -2,6 +2,12 @@
 #include "../src/machine.hpp"
 #include "../src/value.hpp"
 #include "../src/instruction.hpp"
+#include "../src/bignum.hpp"
+#include "../src/background_loader.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
 
 using namespace nutmeg;
 
@@ -57,3 +63,181 @@ TEST_CASE("Threaded interpreter can handle strings", "[threaded]") {
     Cell* str_ptr = static_cast<Cell*>(as_detagged_ptr(str));
     REQUIRE(std::string(machine.get_heap().get_string_data(str_ptr)) == "hello");
 }
+
+TEST_CASE("Instrumented dispatch counts instructions and can be switched off", "[threaded]") {
+    Machine machine;
+    const auto& opcode_map = machine.get_opcode_map();
+
+    // Compile to threaded code: PUSH_INT 42, PUSH_INT 100, HALT.
+    std::vector<Cell> code(5);
+    code[0].label_addr = opcode_map.at(Opcode::PUSH_INT);
+    code[1].i64 = 42;
+    code[2].label_addr = opcode_map.at(Opcode::PUSH_INT);
+    code[3].i64 = 100;
+    code[4].label_addr = opcode_map.at(Opcode::HALT);
+
+    Cell* func_ptr = machine.allocate_function(code, 0, 0);
+
+    // Plain labels do not count anything.
+    machine.execute(func_ptr);
+    REQUIRE(machine.get_instruction_counts()[static_cast<size_t>(Opcode::PUSH_INT)] == 0);
+
+    // Switch just this function over to the instrumented labels.
+    machine.set_function_instrumentation(func_ptr, true);
+    machine.execute(func_ptr);
+    REQUIRE(machine.get_instruction_counts()[static_cast<size_t>(Opcode::PUSH_INT)] == 2);
+    REQUIRE(machine.get_instruction_counts()[static_cast<size_t>(Opcode::HALT)] == 1);
+
+    // And back again.
+    machine.set_function_instrumentation(func_ptr, false);
+    machine.reset_instruction_counts();
+    machine.execute(func_ptr);
+    REQUIRE(machine.get_instruction_counts()[static_cast<size_t>(Opcode::PUSH_INT)] == 0);
+    REQUIRE(machine.stack_size() == 6);
+}
+
+TEST_CASE("Allocation profiling charges sampled bytes to the allocating instruction", "[threaded]") {
+    Machine machine;
+    // 2^64 - 1 + 1 allocates a bignum of two limbs: five cells, with its prefix.
+    machine.define_global("main", make_tagged_ptr(machine.allocate_function(machine.parse_function_object(R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "push.int", "index": 18446744073709551615},
+            {"type": "push.int", "index": 1},
+            {"type": "syscall.counted", "index": 0, "name": "+"},
+            {"type": "return"}
+        ]
+    })"))));
+
+    // At a sample per cell, every byte is charged.
+    machine.set_allocation_profiling(sizeof(Cell));
+    machine.execute(machine.get_global_cell_ptr("main"));
+    std::vector<AllocationSite> sites = machine.get_allocation_profile();
+    REQUIRE(sites.size() == 1);
+    CHECK(sites[0].function == "main");
+    CHECK(sites[0].instruction == opcode_to_string(Opcode::SYSCALL_COUNTED));
+    CHECK(sites[0].samples == 1);
+    CHECK(sites[0].bytes == 5 * sizeof(Cell));
+
+    // The samples accumulate. At a sample per 64 bytes, only the second run's
+    // allocation reaches a sampled byte.
+    machine.set_allocation_profiling(0);
+    machine.set_allocation_profiling(64);
+    machine.execute(machine.get_global_cell_ptr("main"));
+    machine.execute(machine.get_global_cell_ptr("main"));
+    sites = machine.get_allocation_profile();
+    REQUIRE(sites.size() == 1);
+    CHECK(sites[0].samples == 2);
+    CHECK(sites[0].bytes == 5 * sizeof(Cell) + 64);
+}
+
+TEST_CASE("Allocation profiling does not sample bindings compiling in the background", "[threaded]") {
+    Machine machine;
+    machine.set_allocation_profiling(sizeof(Cell));
+
+    // Each binding plants a string constant and a bignum constant, on a worker.
+    const int num_bindings = 20;
+    std::atomic<int> compiled{0};
+    BackgroundLoader loader(2);
+    for (int i = 0; i < num_bindings; i++) {
+        loader.add("f" + std::to_string(i), [&machine, &compiled]() {
+            FunctionObject func = machine.parse_function_object(R"({
+                "nlocals": 0,
+                "nparams": 0,
+                "instructions": [
+                    {"type": "push.string", "value": "constant"},
+                    {"type": "push.int", "index": 18446744073709551615},
+                    {"type": "return"}
+                ]
+            })");
+            compiled++;
+            return func;
+        });
+    }
+    loader.start();
+    while (compiled < num_bindings) {
+        std::this_thread::yield();
+    }
+    CHECK(machine.get_allocation_profile().empty());
+
+    // Allocating the compiled functions, on this thread, is sampled.
+    for (int i = 0; i < num_bindings; i++) {
+        machine.allocate_function(loader.take("f" + std::to_string(i)));
+    }
+    CHECK(machine.get_allocation_profile().size() == 1);
+}
+
+// Compute (2^64 - 1 + 1) * 3 - 5 in three sys-calls, each result a bignum. The
+// first two results are consumed in the frame; only the last escapes through
+// the return.
+const char* const REGION_JSON = R"({
+    "nlocals": 1,
+    "nparams": 0,
+    "instructions": [
+        {"type": "stack.length", "index": 0},
+        {"type": "push.int", "index": 18446744073709551615},
+        {"type": "push.int", "index": 1},
+        {"type": "syscall.counted", "index": 0, "name": "+"},
+        {"type": "push.int", "index": 3},
+        {"type": "syscall.counted", "index": 0, "name": "*"},
+        {"type": "push.int", "index": 5},
+        {"type": "syscall.counted", "index": 0, "name": "-"},
+        {"type": "return"}
+    ]
+})";
+
+TEST_CASE("Region allocation keeps temporaries that never leave their frame out of the heap", "[threaded]") {
+    Machine machine;
+    machine.set_region_allocation(true);
+    Cell* main = machine.allocate_function(machine.parse_function_object(REGION_JSON));
+
+    // The first two sys-calls are region sites; the third's result is returned.
+    std::vector<Opcode> opcodes;
+    Cell* code = machine.get_heap().get_function_code(main);
+    for (int64_t i = 0; i < as_detagged_int(main[-2]); ) {
+        Opcode opcode = *machine.find_opcode(code[i].label_addr);
+        opcodes.push_back(opcode);
+        i += 1 + opcode_operand_count(opcode);
+    }
+    REQUIRE(std::count(opcodes.begin(), opcodes.end(), Opcode::SYSCALL_REGION) == 2);
+    REQUIRE(std::count(opcodes.begin(), opcodes.end(), Opcode::SYSCALL_COUNTED) == 1);
+    REQUIRE(std::count(opcodes.begin(), opcodes.end(), Opcode::RETURN_REGION) == 1);
+
+    machine.execute(main);
+    REQUIRE(machine.stack_size() == 1);
+    CHECK(bignum_to_string(machine.get_heap(), machine.peek()) == "55340232221128654843");
+    CHECK(machine.get_heap().in_nursery(as_detagged_ptr(machine.peek())));
+    CHECK(machine.get_heap().get_region_mark() == 0);
+
+    // Without region allocation, nothing is rewritten.
+    Machine plain;
+    Cell* plain_main = plain.allocate_function(plain.parse_function_object(REGION_JSON));
+    CHECK(plain.find_opcode(plain.get_heap().get_function_code(plain_main)[6].label_addr) == Opcode::SYSCALL_COUNTED);
+}
+
+TEST_CASE("Region objects an exception leaves on the stack are moved to the heap", "[threaded]") {
+    Machine machine;
+    machine.set_region_allocation(true);
+    Cell* main = machine.allocate_function(machine.parse_function_object(R"({
+        "nlocals": 1,
+        "nparams": 0,
+        "instructions": [
+            {"type": "stack.length", "index": 0},
+            {"type": "push.int", "index": 18446744073709551615},
+            {"type": "push.int", "index": 1},
+            {"type": "syscall.counted", "index": 0, "name": "+"},
+            {"type": "push.string", "value": "x"},
+            {"type": "syscall.counted", "index": 0, "name": "+"},
+            {"type": "return"}
+        ]
+    })"));
+
+    REQUIRE_THROWS_AS(machine.execute(main), std::runtime_error);
+    REQUIRE(machine.stack_size() >= 2);
+    Cell sum = machine.peek_at(machine.stack_size() - 2);
+    CHECK(bignum_to_string(machine.get_heap(), sum) == "18446744073709551616");
+    CHECK(machine.get_heap().in_nursery(as_detagged_ptr(sum)));
+    CHECK(machine.get_heap().get_region_mark() == 0);
+}
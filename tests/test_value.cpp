@@ -0,0 +1,57 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_template_test_macros.hpp>
+#include "../src/value.hpp"
+#include <limits>
+
+using namespace nutmeg;
+
+TEMPLATE_TEST_CASE("Value representations round-trip each kind of value", "[value]", LowTagRepr, NanBoxRepr) {
+    for (int64_t value : {int64_t{0}, int64_t{1}, int64_t{-1}, TestType::INT_MIN_VALUE, TestType::INT_MAX_VALUE}) {
+        Cell cell = TestType::make_int(value);
+        REQUIRE(TestType::is_int(cell));
+        REQUIRE(!TestType::is_float(cell));
+        REQUIRE(!TestType::is_ptr(cell));
+        REQUIRE(TestType::as_int(cell) == value);
+    }
+
+    alignas(8) static int64_t target = 0;
+    Cell ptr = TestType::make_ptr(&target);
+    REQUIRE(TestType::is_ptr(ptr));
+    REQUIRE(!TestType::is_int(ptr));
+    REQUIRE(!TestType::is_float(ptr));
+    REQUIRE(TestType::as_ptr(ptr) == &target);
+
+    Cell half = TestType::make_float(0.5);
+    REQUIRE(TestType::is_float(half));
+    REQUIRE(!TestType::is_int(half));
+    REQUIRE(TestType::as_float(half) == 0.5);
+}
+
+TEMPLATE_TEST_CASE("Value representations detect integer overflow", "[value]", LowTagRepr, NanBoxRepr) {
+    Cell result;
+    REQUIRE(TestType::add_ints(TestType::make_int(40), TestType::make_int(2), result));
+    REQUIRE(TestType::as_int(result) == 42);
+    REQUIRE(TestType::multiply_ints(TestType::make_int(-6), TestType::make_int(7), result));
+    REQUIRE(TestType::as_int(result) == -42);
+    REQUIRE(!TestType::add_ints(TestType::make_int(TestType::INT_MAX_VALUE), TestType::make_int(1), result));
+    REQUIRE(!TestType::subtract_ints(TestType::make_int(TestType::INT_MIN_VALUE), TestType::make_int(1), result));
+    REQUIRE(!TestType::multiply_ints(TestType::make_int(TestType::INT_MAX_VALUE), TestType::make_int(2), result));
+}
+
+TEST_CASE("NaN-boxing keeps doubles at full precision", "[value]") {
+    double value = 0.1;
+    REQUIRE(NanBoxRepr::as_float(NanBoxRepr::make_float(value)) == value);
+    REQUIRE(LowTagRepr::as_float(LowTagRepr::make_float(value)) != value);
+
+    // NaNs are canonicalised and never mistaken for boxed values.
+    Cell nan = NanBoxRepr::make_float(-std::numeric_limits<double>::quiet_NaN());
+    REQUIRE(NanBoxRepr::is_float(nan));
+    REQUIRE(!NanBoxRepr::is_ptr(nan));
+    REQUIRE(!NanBoxRepr::is_int(nan));
+}
+
+TEST_CASE("Low-bit tagging keeps the sign and exponent of floats", "[value]") {
+    for (double value : {-0.5, -1e300, 1e300, 3.0}) {
+        REQUIRE(LowTagRepr::as_float(LowTagRepr::make_float(value)) == value);
+    }
+}
@@ -0,0 +1,90 @@
+// Report on a heap dump written by nutmeg-run --heap-dump: the size of each
+// space, the objects reachable from the roots, how much of the heap each root
+// alone keeps alive, the largest objects and the strings held more than once.
+//
+// Usage: nutmeg-heapdump DUMP [--top N]
+
+#include "../src/heap_dump.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fmt/core.h>
+#include <map>
+#include <string>
+
+using namespace nutmeg;
+
+static constexpr size_t MAX_STRING_SHOWN = 40;
+
+static double megabytes(uint64_t bytes) {
+    return static_cast<double>(bytes) / (1 << 20);
+}
+
+// A string as a quoted literal, shortened if it is long.
+static std::string quoted(const std::string& value) {
+    std::string text = value.size() > MAX_STRING_SHOWN ? value.substr(0, MAX_STRING_SHOWN) + "..." : value;
+    return fmt::format("\"{}\"", text);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2 && !(argc == 4 && std::strcmp(argv[2], "--top") == 0)) {
+        fmt::print(stderr, "Usage: nutmeg-heapdump DUMP [--top N]\n");
+        return 1;
+    }
+    size_t top = argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 10;
+
+    try {
+        HeapDump dump(argv[1]);
+
+        fmt::print("{:<12} {:>18} {:>12}\n", "space", "base", "used MB");
+        for (const HeapDump::Space& space : dump.get_spaces()) {
+            fmt::print("{:<12} {:>#18x} {:>12.2f}\n", space.name, space.base,
+                       megabytes(space.cells.size() * sizeof(Cell)));
+        }
+
+        std::map<std::string, std::pair<uint64_t, uint64_t>> by_kind;
+        uint64_t reachable_bytes = 0;
+        for (const HeapDump::Object& object : dump.get_objects()) {
+            std::string kind = object.kind.rfind("record/", 0) == 0 ? "record" : object.kind;
+            by_kind[kind].first++;
+            by_kind[kind].second += object.bytes;
+            reachable_bytes += object.bytes;
+        }
+        fmt::print("\nReachable from {} roots: {} objects, {:.2f} MB\n", dump.get_num_roots(),
+                   dump.get_objects().size(), megabytes(reachable_bytes));
+        for (const auto& [kind, totals] : by_kind) {
+            fmt::print("  {:<10} {:>12} objects {:>12.2f} MB\n", kind, totals.first, megabytes(totals.second));
+        }
+
+        fmt::print("\nRetained size by root:\n");
+        fmt::print("  {:<32} {:>12} {:>12}\n", "root", "objects", "MB");
+        size_t shown = 0;
+        for (const HeapDump::Retained& retained : dump.retained_by_root()) {
+            if (shown++ == top || retained.bytes == 0) {
+                break;
+            }
+            fmt::print("  {:<32} {:>12} {:>12.2f}\n", retained.root, retained.objects, megabytes(retained.bytes));
+        }
+
+        fmt::print("\nLargest objects:\n");
+        for (const HeapDump::Object& object : dump.largest_objects(top)) {
+            std::string value = object.kind == "string" ? " " + quoted(dump.get_string(object)) : "";
+            fmt::print("  {:>#18x} {:<12} {:>12} bytes{}\n", object.address, object.kind, object.bytes, value);
+        }
+
+        std::vector<HeapDump::DuplicateString> duplicates = dump.duplicate_strings();
+        uint64_t wasted = 0;
+        for (const HeapDump::DuplicateString& duplicate : duplicates) {
+            wasted += duplicate.wasted_bytes();
+        }
+        fmt::print("\nDuplicate strings: {} values, {:.2f} MB wasted\n", duplicates.size(), megabytes(wasted));
+        for (size_t i = 0; i < duplicates.size() && i < top; i++) {
+            fmt::print("  {:>8} copies {:>12} bytes wasted {}\n", duplicates[i].count, duplicates[i].wasted_bytes(),
+                       quoted(duplicates[i].value));
+        }
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "Error: {}\n", e.what());
+        return 1;
+    }
+    return 0;
+}